@@ -0,0 +1,37 @@
+// hal.h - Hardware abstraction used by the firmware core (main.c)
+//
+// main.c talks to the outside world only through these calls plus the
+// normal FatFs API (ff.h) and stdio:
+//   hal_pico.c       → Raspberry Pi Pico: SPI0 flash, SPI1 SD via FatFs_SPI, USB stdio
+//   host/hal_host.c  → Linux: simulated SPI NOR flash, SD volume = host directory
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HAL_NO_CHAR         (-1)   // hal_getchar(): nothing pending
+#define HAL_CONSOLE_CLOSED  (-2)   // hal_getchar(): input gone for good (host stdin EOF)
+
+// stdio + clocks
+void     hal_init(void);
+
+// ---- DUT flash bus (SPI mode 0, CS active low) ----
+void     hal_flash_bus_init(void);                 // SPI + CS pin, CS idle high
+void     hal_flash_select(bool active);            // true = CS low
+void     hal_flash_write(const uint8_t *src, size_t len);
+void     hal_flash_read(uint8_t *dst, size_t len); // clocks out 0x00
+void     hal_flash_transfer(const uint8_t *tx, uint8_t *rx, size_t len);
+
+// ---- time ----
+uint64_t hal_time_us(void);
+uint32_t hal_time_ms(void);
+void     hal_sleep_ms(uint32_t ms);
+void     hal_idle(void);                           // nothing to do this loop pass
+
+// ---- console (non-blocking) ----
+int      hal_getchar(void);                        // char, HAL_NO_CHAR or HAL_CONSOLE_CLOSED
+void     hal_console_write(const uint8_t *src, size_t len); // binary, no \n → \r\n translation
+
+// ---- SD card ----
+bool     hal_sd_mount(void);                       // mount volume "0:" (prints on failure)
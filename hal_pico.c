@@ -0,0 +1,145 @@
+// hal_pico.c - Raspberry Pi Pico implementation of hal.h
+
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+
+#include "ff.h"
+#include "diskio.h"
+#include "spi.h"
+#include "sd_card.h"
+
+#include "hal.h"
+
+// =====================================================
+// ===============  HARDWARE PIN CONFIG  ================
+//
+//  External SPI Flash on SPI0
+//      GP2  = SCK
+//      GP3  = MOSI
+//      GP4  = MISO
+//      GP5  = CS
+//
+//  SD Card on SPI1 (Maker Pi Pico)
+//      GP10 = SCK
+//      GP11 = MOSI
+//      GP12 = MISO
+//      GP13 = CS
+// =====================================================
+
+// -------- SPI0: external flash --------
+#define FLASH_SPI_PORT   spi0
+#define FLASH_PIN_SCK    2
+#define FLASH_PIN_MOSI   3
+#define FLASH_PIN_MISO   4
+#define FLASH_PIN_CS     5
+
+#define FLASH_SPI_HZ     (1u * 1000u * 1000u) // 1 MHz (safe), 10 MHz (faster)
+
+// -------- SPI1: SD card (inlined hw_config.c) --------
+static spi_t sd_spi = {
+    .hw_inst            = spi1,
+    .miso_gpio          = 12,
+    .mosi_gpio          = 11,
+    .sck_gpio           = 10,
+    .baud_rate          = 10 * 1000 * 1000,   // can lower to 400k if needed
+    .set_drive_strength = false,
+};
+
+static sd_card_t sd = {
+    .pcName             = "0:",
+    .spi                = &sd_spi,
+    .ss_gpio            = 13,        // CS
+    .use_card_detect    = false,     // no CD switch on Maker Pi Pico
+    .card_detect_gpio   = 0,
+    .card_detected_true = 1,
+    .set_drive_strength = false,
+};
+
+// Required by FatFs_SPI library
+size_t spi_get_num(void)            { return 1; }
+spi_t *spi_get_by_num(size_t n)     { return (n == 0) ? &sd_spi : NULL; }
+size_t sd_get_num(void)             { return 1; }
+sd_card_t *sd_get_by_num(size_t n)  { return (n == 0) ? &sd : NULL; }
+
+void hal_init(void) {
+    stdio_init_all();
+}
+
+// ---------------- DUT flash bus ----------------
+
+void hal_flash_bus_init(void) {
+    spi_init(FLASH_SPI_PORT, FLASH_SPI_HZ);
+    gpio_set_function(FLASH_PIN_MISO, GPIO_FUNC_SPI);
+    gpio_set_function(FLASH_PIN_MOSI, GPIO_FUNC_SPI);
+    gpio_set_function(FLASH_PIN_SCK,  GPIO_FUNC_SPI);
+    gpio_init(FLASH_PIN_CS);
+    gpio_set_dir(FLASH_PIN_CS, GPIO_OUT);
+    gpio_put(FLASH_PIN_CS, 1);
+}
+
+void hal_flash_select(bool active) {
+    asm volatile("nop; nop; nop;");
+    gpio_put(FLASH_PIN_CS, active ? 0 : 1);
+    asm volatile("nop; nop; nop;");
+}
+
+void hal_flash_write(const uint8_t *src, size_t len) {
+    spi_write_blocking(FLASH_SPI_PORT, src, len);
+}
+
+void hal_flash_read(uint8_t *dst, size_t len) {
+    spi_read_blocking(FLASH_SPI_PORT, 0, dst, len);
+}
+
+void hal_flash_transfer(const uint8_t *tx, uint8_t *rx, size_t len) {
+    spi_write_read_blocking(FLASH_SPI_PORT, tx, rx, len);
+}
+
+// ---------------- time ----------------
+
+uint64_t hal_time_us(void) {
+    return time_us_64();
+}
+
+uint32_t hal_time_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    sleep_ms(ms);
+}
+
+void hal_idle(void) {
+    tight_loop_contents();
+}
+
+// ---------------- console ----------------
+
+int hal_getchar(void) {
+    int c = getchar_timeout_us(0);
+    return (c == PICO_ERROR_TIMEOUT) ? HAL_NO_CHAR : c;
+}
+
+// putchar_raw bypasses stdio's CR/LF translation, which would corrupt frames
+void hal_console_write(const uint8_t *src, size_t len) {
+    for (size_t i = 0; i < len; i++) putchar_raw(src[i]);
+}
+
+// ---------------- SD card ----------------
+
+bool hal_sd_mount(void) {
+    sd_card_t *pSD = sd_get_by_num(0);
+    if (!pSD) {
+        printf("sd_get_by_num(0) failed\n");
+        return false;
+    }
+
+    FRESULT fr = f_mount(&pSD->fatfs, pSD->pcName, 1);
+    if (fr != FR_OK) {
+        printf("f_mount failed: %d\n", fr);
+        return false;
+    }
+    return true;
+}
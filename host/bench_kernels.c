@@ -0,0 +1,393 @@
+// bench_kernels.c - Host microbenchmarks for the firmware hot paths
+//
+// main.c is included as-is (its main() renamed) so the kernels timed here are
+// exactly the static functions the firmware runs:
+//   crc32_update              backup / verify / scrub CRC over a 16 MiB image
+//   sig_feed                  backup signature scan over the same image
+//   smap_feed                 backup sector classes over the same image
+//   parse_chip_line           CSV loader, 1k / 10k / 100k rows
+//   score_entry+rank_insert   chip ranking with top-N selection
+//   page_span                 restore page-splitting loop (aligned and odd chunks)
+//   restore_open+verify       FIMG header validation, CRC pass and trailer check
+//
+//   spi_flash_bench [-o out.json] [-b baseline.json] [-t pct] [-r reps] [--quick]
+//
+// Results are written as JSON (stdout unless -o). With -b every kernel is
+// compared against the baseline's median and the exit status is 1 if any
+// kernel got slower by more than -t percent (default 10).
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#define main spi_flash_firmware_main
+#include "main.c"
+#undef main
+
+#define MAX_RESULTS  32
+#define MAX_REPS     50
+
+typedef struct {
+    char     name[48];
+    uint64_t items;          // bytes or rows processed per run
+    const char *unit;
+    uint64_t median_ns, min_ns;
+} bench_result_t;
+
+static bench_result_t results[MAX_RESULTS];
+static int            result_count = 0;
+static int            reps         = 5;
+static volatile uint32_t sink;             // keeps results observable
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// xorshift32, fixed seed: every run sees the same data
+static uint32_t rng = 0x12345678u;
+static uint32_t rnd(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+typedef void (*kernel_fn)(void *arg);
+
+static void run_kernel(const char *name, uint64_t items, const char *unit,
+                       kernel_fn fn, void *arg) {
+    uint64_t t[MAX_REPS];
+    fn(arg);                                  // warm-up (page faults, caches)
+    for (int r = 0; r < reps; r++) {
+        uint64_t t0 = now_ns();
+        fn(arg);
+        t[r] = now_ns() - t0;
+    }
+    qsort(t, (size_t)reps, sizeof(t[0]), cmp_u64);
+
+    if (result_count == MAX_RESULTS) return;
+    bench_result_t *res = &results[result_count++];
+    snprintf(res->name, sizeof(res->name), "%s", name);
+    res->items     = items;
+    res->unit      = unit;
+    res->median_ns = t[reps / 2];
+    res->min_ns    = t[0];
+    fprintf(stderr, "%-32s %12.3f ms  %10.2f ns/%s\n", name,
+            res->median_ns / 1e6, (double)res->median_ns / (double)items, unit);
+}
+
+// ---------------- kernels ----------------
+
+typedef struct { const uint8_t *buf; uint32_t len; } crc_arg_t;
+
+// same slicing as backup_step
+static void k_crc32(void *arg) {
+    const crc_arg_t *a = arg;
+    uint32_t crc = 0;
+    for (uint32_t off = 0; off < a->len; off += JOB_SLICE_BYTES)
+        crc = crc32_update(crc, a->buf + off, JOB_SLICE_BYTES);
+    sink = crc;
+}
+
+// backup_step's structure scan over the same slices (sig_begin() done by the caller)
+static void k_sigscan(void *arg) {
+    const crc_arg_t *a = arg;
+    sig.state = 0;
+    sig.ncap  = 0;
+    sig.nhits = 0;
+    for (uint32_t off = 0; off < a->len; off += JOB_SLICE_BYTES)
+        sig_feed(off, a->buf + off, JOB_SLICE_BYTES);
+    sig_finish();
+    sink = (uint32_t)sig.nhits;
+}
+
+// backup_step's sector classifier, histogram + entropy per 4 KiB
+static void k_smap(void *arg) {
+    const crc_arg_t *a = arg;
+    sector_map_t sm;
+    if (!smap_begin(&sm, a->len)) return;
+    for (uint32_t off = 0; off < a->len; off += JOB_SLICE_BYTES)
+        smap_feed(&sm, a->buf + off, JOB_SLICE_BYTES);
+    smap_finish(&sm);
+    sink = sm.count[SC_HIGH];
+    smap_free(&sm);
+}
+
+typedef struct { char **lines; int n; ChipEntry *db; } rows_arg_t;
+
+static void k_parse(void *arg) {
+    const rows_arg_t *a = arg;
+    int ok = 0;
+    for (int i = 0; i < a->n; i++)
+        ok += parse_chip_line(a->lines[i], &a->db[i]);
+    sink = (uint32_t)ok;
+}
+
+// same filter + scoring + top-N as bench_rank_slice
+static void k_rank(void *arg) {
+    const rows_arg_t *a = arg;
+    RankItem best[MAX_MATCHES];
+    for (int i = 0; i < MAX_MATCHES; i++) {
+        best[i].index = -1;
+        best[i].score = INFINITY;
+    }
+    for (int i = 0; i < a->n; i++) {
+        const ChipEntry *c = &a->db[i];
+        if (c->read_time_us <= 0.0f || c->write_time_ms <= 0.0f ||
+            c->erase_time_ms <= 0.0f)
+            continue;
+        float sc = score_entry(c, 0xEF, 0x40, 0x18, 48.0, 0.7, 45.0);
+        rank_insert(best, MAX_MATCHES, i, sc);
+    }
+    sink = (uint32_t)best[0].index;
+}
+
+typedef struct { const uint8_t *buf; uint32_t len, chunk; } split_arg_t;
+
+// restore_step_program without the SPI write: chunk refill + page splits
+static void k_page_split(void *arg) {
+    const split_arg_t *a = arg;
+    uint8_t page[FLASH_PAGE_SIZE];
+    uint32_t pos = 0, acc = 0;
+    while (pos < a->len) {
+        uint32_t len = a->len - pos;
+        if (len > a->chunk) len = a->chunk;
+        const uint8_t *chunk = a->buf + pos;
+        for (uint32_t off = 0; off < len; ) {
+            uint32_t w = page_span(pos, len - off);
+            memcpy(page, chunk + off, w);
+            acc += page[w - 1];
+            off += w;
+            pos += w;
+        }
+    }
+    sink = acc;
+}
+
+// restore_open + RS_VERIFY phase on a .fimg written by write_fimg()
+static void k_fimg_verify(void *arg) {
+    const char *path = arg;
+    job_t job;
+    memset(&job, 0, sizeof(job));
+    if (restore_open(path) != 0) exit(2);
+    int rc;
+    while ((rc = restore_step_verify(&job)) == JOB_CONTINUE && rs.phase == RS_VERIFY) {}
+    if (rc < 0) exit(2);
+    restore_cleanup(&job);
+}
+
+// ---------------- fixtures ----------------
+
+static char **make_rows(int n) {
+    static const char *vendors[] = { "W25Q", "MX25L", "GD25Q", "SST25VF", "AT25SF" };
+    static const uint8_t manf[]  = { 0xEF,   0xC2,    0xC8,    0xBF,      0x1F };
+    char **lines = malloc((size_t)n * sizeof(*lines));
+    rng = 0x9E3779B9u ^ (uint32_t)n;      // same rows for a given n in every run
+    for (int i = 0; i < n; i++) {
+        int v = (int)(rnd() % 5);
+        lines[i] = malloc(96);
+        if (rnd() % 20 == 0) {     // rows with missing data are common in the DB
+            snprintf(lines[i], 96, "%s%05d,0x%02X,0x40,0x%02X,N/A,N/A,N/A,N/A,N/A",
+                     vendors[v], i, manf[v], 0x14 + (int)(rnd() % 6));
+            continue;
+        }
+        snprintf(lines[i], 96, "%s%05d,0x%02X,0x%02X,0x%02X,%.2f,%.2f,%.2f,%.2f,%.2f",
+                 vendors[v], i, manf[v], 0x20 + (int)(rnd() % 0x40),
+                 0x14 + (int)(rnd() % 6),
+                 20.0 + rnd() % 60, 0.4 + (rnd() % 30) / 10.0, 3.0 + rnd() % 3,
+                 30.0 + rnd() % 50, 200.0 + rnd() % 200);
+    }
+    return lines;
+}
+
+static void free_rows(char **lines, int n) {
+    for (int i = 0; i < n; i++) free(lines[i]);
+    free(lines);
+}
+
+// header, image data, CRC trailer: the file backup_step leaves on SD
+static bool write_fimg(const char *path, const uint8_t *img, uint32_t size) {
+    FIL fp; UINT bw;
+    flashimg_hdr_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "FIMGv1\0", 8);
+    h.jedec[0] = 0xEF; h.jedec[1] = 0x40; h.jedec[2] = 0x18;
+    h.flash_size = h.image_size = size;
+    h.chunk_size = CHUNK_BYTES;
+    h.crc32_all  = crc32_update(0, img, size);
+
+    if (f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return false;
+    bool ok = f_write(&fp, &h, sizeof(h), &bw) == FR_OK &&
+              f_write(&fp, img, size, &bw) == FR_OK && bw == size &&
+              f_write(&fp, &h.crc32_all, sizeof(h.crc32_all), &bw) == FR_OK;
+    f_close(&fp);
+    return ok;
+}
+
+// ---------------- JSON + baseline ----------------
+
+static void write_json(FILE *out, bool quick) {
+    fprintf(out, "{\n  \"suite\": \"spi_flash_kernels\",\n  \"quick\": %s,\n"
+                 "  \"reps\": %d,\n  \"results\": [\n", quick ? "true" : "false", reps);
+    for (int i = 0; i < result_count; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"items\": %llu, \"unit\": \"%s\", "
+                     "\"median_ns\": %llu, \"min_ns\": %llu, \"ns_per_item\": %.4f}%s\n",
+                r->name, (unsigned long long)r->items, r->unit,
+                (unsigned long long)r->median_ns, (unsigned long long)r->min_ns,
+                (double)r->median_ns / (double)r->items,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Reads the files write_json() produces (one result object per line).
+// Returns the number of regressions, or -1 if the baseline can't be read.
+static int compare_baseline(const char *path, double threshold_pct) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open baseline %s\n", path);
+        return -1;
+    }
+    int regressions = 0, matched = 0;
+    char line[512];
+    fprintf(stderr, "\n%-32s %12s %12s %8s\n", "kernel", "base ms", "now ms", "delta");
+    while (fgets(line, sizeof(line), f)) {
+        char name[48];
+        unsigned long long base_ns;
+        const char *p = strstr(line, "\"name\": \"");
+        const char *q = strstr(line, "\"median_ns\": ");
+        if (!p || !q ||
+            sscanf(p, "\"name\": \"%47[^\"]\"", name) != 1 ||
+            sscanf(q, "\"median_ns\": %llu", &base_ns) != 1 || base_ns == 0)
+            continue;
+
+        for (int i = 0; i < result_count; i++) {
+            if (strcmp(results[i].name, name) != 0) continue;
+            double delta = ((double)results[i].median_ns - (double)base_ns) * 100.0 / (double)base_ns;
+            bool bad = delta > threshold_pct;
+            fprintf(stderr, "%-32s %12.3f %12.3f %+7.1f%%%s\n", name, base_ns / 1e6,
+                    results[i].median_ns / 1e6, delta, bad ? "  REGRESSION" : "");
+            regressions += bad;
+            matched++;
+        }
+    }
+    fclose(f);
+    if (!matched) fprintf(stderr, "No kernels in common with %s\n", path);
+    return regressions;
+}
+
+// ---------------- main ----------------
+
+int main(int argc, char **argv) {
+    const char *out_path = NULL, *base_path = NULL;
+    double threshold = 10.0;
+    bool quick = false;
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "-o") && i + 1 < argc) out_path  = argv[++i];
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc) base_path = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) reps      = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--quick"))            quick     = true;
+        else {
+            fprintf(stderr, "usage: %s [-o out.json] [-b baseline.json] [-t pct] "
+                            "[-r reps] [--quick]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (reps < 1)        reps = 1;
+    if (reps > MAX_REPS) reps = MAX_REPS;
+
+    // the firmware prints progress to stdout; keep it out of the JSON
+    FILE *out = out_path ? fopen(out_path, "w") : fdopen(dup(STDOUT_FILENO), "w");
+    if (!out) {
+        fprintf(stderr, "Cannot open %s\n", out_path ? out_path : "stdout");
+        return 2;
+    }
+    if (!freopen("/dev/null", "w", stdout)) return 2;
+
+    // scratch SD card for the FIMG kernel
+    char sd_dir[] = "/tmp/spi_flash_bench.XXXXXX";
+    if (!mkdtemp(sd_dir)) return 2;
+    setenv("SPI_FLASH_SD_DIR", sd_dir, 1);
+    hal_init();
+
+    const uint32_t img_size = quick ? (1u << 20) : (16u << 20);
+    const char    *img_tag  = quick ? "1MiB" : "16MiB";
+    uint8_t *img = malloc(img_size);
+    if (!img) return 2;
+    for (uint32_t i = 0; i < img_size; i += 4) {
+        uint32_t v = rnd();
+        memcpy(img + i, &v, 4);
+    }
+
+    char name[48];
+    crc_arg_t ca = { img, img_size };
+    snprintf(name, sizeof(name), "crc32_update/%s", img_tag);
+    run_kernel(name, img_size, "B", k_crc32, &ca);
+    if (!sig_begin()) return 2;
+    snprintf(name, sizeof(name), "sig_feed/%s", img_tag);
+    run_kernel(name, img_size, "B", k_sigscan, &ca);
+    sig_free();
+    snprintf(name, sizeof(name), "smap_feed/%s", img_tag);
+    run_kernel(name, img_size, "B", k_smap, &ca);
+
+    const int row_counts[] = { 1000, 10000, 100000 };
+    for (int k = 0; k < 3; k++) {
+        int n = row_counts[k];
+        if (quick && n > 10000) break;
+        rows_arg_t ra = { make_rows(n), n, calloc((size_t)n, sizeof(ChipEntry)) };
+        snprintf(name, sizeof(name), "parse_chip_line/%dk", n / 1000);
+        run_kernel(name, (uint64_t)n, "row", k_parse, &ra);
+        snprintf(name, sizeof(name), "score_rank_top%d/%dk", MAX_MATCHES, n / 1000);
+        run_kernel(name, (uint64_t)n, "row", k_rank, &ra);
+        free_rows(ra.lines, n);
+        free(ra.db);
+    }
+
+    const uint32_t chunks[] = { CHUNK_BYTES, 3000u };
+    for (int k = 0; k < 2; k++) {
+        split_arg_t sa = { img, img_size, chunks[k] };
+        snprintf(name, sizeof(name), "page_split/%s/chunk%u", img_tag, (unsigned)chunks[k]);
+        run_kernel(name, img_size, "B", k_page_split, &sa);
+    }
+
+    char fimg[64];
+    snprintf(fimg, sizeof(fimg), "%s/bench.fimg", DUMP_FOLDER);
+    if (!fs_mount_once()) return 2;
+    ensure_folder();
+    if (!write_fimg(fimg, img, img_size)) {
+        fprintf(stderr, "Cannot write %s/%s\n", sd_dir, fimg);
+        return 2;
+    }
+    snprintf(name, sizeof(name), "fimg_open_verify/%s", img_tag);
+    run_kernel(name, img_size, "B", k_fimg_verify, fimg);
+
+    f_unlink(fimg);
+    f_unlink(CATALOG_FILE);
+    f_unlink(DUMP_FOLDER);
+    rmdir(sd_dir);
+    free(img);
+
+    write_json(out, quick);
+    fclose(out);
+
+    if (base_path) {
+        int reg = compare_baseline(base_path, threshold);
+        if (reg < 0) return 2;
+        if (reg > 0) {
+            fprintf(stderr, "%d kernel(s) slower than baseline by more than %.1f%%\n",
+                    reg, threshold);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""Convert a BUSLOG/*.fbl bus log (menu 'b') to a VCD waveform for PulseView.
+
+Signals, 1 us timescale, in the "dut_spi" scope:
+
+    cs_n      low for every recorded transaction
+    opcode    8-bit opcode of the transaction, z while CS is high
+    addr      24-bit address of READ / PP / erase / SFDP
+    repeat    number of identical transactions merged into the record
+              (WIP polling: CS stays low on the waveform for the whole run)
+    busy      WREN..PP / erase / WRSR until the status polling after it ends
+
+With -t, the firmware spans from a trace dump (menu 't') in the same log
+capture are added as one 1-bit signal each in the "firmware" scope. Both use
+the same hal_time_us() clock, so sleep, sd_write, crc and friends line up
+with the bus.
+
+    host/buslog2vcd.py sdcard/BUSLOG/t0000002016.fbl -t run.log -o restore.vcd --gaps
+
+--gaps prints the time between transactions (CS high) grouped by the
+opcode before and after the gap. The driver's fixed sleeps show up there,
+and so does the CS-edge overhead per transaction.
+"""
+
+import argparse
+import os
+import statistics
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from trace2chrome import parse_dumps  # noqa: E402
+
+HDR = struct.Struct("<8sIII3sBI")      # buslog_hdr_t in main.c
+REC = struct.Struct("<IIIHHB3s")       # buslog_rec_t in main.c
+
+WRITE_OPS = {0x02, 0x20, 0xD8, 0xC7, 0x01}
+RDSR1 = 0x05
+
+
+def read_log(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, rec_size, records, dropped, jedec, _, t0 = HDR.unpack_from(data, 0)
+    if not magic.startswith(b"FBLv1") or rec_size != REC.size:
+        sys.exit("%s: not a bus log (FBLv1, %d-byte records)" % (path, REC.size))
+    recs = []
+    for off in range(HDR.size, len(data) - REC.size + 1, REC.size):
+        t, dur, _hash, length, repeat, op, addr = REC.unpack_from(data, off)
+        recs.append({"t": (t - t0) & 0xFFFFFFFF, "dur": dur, "len": length,
+                     "repeat": repeat, "op": op, "addr": int.from_bytes(addr, "big")})
+    return {"jedec": jedec, "dropped": dropped, "records": records, "t0": t0}, recs
+
+
+class Vcd:
+    """Collects value changes, writes them in time order."""
+
+    def __init__(self):
+        self.vars = []          # (scope, name, width, id)
+        self.changes = []       # (time, seq, id, value)
+        self.seq = 0
+
+    def var(self, scope, name, width):
+        ident = chr(33 + len(self.vars))
+        self.vars.append((scope, name, width, ident))
+        return ident
+
+    def set(self, t, ident, value):
+        self.changes.append((t, self.seq, ident, value))
+        self.seq += 1
+
+    @staticmethod
+    def fmt(width, ident, value):
+        if width == 1:
+            return "%s%s" % (value, ident)
+        if value == "z":
+            return "bz %s" % ident
+        return "b%s %s" % (format(value, "b"), ident)
+
+    def write(self, out, comment):
+        widths = {ident: width for _, _, width, ident in self.vars}
+        out.write("$comment %s $end\n" % comment)
+        out.write("$version spi_flash buslog2vcd $end\n$timescale 1us $end\n")
+        scope = None
+        for sc, name, width, ident in self.vars:
+            if sc != scope:
+                if scope is not None:
+                    out.write("$upscope $end\n")
+                out.write("$scope module %s $end\n" % sc)
+                scope = sc
+            out.write("$var wire %d %s %s $end\n" % (width, ident, name))
+        out.write("$upscope $end\n$enddefinitions $end\n")
+
+        last_t = None
+        for t, _, ident, value in sorted(self.changes):
+            if t != last_t:
+                out.write("#%d\n" % t)
+                last_t = t
+            out.write(self.fmt(widths[ident], ident, value) + "\n")
+
+
+def build_bus(vcd, recs):
+    cs = vcd.var("dut_spi", "cs_n", 1)
+    op = vcd.var("dut_spi", "opcode", 8)
+    addr = vcd.var("dut_spi", "addr", 24)
+    rep = vcd.var("dut_spi", "repeat", 16)
+    busy = vcd.var("dut_spi", "busy", 1)
+    for ident, v in ((cs, 1), (op, "z"), (addr, 0), (rep, 0), (busy, 0)):
+        vcd.set(0, ident, v)
+
+    busy_since = None
+    for i, r in enumerate(recs):
+        start, end = r["t"], r["t"] + max(r["dur"], 1)
+        vcd.set(start, cs, 0)
+        vcd.set(start, op, r["op"])
+        vcd.set(start, addr, r["addr"])
+        vcd.set(start, rep, r["repeat"])
+        vcd.set(end, cs, 1)
+        vcd.set(end, op, "z")
+
+        if r["op"] in WRITE_OPS:
+            busy_since = end
+            vcd.set(end, busy, 1)
+        elif busy_since is not None and r["op"] == RDSR1:
+            nxt = recs[i + 1] if i + 1 < len(recs) else None
+            if nxt is None or nxt["op"] != RDSR1:     # last poll: WIP read as 0
+                vcd.set(end, busy, 0)
+                busy_since = None
+
+
+def build_trace(vcd, dumps, t0):
+    idents = {}
+    for spans in dumps:
+        for start, dur, name, _ in spans:
+            if name not in idents:
+                idents[name] = vcd.var("firmware", name, 1)
+                vcd.set(0, idents[name], 0)
+            rel = (start - t0) & 0xFFFFFFFF
+            if rel >= 0x80000000:      # before the bus log started
+                continue
+            vcd.set(rel, idents[name], 1)
+            vcd.set(rel + max(dur, 1), idents[name], 0)
+
+
+def gap_report(recs, out):
+    gaps = {}
+    for prev, r in zip(recs, recs[1:]):
+        g = r["t"] - (prev["t"] + prev["dur"])
+        if g >= 0:
+            gaps.setdefault((prev["op"], r["op"]), []).append(g)
+    out.write("%-12s %8s %8s %8s %8s %12s\n" %
+              ("ops", "count", "min us", "med us", "max us", "total ms"))
+    rows = sorted(gaps.items(), key=lambda kv: -sum(kv[1]))
+    for (a, b), g in rows:
+        out.write("%02X -> %02X     %8d %8d %8d %8d %12.3f\n" %
+                  (a, b, len(g), min(g), statistics.median(g), max(g), sum(g) / 1000.0))
+    total = sum(sum(g) for g in gaps.values())
+    out.write("%-12s %8d %35.3f\n" % ("all", sum(len(g) for g in gaps.values()), total / 1000.0))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("log", help="BUSLOG/*.fbl file")
+    ap.add_argument("-t", "--trace", help="console log with a [TRACE] dump to overlay")
+    ap.add_argument("-o", "--output", help="write VCD here (default stdout)")
+    ap.add_argument("--gaps", action="store_true",
+                    help="print inter-transaction gap statistics to stderr")
+    args = ap.parse_args()
+
+    hdr, recs = read_log(args.log)
+    vcd = Vcd()
+    build_bus(vcd, recs)
+    if args.trace:
+        with open(args.trace, errors="ignore") as f:
+            build_trace(vcd, list(parse_dumps(f)), hdr["t0"])
+
+    comment = "%s JEDEC %s, %d records, %d dropped" % (
+        os.path.basename(args.log), hdr["jedec"].hex(), len(recs), hdr["dropped"])
+    if args.output:
+        with open(args.output, "w") as f:
+            vcd.write(f, comment)
+    else:
+        vcd.write(sys.stdout, comment)
+    if args.gaps:
+        gap_report(recs, sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,381 @@
+// chip_ident.cpp - Rank a benchmark fingerprint against a large datasheet CSV
+//
+// On the Pico, menu 1 loads at most MAX_CHIPS rows of Embedded_datasheet.csv
+// and scores them one by one in soft float. This tool holds the whole CSV
+// (millions of rows) in memory, column by column, and scores every row with
+// the same arithmetic as score_entry() / bench_rank_slice() in main.c, split
+// across all cores, in blocks the compiler vectorises:
+//
+//   spi_flash_ident db.csv -j EF4015 -r 2200 -p 0.4 -e 45 [-n 3]    one query
+//   spi_flash_ident db.csv --serve                                  web/ident.py
+//
+// Options:
+//   -j hex     observed JEDEC ID              -r us    average read time
+//   -p ms      average page program time      -e ms    average sector erase time
+//   -n N       matches to report (default 3)  -t N     threads (default: all cores)
+//
+// --serve answers one query per stdin line, "<jedec> <read_us> <prog_ms>
+// <erase_ms> <N>", with one JSON line on stdout. The first line it prints
+// describes the loaded database.
+//
+// Rows are parsed like parse_chip_line() (the same 9 fields, a bad row is
+// skipped) and numbered like chip_data[]: "row" is 1-based among the rows
+// that parsed. Scores match the device bit for bit: the kernel is built
+// with -ffp-contract=off so no multiply-add is fused, and ties keep the
+// lower row first, as rank_insert() does.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int MAX_TOP = 100;            // -n limit; the device asks for <= MAX_MATCHES
+static const size_t BLOCK_ROWS = 4096;     // rows scored per kernel call
+
+struct ChipRow {
+    std::string name;
+    uint8_t manf_id, device_id[2];
+    float read_time_us, write_time_ms, write_time_ms_max, erase_time_ms, erase_time_ms_max;
+};
+
+// Columns of the scoring inputs, index = row - 1
+struct ChipDb {
+    std::string text;                   // the CSV, lines are re-parsed for reports
+    std::vector<uint32_t> line_off;
+    std::vector<uint32_t> jedec;        // manf << 16 | dev0 << 8 | dev1
+    std::vector<float> read_us, prog_ms, erase_ms;
+    size_t skipped = 0;
+
+    size_t size() const { return jedec.size(); }
+};
+
+struct Query {
+    uint32_t jedec;
+    float read_us, prog_ms, erase_ms;
+    int top;
+};
+
+struct Rank {
+    uint32_t index;
+    float score;
+};
+
+// ---------- CSV (same fields as parse_chip_line) ----------
+
+static bool parse_hex_byte(const char *&p, uint8_t *out) {
+    if (p[0] != '0' || p[1] != 'x') return false;
+    char *end;
+    unsigned long v = strtoul(p + 2, &end, 16);
+    if (end == p + 2) return false;
+    *out = (uint8_t)v;
+    p = end;
+    return true;
+}
+
+static bool parse_float(const char *&p, float *out) {
+    char *end;
+    *out = strtof(p, &end);
+    if (end == p) return false;
+    p = end;
+    return true;
+}
+
+// "%31[^,],0x%hhx,0x%hhx,0x%hhx,%f,%f,%f,%f,%f"; the line ends at '\n'
+static bool parse_row(const char *p, ChipRow *row) {
+    const char *comma = p;
+    while (*comma && *comma != ',' && *comma != '\n') comma++;
+    if (comma == p || comma - p > 31 || *comma != ',') return false;
+    row->name.assign(p, comma);
+    p = comma + 1;
+
+    if (!parse_hex_byte(p, &row->manf_id) || *p++ != ',') return false;
+    if (!parse_hex_byte(p, &row->device_id[0]) || *p++ != ',') return false;
+    if (!parse_hex_byte(p, &row->device_id[1]) || *p++ != ',') return false;
+
+    float *f[] = { &row->read_time_us, &row->write_time_ms, &row->write_time_ms_max,
+                   &row->erase_time_ms, &row->erase_time_ms_max };
+    for (int i = 0; i < 5; i++) {
+        if (!parse_float(p, f[i])) return false;
+        if (i < 4 && *p++ != ',') return false;
+    }
+    return true;
+}
+
+struct Part {
+    std::vector<uint32_t> line_off, jedec;
+    std::vector<float> read_us, prog_ms, erase_ms;
+    size_t skipped = 0;
+};
+
+static void parse_range(const std::string &text, size_t from, size_t to, Part *out) {
+    ChipRow row;
+    while (from < to) {
+        size_t eol = text.find('\n', from);
+        if (eol == std::string::npos) eol = text.size();
+        if (parse_row(text.c_str() + from, &row)) {
+            out->line_off.push_back((uint32_t)from);
+            out->jedec.push_back((uint32_t)row.manf_id << 16 | row.device_id[0] << 8 | row.device_id[1]);
+            out->read_us.push_back(row.read_time_us);
+            out->prog_ms.push_back(row.write_time_ms);
+            out->erase_ms.push_back(row.erase_time_ms);
+        } else if (eol > from && !(eol == from + 1 && text[from] == '\r')) {
+            out->skipped++;             // blank lines are not counted
+        }
+        from = eol + 1;
+    }
+}
+
+// Whole file, parsed by `threads` workers on line-aligned slices
+static bool load_db(const char *path, int threads, ChipDb *db) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len < 0 || (unsigned long)len > UINT32_MAX) {
+        fprintf(stderr, "%s: unsupported size\n", path);
+        fclose(f);
+        return false;
+    }
+    db->text.resize((size_t)len);
+    size_t got = fread(&db->text[0], 1, (size_t)len, f);
+    fclose(f);
+    if (got != (size_t)len) {
+        fprintf(stderr, "%s: read failed\n", path);
+        return false;
+    }
+
+    // the first line is the header, as on the device
+    size_t start = db->text.find('\n');
+    start = (start == std::string::npos) ? db->text.size() : start + 1;
+
+    std::vector<size_t> cut(threads + 1, db->text.size());
+    cut[0] = start;
+    for (int t = 1; t < threads; t++) {
+        size_t at = start + (db->text.size() - start) * t / threads;
+        size_t eol = db->text.find('\n', std::max(at, cut[t - 1]));
+        cut[t] = (eol == std::string::npos) ? db->text.size() : eol + 1;
+    }
+
+    std::vector<Part> parts(threads);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+        pool.emplace_back(parse_range, std::cref(db->text), cut[t], cut[t + 1], &parts[t]);
+    for (auto &th : pool) th.join();
+
+    for (auto &p : parts) {
+        db->line_off.insert(db->line_off.end(), p.line_off.begin(), p.line_off.end());
+        db->jedec.insert(db->jedec.end(), p.jedec.begin(), p.jedec.end());
+        db->read_us.insert(db->read_us.end(), p.read_us.begin(), p.read_us.end());
+        db->prog_ms.insert(db->prog_ms.end(), p.prog_ms.begin(), p.prog_ms.end());
+        db->erase_ms.insert(db->erase_ms.end(), p.erase_ms.begin(), p.erase_ms.end());
+        db->skipped += p.skipped;
+    }
+    return true;
+}
+
+// ---------- Scoring (same arithmetic as score_entry) ----------
+
+static inline float rel2(float a, float b) {
+    const float eps = 1e-6f;
+    float r = (a - b) / (fabsf(b) + eps);
+    return (b == 0.0f) ? 0.0f : r * r;
+}
+
+// Branch-free over one block so it vectorises; rows bench_rank_slice()
+// skips (missing timing) score +inf and never make the list
+static void score_block(const ChipDb &db, const Query &q, size_t from, size_t n,
+                        float *__restrict out) {
+    const float W_ID_MATCH_BONUS   = -1.5f;
+    const float W_ID_PARTIAL_BONUS = -0.6f;
+    const float W_READ  = 1.0f;
+    const float W_PROG  = 0.8f;
+    const float W_ERASE = 0.6f;
+
+    const uint32_t *__restrict jedec = db.jedec.data() + from;
+    const float *__restrict rd = db.read_us.data() + from;
+    const float *__restrict pr = db.prog_ms.data() + from;
+    const float *__restrict er = db.erase_ms.data() + from;
+    const uint32_t q_manf = q.jedec >> 16;
+
+    for (size_t i = 0; i < n; i++) {
+        float s = 0.0f;
+        s += (jedec[i] == q.jedec) ? W_ID_MATCH_BONUS
+           : (jedec[i] >> 16 == q_manf) ? W_ID_PARTIAL_BONUS : 0.0f;
+        s += W_READ  * rel2(q.read_us,  rd[i]);
+        s += W_PROG  * rel2(q.prog_ms,  pr[i]);
+        s += W_ERASE * rel2(q.erase_ms, er[i]);
+        bool skip = rd[i] <= 0.0f || pr[i] <= 0.0f || er[i] <= 0.0f;
+        out[i] = skip ? INFINITY : s;
+    }
+}
+
+// rank_insert() from main.c
+static void rank_insert(Rank *best, int top, uint32_t index, float sc) {
+    for (int k = 0; k < top; k++) {
+        if (sc < best[k].score) {
+            for (int m = top - 1; m > k; m--) best[m] = best[m - 1];
+            best[k].index = index;
+            best[k].score = sc;
+            break;
+        }
+    }
+}
+
+static void rank_range(const ChipDb &db, const Query &q, size_t from, size_t to, Rank *best) {
+    for (int k = 0; k < q.top; k++) best[k] = { UINT32_MAX, INFINITY };
+    float scores[BLOCK_ROWS];
+    for (size_t b = from; b < to; b += BLOCK_ROWS) {
+        size_t n = std::min(BLOCK_ROWS, to - b);
+        score_block(db, q, b, n, scores);
+        for (size_t i = 0; i < n; i++)
+            if (scores[i] < best[q.top - 1].score)
+                rank_insert(best, q.top, (uint32_t)(b + i), scores[i]);
+    }
+}
+
+// Top q.top over the whole database; each thread ranks one slice
+static std::vector<Rank> rank_all(const ChipDb &db, const Query &q, int threads) {
+    std::vector<Rank> per(threads * q.top);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        size_t from = db.size() * t / threads, to = db.size() * (t + 1) / threads;
+        pool.emplace_back(rank_range, std::cref(db), std::cref(q), from, to, &per[t * q.top]);
+    }
+    for (auto &th : pool) th.join();
+
+    // the device scans in row order, so among equal scores the lower row wins
+    std::sort(per.begin(), per.end(), [](const Rank &a, const Rank &b) {
+        return a.score < b.score || (a.score == b.score && a.index < b.index);
+    });
+    std::vector<Rank> best;
+    for (const Rank &r : per)
+        if ((int)best.size() < q.top && r.score < INFINITY) best.push_back(r);
+    return best;
+}
+
+// ---------- Output ----------
+
+static void json_string(const std::string &s) {
+    putchar('"');
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') printf("\\%c", c);
+        else if (c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+static void print_json(const ChipDb &db, const std::vector<Rank> &best, double ms) {
+    printf("{\"rows\":%zu,\"ms\":%.3f,\"matches\":[", db.size(), ms);
+    for (size_t k = 0; k < best.size(); k++) {
+        ChipRow c;
+        parse_row(db.text.c_str() + db.line_off[best[k].index], &c);
+        printf("%s{\"rank\":%zu,\"row\":%u,\"score\":%.9g,\"name\":", k ? "," : "",
+               k + 1, best[k].index + 1, best[k].score);
+        json_string(c.name);
+        printf(",\"jedec\":\"%02X%02X%02X\",\"read_us\":%.9g,\"prog_ms\":%.9g,"
+               "\"prog_max_ms\":%.9g,\"erase_ms\":%.9g,\"erase_max_ms\":%.9g}",
+               c.manf_id, c.device_id[0], c.device_id[1], c.read_time_us, c.write_time_ms,
+               c.write_time_ms_max, c.erase_time_ms, c.erase_time_ms_max);
+    }
+    printf("]}\n");
+    fflush(stdout);
+}
+
+static void print_table(const ChipDb &db, const Query &q, const std::vector<Rank> &best, double ms) {
+    printf("Observed JEDEC: %06X  READ=%.2f us, PROG=%.2f ms, ERASE=%.2f ms\n",
+           q.jedec, q.read_us, q.prog_ms, q.erase_ms);
+    printf("%zu rows ranked in %.3f ms\n\n", db.size(), ms);
+    printf("Rank  Row        Score     JEDEC   Name\n");
+    for (size_t k = 0; k < best.size(); k++) {
+        ChipRow c;
+        parse_row(db.text.c_str() + db.line_off[best[k].index], &c);
+        printf("#%-4zu %-10u %-9.4f %02X%02X%02X  %s\n", k + 1, best[k].index + 1,
+               best[k].score, c.manf_id, c.device_id[0], c.device_id[1], c.name.c_str());
+    }
+}
+
+static double ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// One query per line until EOF; a malformed line gets {"error": ...}
+static void serve(const ChipDb &db, int threads) {
+    char line[256];
+    while (fgets(line, sizeof(line), stdin)) {
+        Query q;
+        unsigned jedec;
+        if (sscanf(line, "%x %f %f %f %d", &jedec, &q.read_us, &q.prog_ms, &q.erase_ms,
+                   &q.top) != 5 || q.top < 1) {
+            printf("{\"error\":\"expected: <jedec> <read_us> <prog_ms> <erase_ms> <N>\"}\n");
+            fflush(stdout);
+            continue;
+        }
+        q.jedec = jedec & 0xFFFFFF;
+        q.top = std::min(q.top, MAX_TOP);
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<Rank> best = rank_all(db, q, threads);
+        print_json(db, best, ms_since(t0));
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s db.csv (-j jedec -r read_us -p prog_ms -e erase_ms [-n N] | --serve) "
+                    "[-t threads]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *db_path = NULL, *jedec = NULL;
+    Query q = { 0, 0.0f, 0.0f, 0.0f, 3 };
+    int threads = (int)std::thread::hardware_concurrency();
+    bool serving = false;
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "-j") && i + 1 < argc) jedec      = argv[++i];
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) q.read_us  = strtof(argv[++i], NULL);
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc) q.prog_ms  = strtof(argv[++i], NULL);
+        else if (!strcmp(argv[i], "-e") && i + 1 < argc) q.erase_ms = strtof(argv[++i], NULL);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) q.top      = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) threads    = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--serve"))            serving    = true;
+        else if (argv[i][0] != '-' && !db_path)          db_path    = argv[i];
+        else usage(argv[0]);
+    }
+    if (!db_path || (!serving && !jedec)) usage(argv[0]);
+    if (threads < 1) threads = 1;
+    q.top = std::max(1, std::min(q.top, MAX_TOP));
+    if (jedec) q.jedec = (uint32_t)strtoul(jedec, NULL, 16) & 0xFFFFFF;
+
+    auto t0 = std::chrono::steady_clock::now();
+    ChipDb db;
+    if (!load_db(db_path, threads, &db)) return 1;
+    double load_ms = ms_since(t0);
+
+    if (serving) {
+        printf("{\"db\":");
+        json_string(db_path);
+        printf(",\"rows\":%zu,\"skipped\":%zu,\"threads\":%d,\"load_ms\":%.1f}\n",
+               db.size(), db.skipped, threads, load_ms);
+        fflush(stdout);
+        serve(db, threads);
+        return 0;
+    }
+
+    fprintf(stderr, "%s: %zu rows (%zu skipped) loaded in %.1f ms\n",
+            db_path, db.size(), db.skipped, load_ms);
+    t0 = std::chrono::steady_clock::now();
+    std::vector<Rank> best = rank_all(db, q, threads);
+    print_table(db, q, best, ms_since(t0));
+    return best.empty() ? 1 : 0;
+}
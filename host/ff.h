@@ -0,0 +1,109 @@
+// ff.h - FatFs API subset for the host build (implemented in ff_host.c)
+//
+// Same names, types and return codes as the FatFs used on the Pico, so
+// main.c compiles unchanged. The "SD card" is a directory on the host
+// (SPI_FLASH_SD_DIR, default ./sdcard); FatFs paths are relative to it.
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef unsigned int  UINT;
+typedef unsigned char BYTE;
+typedef uint16_t      WORD;
+typedef uint32_t      DWORD;
+typedef uint64_t      FSIZE_t;
+typedef char          TCHAR;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER
+} FRESULT;
+
+// f_open() mode flags
+#define FA_READ           0x01
+#define FA_WRITE          0x02
+#define FA_OPEN_EXISTING  0x00
+#define FA_CREATE_NEW     0x04
+#define FA_CREATE_ALWAYS  0x08
+#define FA_OPEN_ALWAYS    0x10
+#define FA_OPEN_APPEND    0x30
+
+// FILINFO.fattrib
+#define AM_RDO  0x01
+#define AM_HID  0x02
+#define AM_SYS  0x04
+#define AM_DIR  0x10
+#define AM_ARC  0x20
+
+typedef struct {
+    int dummy;
+} FATFS;
+
+typedef struct {
+    FILE *fp;
+} FIL;
+
+typedef struct {
+    void *dp;             // POSIX DIR*
+    char  path[256];
+} FF_DIR;
+
+#ifndef FF_HOST_IMPL
+typedef FF_DIR DIR;       // ff_host.c needs the POSIX DIR from <dirent.h>
+#endif
+
+#define FF_LFN_BUF  255   // longest name f_readdir / f_stat report, as FatFs' default
+
+typedef struct {
+    FSIZE_t fsize;
+    WORD    fdate;        // FAT date: bit15:9 year-1980, bit8:5 month, bit4:0 day
+    WORD    ftime;        // FAT time: bit15:11 hour, bit10:5 minute, bit4:0 second/2
+    BYTE    fattrib;
+    TCHAR   fname[FF_LFN_BUF + 1];
+} FILINFO;
+
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt);
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode);
+FRESULT f_close(FIL *fp);
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br);
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
+FRESULT f_sync(FIL *fp);
+FRESULT f_stat(const TCHAR *path, FILINFO *fno);
+FRESULT f_mkdir(const TCHAR *path);
+FRESULT f_unlink(const TCHAR *path);
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new);
+FRESULT f_opendir(FF_DIR *dp, const TCHAR *path);
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno);
+FRESULT f_closedir(FF_DIR *dp);
+TCHAR  *f_gets(TCHAR *buff, int len, FIL *fp);
+int     f_puts(const TCHAR *str, FIL *fp);
+
+FSIZE_t ff_host_size(FIL *fp);
+FSIZE_t ff_host_tell(FIL *fp);
+
+#define f_size(fp)  ff_host_size(fp)
+#define f_tell(fp)  ff_host_tell(fp)
+
+// Host only: directory that backs volume "0:"
+void        ff_host_set_root(const char *dir);
+const char *ff_host_root(void);
@@ -0,0 +1,216 @@
+// ff_host.c - FatFs API on top of a host directory (see ff.h)
+
+#define FF_HOST_IMPL
+#include "ff.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static char root_dir[256] = "sdcard";
+
+void ff_host_set_root(const char *dir) {
+    snprintf(root_dir, sizeof(root_dir), "%s", dir);
+}
+
+const char *ff_host_root(void) {
+    return root_dir;
+}
+
+// "0:/FLASHIMG\x.fimg" → "<root>/FLASHIMG/x.fimg"; false if it does not fit
+static bool host_path(char *out, size_t n, const TCHAR *path) {
+    const char *colon = strchr(path, ':');
+    if (colon) path = colon + 1;
+    while (*path == '/' || *path == '\\') path++;
+
+    int len = snprintf(out, n, "%s/%s", root_dir, path);
+    if (len < 0 || (size_t)len >= n) return false;
+    for (char *p = out; *p; p++)
+        if (*p == '\\') *p = '/';
+    return true;
+}
+
+static FRESULT errno_to_fr(int e) {
+    switch (e) {
+    case ENOENT:  return FR_NO_FILE;
+    case ENOTDIR: return FR_NO_PATH;
+    case EEXIST:  return FR_EXIST;
+    case EACCES:
+    case EPERM:   return FR_DENIED;
+    case EROFS:   return FR_WRITE_PROTECTED;
+    case EMFILE:
+    case ENFILE:  return FR_TOO_MANY_OPEN_FILES;
+    case ENOMEM:  return FR_NOT_ENOUGH_CORE;
+    case EINVAL:  return FR_INVALID_PARAMETER;
+    default:      return FR_DISK_ERR;
+    }
+}
+
+// false if the name is longer than FatFs would report (FF_LFN_BUF)
+static bool fill_info(FILINFO *fno, const char *name, const struct stat *st) {
+    struct tm tm;
+    localtime_r(&st->st_mtime, &tm);
+
+    fno->fsize   = S_ISDIR(st->st_mode) ? 0 : (FSIZE_t)st->st_size;
+    fno->fdate   = (WORD)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+    fno->ftime   = (WORD)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+    fno->fattrib = S_ISDIR(st->st_mode) ? AM_DIR : AM_ARC;
+    int len = snprintf(fno->fname, sizeof(fno->fname), "%s", name);
+    return len >= 0 && (size_t)len < sizeof(fno->fname);
+}
+
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt) {
+    (void)fs; (void)path; (void)opt;
+    struct stat st;
+    if (stat(root_dir, &st) != 0) {
+        if (mkdir(root_dir, 0777) != 0) return FR_NOT_READY;
+        return FR_OK;
+    }
+    return S_ISDIR(st.st_mode) ? FR_OK : FR_NO_FILESYSTEM;
+}
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode) {
+    char p[512];
+    fp->fp = NULL;
+    if (!host_path(p, sizeof(p), path)) return FR_INVALID_NAME;
+
+    int flags = (mode & FA_WRITE) ? O_RDWR : O_RDONLY;
+    if ((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND || (mode & FA_OPEN_ALWAYS))
+        flags |= O_CREAT;
+    else if (mode & FA_CREATE_ALWAYS)
+        flags |= O_CREAT | O_TRUNC;
+    else if (mode & FA_CREATE_NEW)
+        flags |= O_CREAT | O_EXCL;
+
+    int fd = open(p, flags, 0666);
+    if (fd < 0) return errno_to_fr(errno);
+
+    fp->fp = fdopen(fd, (mode & FA_WRITE) ? "r+b" : "rb");
+    if (!fp->fp) {
+        close(fd);
+        return FR_INT_ERR;
+    }
+    if ((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND)
+        fseeko(fp->fp, 0, SEEK_END);
+    return FR_OK;
+}
+
+FRESULT f_close(FIL *fp) {
+    if (!fp->fp) return FR_INVALID_OBJECT;
+    int rc = fclose(fp->fp);
+    fp->fp = NULL;
+    return rc == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+    if (!fp->fp) return FR_INVALID_OBJECT;
+    size_t n = fread(buff, 1, btr, fp->fp);
+    *br = (UINT)n;
+    return (n < btr && ferror(fp->fp)) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw) {
+    if (!fp->fp) return FR_INVALID_OBJECT;
+    size_t n = fwrite(buff, 1, btw, fp->fp);
+    *bw = (UINT)n;
+    return (n < btw) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs) {
+    if (!fp->fp) return FR_INVALID_OBJECT;
+    return fseeko(fp->fp, (off_t)ofs, SEEK_SET) == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_sync(FIL *fp) {
+    if (!fp->fp) return FR_INVALID_OBJECT;
+    return fflush(fp->fp) == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FSIZE_t ff_host_size(FIL *fp) {
+    struct stat st;
+    if (!fp->fp) return 0;
+    fflush(fp->fp);
+    return fstat(fileno(fp->fp), &st) == 0 ? (FSIZE_t)st.st_size : 0;
+}
+
+FSIZE_t ff_host_tell(FIL *fp) {
+    return fp->fp ? (FSIZE_t)ftello(fp->fp) : 0;
+}
+
+FRESULT f_stat(const TCHAR *path, FILINFO *fno) {
+    char p[512];
+    struct stat st;
+    if (!host_path(p, sizeof(p), path)) return FR_INVALID_NAME;
+    if (stat(p, &st) != 0) return errno_to_fr(errno);
+
+    const char *name = strrchr(p, '/');
+    return fill_info(fno, name ? name + 1 : p, &st) ? FR_OK : FR_INVALID_NAME;
+}
+
+FRESULT f_mkdir(const TCHAR *path) {
+    char p[512];
+    if (!host_path(p, sizeof(p), path)) return FR_INVALID_NAME;
+    return mkdir(p, 0777) == 0 ? FR_OK : errno_to_fr(errno);
+}
+
+FRESULT f_unlink(const TCHAR *path) {
+    char p[512];
+    if (!host_path(p, sizeof(p), path)) return FR_INVALID_NAME;
+    return remove(p) == 0 ? FR_OK : errno_to_fr(errno);
+}
+
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new) {
+    char a[512], b[512];
+    if (!host_path(a, sizeof(a), path_old) || !host_path(b, sizeof(b), path_new))
+        return FR_INVALID_NAME;
+    return rename(a, b) == 0 ? FR_OK : errno_to_fr(errno);
+}
+
+FRESULT f_opendir(FF_DIR *dp, const TCHAR *path) {
+    dp->dp = NULL;
+    if (!host_path(dp->path, sizeof(dp->path), path)) return FR_INVALID_NAME;
+    dp->dp = opendir(dp->path);
+    return dp->dp ? FR_OK : errno_to_fr(errno);
+}
+
+// End of directory → FR_OK with fno->fname[0] == '\0', like FatFs
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno) {
+    if (!dp->dp) return FR_INVALID_OBJECT;
+
+    struct dirent *de;
+    while ((de = readdir((DIR *)dp->dp)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+        char p[512];
+        struct stat st;
+        int len = snprintf(p, sizeof(p), "%s/%s", dp->path, de->d_name);
+        if (len < 0 || (size_t)len >= sizeof(p)) continue;     // cannot be opened either
+        if (stat(p, &st) != 0) continue;
+        if (!fill_info(fno, de->d_name, &st)) continue;
+        return FR_OK;
+    }
+    fno->fname[0] = '\0';
+    return FR_OK;
+}
+
+FRESULT f_closedir(FF_DIR *dp) {
+    if (!dp->dp) return FR_INVALID_OBJECT;
+    closedir((DIR *)dp->dp);
+    dp->dp = NULL;
+    return FR_OK;
+}
+
+TCHAR *f_gets(TCHAR *buff, int len, FIL *fp) {
+    if (!fp->fp) return NULL;
+    return fgets(buff, len, fp->fp);
+}
+
+int f_puts(const TCHAR *str, FIL *fp) {
+    if (!fp->fp) return -1;
+    return fputs(str, fp->fp) < 0 ? -1 : (int)strlen(str);
+}
@@ -0,0 +1,271 @@
+// fimg_diff.cpp - Compare two .fimg images of the same board (libfimg)
+//
+//   spi_flash_fimg_diff before.fimg after.fimg            summary + changed ranges
+//   spi_flash_fimg_diff a.fimg b.fimg -m                  + sector map
+//   spi_flash_fimg_diff a.fimg b.fimg -o diff.json        everything as JSON
+//
+// Options:
+//   -g bytes   merge changed ranges closer than this (default 0: exact ranges)
+//   -r N       print at most N ranges (default 50, 0 = all)
+//   -t N       threads (default: all cores)
+//
+// Both images are mapped, not read. The common length is split into
+// batches of 4 KiB sectors that worker threads take from a shared counter;
+// a sector is compared with 64-bit word XORs the compiler vectorises, and
+// only a changed sector is walked byte by byte for its exact ranges and
+// its bit flips. Bits that went 0 -> 1 mean the sector was erased in
+// between, 1 -> 0 alone is programming (or decay). Bytes past the end of
+// the shorter image count as changed.
+//
+// Exit status like cmp: 0 identical, 1 different, 2 error.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fimg.h"
+
+static const size_t SECTOR = fimg::SECTOR_SIZE;
+static const size_t BATCH_SECTORS = 64;        // sectors per work item (256 KiB)
+
+struct Range {
+    uint64_t start, end;        // [start, end)
+};
+
+struct Stats {
+    uint64_t changed_sectors = 0;
+    uint64_t changed_bytes = 0;
+    uint64_t bits_0to1 = 0;     // needs an erase
+    uint64_t bits_1to0 = 0;     // programmed
+};
+
+struct Batch {
+    std::vector<Range> ranges;
+    Stats stats;
+};
+
+static inline uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+// any difference in [0, n)? n is a multiple of 8 except for a short last sector
+static bool sector_differs(const uint8_t *a, const uint8_t *b, size_t n) {
+    uint64_t acc = 0;
+    size_t words = n / 8;
+    for (size_t i = 0; i < words; i++) acc |= load64(a + i * 8) ^ load64(b + i * 8);
+    for (size_t i = words * 8; i < n; i++) acc |= (uint64_t)(a[i] ^ b[i]);
+    return acc != 0;
+}
+
+static void add_range(std::vector<Range> &out, uint64_t start, uint64_t end, uint64_t gap) {
+    if (!out.empty() && out.back().end + gap >= start)
+        out.back().end = std::max(out.back().end, end);
+    else
+        out.push_back({ start, end });
+}
+
+// Exact changed runs and bit flips of one sector at addr
+static void sector_detail(const uint8_t *a, const uint8_t *b, size_t n, uint64_t addr,
+                          uint64_t gap, Batch *out) {
+    size_t i = 0;
+    while (i < n) {
+        if (i + 8 <= n && load64(a + i) == load64(b + i)) {
+            i += 8;
+            continue;
+        }
+        if (a[i] == b[i]) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while (i < n && a[i] != b[i]) {
+            out->stats.bits_0to1 += __builtin_popcount((unsigned)(~a[i] & b[i]) & 0xFF);
+            out->stats.bits_1to0 += __builtin_popcount((unsigned)(a[i] & ~b[i]) & 0xFF);
+            i++;
+        }
+        out->stats.changed_bytes += i - start;
+        add_range(out->ranges, addr + start, addr + i, gap);
+    }
+}
+
+struct Job {
+    const uint8_t *a, *b;
+    uint64_t common;            // bytes present in both
+    uint64_t gap;
+    std::vector<uint8_t> *changed;      // one flag per sector
+    std::vector<Batch> *batches;
+    std::atomic<size_t> next{0};
+};
+
+static void worker(Job *job) {
+    const size_t sectors = (size_t)((job->common + SECTOR - 1) / SECTOR);
+    const size_t nbatch = job->batches->size();
+    for (size_t bi; (bi = job->next.fetch_add(1)) < nbatch;) {
+        Batch &out = (*job->batches)[bi];
+        size_t last = std::min(sectors, (bi + 1) * BATCH_SECTORS);
+        for (size_t s = bi * BATCH_SECTORS; s < last; s++) {
+            uint64_t addr = (uint64_t)s * SECTOR;
+            size_t n = (size_t)std::min<uint64_t>(SECTOR, job->common - addr);
+            if (!sector_differs(job->a + addr, job->b + addr, n)) continue;
+            (*job->changed)[s] = 1;
+            out.stats.changed_sectors++;
+            sector_detail(job->a + addr, job->b + addr, n, addr, job->gap, &out);
+        }
+    }
+}
+
+static void print_side_json(FILE *f, const char *key, const fimg::Image &img) {
+    fprintf(f, "\"%s\":{\"path\":\"", key);
+    for (char c : img.path()) {
+        if (c == '"' || c == '\\') fputc('\\', f);
+        fputc(c, f);
+    }
+    fprintf(f, "\",\"jedec\":\"%s\",\"image_size\":%u,\"crc32\":\"%08x\"}",
+            img.jedec_hex().c_str(), img.header().image_size, img.header().crc32_all);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s a.fimg b.fimg [-o out.json] [-m] [-g gap] [-r max_ranges] "
+                    "[-t threads]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *paths[2] = { NULL, NULL }, *json_path = NULL;
+    uint64_t gap = 0;
+    size_t max_ranges = 50;
+    int threads = (int)std::thread::hardware_concurrency();
+    bool show_map = false;
+    int npaths = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "-o") && i + 1 < argc) json_path  = argv[++i];
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc) gap        = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) max_ranges = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) threads    = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-m"))                 show_map   = true;
+        else if (argv[i][0] != '-' && npaths < 2)        paths[npaths++] = argv[i];
+        else usage(argv[0]);
+    }
+    if (npaths != 2) usage(argv[0]);
+    if (threads < 1) threads = 1;
+
+    fimg::Image img[2];
+    std::string err;
+    for (int i = 0; i < 2; i++) {
+        if (!img[i].open(paths[i], &err)) {
+            fprintf(stderr, "%s\n", err.c_str());
+            return 2;
+        }
+    }
+    if (memcmp(img[0].header().jedec, img[1].header().jedec, 3) != 0)
+        fprintf(stderr, "warning: JEDEC %s vs %s, not the same chip\n",
+                img[0].jedec_hex().c_str(), img[1].jedec_hex().c_str());
+
+    auto t0 = std::chrono::steady_clock::now();
+    fimg::Bytes a = img[0].data(), b = img[1].data();
+    uint64_t common = std::min(a.size(), b.size());
+    uint64_t longest = std::max(a.size(), b.size());
+    size_t sectors = (size_t)((longest + SECTOR - 1) / SECTOR);
+    size_t common_sectors = (size_t)((common + SECTOR - 1) / SECTOR);
+
+    std::vector<uint8_t> changed(sectors, 0);
+    std::vector<Batch> batches((common_sectors + BATCH_SECTORS - 1) / BATCH_SECTORS);
+    Job job;
+    job.a = a.data();
+    job.b = b.data();
+    job.common = common;
+    job.gap = gap;
+    job.changed = &changed;
+    job.batches = &batches;
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) pool.emplace_back(worker, &job);
+    for (auto &th : pool) th.join();
+
+    // batches in address order; ranges may continue across a batch boundary
+    std::vector<Range> ranges;
+    Stats st;
+    for (const Batch &bt : batches) {
+        for (const Range &r : bt.ranges) add_range(ranges, r.start, r.end, gap);
+        st.changed_sectors += bt.stats.changed_sectors;
+        st.changed_bytes += bt.stats.changed_bytes;
+        st.bits_0to1 += bt.stats.bits_0to1;
+        st.bits_1to0 += bt.stats.bits_1to0;
+    }
+    if (longest > common) {
+        add_range(ranges, common, longest, gap);
+        st.changed_bytes += longest - common;
+        for (size_t s = common / SECTOR; s < sectors; s++) {
+            if (!changed[s]) st.changed_sectors++;
+            changed[s] = 1;
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    printf("A: %s (%s, %zu bytes)\n", paths[0], img[0].jedec_hex().c_str(), a.size());
+    printf("B: %s (%s, %zu bytes)\n", paths[1], img[1].jedec_hex().c_str(), b.size());
+    if (a.size() != b.size())
+        printf("Only in %s: 0x%08llx - 0x%08llx\n", a.size() > b.size() ? "A" : "B",
+               (unsigned long long)common, (unsigned long long)longest);
+    printf("Changed: %llu of %zu sectors, %llu bytes in %zu ranges\n",
+           (unsigned long long)st.changed_sectors, sectors,
+           (unsigned long long)st.changed_bytes, ranges.size());
+    printf("Bit flips: %llu 1->0 (program), %llu 0->1 (erase)\n",
+           (unsigned long long)st.bits_1to0, (unsigned long long)st.bits_0to1);
+    printf("Compared %.1f MiB in %.1f ms (%d threads)\n", common / 1048576.0, ms, threads);
+
+    size_t shown = max_ranges ? std::min(max_ranges, ranges.size()) : ranges.size();
+    for (size_t i = 0; i < shown; i++)
+        printf("  0x%08llx - 0x%08llx  %llu bytes\n", (unsigned long long)ranges[i].start,
+               (unsigned long long)ranges[i].end, (unsigned long long)(ranges[i].end - ranges[i].start));
+    if (shown < ranges.size()) printf("  ... %zu more (-r 0 for all)\n", ranges.size() - shown);
+
+    // 64 sectors (256 KiB) per line, X = changed
+    if (show_map) {
+        for (size_t s = 0; s < sectors; s += 64) {
+            printf("%08llx ", (unsigned long long)s * SECTOR);
+            for (size_t k = s; k < std::min(sectors, s + 64); k++) putchar(changed[k] ? 'X' : '.');
+            putchar('\n');
+        }
+    }
+
+    if (json_path) {
+        FILE *f = fopen(json_path, "w");
+        if (!f) {
+            fprintf(stderr, "Cannot write %s\n", json_path);
+            return 2;
+        }
+        fputc('{', f);
+        print_side_json(f, "a", img[0]);
+        fputc(',', f);
+        print_side_json(f, "b", img[1]);
+        fprintf(f, ",\"sector_size\":%zu,\"sectors\":%zu,\"changed_sectors\":%llu,"
+                   "\"changed_bytes\":%llu,\"bits_1to0\":%llu,\"bits_0to1\":%llu,\"ms\":%.3f,",
+                SECTOR, sectors, (unsigned long long)st.changed_sectors,
+                (unsigned long long)st.changed_bytes, (unsigned long long)st.bits_1to0,
+                (unsigned long long)st.bits_0to1, ms);
+        // bit s of the bitmap = sector s, least significant bit first, as hex bytes
+        fprintf(f, "\"bitmap\":\"");
+        for (size_t s = 0; s < sectors; s += 8) {
+            unsigned v = 0;
+            for (size_t k = 0; k < 8 && s + k < sectors; k++) v |= (unsigned)changed[s + k] << k;
+            fprintf(f, "%02x", v);
+        }
+        fprintf(f, "\",\"ranges\":[");
+        for (size_t i = 0; i < ranges.size(); i++)
+            fprintf(f, "%s[%llu,%llu]", i ? "," : "", (unsigned long long)ranges[i].start,
+                    (unsigned long long)ranges[i].end);
+        fprintf(f, "]}\n");
+        fclose(f);
+    }
+    return st.changed_bytes ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+// fimg_tool.cpp - Inspect, pack and unpack .fimg images (libfimg)
+//
+//   spi_flash_fimg info FLASHIMG/t0000123456_ef4018.fimg
+//   spi_flash_fimg pack dump.bin out.fimg -j EF4018 [-f flash_size]
+//   spi_flash_fimg unpack in.fimg out.bin [-a addr] [-n bytes]
+//
+// info prints the header, checks size, header CRC, trailer and sector map,
+// and counts sector classes (from the map, or classified here for images
+// without one) and erased (all 0xFF) pages. pack wraps a raw dump (from an
+// external programmer, or flash_sim's -i file) so it can be uploaded and
+// restored; unpack writes the flash contents, or one address range, back out.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fimg.h"
+
+static bool erased(fimg::Bytes b) {
+    for (uint8_t v : b)
+        if (v != 0xFF) return false;
+    return true;
+}
+
+static int cmd_info(const char *path) {
+    fimg::Image img;
+    std::string err;
+    if (!img.open(path, &err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    const fimg::Header &h = img.header();
+    printf("File:        %s (%llu bytes)\n", path, (unsigned long long)img.file_size());
+    printf("JEDEC:       %s\n", img.jedec_hex().c_str());
+    printf("Flash size:  %u\n", h.flash_size);
+    printf("Image size:  %u\n", h.image_size);
+    printf("Chunk size:  %u\n", h.chunk_size);
+    printf("Header CRC:  %08x\n", h.crc32_all);
+
+    fimg::Check c = img.verify();
+    printf("Data CRC:    %08x\n", c.data_crc);
+    printf("Trailer:     %s\n", c.size_ok ? "present" : "missing (size mismatch)");
+
+    std::string map_err;
+    std::vector<fimg::SectorClass> classes = img.sector_map(&map_err);
+    if (img.has_sector_map()) printf("Sector map:  %s\n", classes.empty() ? map_err.c_str() : "present");
+    else                      printf("Sector map:  none\n");
+    if (classes.empty()) {
+        for (fimg::Bytes s : img.sectors()) classes.push_back(fimg::classify_sector(s.data(), s.size()));
+    }
+    size_t count[fimg::SECTOR_CLASSES] = {};
+    for (fimg::SectorClass k : classes) count[(size_t)k < fimg::SECTOR_CLASSES ? (size_t)k : 0]++;
+    printf("Sectors:     %zu", classes.size());
+    for (size_t k = 1; k < fimg::SECTOR_CLASSES; k++)
+        if (count[k]) printf(", %zu %s", count[k], fimg::sector_class_name((fimg::SectorClass)k));
+    printf("\n");
+
+    size_t blank_pages = 0;
+    for (fimg::Bytes p : img.pages()) blank_pages += erased(p);
+    printf("Erased:      %zu of %zu sectors, %zu of %zu pages\n",
+           count[(size_t)fimg::SectorClass::Blank], classes.size(), blank_pages, img.pages().size());
+
+    printf("Status:      %s\n", c.valid ? "OK" : c.error.c_str());
+    return c.valid ? 0 : 1;
+}
+
+static int cmd_pack(const char *in, const char *out, const char *jedec, uint32_t flash_size) {
+    uint8_t id[3] = { 0xFF, 0xFF, 0xFF };
+    if (jedec) {
+        unsigned long v = strtoul(jedec, NULL, 16);
+        id[0] = (uint8_t)(v >> 16);
+        id[1] = (uint8_t)(v >> 8);
+        id[2] = (uint8_t)v;
+    }
+
+    FILE *f = fopen(in, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", in);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0 || (unsigned long)size > UINT32_MAX) {
+        fprintf(stderr, "%s: unsupported size\n", in);
+        fclose(f);
+        return 1;
+    }
+
+    fimg::Writer w;
+    std::string err;
+    bool ok = w.open(out, id, (uint32_t)size, &err, flash_size);
+    static uint8_t buf[1 << 20];
+    size_t n;
+    while (ok && (n = fread(buf, 1, sizeof(buf), f)) > 0)
+        ok = w.write(buf, n, &err);
+    fclose(f);
+    if (ok) ok = w.finish(&err);
+    if (!ok) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    printf("%s: %ld bytes, crc=0x%08x\n", out, size, w.crc());
+    return 0;
+}
+
+static int cmd_unpack(const char *in, const char *out, uint64_t addr, uint64_t len) {
+    fimg::Image img;
+    std::string err;
+    if (!img.open(in, &err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    fimg::Check c = img.verify();
+    if (!c.valid) fprintf(stderr, "warning: %s: %s\n", in, c.error.c_str());
+
+    fimg::Bytes r = img.range(addr, len ? (size_t)len : SIZE_MAX);
+    FILE *f = fopen(out, "wb");
+    if (!f || fwrite(r.data(), 1, r.size(), f) != r.size() || fclose(f) != 0) {
+        fprintf(stderr, "Cannot write %s\n", out);
+        return 1;
+    }
+    printf("%s: %zu bytes from 0x%08llx\n", out, r.size(), (unsigned long long)addr);
+    return 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s info img.fimg\n"
+                    "       %s pack raw.bin out.fimg [-j jedec] [-f flash_size]\n"
+                    "       %s unpack img.fimg out.bin [-a addr] [-n bytes]\n",
+            argv0, argv0, argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *files[3] = { NULL, NULL, NULL }, *jedec = NULL;
+    uint32_t flash_size = 0;
+    uint64_t addr = 0, len = 0;
+    int nfiles = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "-j") && i + 1 < argc) jedec      = argv[++i];
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc) flash_size = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-a") && i + 1 < argc) addr       = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) len        = strtoull(argv[++i], NULL, 0);
+        else if (argv[i][0] != '-' && nfiles < 3)        files[nfiles++] = argv[i];
+        else usage(argv[0]);
+    }
+    if (nfiles == 2 && !strcmp(files[0], "info")) return cmd_info(files[1]);
+    if (nfiles == 3 && !strcmp(files[0], "pack")) return cmd_pack(files[1], files[2], jedec, flash_size);
+    if (nfiles == 3 && !strcmp(files[0], "unpack")) return cmd_unpack(files[1], files[2], addr, len);
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,355 @@
+// fimg_verify.cpp - Verify every .fimg of an archive in parallel (libfimg)
+//
+//   spi_flash_fimg_verify /mnt/sd/FLASHIMG                 one line per image + summary
+//   spi_flash_fimg_verify archive/ -o report.csv           + report (.json: JSON)
+//   spi_flash_fimg_verify /mnt/sd/FLASHIMG -c              + CATALOG.csv for the device
+//
+// Options:
+//   -o file    write a report; CSV, or JSON when the name ends in .json
+//   -c         write CATALOG.csv (the device's format) next to the images
+//   -q         print only images that fail
+//   -t N       threads (default: all cores)
+//
+// Arguments are directories (searched recursively for *.fimg) or image
+// files. Each image is cut into slices of up to 16 MiB; the slices go on
+// per-thread deques, whole images dealt out largest first. A thread works
+// from the back of its own deque and, once that is empty, steals from the
+// front of the others', so one 256 MiB dump does not leave the other cores
+// idle behind it. Slice CRCs are joined with crc32_combine() and checked
+// against the header and the trailer exactly as Image::verify() would.
+//
+// The catalog written by -c is what the device keeps in
+// FLASHIMG/CATALOG.csv (see catalog_load() in main.c). An existing catalog
+// is updated in place: rows of the images verified here get size, FAT
+// date/time (from the file), CRC and status, everything else is kept as
+// it was, checked_ms included (0 for rows added here). The scrubber and
+// restore then trust an image checked here until the file changes. The
+// device reads at most 64 entries.
+//
+// Exit status: 0 all images OK, 1 any image bad, 2 error.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#include "fimg.h"
+
+namespace fs = std::filesystem;
+
+static const size_t SLICE = 16u << 20;
+
+struct Entry {
+    std::string path;
+    fimg::Image img;
+    std::string open_error;         // not a FIMGv1 image / unreadable
+    std::vector<uint32_t> slice_crc;
+    fimg::Check check;
+};
+
+struct Task {
+    size_t entry, slice;
+};
+
+// One per thread: the owner pops from the back, thieves take from the front
+struct TaskQueue {
+    std::mutex m;
+    std::deque<Task> q;
+};
+
+struct Pool {
+    std::vector<Entry> *entries;
+    std::vector<TaskQueue> queues;
+};
+
+static bool take(TaskQueue &tq, bool own, Task *t) {
+    std::lock_guard<std::mutex> lock(tq.m);
+    if (tq.q.empty()) return false;
+    if (own) {
+        *t = tq.q.back();
+        tq.q.pop_back();
+    } else {
+        *t = tq.q.front();
+        tq.q.pop_front();
+    }
+    return true;
+}
+
+// No task creates new ones, so all deques empty means the pass is done
+static void worker(Pool *pool, size_t self) {
+    const size_t n = pool->queues.size();
+    Task t;
+    for (;;) {
+        bool got = take(pool->queues[self], true, &t);
+        for (size_t k = 1; !got && k < n; k++) got = take(pool->queues[(self + k) % n], false, &t);
+        if (!got) return;
+
+        Entry &e = (*pool->entries)[t.entry];
+        fimg::Bytes s = e.img.data().sub(t.slice * SLICE, SLICE);
+        e.slice_crc[t.slice] = fimg::crc32(0, s.data(), s.size());
+    }
+}
+
+static void collect(const std::string &arg, std::vector<std::string> *out) {
+    std::error_code ec;
+    if (!fs::is_directory(arg, ec)) {
+        out->push_back(arg);
+        return;
+    }
+    for (fs::recursive_directory_iterator it(arg, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec) && it->path().extension() == ".fimg")
+            out->push_back(it->path().string());
+    }
+    if (ec) fprintf(stderr, "warning: %s: %s\n", arg.c_str(), ec.message().c_str());
+}
+
+static const char *status_name(const Entry &e) {
+    return e.check.valid ? "OK" : "BAD";
+}
+
+static std::string error_text(const Entry &e) {
+    return e.open_error.empty() ? e.check.error : e.open_error;
+}
+
+static void write_json_string(FILE *f, const std::string &s) {
+    fputc('"', f);
+    for (char c : s) {
+        if (c == '"' || c == '\\') fputc('\\', f);
+        if ((unsigned char)c >= 0x20) fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+// Commas would break the CSV; paths and messages do not need them
+static std::string csv_field(const std::string &s) {
+    std::string r = s;
+    std::replace(r.begin(), r.end(), ',', ';');
+    return r;
+}
+
+static bool write_report(const char *path, const std::vector<Entry> &entries) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    size_t len = strlen(path);
+    bool json = len >= 5 && !strcmp(path + len - 5, ".json");
+
+    if (json) fputc('[', f);
+    else fprintf(f, "path,jedec,flash_size,image_size,file_size,header_crc,trailer_crc,data_crc,status,error\n");
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Entry &e = entries[i];
+        const fimg::Header &h = e.img.header();
+        bool open = e.img.is_open();
+        if (json) {
+            fprintf(f, "%s{\"path\":", i ? "," : "");
+            write_json_string(f, e.path);
+            if (open)
+                fprintf(f, ",\"jedec\":\"%s\",\"flash_size\":%u,\"image_size\":%u,\"file_size\":%llu,"
+                           "\"header_crc\":\"%08x\",\"trailer_crc\":\"%08x\",\"data_crc\":\"%08x\"",
+                        e.img.jedec_hex().c_str(), h.flash_size, h.image_size,
+                        (unsigned long long)e.img.file_size(), h.crc32_all, e.img.trailer(),
+                        e.check.data_crc);
+            fprintf(f, ",\"status\":\"%s\",\"error\":", status_name(e));
+            write_json_string(f, error_text(e));
+            fputc('}', f);
+        } else if (open) {
+            fprintf(f, "%s,%s,%u,%u,%llu,%08x,%08x,%08x,%s,%s\n", csv_field(e.path).c_str(),
+                    e.img.jedec_hex().c_str(), h.flash_size, h.image_size,
+                    (unsigned long long)e.img.file_size(), h.crc32_all, e.img.trailer(),
+                    e.check.data_crc, status_name(e), csv_field(error_text(e)).c_str());
+        } else {
+            fprintf(f, "%s,,,,,,,,%s,%s\n", csv_field(e.path).c_str(), status_name(e),
+                    csv_field(error_text(e)).c_str());
+        }
+    }
+    if (json) fprintf(f, "]\n");
+    return fclose(f) == 0;
+}
+
+// One CATALOG.csv line: the name, and the rest of the line as found
+struct CatalogRow {
+    std::string name, rest;
+};
+
+static std::vector<CatalogRow> read_catalog(const std::string &path) {
+    std::vector<CatalogRow> rows;
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line)) return rows;       // none yet, or only the header
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        size_t comma = line.find(',');
+        if (comma == std::string::npos) rows.push_back({ line, "" });
+        else rows.push_back({ line.substr(0, comma), line.substr(comma) });
+    }
+    return rows;
+}
+
+// checked_ms (last field) of a row read back, "0" when it has none
+static std::string checked_ms(const CatalogRow &r) {
+    size_t comma = r.rest.rfind(',');
+    if (comma == std::string::npos || std::count(r.rest.begin(), r.rest.end(), ',') != 6) return "0";
+    return r.rest.substr(comma + 1);
+}
+
+// CATALOG.csv in every directory that holds images, as catalog_save() writes
+// it; only the rows of images verified in this run change
+static bool write_catalogs(const std::vector<Entry> &entries) {
+    std::map<std::string, std::vector<const Entry *>> dirs;
+    for (const Entry &e : entries) dirs[fs::path(e.path).parent_path().string()].push_back(&e);
+
+    bool ok = true;
+    for (const auto &d : dirs) {
+        std::string cat = (fs::path(d.first) / "CATALOG.csv").string();
+        std::vector<CatalogRow> rows = read_catalog(cat);
+        size_t updated = 0, added = 0;
+
+        for (const Entry *e : d.second) {
+            struct stat st;
+            if (stat(e->path.c_str(), &st) != 0) continue;
+            // FAT date/time from the mtime, like FatFs / ff_host.c report it
+            struct tm tm;
+            localtime_r(&st.st_mtime, &tm);
+            unsigned fdate = (unsigned)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+            unsigned ftime = (unsigned)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+            std::string name = fs::path(e->path).filename().string();
+
+            auto it = std::find_if(rows.begin(), rows.end(),
+                                   [&](const CatalogRow &r) { return r.name == name; });
+            std::string checked = (it != rows.end()) ? checked_ms(*it) : "0";
+            char rest[96];
+            snprintf(rest, sizeof(rest), ",%llu,%u,%u,%08x,%s,%s", (unsigned long long)st.st_size,
+                     fdate & 0xFFFF, ftime & 0xFFFF, e->check.data_crc, status_name(*e),
+                     checked.c_str());
+            if (it != rows.end()) {
+                it->rest = rest;
+                updated++;
+            } else {
+                rows.push_back({ name, rest });
+                added++;
+            }
+        }
+
+        std::string part = cat + ".part";
+        FILE *f = fopen(part.c_str(), "w");
+        if (!f) {
+            fprintf(stderr, "Cannot write %s\n", part.c_str());
+            ok = false;
+            continue;
+        }
+        fprintf(f, "name,size,fdate,ftime,crc,status,checked_ms\n");
+        for (const CatalogRow &r : rows) fprintf(f, "%s%s\n", r.name.c_str(), r.rest.c_str());
+        if (fclose(f) != 0 || rename(part.c_str(), cat.c_str()) != 0) {
+            fprintf(stderr, "Cannot write %s\n", cat.c_str());
+            remove(part.c_str());
+            ok = false;
+            continue;
+        }
+        printf("Catalog: %s (%zu updated, %zu added, %zu rows)\n", cat.c_str(), updated, added,
+               rows.size());
+    }
+    return ok;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s dir|img.fimg... [-o report.csv|report.json] [-c] [-q] [-t threads]\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *report = NULL;
+    bool catalog = false, quiet = false;
+    int threads = (int)std::thread::hardware_concurrency();
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "-o") && i + 1 < argc) report  = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c"))                 catalog = true;
+        else if (!strcmp(argv[i], "-q"))                 quiet   = true;
+        else if (argv[i][0] != '-')                      collect(argv[i], &paths);
+        else usage(argv[0]);
+    }
+    if (paths.empty()) {
+        fprintf(stderr, "No .fimg images found\n");
+        return 2;
+    }
+    if (threads < 1) threads = 1;
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<Entry> entries(paths.size());
+    std::vector<size_t> order;
+    uint64_t total = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        Entry &e = entries[i];
+        e.path = paths[i];
+        if (!e.img.open(e.path, &e.open_error)) continue;
+        e.slice_crc.assign(std::max<size_t>(1, (e.img.data().size() + SLICE - 1) / SLICE), 0);
+        total += e.img.data().size();
+        order.push_back(i);
+    }
+
+    // largest first, round-robin: every thread starts on big work, stealing evens out the rest
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return entries[a].img.data().size() > entries[b].img.data().size();
+    });
+    Pool pool;
+    pool.entries = &entries;
+    pool.queues = std::vector<TaskQueue>((size_t)threads);
+    for (size_t k = 0; k < order.size(); k++) {
+        std::deque<Task> &q = pool.queues[k % threads].q;
+        for (size_t s = 0; s < entries[order[k]].slice_crc.size(); s++)
+            q.push_front({ order[k], s });
+    }
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) workers.emplace_back(worker, &pool, (size_t)t);
+    for (auto &th : workers) th.join();
+
+    size_t bad = 0;
+    for (Entry &e : entries) {
+        if (e.img.is_open()) {
+            size_t size = e.img.data().size();
+            uint32_t crc = 0;
+            for (size_t s = 0; s < e.slice_crc.size(); s++) {
+                uint64_t len = std::min(SLICE, size - std::min(size, s * SLICE));
+                crc = fimg::crc32_combine(crc, e.slice_crc[s], len);
+            }
+            e.check = e.img.check(crc);
+        }
+        if (!e.check.valid) bad++;
+        if (quiet && e.check.valid) continue;
+        if (e.img.is_open())
+            printf("%-4s %s  %s %u bytes crc=%08x%s%s\n", status_name(e), e.path.c_str(),
+                   e.img.jedec_hex().c_str(), e.img.header().image_size, e.check.data_crc,
+                   e.check.valid ? "" : "  ", error_text(e).c_str());
+        else
+            printf("%-4s %s  %s\n", status_name(e), e.path.c_str(), error_text(e).c_str());
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    printf("Verified %zu images: %zu OK, %zu bad\n", entries.size(), entries.size() - bad, bad);
+    printf("Read %.1f MiB in %.1f ms (%.0f MiB/s, %d threads)\n", total / 1048576.0, ms,
+           ms > 0 ? total / 1048576.0 / (ms / 1000.0) : 0.0, threads);
+
+    if (report && !write_report(report, entries)) {
+        fprintf(stderr, "Cannot write %s\n", report);
+        return 2;
+    }
+    if (catalog && !write_catalogs(entries)) return 2;
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,401 @@
+// flash_sim.c - Cycle-approximate SPI NOR flash model (see flash_sim.h)
+
+#include "flash_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Opcodes (same values as main.c)
+#define OP_WREN        0x06
+#define OP_WRDI        0x04
+#define OP_RDSR1       0x05
+#define OP_RDSR2       0x35
+#define OP_WRSR        0x01
+#define OP_READ        0x03
+#define OP_PP          0x02
+#define OP_SE_4K       0x20
+#define OP_BE_64K      0xD8
+#define OP_CHIP_ERASE  0xC7
+#define OP_JEDEC_ID    0x9F
+#define OP_SFDP        0x5A
+#define OP_RSTEN       0x66
+#define OP_RST         0x99
+#define OP_ULBPR       0x98
+#define OP_RESUME      0x7A
+
+#define SR1_WIP   0x01
+#define SR1_WEL   0x02
+#define SR1_BP    0x1C      // BP2..0
+#define SR1_TB    0x20      // protect from bottom instead of top
+
+#define PAGE_SIZE    256u
+#define SECTOR_SIZE  4096u
+#define BLOCK_SIZE   65536u
+
+// Not in the CSV: block / chip erase derived from tSE
+#define BE64_PER_SE      4.0        // 64K block erase ≈ 4 × tSE
+#define CE_PER_SECTOR    0.125      // chip erase ≈ sectors × tSE / 8
+
+#define HANG_NS          UINT64_MAX
+
+static struct {
+    uint8_t           *mem;
+    uint32_t           size;
+    flash_sim_config_t cfg;
+    uint8_t            sr1, sr2;
+    bool               rst_enabled;  // RSTEN seen, RST must follow
+    uint64_t           now_ns;
+    uint64_t           busy_until;   // WIP while now_ns < busy_until
+    uint64_t           byte_ns;      // 8 SPI clocks
+    uint64_t           rng;
+    uint8_t            sfdp[64];
+
+    // current transaction
+    bool               selected;
+    bool               ignored;      // started while busy → not executed
+    uint32_t           nbytes;       // bytes shifted since CS fell
+    uint8_t            op;
+    uint32_t           addr;
+    uint8_t            wr[2];        // WRSR payload
+    uint8_t            page[PAGE_SIZE];
+    bool               page_dirty[PAGE_SIZE];
+} sim;
+
+// ---------------- PRNG (xorshift64*) ----------------
+
+static uint64_t rng_next(void) {
+    sim.rng ^= sim.rng >> 12;
+    sim.rng ^= sim.rng << 25;
+    sim.rng ^= sim.rng >> 27;
+    return sim.rng * 0x2545F4914F6CDD1Dull;
+}
+
+static double rng_unit(void) {
+    return (double)(rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool rng_hit(double p) {
+    return p > 0.0 && rng_unit() < p;
+}
+
+// typ ± jitter (triangular), clamped to [0, max]
+static uint64_t sample_ns(double typ_ms, double max_ms) {
+    double u  = rng_unit() + rng_unit() - 1.0;
+    double ms = typ_ms * (1.0 + sim.cfg.timing.jitter * u);
+    if (max_ms > 0.0 && ms > max_ms) ms = max_ms;
+    if (ms < 0.0) ms = 0.0;
+    return (uint64_t)(ms * 1e6);
+}
+
+// ---------------- SFDP (JESD216, BFPT only) ----------------
+
+static void sfdp_build(void) {
+    memset(sim.sfdp, 0xFF, sizeof(sim.sfdp));
+    const uint8_t hdr[16] = {
+        'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xFF,   // rev 1.6, 1 parameter header
+        0x00, 0x06, 0x01, 0x09, 0x10, 0x00, 0x00, 0xFF // BFPT v1.6, 9 DWORDs @ 0x10
+    };
+    memcpy(sim.sfdp, hdr, sizeof(hdr));
+
+    uint8_t *bfpt = sim.sfdp + 0x10;
+    bfpt[0] = 0xE5;                                    // 4K erase supported
+    bfpt[1] = 0x20;                                    // 4K erase opcode
+    // DWORD2: density, bits - 1 up to 4 Gbit, else bit 31 + N for 2^N bits
+    uint64_t bits = (uint64_t)sim.size * 8u;
+    uint32_t density = (bits <= (1ull << 32)) ? (uint32_t)(bits - 1u)
+                                              : 0x80000000u | (uint32_t)(63 - __builtin_clzll(bits));
+    bfpt[4] = (uint8_t)density;
+    bfpt[5] = (uint8_t)(density >> 8);
+    bfpt[6] = (uint8_t)(density >> 16);
+    bfpt[7] = (uint8_t)(density >> 24);
+}
+
+// ---------------- setup ----------------
+
+bool flash_sim_init(const flash_sim_config_t *cfg) {
+    flash_sim_free();
+    memset(&sim, 0, sizeof(sim));
+    sim.cfg = *cfg;
+
+    sim.size = cfg->size_bytes;
+    if (!sim.size) {
+        uint8_t c = cfg->jedec[2];
+        if (c > 0x1F) c = 0x1F;                        // 1u << 32 does not fit
+        sim.size = (c >= 0x10) ? (1u << c) : 16u * 1024u * 1024u;   // 2^code bytes, as main.c
+    }
+    uint32_t hz  = cfg->spi_hz ? cfg->spi_hz : 1000000u;
+    sim.byte_ns  = 8000000000ull / hz;
+    sim.rng      = cfg->seed ? cfg->seed : 0x9E3779B97F4A7C15ull;
+    sim.sr1      = (uint8_t)((cfg->bp & 7u) << 2);
+
+    sim.mem = malloc(sim.size);
+    if (!sim.mem) return false;
+    memset(sim.mem, 0xFF, sim.size);
+    sfdp_build();
+
+    if (cfg->image_path && *cfg->image_path) {
+        FILE *f = fopen(cfg->image_path, "rb");
+        if (!f) {
+            fprintf(stderr, "flash_sim: cannot open %s\n", cfg->image_path);
+            return false;
+        }
+        size_t n = fread(sim.mem, 1, sim.size, f);
+        fclose(f);
+        if (n < sim.size)
+            fprintf(stderr, "flash_sim: %s shorter than flash, rest left erased\n",
+                    cfg->image_path);
+    }
+    return true;
+}
+
+void flash_sim_free(void) {
+    free(sim.mem);
+    sim.mem = NULL;
+}
+
+int flash_sim_load_timing_csv(const char *path, const char *name,
+                              uint8_t jedec[3], flash_sim_timing_t *t) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    char line[256];
+    int row = 0, found = 0;
+    if (!fgets(line, sizeof(line), f)) {   // header
+        fclose(f);
+        return 0;
+    }
+    while (!found && fgets(line, sizeof(line), f)) {
+        char dev[32];
+        unsigned char m, d0, d1;
+        float rd, pp, pp_max, se, se_max;
+        row++;
+        // same layout as parse_chip_line() in main.c
+        if (sscanf(line, "%31[^,],0x%hhx,0x%hhx,0x%hhx,%f,%f,%f,%f,%f",
+                   dev, &m, &d0, &d1, &rd, &pp, &pp_max, &se, &se_max) != 9)
+            continue;
+
+        bool by_name  = name && *name && strcmp(dev, name) == 0;
+        bool by_jedec = !(name && *name) && m == jedec[0] && d0 == jedec[1] && d1 == jedec[2];
+        if (!by_name && !by_jedec) continue;
+
+        double jitter   = t->jitter;
+        memset(t, 0, sizeof(*t));
+        t->read_us      = rd;
+        t->prog_ms      = pp;
+        t->prog_max_ms  = pp_max;
+        t->erase_ms     = se;
+        t->erase_max_ms = se_max;
+        t->jitter       = jitter;
+        if (by_name) {
+            jedec[0] = m;
+            jedec[1] = d0;
+            jedec[2] = d1;
+        }
+        found = row;
+    }
+    fclose(f);
+    return found;
+}
+
+// ---------------- clock ----------------
+
+uint64_t flash_sim_now_ns(void) { return sim.now_ns; }
+
+void flash_sim_advance_ns(uint64_t ns) {
+    sim.now_ns += ns;
+}
+
+bool flash_sim_busy(void) {
+    return sim.now_ns < sim.busy_until;
+}
+
+uint8_t *flash_sim_mem(void)  { return sim.mem; }
+uint32_t flash_sim_size(void) { return sim.size; }
+
+// ---------------- protection ----------------
+
+// BP2..0 protect the top (or bottom with TB) 1/64 .. all of the array
+static bool addr_protected(uint32_t addr) {
+    uint32_t bp = (sim.sr1 & SR1_BP) >> 2;
+    if (bp == 0) return false;
+    if (bp == 7) return true;
+
+    uint32_t len = sim.size >> (7 - bp);
+    if (sim.sr1 & SR1_TB) return addr < len;
+    return addr >= sim.size - len;
+}
+
+static void set_busy(uint64_t ns) {
+    sim.busy_until = (ns == HANG_NS) ? HANG_NS : sim.now_ns + ns;
+}
+
+// ---------------- commands ----------------
+
+static bool op_has_addr(uint8_t op) {
+    return op == OP_READ || op == OP_PP || op == OP_SE_4K ||
+           op == OP_BE_64K || op == OP_SFDP;
+}
+
+// Allowed while WIP=1; everything else is ignored by the part
+static bool op_allowed_busy(uint8_t op) {
+    return op == OP_RDSR1 || op == OP_RDSR2 || op == OP_RSTEN ||
+           op == OP_RST   || op == OP_RESUME;
+}
+
+static void do_erase(uint32_t len, double typ_ms, double max_ms) {
+    uint32_t base = (sim.addr % sim.size) & ~(len - 1);
+    if (!addr_protected(base) && !addr_protected(base + len - 1))
+        memset(sim.mem + base, 0xFF, len);
+
+    if (rng_hit(sim.cfg.erase_hang)) set_busy(HANG_NS);
+    else                             set_busy(sample_ns(typ_ms, max_ms));
+}
+
+// Execute a command on CS rising edge
+static void sim_commit(void) {
+    const bool wel       = (sim.sr1 & SR1_WEL) != 0;
+    const bool addr_ok   = sim.nbytes >= 4;
+    const bool rst_armed = sim.rst_enabled;   // RST only counts right after RSTEN
+    const flash_sim_timing_t *t = &sim.cfg.timing;
+
+    sim.rst_enabled = false;
+    switch (sim.op) {
+    case OP_WREN:
+        sim.sr1 |= SR1_WEL;
+        return;
+    case OP_WRDI:
+        sim.sr1 &= (uint8_t)~SR1_WEL;
+        return;
+    case OP_RSTEN:
+        sim.rst_enabled = true;
+        return;
+    case OP_RST:
+        if (rst_armed) {
+            // aborts an erase/program in progress (incl. a hung one)
+            sim.busy_until = sim.now_ns;
+            sim.sr1 &= (uint8_t)~SR1_WEL;
+        }
+        return;
+    case OP_ULBPR:
+        if (wel && !sim.cfg.sr_locked) sim.sr1 &= (uint8_t)~(SR1_BP | SR1_TB);
+        sim.sr1 &= (uint8_t)~SR1_WEL;
+        return;
+    case OP_WRSR:
+        if (wel && !sim.cfg.sr_locked && sim.nbytes >= 2) {
+            sim.sr1 = (uint8_t)(sim.wr[0] & 0xFC);
+            if (sim.nbytes >= 3) sim.sr2 = sim.wr[1];
+            set_busy(sample_ns(t->prog_ms, t->prog_max_ms));   // tW ≈ tPP
+        }
+        sim.sr1 &= (uint8_t)~SR1_WEL;
+        return;
+    case OP_PP:
+        if (wel && sim.nbytes > 4) {
+            uint32_t base = (sim.addr % sim.size) & ~(PAGE_SIZE - 1);
+            if (!addr_protected(base)) {
+                for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+                    if (!sim.page_dirty[i]) continue;
+                    uint8_t v = sim.page[i];
+                    if (rng_hit(sim.cfg.flip_prog))
+                        v |= (uint8_t)(1u << (rng_next() & 7));   // bit failed to program
+                    sim.mem[base + i] &= v;                        // 1 → 0 only
+                }
+            }
+            set_busy(sample_ns(t->prog_ms, t->prog_max_ms));
+        }
+        sim.sr1 &= (uint8_t)~SR1_WEL;
+        return;
+    case OP_SE_4K:
+        if (wel && addr_ok) do_erase(SECTOR_SIZE, t->erase_ms, t->erase_max_ms);
+        sim.sr1 &= (uint8_t)~SR1_WEL;
+        return;
+    case OP_BE_64K:
+        if (wel && addr_ok) do_erase(BLOCK_SIZE, t->erase_ms * BE64_PER_SE,
+                                     t->erase_max_ms * BE64_PER_SE);
+        sim.sr1 &= (uint8_t)~SR1_WEL;
+        return;
+    case OP_CHIP_ERASE:
+        if (wel) {
+            if ((sim.sr1 & SR1_BP) == 0) memset(sim.mem, 0xFF, sim.size);
+            double k = (sim.size / SECTOR_SIZE) * CE_PER_SECTOR;
+            set_busy(sample_ns(t->erase_ms * k, t->erase_max_ms * k));
+        }
+        sim.sr1 &= (uint8_t)~SR1_WEL;
+        return;
+    default:
+        return;
+    }
+}
+
+void flash_sim_select(bool active) {
+    if (active == sim.selected) return;
+    sim.selected = active;
+
+    if (active) {
+        sim.nbytes  = 0;
+        sim.op      = 0;
+        sim.addr    = 0;
+        sim.ignored = false;
+        memset(sim.page_dirty, 0, sizeof(sim.page_dirty));
+        return;
+    }
+    if (sim.nbytes && !sim.ignored) sim_commit();
+}
+
+static uint8_t status1(void) {
+    return flash_sim_busy() ? (uint8_t)(sim.sr1 | SR1_WIP) : (uint8_t)(sim.sr1 & ~SR1_WIP);
+}
+
+uint8_t flash_sim_xfer(uint8_t mosi) {
+    sim.now_ns += sim.byte_ns;
+    if (!sim.selected) return 0xFF;
+
+    uint32_t n = sim.nbytes++;
+    if (n == 0) {
+        sim.op      = mosi;
+        sim.ignored = flash_sim_busy() && !op_allowed_busy(mosi);
+        return 0xFF;
+    }
+    if (sim.ignored) return 0xFF;
+
+    if (op_has_addr(sim.op) && n <= 3) {
+        sim.addr = (sim.addr << 8) | mosi;
+        // access latency so a whole 256-byte READ matches the row's Read_typ
+        if (n == 3 && sim.op == OP_READ && sim.cfg.timing.read_us > 0.0) {
+            uint64_t want = (uint64_t)(sim.cfg.timing.read_us * 1000.0);
+            uint64_t bus  = (4u + PAGE_SIZE) * sim.byte_ns;
+            if (want > bus) sim.now_ns += want - bus;
+        }
+        return 0xFF;
+    }
+
+    switch (sim.op) {
+    case OP_JEDEC_ID:
+        return sim.cfg.jedec[(n - 1) % 3];
+    case OP_RDSR1:
+        return status1();
+    case OP_RDSR2:
+        return sim.sr2;
+    case OP_WRSR:
+        if (n <= 2) sim.wr[n - 1] = mosi;
+        return 0xFF;
+    case OP_READ: {
+        uint8_t v = sim.mem[(sim.addr + (n - 4)) % sim.size];
+        if (rng_hit(sim.cfg.flip_read)) v ^= (uint8_t)(1u << (rng_next() & 7));
+        return v;
+    }
+    case OP_PP: {
+        uint32_t i = (sim.addr + (n - 4)) & (PAGE_SIZE - 1);   // wraps inside the page
+        sim.page[i]       = mosi;
+        sim.page_dirty[i] = true;
+        return 0xFF;
+    }
+    case OP_SFDP: {
+        if (n == 4) return 0xFF;                        // dummy byte
+        uint32_t a = sim.addr + (n - 5);
+        return (a < sizeof(sim.sfdp)) ? sim.sfdp[a] : 0xFF;
+    }
+    default:
+        return 0xFF;
+    }
+}
@@ -0,0 +1,67 @@
+// flash_sim.h - Simulated SPI NOR flash (DUT) for the host build
+//
+// Byte-level model of the chip behind hal_flash_*(): the host HAL forwards
+// CS edges and every byte shifted on MOSI, the simulator returns MISO.
+// Commands take effect on CS rising edge, like on real parts.
+//
+// Timing is cycle-approximate and runs on the simulator's own clock
+// (flash_sim_now_ns): every byte costs 8 SPI clocks, a READ adds the access
+// latency of the datasheet row, erase/program keep WIP set for the row's
+// typical time ± jitter (never above the max column). Faults: block
+// protection (BP bits / locked status register), read/program bit flips
+// and erases that hang until a software reset. All randomness comes from
+// a seeded PRNG, so runs are reproducible.
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    double read_us;        // one 256-byte READ transaction (CSV Read_typ), 0 = bus time only
+    double prog_ms;        // page program typ / max (CSV tPP)
+    double prog_max_ms;
+    double erase_ms;       // 4K sector erase typ / max (CSV tSE)
+    double erase_max_ms;
+    double jitter;         // typ * (1 ± jitter), triangular distribution
+} flash_sim_timing_t;
+
+typedef struct {
+    uint8_t            jedec[3];      // manufacturer, memory type, capacity code
+    uint32_t           size_bytes;    // 0 → derived from the capacity code
+    const char        *image_path;    // optional raw file with initial contents
+    uint32_t           spi_hz;        // bus clock, 0 → 1 MHz (FLASH_SPI_HZ)
+    flash_sim_timing_t timing;        // all zero → instant erase/program
+    uint64_t           seed;          // PRNG seed for jitter and faults
+
+    // write protection
+    uint8_t            bp;            // initial BP2..0 (SR1 bits 4..2)
+    bool               sr_locked;     // WP# asserted: WRSR / ULBPR ignored
+
+    // fault injection, probabilities in [0,1]
+    double             flip_read;     // per byte read: one transient bit flip
+    double             flip_prog;     // per byte programmed: one bit stays 1
+    double             erase_hang;    // per erase: WIP never clears until RST
+} flash_sim_config_t;
+
+bool     flash_sim_init(const flash_sim_config_t *cfg);
+void     flash_sim_free(void);
+
+// Load timing for a chip from an Embedded_datasheet.csv style file.
+// Picks the row named `name`, else the first row matching `jedec`
+// (manf + 2 device bytes). On success fills *t and, when picked by
+// name, jedec[] from the row. Returns the 1-based data row, 0 if none.
+int      flash_sim_load_timing_csv(const char *path, const char *name,
+                                   uint8_t jedec[3], flash_sim_timing_t *t);
+
+void     flash_sim_select(bool active);   // true = CS low
+uint8_t  flash_sim_xfer(uint8_t mosi);    // one full-duplex byte
+
+// simulated clock
+uint64_t flash_sim_now_ns(void);
+void     flash_sim_advance_ns(uint64_t ns);   // time passing off the bus (sleeps)
+bool     flash_sim_busy(void);
+
+// direct access for tooling (bypasses the bus)
+uint8_t *flash_sim_mem(void);
+uint32_t flash_sim_size(void);
@@ -0,0 +1,189 @@
+// hal_host.c - Linux implementation of hal.h
+//
+// Environment:
+//   SPI_FLASH_SD_DIR      directory used as the SD card       (default ./sdcard)
+//   SPI_FLASH_SIM_JEDEC   simulated JEDEC ID, 6 hex digits     (default ef4018)
+//   SPI_FLASH_SIM_SIZE    simulated flash size in bytes        (default from JEDEC)
+//   SPI_FLASH_SIM_IMAGE   raw file with initial flash contents (default: erased)
+//   SPI_FLASH_SIM_HZ      simulated SPI clock                  (default 1000000)
+//   SPI_FLASH_SIM_DB      Embedded_datasheet.csv for the timing model
+//   SPI_FLASH_SIM_CHIP    row name in SPI_FLASH_SIM_DB         (default: match JEDEC)
+//   SPI_FLASH_SIM_JITTER  erase/program time spread, fraction  (default 0.1)
+//   SPI_FLASH_SIM_SEED    PRNG seed for jitter and faults
+//   SPI_FLASH_SIM_BP      initial block-protect bits 0..7
+//   SPI_FLASH_SIM_WP      1 = WP# asserted, status register locked
+//   SPI_FLASH_SIM_FLIP_READ / _FLIP_PROG / _ERASE_HANG   fault probabilities
+//
+// Console input is stdin (raw + non-blocking on a tty). When stdin is a pipe
+// and reaches EOF, main() exits after the last job, so
+//     printf '6backup; restore; verify\n' | ./spi_flash_host
+// is a complete end-to-end regression run.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ff.h"
+#include "hal.h"
+#include "host.h"
+#include "flash_sim.h"
+
+static uint64_t        t0_ns;
+static bool            tty_raw = false;
+static struct termios  tty_saved;
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static double env_num(const char *name, double dflt) {
+    const char *v = getenv(name);
+    return (v && *v) ? strtod(v, NULL) : dflt;
+}
+
+static void tty_restore(void) {
+    if (tty_raw) tcsetattr(STDIN_FILENO, TCSANOW, &tty_saved);
+}
+
+void hal_init(void) {
+    t0_ns = mono_ns();
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    // stdin: no line buffering / echo (the firmware echoes), never block
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &tty_saved) == 0) {
+        struct termios raw = tty_saved;
+        raw.c_lflag &= (tcflag_t)~(ICANON | ECHO);
+        raw.c_cc[VMIN]  = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        tty_raw = true;
+        atexit(tty_restore);
+    }
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+    const char *sd_dir = getenv("SPI_FLASH_SD_DIR");
+    ff_host_set_root(sd_dir && *sd_dir ? sd_dir : "sdcard");
+
+    flash_sim_config_t cfg = { .jedec = { 0xEF, 0x40, 0x18 } };
+    const char *jedec = getenv("SPI_FLASH_SIM_JEDEC");
+    if (jedec && strlen(jedec) == 6) {
+        unsigned long v = strtoul(jedec, NULL, 16);
+        cfg.jedec[0] = (uint8_t)(v >> 16);
+        cfg.jedec[1] = (uint8_t)(v >> 8);
+        cfg.jedec[2] = (uint8_t)v;
+    }
+    cfg.size_bytes      = (uint32_t)env_num("SPI_FLASH_SIM_SIZE", 0);
+    cfg.image_path      = getenv("SPI_FLASH_SIM_IMAGE");
+    cfg.spi_hz          = (uint32_t)env_num("SPI_FLASH_SIM_HZ", 1000000);
+    cfg.seed            = (uint64_t)env_num("SPI_FLASH_SIM_SEED", 1);
+    cfg.bp              = (uint8_t)env_num("SPI_FLASH_SIM_BP", 0);
+    cfg.sr_locked       = env_num("SPI_FLASH_SIM_WP", 0) != 0;
+    cfg.flip_read       = env_num("SPI_FLASH_SIM_FLIP_READ", 0);
+    cfg.flip_prog       = env_num("SPI_FLASH_SIM_FLIP_PROG", 0);
+    cfg.erase_hang      = env_num("SPI_FLASH_SIM_ERASE_HANG", 0);
+    cfg.timing.jitter   = env_num("SPI_FLASH_SIM_JITTER", 0.1);
+
+    const char *db = getenv("SPI_FLASH_SIM_DB");
+    if (db && *db) {
+        const char *chip = getenv("SPI_FLASH_SIM_CHIP");
+        int row = flash_sim_load_timing_csv(db, chip, cfg.jedec, &cfg.timing);
+        if (!row) {
+            fprintf(stderr, "flash simulator: no row for %s in %s\n",
+                    (chip && *chip) ? chip : "JEDEC ID", db);
+            exit(1);
+        }
+        fprintf(stderr, "flash simulator: timing from %s row %d\n", db, row);
+    }
+
+    if (!flash_sim_init(&cfg)) {
+        fprintf(stderr, "flash simulator init failed\n");
+        exit(1);
+    }
+}
+
+// ---------------- DUT flash bus → simulator ----------------
+
+void hal_flash_bus_init(void) {
+    flash_sim_select(false);
+}
+
+void hal_flash_select(bool active) {
+    flash_sim_select(active);
+}
+
+void hal_flash_write(const uint8_t *src, size_t len) {
+    for (size_t i = 0; i < len; i++) (void)flash_sim_xfer(src[i]);
+}
+
+void hal_flash_read(uint8_t *dst, size_t len) {
+    for (size_t i = 0; i < len; i++) dst[i] = flash_sim_xfer(0x00);
+}
+
+void hal_flash_transfer(const uint8_t *tx, uint8_t *rx, size_t len) {
+    for (size_t i = 0; i < len; i++) rx[i] = flash_sim_xfer(tx[i]);
+}
+
+// ---------------- time ----------------
+
+// The simulator's clock is the simulated part of time: SPI bytes,
+// READ latency and sleeps. Erase/program busy time passes through it.
+void host_time_advance_us(uint64_t us) {
+    flash_sim_advance_ns(us * 1000u);
+}
+
+uint64_t host_time_virtual_us(void) {
+    return flash_sim_now_ns() / 1000u;
+}
+
+uint64_t hal_time_us(void) {
+    return (mono_ns() - t0_ns) / 1000u + host_time_virtual_us();
+}
+
+uint32_t hal_time_ms(void) {
+    return (uint32_t)(hal_time_us() / 1000u);
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    host_time_advance_us((uint64_t)ms * 1000u);
+}
+
+void hal_idle(void) {
+    struct timespec ts = { 0, 200000 };   // 0.2 ms, don't spin a host core
+    nanosleep(&ts, NULL);
+}
+
+// ---------------- console ----------------
+
+int hal_getchar(void) {
+    unsigned char c;
+    ssize_t n = read(STDIN_FILENO, &c, 1);
+    if (n == 1) return c;
+    if (n == 0) return HAL_CONSOLE_CLOSED;
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return HAL_NO_CHAR;
+    return HAL_CONSOLE_CLOSED;
+}
+
+// same FILE as printf, so text and frames stay in order
+void hal_console_write(const uint8_t *src, size_t len) {
+    fwrite(src, 1, len, stdout);
+    fflush(stdout);
+}
+
+// ---------------- SD card ----------------
+
+bool hal_sd_mount(void) {
+    static FATFS fs;
+    FRESULT fr = f_mount(&fs, "0:", 1);
+    if (fr != FR_OK) {
+        printf("f_mount failed: %d (%s)\n", fr, ff_host_root());
+        return false;
+    }
+    return true;
+}
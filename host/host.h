@@ -0,0 +1,10 @@
+// host.h - Extras of the host HAL that only host-side code uses
+#pragma once
+
+#include <stdint.h>
+
+// Simulated time: hal_time_us() = real elapsed time + the flash simulator's
+// clock (SPI bus time, device latencies). hal_sleep_ms() advances it instead
+// of sleeping, so host runs are fast but firmware timing still sees time pass.
+void     host_time_advance_us(uint64_t us);
+uint64_t host_time_virtual_us(void);
@@ -0,0 +1,317 @@
+// fimg.cpp - libfimg reader (mmap) and writer
+
+#include "fimg.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fimg {
+
+static const char MAGIC[] = "FIMGv1";
+static const char SMAP_MAGIC[4] = { 'S', 'M', 'A', 'P' };
+static const size_t VERIFY_BLOCK = 4u << 20;   // bytes per CRC call / progress report
+
+static bool fail(std::string *err, const std::string &msg) {
+    if (err) *err = msg;
+    return false;
+}
+
+static std::string sys_error(const std::string &what, const std::string &path) {
+    return what + " " + path + ": " + strerror(errno);
+}
+
+Bytes Bytes::sub(size_t off, size_t len) const {
+    if (off > size_) off = size_;
+    if (len > size_ - off) len = size_ - off;
+    return Bytes(data_ + off, len);
+}
+
+// ---------- Image ----------
+
+Image::~Image() {
+    close();
+}
+
+Image::Image(Image &&o) noexcept {
+    *this = std::move(o);
+}
+
+Image &Image::operator=(Image &&o) noexcept {
+    if (this != &o) {
+        close();
+        path_ = std::move(o.path_);
+        map_ = o.map_;
+        size_ = o.size_;
+        hdr_ = o.hdr_;
+        o.map_ = nullptr;
+        o.size_ = 0;
+    }
+    return *this;
+}
+
+bool Image::open(const std::string &path, std::string *err) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fail(err, sys_error("cannot open", path));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::string msg = sys_error("cannot stat", path);
+        ::close(fd);
+        return fail(err, msg);
+    }
+    if ((uint64_t)st.st_size < HEADER_SIZE) {
+        ::close(fd);
+        return fail(err, path + ": shorter than the header");
+    }
+
+    void *m = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    std::string msg = (m == MAP_FAILED) ? sys_error("cannot map", path) : "";
+    ::close(fd);                    // the mapping keeps the file
+    if (m == MAP_FAILED) return fail(err, msg);
+
+    memcpy(&hdr_, m, HEADER_SIZE);
+    if (memcmp(hdr_.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        munmap(m, (size_t)st.st_size);
+        return fail(err, path + ": not a FIMGv1 image");
+    }
+    madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+    map_ = (const uint8_t *)m;
+    size_ = (uint64_t)st.st_size;
+    path_ = path;
+    return true;
+}
+
+void Image::close() {
+    if (map_) munmap((void *)map_, (size_t)size_);
+    map_ = nullptr;
+    size_ = 0;
+    path_.clear();
+}
+
+std::string Image::jedec_hex() const {
+    char s[7];
+    snprintf(s, sizeof(s), "%02X%02X%02X", hdr_.jedec[0], hdr_.jedec[1], hdr_.jedec[2]);
+    return s;
+}
+
+static uint64_t map_sectors(const Header &h) {
+    return ((uint64_t)h.image_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+static uint64_t expected_size(const Header &h) {
+    uint64_t n = HEADER_SIZE + (uint64_t)h.image_size + TRAILER_SIZE;
+    if (h.flags & FLAG_SECTOR_MAP) n += sizeof(SectorMapHeader) + (map_sectors(h) + 1) / 2;
+    return n;
+}
+
+bool Image::complete() const {
+    return is_open() && size_ == expected_size(hdr_);
+}
+
+uint32_t Image::trailer() const {
+    if (!complete()) return 0;
+    uint32_t t;
+    memcpy(&t, map_ + HEADER_SIZE + hdr_.image_size, 4);
+    return t;
+}
+
+std::vector<SectorClass> Image::sector_map(std::string *err) const {
+    std::vector<SectorClass> out;
+    if (!has_sector_map()) {
+        fail(err, "no sector map");
+        return out;
+    }
+    if (!complete()) {
+        fail(err, "sector map cut off");
+        return out;
+    }
+    SectorMapHeader mh;
+    const uint8_t *p = map_ + HEADER_SIZE + hdr_.image_size + TRAILER_SIZE;
+    memcpy(&mh, p, sizeof(mh));
+    uint64_t sectors = map_sectors(hdr_);
+    const uint8_t *packed = p + sizeof(mh);
+    if (memcmp(mh.magic, SMAP_MAGIC, 4) != 0 || mh.sector_size != SECTOR_SIZE || mh.bits != 4 ||
+        mh.sectors != sectors) {
+        fail(err, "bad sector map header");
+        return out;
+    }
+    if (crc32(0, packed, (size_t)(sectors + 1) / 2) != mh.crc) {
+        fail(err, "sector map CRC mismatch");
+        return out;
+    }
+    out.resize((size_t)sectors);
+    for (size_t s = 0; s < out.size(); s++)
+        out[s] = (SectorClass)((packed[s >> 1] >> ((s & 1) * 4)) & 0x0F);
+    return out;
+}
+
+Bytes Image::data() const {
+    if (!is_open()) return Bytes();
+    uint64_t avail = size_ - HEADER_SIZE;
+    return Bytes(map_ + HEADER_SIZE, (size_t)std::min<uint64_t>(avail, hdr_.image_size));
+}
+
+uint32_t Image::chunk_size() const {
+    return hdr_.chunk_size ? hdr_.chunk_size : CHUNK_SIZE;
+}
+
+Check Image::verify(const Progress &progress) const {
+    Check c;
+    if (!is_open()) {
+        c.error = "not open";
+        return c;
+    }
+    Bytes d = data();
+    uint32_t crc = 0;
+    for (size_t off = 0; off < d.size(); off += VERIFY_BLOCK) {
+        size_t n = std::min(VERIFY_BLOCK, d.size() - off);
+        crc = crc32(crc, d.data() + off, n);
+        if (progress && !progress(off + n, d.size())) {
+            c.data_crc = crc;
+            c.error = "cancelled";
+            return c;
+        }
+    }
+    return check(crc);
+}
+
+Check Image::check(uint32_t data_crc) const {
+    Check c;
+    c.data_crc = data_crc;
+    if (!is_open()) {
+        c.error = "not open";
+        return c;
+    }
+    c.size_ok = complete();
+    c.header_crc_ok = c.size_ok && c.data_crc == hdr_.crc32_all;
+    c.trailer_ok = c.size_ok && c.data_crc == trailer();
+    std::string map_error;
+    c.map_ok = c.size_ok && (!has_sector_map() || !sector_map(&map_error).empty());
+
+    char msg[160];
+    if (!c.size_ok) {
+        snprintf(msg, sizeof(msg), "size %llu != %llu (header + %u + trailer%s)",
+                 (unsigned long long)size_, (unsigned long long)expected_size(hdr_),
+                 hdr_.image_size, has_sector_map() ? " + sector map" : "");
+        c.error = msg;
+    } else if (!c.header_crc_ok || !c.trailer_ok) {
+        snprintf(msg, sizeof(msg), "CRC data %08x, header %08x, trailer %08x",
+                 c.data_crc, hdr_.crc32_all, trailer());
+        c.error = msg;
+    } else if (!c.map_ok) {
+        c.error = map_error;
+    }
+    c.valid = c.error.empty();
+    return c;
+}
+
+// ---------- Writer ----------
+
+Writer::~Writer() {
+    abandon();
+}
+
+void Writer::abandon() {
+    if (!fp_) return;
+    fclose(fp_);
+    fp_ = nullptr;
+    remove(part_.c_str());
+}
+
+bool Writer::open(const std::string &path, const uint8_t jedec[3], uint32_t image_size,
+                  std::string *err, uint32_t flash_size, uint32_t chunk_size) {
+    abandon();
+    path_ = path;
+    part_ = path + ".part";
+    fp_ = fopen(part_.c_str(), "wb");
+    if (!fp_) return fail(err, sys_error("cannot create", part_));
+
+    memset(&hdr_, 0, sizeof(hdr_));
+    memcpy(hdr_.magic, MAGIC, sizeof(MAGIC));
+    memcpy(hdr_.jedec, jedec, 3);
+    hdr_.flash_size = flash_size ? flash_size : image_size;
+    hdr_.chunk_size = chunk_size;
+    hdr_.image_size = image_size;
+    written_ = 0;
+    crc_ = 0;
+    classes_ = SectorClassifier();
+
+    // crc32_all = 0 until finish(), as on the device
+    if (fwrite(&hdr_, HEADER_SIZE, 1, fp_) != 1) {
+        std::string msg = sys_error("cannot write", part_);
+        abandon();
+        return fail(err, msg);
+    }
+    return true;
+}
+
+bool Writer::write(const void *data, size_t len, std::string *err) {
+    if (!fp_) return fail(err, "writer not open");
+    if (written_ + len > hdr_.image_size)
+        return fail(err, part_ + ": more than image_size bytes");
+    if (len && fwrite(data, 1, len, fp_) != len) return fail(err, sys_error("cannot write", part_));
+    crc_ = crc32(crc_, data, len);
+    classes_.feed(data, len);
+    written_ += len;
+    return true;
+}
+
+bool Writer::finish(std::string *err) {
+    if (!fp_) return fail(err, "writer not open");
+    if (written_ != hdr_.image_size) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), ": %llu of %u bytes written",
+                 (unsigned long long)written_, hdr_.image_size);
+        return fail(err, part_ + msg);
+    }
+    classes_.finish();
+    std::vector<uint8_t> packed = classes_.packed();
+    SectorMapHeader mh;
+    memcpy(mh.magic, SMAP_MAGIC, 4);
+    mh.sector_size = SECTOR_SIZE;
+    mh.bits = 4;
+    mh.reserved = 0;
+    mh.sectors = (uint32_t)classes_.classes().size();
+    mh.crc = crc32(0, packed.data(), packed.size());
+
+    hdr_.crc32_all = crc_;
+    hdr_.flags |= FLAG_SECTOR_MAP;
+    bool ok = fwrite(&crc_, 4, 1, fp_) == 1 &&
+              fwrite(&mh, sizeof(mh), 1, fp_) == 1 &&
+              (packed.empty() || fwrite(packed.data(), packed.size(), 1, fp_) == 1) &&
+              fseek(fp_, 0, SEEK_SET) == 0 &&
+              fwrite(&hdr_, HEADER_SIZE, 1, fp_) == 1 &&
+              fflush(fp_) == 0 && fsync(fileno(fp_)) == 0;
+    std::string msg = ok ? "" : sys_error("cannot write", part_);
+    if (fclose(fp_) != 0 && ok) {
+        ok = false;
+        msg = sys_error("cannot close", part_);
+    }
+    fp_ = nullptr;
+    if (ok && rename(part_.c_str(), path_.c_str()) != 0) {
+        ok = false;
+        msg = sys_error("cannot rename to", path_);
+    }
+    if (!ok) {
+        remove(part_.c_str());
+        return fail(err, msg);
+    }
+    return true;
+}
+
+bool write_image(const std::string &path, const uint8_t jedec[3], Bytes data, std::string *err) {
+    if (data.size() > UINT32_MAX) return fail(err, path + ": image larger than 4 GiB");
+    Writer w;
+    return w.open(path, jedec, (uint32_t)data.size(), err) &&
+           w.write(data.data(), data.size(), err) &&
+           w.finish(err);
+}
+
+}  // namespace fimg
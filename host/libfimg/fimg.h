@@ -0,0 +1,294 @@
+// fimg.h - libfimg: .fimg flash images on the host (C++17)
+//
+// The format written by the firmware's backup (menu 2, "FIMG BACKUP /
+// RESTORE" in main.c) and by menu 'f' uploads:
+//
+//     flashimg_hdr_t (28 bytes, packed, little-endian)
+//     image_size bytes of flash contents, address 0 first
+//     u32 CRC-32 of the image bytes (trailer, same value as crc32_all)
+//     flags & FLAG_SECTOR_MAP: SectorMapHeader (16 bytes) and one
+//       SectorClass per 4 KiB sector, two per byte, even sector in the
+//       low nibble
+//
+// Image maps a file read-only and hands out views into the mapping
+// (Bytes): the whole image, one chunk / sector / page, or any address
+// range, without copying. Blocks is a random-access range over fixed-size
+// pieces (for (Bytes page : img.pages()), std::for_each with a pool, or
+// blocks[i]). verify() streams the image once through the CRC and checks
+// header, trailer, size and the sector map. Writer creates new images the
+// way the device does: <path>.part first, renamed once the trailer, sector
+// map and header CRC are in.
+//
+// Errors are reported as a false return plus a message in *err (may be
+// null); nothing throws.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace fimg {
+
+// flashimg_hdr_t in main.c
+struct Header {
+    char     magic[8];      // "FIMGv1\0"
+    uint8_t  jedec[3];      // manuf, type, capacity_id
+    uint8_t  flags;         // FLAG_* (0 in older images)
+    uint32_t flash_size;    // bytes
+    uint32_t chunk_size;    // 4096 from the firmware
+    uint32_t image_size;    // bytes of image data
+    uint32_t crc32_all;     // CRC-32 of the image data
+} __attribute__((packed));
+
+static_assert(sizeof(Header) == 28, "Header must match flashimg_hdr_t");
+
+constexpr uint8_t FLAG_SECTOR_MAP = 0x01;   // FIMG_F_SECTOR_MAP
+
+// fimg_smap_t in main.c, after the trailer when FLAG_SECTOR_MAP is set
+struct SectorMapHeader {
+    char     magic[4];      // "SMAP"
+    uint16_t sector_size;   // SECTOR_SIZE
+    uint8_t  bits;          // 4 per sector
+    uint8_t  reserved;
+    uint32_t sectors;       // ceil(image_size / sector_size)
+    uint32_t crc;           // CRC-32 of the packed classes
+} __attribute__((packed));
+
+static_assert(sizeof(SectorMapHeader) == 16, "SectorMapHeader must match fimg_smap_t");
+
+constexpr size_t   HEADER_SIZE  = sizeof(Header);
+constexpr size_t   TRAILER_SIZE = 4;
+constexpr uint32_t CHUNK_SIZE   = 4096;     // CHUNK_BYTES
+constexpr uint32_t SECTOR_SIZE  = 4096;     // FLASH_SECTOR_SIZE, one 4K erase
+constexpr uint32_t PAGE_SIZE    = 256;      // FLASH_PAGE_SIZE, one page program
+
+// ---------- CRC-32 (fimg_crc.cpp) ----------
+
+// Same convention as crc32_update() in main.c: start with 0, chain calls.
+// Slicing-by-16, several GB/s per core.
+uint32_t crc32(uint32_t crc, const void *data, size_t len);
+
+// CRC of A followed by B, from crc(A), crc(B) and len(B): lets threads CRC
+// slices of one image independently.
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+
+// ---------- Sector classes (fimg_sector.cpp) ----------
+
+// sector_class_t in main.c
+enum class SectorClass : uint8_t {
+    None = 0,       // not classified
+    Blank,          // all 0xFF: erased
+    Zero,           // all 0x00
+    Uniform,        // one other byte value throughout
+    Low,            // code, text, tables, sparse data
+    High,           // >= 7.5 bits/byte: compressed or encrypted
+};
+constexpr size_t SECTOR_CLASSES = 6;
+
+const char *sector_class_name(SectorClass c);   // "blank", "high-entropy", ...
+
+// Byte-histogram entropy in integer arithmetic, bit for bit what the
+// firmware's backup puts in the map (sector_classify() in main.c)
+SectorClass classify_sector(const uint8_t *data, size_t len);
+
+// Streaming classifier: feed the image in address order, any slice sizes
+class SectorClassifier {
+public:
+    void feed(const void *data, size_t len);
+    void finish();                          // classify a short last sector
+    const std::vector<SectorClass> &classes() const { return classes_; }
+    std::vector<uint8_t> packed() const;    // map block payload
+
+private:
+    uint32_t hist_[256] = {};
+    uint32_t fill_ = 0;
+    std::vector<SectorClass> classes_;
+};
+
+// ---------- Views ----------
+
+// Non-owning view of bytes inside a mapping (std::span before C++20)
+class Bytes {
+public:
+    Bytes() = default;
+    Bytes(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const uint8_t *begin() const { return data_; }
+    const uint8_t *end() const { return data_ + size_; }
+    uint8_t operator[](size_t i) const { return data_[i]; }
+
+    // [off, off + len) clamped to the view
+    Bytes sub(size_t off, size_t len = SIZE_MAX) const;
+
+private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Random-access range of block_size pieces of a view; the last one may be short
+class Blocks {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = Bytes;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Bytes;
+
+        iterator() = default;
+        iterator(const Blocks *b, size_t i) : b_(b), i_(i) {}
+
+        Bytes operator*() const { return (*b_)[i_]; }
+        Bytes operator[](difference_type n) const { return (*b_)[i_ + n]; }
+        size_t index() const { return i_; }
+
+        iterator &operator++() { ++i_; return *this; }
+        iterator operator++(int) { iterator t = *this; ++i_; return t; }
+        iterator &operator--() { --i_; return *this; }
+        iterator operator--(int) { iterator t = *this; --i_; return t; }
+        iterator &operator+=(difference_type n) { i_ += n; return *this; }
+        iterator &operator-=(difference_type n) { i_ -= n; return *this; }
+        iterator operator+(difference_type n) const { return iterator(b_, i_ + n); }
+        iterator operator-(difference_type n) const { return iterator(b_, i_ - n); }
+        difference_type operator-(const iterator &o) const {
+            return (difference_type)i_ - (difference_type)o.i_;
+        }
+        bool operator==(const iterator &o) const { return i_ == o.i_; }
+        bool operator!=(const iterator &o) const { return i_ != o.i_; }
+        bool operator<(const iterator &o) const { return i_ < o.i_; }
+        bool operator>(const iterator &o) const { return i_ > o.i_; }
+        bool operator<=(const iterator &o) const { return i_ <= o.i_; }
+        bool operator>=(const iterator &o) const { return i_ >= o.i_; }
+
+    private:
+        const Blocks *b_ = nullptr;
+        size_t i_ = 0;
+    };
+
+    Blocks(Bytes all, size_t block_size) : all_(all), block_(block_size ? block_size : 1) {}
+
+    size_t size() const { return (all_.size() + block_ - 1) / block_; }
+    size_t block_size() const { return block_; }
+    Bytes operator[](size_t i) const { return all_.sub(i * block_, block_); }
+    uint64_t address(size_t i) const { return (uint64_t)i * block_; }
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, size()); }
+
+private:
+    Bytes all_;
+    size_t block_;
+};
+
+// ---------- Reader ----------
+
+struct Check {
+    bool        valid = false;      // magic, size, header CRC and trailer all agree
+    uint32_t    data_crc = 0;       // recomputed over the image bytes present
+    bool        size_ok = false;    // file = header + image_size + trailer [+ map]
+    bool        header_crc_ok = false;
+    bool        trailer_ok = false;
+    bool        map_ok = false;     // no sector map, or one that checks out
+    std::string error;              // first problem found, empty when valid
+};
+
+// Called while verify() runs; return false to stop (the check then fails)
+using Progress = std::function<bool(uint64_t done, uint64_t total)>;
+
+class Image {
+public:
+    Image() = default;
+    ~Image();
+    Image(Image &&o) noexcept;
+    Image &operator=(Image &&o) noexcept;
+    Image(const Image &) = delete;
+    Image &operator=(const Image &) = delete;
+
+    // Map a file and read its header. Fails when the file cannot be mapped
+    // or is not FIMGv1 at all; a truncated or corrupt image still opens
+    // (complete() / verify() tell).
+    bool open(const std::string &path, std::string *err = nullptr);
+    void close();
+
+    bool is_open() const { return map_ != nullptr; }
+    const std::string &path() const { return path_; }
+    const Header &header() const { return hdr_; }
+    std::string jedec_hex() const;          // "EF4018"
+    uint64_t file_size() const { return size_; }
+
+    // file size is exactly header + image_size + trailer (+ sector map)
+    bool complete() const;
+    uint32_t trailer() const;               // 0 unless complete()
+
+    bool has_sector_map() const { return hdr_.flags & FLAG_SECTOR_MAP; }
+    // class of every sector from the stored map; empty with *err set when
+    // there is none or it does not check out
+    std::vector<SectorClass> sector_map(std::string *err = nullptr) const;
+
+    // image bytes present in the file (shorter than image_size if truncated)
+    Bytes data() const;
+    // [addr, addr + len) of the flash contents, clamped
+    Bytes range(uint64_t addr, size_t len) const { return data().sub(addr, len); }
+    // header chunk_size, CHUNK_SIZE when the header has none
+    uint32_t chunk_size() const;
+
+    Blocks chunks() const { return Blocks(data(), chunk_size()); }
+    Blocks sectors() const { return Blocks(data(), SECTOR_SIZE); }
+    Blocks pages() const { return Blocks(data(), PAGE_SIZE); }
+
+    // One sequential pass over the image: data CRC vs header and trailer, size
+    Check verify(const Progress &progress = nullptr) const;
+    // The same verdict for a data CRC computed elsewhere (slices combined
+    // with crc32_combine, say)
+    Check check(uint32_t data_crc) const;
+
+private:
+    std::string path_;
+    const uint8_t *map_ = nullptr;
+    uint64_t size_ = 0;
+    Header hdr_{};
+};
+
+// ---------- Writer ----------
+
+class Writer {
+public:
+    Writer() = default;
+    ~Writer();                              // unfinished: the .part is removed
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    // Start <path>.part for image_size bytes; flash_size 0 = image_size
+    bool open(const std::string &path, const uint8_t jedec[3], uint32_t image_size,
+              std::string *err = nullptr, uint32_t flash_size = 0,
+              uint32_t chunk_size = CHUNK_SIZE);
+    // Append image bytes, in address order
+    bool write(const void *data, size_t len, std::string *err = nullptr);
+    // All image_size bytes written: trailer, sector map, header CRC, rename to <path>
+    bool finish(std::string *err = nullptr);
+    void abandon();
+
+    uint64_t written() const { return written_; }
+    uint32_t crc() const { return crc_; }
+
+private:
+    std::string path_, part_;
+    FILE *fp_ = nullptr;
+    Header hdr_{};
+    uint64_t written_ = 0;
+    uint32_t crc_ = 0;
+    SectorClassifier classes_;
+};
+
+// Whole image in one call
+bool write_image(const std::string &path, const uint8_t jedec[3], Bytes data,
+                 std::string *err = nullptr);
+
+}  // namespace fimg
@@ -0,0 +1,85 @@
+// fimg_sector.cpp - Sector classes of the .fimg sector map for libfimg
+//
+// A port of the classifier in main.c's backup ("sector map" subsection):
+// the byte histogram of each 4 KiB sector, Shannon entropy in 1/256 bit
+// with a table-based log2, no floating point. It has to stay integer so a
+// map computed here equals the one the device stored.
+
+#include "fimg.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace fimg {
+
+static const uint32_t HIGH_Q8 = 1920;       // 7.5 bits/byte, SC_HIGH_Q8
+
+// log2(1 + i/32) in 1/256 bit, log2_frac_q8 in main.c
+static const uint8_t LOG2_FRAC_Q8[32] = {
+      0,  11,  22,  33,  44,  54,  63,  73,  82,  92, 100, 109, 118, 126, 134, 142,
+    150, 157, 165, 172, 179, 186, 193, 200, 207, 213, 220, 226, 232, 238, 244, 250,
+};
+
+static uint32_t log2_q8(uint32_t c) {
+    uint32_t e = 31u - (uint32_t)__builtin_clz(c);
+    uint32_t i = (e >= 5) ? (c >> (e - 5)) & 31u : (c << (5 - e)) & 31u;
+    return (e << 8) + LOG2_FRAC_Q8[i];
+}
+
+static SectorClass classify(const uint32_t hist[256], uint32_t n) {
+    if (hist[0xFF] == n) return SectorClass::Blank;
+    if (hist[0x00] == n) return SectorClass::Zero;
+
+    uint32_t sum = 0;
+    for (int v = 0; v < 256; v++) {
+        uint32_t c = hist[v];
+        if (c == n) return SectorClass::Uniform;
+        if (c > 1) sum += c * log2_q8(c);
+    }
+    uint32_t total = n * log2_q8(n);
+    uint32_t h = (total > sum) ? (total - sum) / n : 0;
+    return (h >= HIGH_Q8) ? SectorClass::High : SectorClass::Low;
+}
+
+const char *sector_class_name(SectorClass c) {
+    static const char *const names[SECTOR_CLASSES] = {
+        "none", "blank", "zero", "uniform", "low-entropy", "high-entropy"
+    };
+    size_t i = (size_t)c;
+    return i < SECTOR_CLASSES ? names[i] : "?";
+}
+
+SectorClass classify_sector(const uint8_t *data, size_t len) {
+    if (len == 0 || len > SECTOR_SIZE) return SectorClass::None;
+    uint32_t hist[256] = {};
+    for (size_t i = 0; i < len; i++) hist[data[i]]++;
+    return classify(hist, (uint32_t)len);
+}
+
+void SectorClassifier::feed(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len) {
+        size_t k = std::min<size_t>(SECTOR_SIZE - fill_, len);
+        for (size_t i = 0; i < k; i++) hist_[p[i]]++;
+        fill_ += (uint32_t)k;
+        p += k;
+        len -= k;
+        if (fill_ == SECTOR_SIZE) finish();
+    }
+}
+
+void SectorClassifier::finish() {
+    if (!fill_) return;
+    classes_.push_back(classify(hist_, fill_));
+    fill_ = 0;
+    memset(hist_, 0, sizeof(hist_));
+}
+
+std::vector<uint8_t> SectorClassifier::packed() const {
+    std::vector<uint8_t> out((classes_.size() + 1) / 2, 0);
+    for (size_t s = 0; s < classes_.size(); s++)
+        out[s >> 1] |= (uint8_t)((uint8_t)classes_[s] << ((s & 1) * 4));
+    return out;
+}
+
+}  // namespace fimg
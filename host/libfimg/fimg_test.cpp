@@ -0,0 +1,273 @@
+// fimg_test.cpp - libfimg self-test (spi_flash_fimg_test, ctest: fimg_test)
+//
+// CRC-32 against known vectors and a bitwise reference, crc32_combine
+// against one-shot CRCs, Writer -> Image round trips, rejection of
+// truncated and bit-flipped images, the sector map and the classifier.
+// Images go to a scratch directory under /tmp that is removed at the end.
+//
+// Exit status: 0 all checks passed, 1 otherwise.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "fimg.h"
+
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t *p, size_t n) {
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static std::vector<uint8_t> pattern(size_t n, uint32_t seed) {
+    std::vector<uint8_t> v(n);
+    uint32_t x = seed;
+    for (size_t i = 0; i < n; i++) {
+        x = x * 1664525u + 1013904223u;
+        v[i] = (uint8_t)(x >> 24);
+    }
+    return v;
+}
+
+// A flash-like image: blank, zero, uniform, text, random sectors and a short tail
+static std::vector<uint8_t> flash_like() {
+    std::vector<uint8_t> d;
+    d.insert(d.end(), fimg::SECTOR_SIZE, 0xFF);
+    d.insert(d.end(), fimg::SECTOR_SIZE, 0x00);
+    d.insert(d.end(), fimg::SECTOR_SIZE, 0x5A);
+    const char *text = "U-Boot 2020.04 (Jan 01 2021) console=ttyS0,115200 root=/dev/mtdblock2 ";
+    for (size_t i = 0; i < fimg::SECTOR_SIZE; i++) d.push_back((uint8_t)text[i % strlen(text)]);
+    std::vector<uint8_t> rnd = pattern(3 * fimg::SECTOR_SIZE, 7);
+    d.insert(d.end(), rnd.begin(), rnd.end());
+    d.insert(d.end(), fimg::SECTOR_SIZE, 0xFF);
+    d.insert(d.end(), 100, 0xFF);                   // short last sector
+    return d;
+}
+
+static std::vector<uint8_t> read_file(const std::string &path) {
+    std::vector<uint8_t> v;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return v;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) v.insert(v.end(), buf, buf + n);
+    fclose(f);
+    return v;
+}
+
+static void write_file(const std::string &path, const std::vector<uint8_t> &v) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return;
+    fwrite(v.data(), 1, v.size(), f);
+    fclose(f);
+}
+
+static void test_crc32() {
+    struct { const char *s; uint32_t crc; } vec[] = {
+        { "", 0x00000000u },
+        { "a", 0xE8B7BE43u },
+        { "123456789", 0xCBF43926u },
+        { "The quick brown fox jumps over the lazy dog", 0x414FA339u },
+    };
+    for (const auto &v : vec) CHECK(fimg::crc32(0, v.s, strlen(v.s)) == v.crc);
+
+    // every length and alignment around the 16-byte steps, chained as the device does
+    std::vector<uint8_t> d = pattern(4099, 1);
+    for (size_t off = 0; off < 17; off++) {
+        for (size_t n = 0; off + n <= 200; n++)
+            CHECK(fimg::crc32(0, d.data() + off, n) == crc32_bitwise(0, d.data() + off, n));
+    }
+    uint32_t chained = 0;
+    for (size_t off = 0; off < d.size(); off += 333)
+        chained = fimg::crc32(chained, d.data() + off, std::min<size_t>(333, d.size() - off));
+    CHECK(chained == crc32_bitwise(0, d.data(), d.size()));
+}
+
+static void test_crc32_combine() {
+    std::vector<uint8_t> d = pattern(100000, 2);
+    uint32_t whole = fimg::crc32(0, d.data(), d.size());
+    const size_t splits[] = { 0, 1, 15, 16, 4096, 65537, 99999, 100000 };
+    for (size_t cut : splits) {
+        uint32_t a = fimg::crc32(0, d.data(), cut);
+        uint32_t b = fimg::crc32(0, d.data() + cut, d.size() - cut);
+        CHECK(fimg::crc32_combine(a, b, d.size() - cut) == whole);
+    }
+}
+
+static void test_round_trip(const std::string &dir) {
+    std::vector<uint8_t> d = flash_like();
+    const uint8_t jedec[3] = { 0xEF, 0x40, 0x18 };
+    std::string path = dir + "/rt.fimg", err;
+
+    fimg::Writer w;
+    CHECK(w.open(path, jedec, (uint32_t)d.size(), &err, 16u << 20));
+    for (size_t off = 0; off < d.size(); off += 1000)       // slices cut across sectors
+        CHECK(w.write(d.data() + off, std::min<size_t>(1000, d.size() - off), &err));
+    CHECK(!w.write(d.data(), 1, &err));                     // more than image_size
+    CHECK(w.finish(&err));
+    CHECK(!fs::exists(path + ".part"));
+
+    fimg::Image img;
+    CHECK(img.open(path, &err));
+    const fimg::Header &h = img.header();
+    CHECK(img.jedec_hex() == "EF4018");
+    CHECK(h.flash_size == (16u << 20));
+    CHECK(h.image_size == d.size());
+    CHECK(h.chunk_size == fimg::CHUNK_SIZE);
+    CHECK(h.crc32_all == fimg::crc32(0, d.data(), d.size()));
+    CHECK(img.has_sector_map());
+    CHECK(img.complete());
+    CHECK(img.trailer() == h.crc32_all);
+    CHECK(img.data().size() == d.size() && memcmp(img.data().data(), d.data(), d.size()) == 0);
+    CHECK(img.range(4096, 10).size() == 10 && img.range(4096, 10)[0] == 0x00);
+    CHECK(img.sectors().size() == 9);
+    CHECK(img.pages().size() == (d.size() + fimg::PAGE_SIZE - 1) / fimg::PAGE_SIZE);
+
+    fimg::Check c = img.verify();
+    CHECK(c.valid && c.size_ok && c.header_crc_ok && c.trailer_ok && c.map_ok);
+    CHECK(c.error.empty());
+
+    // write_image() produces the same file
+    CHECK(fimg::write_image(dir + "/rt2.fimg", jedec, fimg::Bytes(d.data(), d.size()), &err));
+    std::vector<uint8_t> a = read_file(path), b = read_file(dir + "/rt2.fimg");
+    for (size_t i = 12; i < 16; i++) a[i] = b[i] = 0;      // flash_size differs
+    CHECK(a == b);
+}
+
+static void test_rejects(const std::string &dir) {
+    std::vector<uint8_t> good = read_file(dir + "/rt.fimg");
+    CHECK(!good.empty());
+    const size_t data_end = fimg::HEADER_SIZE + flash_like().size();
+    std::string path = dir + "/bad.fimg", err;
+
+    struct Case { const char *what; size_t off; bool truncate; };
+    const Case cases[] = {
+        { "truncated by one byte", 0, true },
+        { "bit flip in the data", fimg::HEADER_SIZE + 5000, false },
+        { "bit flip in the header CRC", 24, false },
+        { "bit flip in the trailer", data_end, false },
+        { "bit flip in the sector map", good.size() - 1, false },
+        { "bit flip in the map header", data_end + fimg::TRAILER_SIZE + 4, false },
+    };
+    for (const Case &k : cases) {
+        std::vector<uint8_t> v = good;
+        if (k.truncate) v.pop_back();
+        else v[k.off] ^= 0x10;
+        write_file(path, v);
+
+        fimg::Image img;
+        CHECK(img.open(path, &err));
+        fimg::Check c = img.verify();
+        if (c.valid || c.error.empty()) fprintf(stderr, "  not rejected: %s\n", k.what);
+        CHECK(!c.valid);
+        CHECK(!c.error.empty());
+    }
+
+    // truncated: size check fails, the data still reads as far as it goes
+    std::vector<uint8_t> v(good.begin(), good.begin() + (long)(fimg::HEADER_SIZE + 5000));
+    write_file(path, v);
+    fimg::Image img;
+    CHECK(img.open(path, &err));
+    CHECK(!img.complete() && img.trailer() == 0 && img.data().size() == 5000);
+    CHECK(!img.verify().size_ok);
+    CHECK(img.sector_map(&err).empty() && !err.empty());
+
+    // not an image at all
+    write_file(path, std::vector<uint8_t>(64, 'x'));
+    CHECK(!img.open(path, &err));
+    write_file(path, std::vector<uint8_t>(10, 0));
+    CHECK(!img.open(path, &err));
+}
+
+static void test_sector_map(const std::string &dir) {
+    std::vector<uint8_t> d = flash_like();
+    fimg::Image img;
+    std::string err;
+    CHECK(img.open(dir + "/rt.fimg", &err));
+
+    using SC = fimg::SectorClass;
+    const SC expect[] = { SC::Blank, SC::Zero, SC::Uniform, SC::Low,
+                          SC::High, SC::High, SC::High, SC::Blank, SC::Blank };
+    std::vector<SC> map = img.sector_map(&err);
+    CHECK(map.size() == 9);
+    for (size_t s = 0; s < map.size() && s < 9; s++) {
+        CHECK(map[s] == expect[s]);
+        fimg::Bytes sec = img.sectors()[s];
+        CHECK(map[s] == fimg::classify_sector(sec.data(), sec.size()));
+    }
+    CHECK(!strcmp(fimg::sector_class_name(SC::High), "high-entropy"));
+    CHECK(!strcmp(fimg::sector_class_name(SC::Blank), "blank"));
+
+    // streaming classifier agrees with classify_sector for any slicing
+    const size_t slices[] = { 1, 7, 512, 4096, 5000, 1u << 20 };
+    for (size_t n : slices) {
+        fimg::SectorClassifier sc;
+        for (size_t off = 0; off < d.size(); off += n) sc.feed(d.data() + off, std::min(n, d.size() - off));
+        sc.finish();
+        CHECK(sc.classes() == map);
+        std::vector<uint8_t> packed = sc.packed();
+        CHECK(packed.size() == 5);
+        CHECK(packed[0] == (uint8_t)((uint8_t)SC::Blank | (uint8_t)SC::Zero << 4));
+    }
+    std::vector<uint8_t> rnd = pattern(fimg::SECTOR_SIZE, 9), one(fimg::SECTOR_SIZE, 0xFF);
+    one[100] = 0x00;
+    CHECK(fimg::classify_sector(rnd.data(), rnd.size()) == SC::High);
+    CHECK(fimg::classify_sector(one.data(), one.size()) == SC::Low);
+    CHECK(fimg::classify_sector(one.data(), 0) == SC::None);
+
+    // an image from before the map: flags 0, no map block, still valid
+    std::vector<uint8_t> old = read_file(dir + "/rt.fimg");
+    old.resize(fimg::HEADER_SIZE + d.size() + fimg::TRAILER_SIZE);
+    old[11] = 0;
+    write_file(dir + "/old.fimg", old);
+    fimg::Image o;
+    CHECK(o.open(dir + "/old.fimg", &err));
+    CHECK(!o.has_sector_map());
+    CHECK(o.sector_map(&err).empty() && err == "no sector map");
+    fimg::Check c = o.verify();
+    CHECK(c.valid && c.map_ok);
+}
+
+int main() {
+    char tmpl[] = "/tmp/fimg_test.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = tmpl;
+
+    test_crc32();
+    test_crc32_combine();
+    test_round_trip(dir);
+    test_rejects(dir);
+    test_sector_map(dir);
+
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("fimg_test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,262 @@
+// replay_buslog.c - Replay a BUSLOG/*.fbl SPI transaction log on the flash simulator
+//
+// The firmware's bus recorder (menu 'b') logs every DUT transaction with its
+// timing. This tool feeds the same transactions to flash_sim and reports,
+// per opcode class, how long they took on the device and on the simulated
+// chip. A slow field run can be compared against datasheet timing (-d/-c)
+// or against another chip without the hardware:
+//
+//   spi_flash_replay BUSLOG/t0000123456.fbl -d Embedded_datasheet.csv -c W25Q128JV
+//
+// Options:
+//   -d csv     datasheet CSV for the timing model     -c name   row in the CSV
+//   -j hex     JEDEC ID (default: from the log)       -s bytes  flash size
+//   -i file    initial flash contents; READ hashes are then checked against it
+//   -z hz      simulated SPI clock (default 1000000)  -v        per-opcode table
+//
+// Gaps between transactions (firmware, SD and console time) are replayed as
+// idle time so erase/program busy periods overlap the same way they did on
+// the device. Polling runs (RDSR repeated until WIP=0) are replayed until the
+// simulated chip is ready, however many polls that takes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash_sim.h"
+
+// must match buslog_hdr_t / buslog_rec_t in main.c
+typedef struct {
+    char     magic[8];
+    uint32_t rec_size;
+    uint32_t records;
+    uint32_t dropped;
+    uint8_t  jedec[3];
+    uint8_t  reserved;
+    uint32_t t0_us;
+} __attribute__((packed)) buslog_hdr_t;
+
+typedef struct {
+    uint32_t t_us;
+    uint32_t dur_us;
+    uint32_t hash;
+    uint16_t len;
+    uint16_t repeat;
+    uint8_t  op;
+    uint8_t  addr[3];
+} __attribute__((packed)) buslog_rec_t;
+
+enum { C_READ, C_PROGRAM, C_ERASE, C_STATUS, C_ID, C_CONTROL, C_OTHER, C_COUNT };
+static const char *const class_names[C_COUNT] = {
+    "read", "program", "erase", "status", "id/sfdp", "control", "other",
+};
+
+typedef struct {
+    uint64_t txns, polls, bytes;
+    uint64_t dev_us;        // as recorded on the device
+    uint64_t sim_ns;        // on the simulator
+} class_stats_t;
+
+static class_stats_t by_class[C_COUNT];
+static class_stats_t by_op[256];
+
+static int op_class(uint8_t op) {
+    switch (op) {
+    case 0x03:                         return C_READ;
+    case 0x02:                         return C_PROGRAM;
+    case 0x20: case 0xD8: case 0xC7:   return C_ERASE;
+    case 0x05: case 0x35: case 0x01:   return C_STATUS;
+    case 0x9F: case 0x5A:              return C_ID;
+    case 0x06: case 0x04: case 0x66:
+    case 0x99: case 0x98: case 0x7A:   return C_CONTROL;
+    default:                           return C_OTHER;
+    }
+}
+
+static bool op_has_addr(uint8_t op) {
+    return op == 0x03 || op == 0x02 || op == 0x20 || op == 0xD8 || op == 0x5A;
+}
+
+// One transaction on the simulator. Data bytes for writes are 0xFF (a no-op
+// for PP on NOR), reads are hashed like the firmware does.
+static uint32_t replay_txn(const buslog_rec_t *r, uint8_t *status) {
+    uint32_t hash = 2166136261u;
+    uint32_t hdr  = op_has_addr(r->op) ? 4 : 1;
+    bool     read = r->op == 0x03 || r->op == 0x05 || r->op == 0x35 ||
+                    r->op == 0x9F || r->op == 0x5A;
+
+    flash_sim_select(true);
+    for (uint32_t i = 0; i < r->len; i++) {
+        uint8_t mosi = (i == 0) ? r->op : (i < hdr) ? r->addr[i - 1] : read ? 0x00 : 0xFF;
+        uint8_t miso = flash_sim_xfer(mosi);
+        if (i >= hdr) {
+            hash = (hash ^ (read ? miso : mosi)) * 16777619u;
+            if (status) *status = miso;
+        }
+    }
+    flash_sim_select(false);
+    return hash;
+}
+
+static void add(class_stats_t *s, uint64_t polls, uint64_t bytes,
+                uint64_t dev_us, uint64_t sim_ns) {
+    s->txns++;
+    s->polls  += polls;
+    s->bytes  += bytes;
+    s->dev_us += dev_us;
+    s->sim_ns += sim_ns;
+}
+
+static void print_row(const char *name, const class_stats_t *s) {
+    printf("%-10s %8llu %8llu %10llu %12.3f %12.3f %+8.1f%%\n", name,
+           (unsigned long long)s->txns, (unsigned long long)s->polls,
+           (unsigned long long)s->bytes, s->dev_us / 1e3, s->sim_ns / 1e6,
+           s->dev_us ? (s->sim_ns / 1e3 - (double)s->dev_us) * 100.0 / (double)s->dev_us : 0.0);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s log.fbl [-d csv [-c chip]] [-j jedec] [-s bytes] "
+                    "[-i image] [-z hz] [-v]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *log_path = NULL, *db = NULL, *chip = NULL, *jedec = NULL;
+    flash_sim_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.spi_hz = 1000000;
+    cfg.seed   = 1;
+    cfg.timing.jitter = 0.1;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "-d") && i + 1 < argc) db             = argv[++i];
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc) chip           = argv[++i];
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) jedec          = argv[++i];
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) cfg.size_bytes = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc) cfg.image_path = argv[++i];
+        else if (!strcmp(argv[i], "-z") && i + 1 < argc) cfg.spi_hz     = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-v"))                 verbose        = true;
+        else if (argv[i][0] != '-' && !log_path)         log_path       = argv[i];
+        else usage(argv[0]);
+    }
+    if (!log_path) usage(argv[0]);
+
+    FILE *f = fopen(log_path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", log_path);
+        return 1;
+    }
+    buslog_hdr_t h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, "FBLv1\0", 6) != 0 ||
+        h.rec_size != sizeof(buslog_rec_t)) {
+        fprintf(stderr, "%s: not a bus log (FBLv1, %zu-byte records)\n",
+                log_path, sizeof(buslog_rec_t));
+        fclose(f);
+        return 1;
+    }
+
+    memcpy(cfg.jedec, h.jedec, 3);
+    if (jedec) {
+        unsigned long v = strtoul(jedec, NULL, 16);
+        cfg.jedec[0] = (uint8_t)(v >> 16);
+        cfg.jedec[1] = (uint8_t)(v >> 8);
+        cfg.jedec[2] = (uint8_t)v;
+    }
+    if (db) {
+        int row = flash_sim_load_timing_csv(db, chip, cfg.jedec, &cfg.timing);
+        if (!row) {
+            fprintf(stderr, "No row for %s in %s\n", chip ? chip : "the log's JEDEC ID", db);
+            return 1;
+        }
+        fprintf(stderr, "Timing from %s row %d\n", db, row);
+    }
+    if (!flash_sim_init(&cfg)) {
+        fprintf(stderr, "flash simulator init failed\n");
+        return 1;
+    }
+
+    printf("Log %s: JEDEC %02X %02X %02X, %u records (%u dropped on device)\n",
+           log_path, h.jedec[0], h.jedec[1], h.jedec[2], h.records, h.dropped);
+    printf("Replaying on JEDEC %02X %02X %02X @ %u Hz\n\n",
+           cfg.jedec[0], cfg.jedec[1], cfg.jedec[2], cfg.spi_hz);
+
+    buslog_rec_t r;
+    uint64_t n = 0, gap_us = 0, hash_bad = 0, hash_checked = 0;
+    uint32_t prev_end = h.t0_us;
+    uint64_t sim_start = flash_sim_now_ns();
+
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        // time the firmware spent off this bus before the transaction
+        uint32_t gap = r.t_us - prev_end;
+        if (gap < 0x80000000u) {
+            gap_us += gap;
+            flash_sim_advance_ns((uint64_t)gap * 1000u);
+        }
+        prev_end = r.t_us + r.dur_us;
+
+        bool     poll  = (r.op == 0x05 && r.repeat > 1);
+        uint64_t t0    = flash_sim_now_ns();
+        uint64_t polls = 1;
+        uint8_t  sr    = 0;
+        uint32_t hash  = replay_txn(&r, &sr);
+        if (poll) {
+            // the device polled until WIP cleared: do the same on this chip
+            while ((sr & 0x01) && flash_sim_now_ns() - t0 < 10ull * 1000000000ull) {
+                replay_txn(&r, &sr);
+                polls++;
+            }
+        } else {
+            for (uint32_t k = 1; k < r.repeat; k++) replay_txn(&r, NULL);
+            polls = r.repeat;
+        }
+        uint64_t sim_ns = flash_sim_now_ns() - t0;
+
+        if (cfg.image_path && r.op == 0x03) {
+            hash_checked++;
+            if (hash != r.hash) hash_bad++;
+        }
+
+        add(&by_class[op_class(r.op)], polls, (uint64_t)r.len * polls, r.dur_us, sim_ns);
+        add(&by_op[r.op],              polls, (uint64_t)r.len * polls, r.dur_us, sim_ns);
+        n++;
+    }
+    fclose(f);
+
+    if (n != h.records)
+        printf("note: header says %u records, file has %llu\n", h.records, (unsigned long long)n);
+
+    printf("%-10s %8s %8s %10s %12s %12s %9s\n",
+           "class", "records", "txns", "bytes", "device ms", "sim ms", "sim/dev");
+    class_stats_t total;
+    memset(&total, 0, sizeof(total));
+    for (int c = 0; c < C_COUNT; c++) {
+        class_stats_t *s = &by_class[c];
+        if (!s->txns) continue;
+        print_row(class_names[c], s);
+        total.txns += s->txns; total.polls += s->polls; total.bytes += s->bytes;
+        total.dev_us += s->dev_us; total.sim_ns += s->sim_ns;
+    }
+    print_row("bus total", &total);
+    printf("%-10s %48.3f ms  (firmware / SD / console between transactions)\n",
+           "gaps", gap_us / 1e3);
+    printf("%-10s %48.3f ms  on the simulator\n", "elapsed",
+           (flash_sim_now_ns() - sim_start) / 1e6);
+
+    if (verbose) {
+        printf("\n%-10s %8s %8s %10s %12s %12s %9s\n",
+               "opcode", "records", "txns", "bytes", "device ms", "sim ms", "sim/dev");
+        for (int op = 0; op < 256; op++) {
+            if (!by_op[op].txns) continue;
+            char name[16];
+            snprintf(name, sizeof(name), "0x%02X", op);
+            print_row(name, &by_op[op]);
+        }
+    }
+    if (hash_checked)
+        printf("\nREAD data vs %s: %llu of %llu transactions differ\n", cfg.image_path,
+               (unsigned long long)hash_bad, (unsigned long long)hash_checked);
+
+    flash_sim_free();
+    return 0;
+}
@@ -0,0 +1,552 @@
+// sigscan.cpp - Structure map of a flash dump: uImage, SquashFS, JFFS2, UBI,
+// gzip / LZMA / xz streams, PEM / X.509 certificates, ELF
+//
+//   spi_flash_sigscan FLASHIMG/t0000123456_ef4018.fimg       .fimg (flash addresses)
+//   spi_flash_sigscan dump.bin -o map.csv                     raw dump, map as CSV
+//   spi_flash_sigscan dump.bin -o map.json -t 8               ... or JSON
+//
+// Options:
+//   -o file    write the map; CSV like the device's <image>.sig.csv, JSON for *.json
+//   -r N       print at most N entries (default 50, 0 = all)
+//   -t N       threads (default: all cores)
+//
+// The magics, header checks and merging are those of the device's scanner
+// ("signature scan" in main.c, run over every backup), so for the same
+// image this prints the same map as the .sig.csv the backup left next to
+// it - without the device's 48-entry cap. The automaton is the same
+// Aho-Corasick over the same patterns, but as a full 256-column DFA whose
+// entries carry a "pattern ends here" bit, and with a SIMD prefilter: in
+// the root state, 16 or 32 positions at a time are compared against the
+// distinct first-two-byte pairs of the patterns, and the DFA only runs from
+// a position that could start one (rare outside real structures). The dump is
+// cut into 4 MiB blocks that threads take from a shared counter; a block
+// is entered (longest pattern - 1) bytes early so magics across the cut
+// are found once, by the block they start in.
+//
+// Exit status: 0 done (with or without hits), 2 error.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fimg.h"
+
+// ---------- signature table (sig_patterns / sig_need in main.c) ----------
+
+enum SigType {
+    SIG_UIMAGE, SIG_SQUASHFS, SIG_JFFS2_LE, SIG_JFFS2_BE, SIG_UBI,
+    SIG_GZIP, SIG_LZMA, SIG_XZ, SIG_PEM, SIG_X509, SIG_ELF, SIG_TYPES
+};
+
+static const char *const TYPE_NAMES[SIG_TYPES] = {
+    "uimage", "squashfs", "jffs2-le", "jffs2-be", "ubi",
+    "gzip", "lzma", "xz", "pem", "x509", "elf",
+};
+
+static const uint8_t NEED[SIG_TYPES] = { 64, 48, 12, 12, 64, 10, 13, 12, 64, 11, 20 };
+
+struct Pattern {
+    uint8_t type, len;
+    const char *magic;
+};
+
+static const Pattern PATTERNS[] = {
+    { SIG_UIMAGE,   4, "\x27\x05\x19\x56" },
+    { SIG_SQUASHFS, 4, "hsqs" },
+    { SIG_SQUASHFS, 4, "sqsh" },
+    { SIG_JFFS2_LE, 4, "\x85\x19\x01\xe0" },
+    { SIG_JFFS2_LE, 4, "\x85\x19\x02\xe0" },
+    { SIG_JFFS2_LE, 4, "\x85\x19\x03\x20" },
+    { SIG_JFFS2_LE, 4, "\x85\x19\x04\x20" },
+    { SIG_JFFS2_BE, 4, "\x19\x85\xe0\x01" },
+    { SIG_JFFS2_BE, 4, "\x19\x85\xe0\x02" },
+    { SIG_JFFS2_BE, 4, "\x19\x85\x20\x03" },
+    { SIG_JFFS2_BE, 4, "\x19\x85\x20\x04" },
+    { SIG_UBI,      4, "UBI#" },
+    { SIG_UBI,      4, "UBI!" },
+    { SIG_GZIP,     3, "\x1f\x8b\x08" },
+    { SIG_LZMA,     3, "\x5d\x00\x00" },
+    { SIG_XZ,       6, "\xfd" "7zXZ\x00" },
+    { SIG_PEM,     11, "-----BEGIN " },
+    { SIG_X509,     2, "\x30\x82" },
+    { SIG_ELF,      4, "\x7f" "ELF" },
+};
+static const size_t NPATTERNS = sizeof(PATTERNS) / sizeof(PATTERNS[0]);
+
+static const uint32_t RUN_GAP = 1u << 20;      // SIG_RUN_GAP
+static const size_t BLOCK = 4u << 20;
+
+struct Hit {
+    uint64_t offset = 0;
+    uint32_t size = 0;          // bytes the header declares, 0 = not known
+    uint64_t end = 0;           // offset + max(size, header)
+    uint32_t count = 1;
+    uint8_t type = 0;
+    char info[48] = "";         // sig_hit_t.info in main.c
+};
+
+static inline uint16_t le16(const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); }
+static inline uint16_t be16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static inline uint32_t le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static inline uint32_t be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void text(char *dst, size_t cap, const uint8_t *src, size_t n) {
+    size_t i = 0;
+    for (; i < n && i + 1 < cap && src[i]; i++) {
+        uint8_t c = src[i];
+        dst[i] = (c < 0x20 || c > 0x7E || c == ',' || c == '"') ? '.' : (char)c;
+    }
+    dst[i] = 0;
+}
+
+static const char *elf_machine(uint16_t m) {
+    switch (m) {
+    case 3:   return "x86";
+    case 8:   return "MIPS";
+    case 20:  return "PowerPC";
+    case 40:  return "ARM";
+    case 62:  return "x86-64";
+    case 94:  return "Xtensa";
+    case 183: return "AArch64";
+    case 243: return "RISC-V";
+    default:  return "machine";
+    }
+}
+
+// sig_check() in main.c; h has n bytes from the magic on
+static bool check(uint8_t type, const uint8_t *h, size_t n, Hit *hit) {
+    static const char *const sqfs_comp[] = { "?", "gzip", "lzma", "lzo", "xz", "lz4", "zstd" };
+
+    if (n < NEED[type]) return false;
+    hit->size = 0;
+    hit->info[0] = 0;
+
+    switch (type) {
+    case SIG_UIMAGE: {
+        uint8_t tmp[64];
+        memcpy(tmp, h, 64);
+        memset(tmp + 4, 0, 4);
+        if (fimg::crc32(0, tmp, 64) != be32(h + 4)) return false;
+        hit->size = 64 + be32(h + 12);
+        text(hit->info, sizeof(hit->info), h + 32, 32);
+        return true;
+    }
+    case SIG_SQUASHFS: {
+        bool le = h[0] == 'h';
+        uint16_t major = le ? le16(h + 28) : be16(h + 28);
+        if (major < 1 || major > 4) return false;
+        if (major < 4) {
+            snprintf(hit->info, sizeof(hit->info), "v%u %s", major, le ? "LE" : "BE");
+            return true;
+        }
+        uint32_t bs = le32(h + 12);
+        uint16_t comp = le16(h + 20);
+        if (!le || le16(h + 22) > 20 || bs != 1u << le16(h + 22) || bs < 4096 || le32(h + 44) != 0)
+            return false;
+        hit->size = le32(h + 40);
+        snprintf(hit->info, sizeof(hit->info), "v4.%u %s block %u", le16(h + 30),
+                 comp < 7 ? sqfs_comp[comp] : "?", bs);
+        return true;
+    }
+    case SIG_JFFS2_LE:
+    case SIG_JFFS2_BE: {
+        bool le = type == SIG_JFFS2_LE;
+        uint32_t totlen = le ? le32(h + 4) : be32(h + 4);
+        uint32_t crc = le ? le32(h + 8) : be32(h + 8);
+        if (totlen < 12 || ~fimg::crc32(0xFFFFFFFFu, h, 8) != crc) return false;
+        hit->size = (totlen + 3) & ~3u;
+        return true;
+    }
+    case SIG_UBI:
+        return h[4] == 1 && ~fimg::crc32(0, h, 60) == be32(h + 60);
+    case SIG_GZIP:
+        if ((h[3] & 0xE0) || (h[8] != 0 && h[8] != 2 && h[8] != 4) || (h[9] > 13 && h[9] != 255))
+            return false;
+        snprintf(hit->info, sizeof(hit->info), "%s", (h[3] & 0x08) ? "named" : "");
+        return true;
+    case SIG_LZMA: {
+        uint32_t dict = le32(h + 1);
+        uint32_t lo = le32(h + 5), hi = le32(h + 9);
+        if ((dict & (dict - 1)) || dict > (1u << 28)) return false;
+        if (lo == 0xFFFFFFFFu && hi == 0xFFFFFFFFu)
+            snprintf(hit->info, sizeof(hit->info), "dict %u KiB", dict >> 10);
+        else if (hi == 0 && lo != 0)
+            snprintf(hit->info, sizeof(hit->info), "dict %u KiB, %u bytes unpacked", dict >> 10, lo);
+        else
+            return false;
+        return true;
+    }
+    case SIG_XZ: {
+        if (h[6] != 0 || (h[7] & 0xF0) || fimg::crc32(0, h + 6, 2) != le32(h + 8)) return false;
+        const char *chk = h[7] == 0 ? "none" : h[7] == 1 ? "crc32" : h[7] == 4 ? "crc64"
+                        : h[7] == 10 ? "sha256" : "?";
+        snprintf(hit->info, sizeof(hit->info), "check %s", chk);
+        return true;
+    }
+    case SIG_PEM: {
+        size_t i = 11;
+        while (i < n && ((h[i] >= 'A' && h[i] <= 'Z') || h[i] == ' ')) i++;
+        if (i == 11 || i + 5 > n || memcmp(h + i, "-----", 5) != 0) return false;
+        text(hit->info, sizeof(hit->info), h + 11, i - 11);
+        return true;
+    }
+    case SIG_X509: {
+        uint16_t outer = be16(h + 2), inner = be16(h + 6);
+        if (outer < 256 || h[4] != 0x30 || h[5] != 0x82 || inner + 4u > outer ||
+            h[8] != 0xA0 || h[9] != 0x03 || h[10] != 0x02)
+            return false;
+        hit->size = 4u + outer;
+        return true;
+    }
+    case SIG_ELF: {
+        static const char *const etypes[] = { "", "rel", "exec", "dyn", "core" };
+        bool le = h[5] == 1;
+        uint16_t etype = le ? le16(h + 16) : be16(h + 16);
+        uint16_t mach = le ? le16(h + 18) : be16(h + 18);
+        if ((h[4] != 1 && h[4] != 2) || (h[5] != 1 && h[5] != 2) || h[6] != 1 || etype < 1 || etype > 4)
+            return false;
+        snprintf(hit->info, sizeof(hit->info), "%u-bit %s %s %s %u", h[4] == 1 ? 32 : 64,
+                 le ? "LE" : "BE", etypes[etype], elf_machine(mach), mach);
+        return true;
+    }
+    }
+    return false;
+}
+
+static bool run_type(uint8_t type) {
+    return type == SIG_JFFS2_LE || type == SIG_JFFS2_BE || type == SIG_UBI;
+}
+
+// ---------- automaton ----------
+
+// prefilter vector: AVX2 width when built for it (SPI_FLASH_SIGSCAN_NATIVE), else SSE2 / NEON
+#if defined(__AVX2__)
+typedef int8_t Lanes __attribute__((vector_size(32)));
+#else
+typedef int8_t Lanes __attribute__((vector_size(16)));
+#endif
+
+class Automaton {
+public:
+    static const uint16_t OUT = 0x8000;        // entry flag: a pattern ends in the target state
+
+    Automaton() {
+        std::vector<int32_t> go(256, -1);      // trie edges, state * 256 + byte
+        std::vector<int> out(1, 0);
+        for (size_t p = 0; p < NPATTERNS; p++) {
+            size_t s = 0;
+            for (int i = 0; i < PATTERNS[p].len; i++) {
+                uint8_t b = (uint8_t)PATTERNS[p].magic[i];
+                if (go[s * 256 + b] < 0) {
+                    go[s * 256 + b] = (int32_t)out.size();
+                    out.push_back(0);
+                    go.resize(out.size() * 256, -1);
+                }
+                s = (size_t)go[s * 256 + b];
+            }
+            out[s] = (int)p + 1;
+            max_len_ = std::max<size_t>(max_len_, PATTERNS[p].len);
+        }
+
+        size_t n = out.size();
+        std::vector<size_t> fail(n, 0), queue;
+        out_.assign(n, 0);
+        link_.assign(n, 0);
+        delta_.assign(n * 256, 0);
+        for (int b = 0; b < 256; b++) {
+            int32_t t = go[b];
+            if (t > 0) queue.push_back((size_t)t);
+            delta_[b] = (uint16_t)(t > 0 ? t : 0);
+        }
+        for (size_t qi = 0; qi < queue.size(); qi++) {
+            size_t s = queue[qi];
+            link_[s] = out[fail[s]] ? fail[s] : link_[fail[s]];
+            for (int b = 0; b < 256; b++) {
+                int32_t t = go[s * 256 + b];
+                uint16_t f = delta_[fail[s] * 256 + b] & ~OUT;
+                if (t < 0) {
+                    delta_[s * 256 + b] = f;
+                } else {
+                    fail[(size_t)t] = f;
+                    delta_[s * 256 + b] = (uint16_t)t;
+                    queue.push_back((size_t)t);
+                }
+            }
+        }
+        for (size_t s = 0; s < n; s++) out_[s] = (uint8_t)out[s];
+        for (uint16_t &e : delta_)
+            if (out_[e] || link_[e]) e |= OUT;
+        for (size_t p = 0; p < NPATTERNS; p++) {
+            const uint8_t *m = (const uint8_t *)PATTERNS[p].magic;
+            if (pair(m)) continue;
+            unsigned v = (unsigned)m[0] << 8 | m[1];
+            pairs_[v >> 6] |= 1ull << (v & 63);
+            for (size_t j = 0; j < sizeof(Lanes); j++) {
+                first_[npairs_][j] = (int8_t)m[0];
+                second_[npairs_][j] = (int8_t)m[1];
+            }
+            npairs_++;
+        }
+    }
+
+    size_t max_len() const { return max_len_; }
+
+    // Matches ending in [from, to), patterns starting before `first` not
+    // reported; f(pattern, start offset) for each
+    template <class F>
+    void scan(const uint8_t *d, size_t from, size_t to, size_t first, F f) const {
+        const uint16_t *delta = delta_.data();
+        size_t s = 0, i = from;
+        while (i < to) {
+            if (s == 0) {
+                i = skip(d, i, to);
+                if (i == to) break;
+            }
+            uint16_t e = delta[s * 256 + d[i]];
+            s = e & ~OUT;
+            if (e & OUT) {
+                for (size_t t = out_[s] ? s : link_[s]; t; t = link_[t]) {
+                    const Pattern &p = PATTERNS[out_[t] - 1];
+                    size_t start = i + 1 - p.len;
+                    if (start >= first) f(out_[t] - 1, start);
+                }
+            }
+            i++;
+        }
+    }
+
+private:
+    bool pair(const uint8_t *p) const {
+        unsigned v = (unsigned)p[0] << 8 | p[1];
+        return (pairs_[v >> 6] >> (v & 63)) & 1;
+    }
+
+    // Prefilter in the root state: next position whose two bytes begin some
+    // pattern (every pattern has two). Lanes compares a vector of positions
+    // against each distinct pair at once; the bitmap does the tail.
+    size_t skip(const uint8_t *d, size_t i, size_t to) const {
+        const size_t W = sizeof(Lanes);
+        while (i + W + 1 <= to) {
+            Lanes a, b, hit = {};
+            memcpy(&a, d + i, W);
+            memcpy(&b, d + i + 1, W);
+            for (size_t k = 0; k < npairs_; k++) hit |= (a == first_[k]) & (b == second_[k]);
+            uint64_t w[W / 8], any = 0;
+            memcpy(w, &hit, W);
+            for (size_t j = 0; j < W / 8; j++) any |= w[j];
+            if (any)
+                for (size_t j = 0; j < W; j++)
+                    if (hit[j]) return i + j;
+            i += W;
+        }
+        for (; i + 1 < to; i++)
+            if (pair(d + i)) return i;
+        return to;
+    }
+
+    std::vector<uint16_t> delta_;
+    std::vector<uint8_t> out_;
+    std::vector<size_t> link_;
+    uint64_t pairs_[65536 / 64] = {};
+    Lanes first_[NPATTERNS], second_[NPATTERNS];    // distinct first-two-byte pairs
+    size_t npairs_ = 0;
+    size_t max_len_ = 0;
+};
+
+// ---------- input ----------
+
+// A .fimg through libfimg (data = flash contents), anything else mapped raw
+struct Input {
+    fimg::Image img;
+    const uint8_t *raw = nullptr;
+    size_t raw_size = 0;
+
+    ~Input() {
+        if (raw) munmap((void *)raw, raw_size);
+    }
+
+    bool open(const char *path) {
+        std::string err;
+        if (img.open(path, &err)) return true;
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "Cannot open %s\n", path);
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        raw_size = (size_t)st.st_size;
+        if (raw_size) {
+            void *m = mmap(nullptr, raw_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) {
+                fprintf(stderr, "Cannot map %s\n", path);
+                ::close(fd);
+                return false;
+            }
+            madvise(m, raw_size, MADV_SEQUENTIAL);
+            raw = (const uint8_t *)m;
+        }
+        ::close(fd);
+        return true;
+    }
+
+    fimg::Bytes data() const {
+        return img.is_open() ? img.data() : fimg::Bytes(raw, raw_size);
+    }
+};
+
+// ---------- scan ----------
+
+struct Job {
+    const Automaton *ac;
+    fimg::Bytes data;
+    std::vector<std::vector<Hit>> *blocks;
+    std::atomic<size_t> next{0};
+};
+
+static void worker(Job *job) {
+    const uint8_t *d = job->data.data();
+    const size_t size = job->data.size();
+    const size_t lead = job->ac->max_len() - 1;
+    for (size_t bi; (bi = job->next.fetch_add(1)) < job->blocks->size();) {
+        std::vector<Hit> &out = (*job->blocks)[bi];
+        size_t first = bi * BLOCK;
+        size_t last = std::min(size, first + BLOCK + lead);   // magics starting in the block end by here
+        job->ac->scan(d, first > lead ? first - lead : 0, last, first, [&](int p, size_t start) {
+            if (start >= first + BLOCK) return;
+            uint8_t type = PATTERNS[p].type;
+            Hit hit;
+            if (!check(type, d + start, std::min<size_t>(NEED[type], size - start), &hit)) return;
+            hit.offset = start;
+            hit.type = type;
+            hit.end = start + std::max<uint64_t>(hit.size, NEED[type]);
+            if (run_type(type)) hit.size = (uint32_t)(hit.end - start);
+            out.push_back(hit);
+        });
+    }
+}
+
+// sig_add() in main.c, over hits in offset order
+static std::vector<Hit> merge(std::vector<Hit> hits) {
+    std::stable_sort(hits.begin(), hits.end(),
+                     [](const Hit &a, const Hit &b) { return a.offset < b.offset; });
+    std::vector<Hit> map;
+    for (const Hit &h : hits) {
+        if (!map.empty()) {
+            Hit &prev = map.back();
+            if (prev.type == h.type && run_type(h.type) && h.offset <= prev.end + RUN_GAP) {
+                prev.end = std::max(prev.end, h.end);
+                prev.size = (uint32_t)(prev.end - prev.offset);
+                prev.count++;
+                continue;
+            }
+        }
+        map.push_back(h);
+    }
+    return map;
+}
+
+static bool write_map(const char *path, const std::vector<Hit> &map) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    size_t len = strlen(path);
+    bool json = len >= 5 && !strcmp(path + len - 5, ".json");
+    if (json) fputc('[', f);
+    else fprintf(f, "offset,size,type,count,info\n");
+    for (size_t i = 0; i < map.size(); i++) {
+        const Hit &h = map[i];
+        if (json) {
+            // text() keeps quotes out of info; backslashes need escaping
+            fprintf(f, "%s{\"offset\":%llu,\"size\":%u,\"type\":\"%s\",\"count\":%u,\"info\":\"",
+                    i ? "," : "", (unsigned long long)h.offset, h.size, TYPE_NAMES[h.type], h.count);
+            for (const char *c = h.info; *c; c++) {
+                if (*c == '\\') fputc('\\', f);
+                fputc(*c, f);
+            }
+            fprintf(f, "\"}");
+        } else {
+            fprintf(f, "0x%08llx,%u,%s,%u,%s\n", (unsigned long long)h.offset, h.size,
+                    TYPE_NAMES[h.type], h.count, h.info);
+        }
+    }
+    if (json) fprintf(f, "]\n");
+    return fclose(f) == 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s image.fimg|dump.bin [-o map.csv|map.json] [-r max_entries] [-t threads]\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL, *out_path = NULL;
+    size_t max_rows = 50;
+    int threads = (int)std::thread::hardware_concurrency();
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "-o") && i + 1 < argc) out_path = argv[++i];
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) max_rows = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) threads  = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !path)             path     = argv[i];
+        else usage(argv[0]);
+    }
+    if (!path) usage(argv[0]);
+    if (threads < 1) threads = 1;
+
+    Input in;
+    if (!in.open(path)) return 2;
+    fimg::Bytes data = in.data();
+
+    auto t0 = std::chrono::steady_clock::now();
+    Automaton ac;
+    std::vector<std::vector<Hit>> blocks((data.size() + BLOCK - 1) / BLOCK);
+    Job job;
+    job.ac = &ac;
+    job.data = data;
+    job.blocks = &blocks;
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) pool.emplace_back(worker, &job);
+    for (auto &th : pool) th.join();
+
+    std::vector<Hit> hits;
+    for (auto &b : blocks) hits.insert(hits.end(), b.begin(), b.end());
+    std::vector<Hit> map = merge(std::move(hits));
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    printf("%s: %zu bytes%s\n", path, data.size(),
+           in.img.is_open() ? (", " + in.img.jedec_hex() + " image").c_str() : ", raw");
+    size_t shown = max_rows ? std::min(max_rows, map.size()) : map.size();
+    for (size_t i = 0; i < shown; i++) {
+        const Hit &h = map[i];
+        printf("  0x%08llx  %-9s", (unsigned long long)h.offset, TYPE_NAMES[h.type]);
+        if (h.count > 1) printf(" x%u", h.count);
+        if (h.size) printf(" %u bytes", h.size);
+        printf(" %s\n", h.info);
+    }
+    if (shown < map.size()) printf("  ... %zu more (-r 0 for all)\n", map.size() - shown);
+    printf("Structures: %zu; scanned %.1f MiB in %.1f ms (%.0f MiB/s, %d threads)\n", map.size(),
+           data.size() / 1048576.0, ms, ms > 0 ? data.size() / 1048576.0 / (ms / 1000.0) : 0.0,
+           threads);
+
+    if (out_path && !write_map(out_path, map)) {
+        fprintf(stderr, "Cannot write %s\n", out_path);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Convert a firmware trace dump (menu 't') to Chrome trace / Perfetto JSON.
+
+The dump is a block of lines in the serial / web log:
+
+    [TRACE] begin events=N dropped=D now_us=T
+    [TRACE] <start_us> <dur_us> <name> <arg>
+    ...
+    [TRACE] end
+
+Anything else in the log is ignored, so a raw capture works, e.g.
+
+    printf '6backup\\nt' | build-host/host/spi_flash_host > run.log
+    host/trace2chrome.py run.log -o backup.json
+
+Open the result in chrome://tracing or https://ui.perfetto.dev. Spans nest by
+time, so a job_step shows the spi_read / crc / sd_write calls it made.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+LINE_RE = re.compile(r"\[TRACE\] (\d+) (\d+) (\w+) (\d+)")
+
+# category (for colouring / filtering) and arg meaning per span name
+SPANS = {
+    "job_step": ("job",     "done"),
+    "spi_read": ("spi",     "bytes"),
+    "spi_prog": ("spi",     "bytes"),
+    "wip_wait": ("spi",     "polls"),
+    "erase":    ("spi",     "addr"),
+    "sd_read":  ("sd",      "bytes"),
+    "sd_write": ("sd",      "bytes"),
+    "crc":      ("crc",     "bytes"),
+    "printf":   ("console", "chars"),
+    "sleep":    ("spi",     "ms"),
+    "sigscan":  ("scan",    "bytes"),
+}
+
+
+def parse_dumps(lines):
+    """Yield one list of (start, dur, name, arg) per dump, start unwrapped."""
+    spans = None
+    for line in lines:
+        if "[TRACE] begin" in line:
+            spans = []
+        elif "[TRACE] end" in line:
+            if spans is not None:
+                yield unwrap(spans)
+            spans = None
+        elif spans is not None:
+            m = LINE_RE.search(line)
+            if m:
+                spans.append((int(m.group(1)), int(m.group(2)), m.group(3), int(m.group(4))))
+
+
+def unwrap(spans):
+    """start_us is a 32-bit counter (wraps every ~71 min): make it monotonic."""
+    out, base, prev = [], 0, None
+    for start, dur, name, arg in spans:
+        if prev is not None and start + base < prev - (1 << 31):
+            base += 1 << 32
+        prev = start + base
+        out.append((start + base, dur, name, arg))
+    return out
+
+
+def to_chrome(dumps):
+    events = [{"name": "process_name", "ph": "M", "pid": 1,
+               "args": {"name": "spi_flash firmware"}}]
+    for n, spans in enumerate(dumps, 1):
+        events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": n,
+                       "args": {"name": "dump %d" % n}})
+        # longer spans first at equal start so the viewer nests them correctly
+        for start, dur, name, arg in sorted(spans, key=lambda s: (s[0], -s[1])):
+            cat, arg_name = SPANS.get(name, ("other", "arg"))
+            events.append({"name": name, "cat": cat, "ph": "X", "pid": 1, "tid": n,
+                           "ts": start, "dur": dur,
+                           "args": {arg_name: hex(arg) if arg_name == "addr" else arg}})
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def summary(dumps, out):
+    total = {}
+    for spans in dumps:
+        for _, dur, name, _ in spans:
+            t = total.setdefault(name, [0, 0])
+            t[0] += 1
+            t[1] += dur
+    out.write("%-10s %8s %12s %10s\n" % ("span", "count", "total ms", "avg us"))
+    for name, (count, us) in sorted(total.items(), key=lambda kv: -kv[1][1]):
+        out.write("%-10s %8d %12.3f %10.1f\n" % (name, count, us / 1000.0, us / count))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("log", nargs="?", help="log file with [TRACE] lines (default stdin)")
+    ap.add_argument("-o", "--output", help="write JSON here (default stdout)")
+    ap.add_argument("-s", "--summary", action="store_true",
+                    help="also print time per span type to stderr")
+    args = ap.parse_args()
+
+    src = open(args.log, errors="ignore") if args.log else sys.stdin
+    with src:
+        dumps = list(parse_dumps(src))
+    if not dumps:
+        sys.exit("no complete [TRACE] dump found")
+
+    doc = to_chrome(dumps)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(doc, f)
+    else:
+        json.dump(doc, sys.stdout)
+    if args.summary:
+        summary(dumps, sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
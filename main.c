@@ -1,4 +1,5 @@
-// main.c - Single file: flash driver + FIMG backup/restore + CSV benchmark
+// main.c - Firmware core: flash driver + FIMG backup/restore + CSV benchmark
+//          (hardware access goes through hal.h, see hal_pico.c / host/)
 
 #include <stdio.h>
 #include <stdint.h>
@@ -7,64 +8,301 @@
 #include <math.h>
 #include <stdlib.h>
 
-#include "pico/stdlib.h"
-#include "hardware/spi.h"
-
 #include "ff.h"
-#include "diskio.h"
-#include "spi.h"
-#include "sd_card.h"
+#include "hal.h"      // SPI / GPIO / time / console / SD mount (Pico or host)
 
 // =====================================================
-// ===============  HARDWARE PIN CONFIG  ================
-//
-//  External SPI Flash on SPI0
-//      GP2  = SCK
-//      GP3  = MOSI
-//      GP4  = MISO
-//      GP5  = CS
-//
-//  SD Card on SPI1 (Maker Pi Pico)
-//      GP10 = SCK
-//      GP11 = MOSI
-//      GP12 = MISO
-//      GP13 = CS
+// ===============  TRACE RECORDER ======================
 // =====================================================
-
-// -------- SPI0: external flash --------
-#define FLASH_SPI_PORT   spi0
-#define FLASH_PIN_SCK    2
-#define FLASH_PIN_MOSI   3
-#define FLASH_PIN_MISO   4
-#define FLASH_PIN_CS     5
-
-#define FLASH_SPI_HZ     (1u * 1000u * 1000u) // 1 MHz (safe), 10 MHz (faster)
-
-// -------- SPI1: SD card (inlined hw_config.c) --------
-static spi_t sd_spi = {
-    .hw_inst            = spi1,
-    .miso_gpio          = 12,
-    .mosi_gpio          = 11,
-    .sck_gpio           = 10,
-    .baud_rate          = 10 * 1000 * 1000,   // can lower to 400k if needed
-    .set_drive_strength = false,
+// Timed spans around the driver, FatFs, CRC and console calls, kept in a RAM
+// ring (oldest overwritten). Menu 't' dumps it as "[TRACE] start dur name arg"
+// lines; host/trace2chrome.py turns a captured log into a Chrome/Perfetto trace.
+
+typedef enum {
+    TR_JOB_STEP,    // one scheduler step of the foreground job
+    TR_SPI_READ,    // READ command + data shifting (arg = bytes)
+    TR_SPI_PROG,    // WREN + PP command + data shifting (arg = bytes)
+    TR_WIP_WAIT,    // RDSR polling until WIP=0 (arg = polls)
+    TR_ERASE,       // 4K sector erase incl. unprotect + retry (arg = address)
+    TR_SD_READ,     // f_read (arg = bytes)
+    TR_SD_WRITE,    // f_write (arg = bytes)
+    TR_CRC,         // crc32_update (arg = bytes)
+    TR_PRINTF,      // console output from the scheduler (arg = chars)
+    TR_SLEEP,       // fixed delays in the flash driver (arg = ms)
+    TR_SIGSCAN,     // sig_feed over backup data (arg = bytes)
+    TR_COUNT
+} trace_id_t;
+
+static const char *const trace_names[TR_COUNT] = {
+    "job_step", "spi_read", "spi_prog", "wip_wait", "erase",
+    "sd_read", "sd_write", "crc", "printf", "sleep", "sigscan",
 };
 
-static sd_card_t sd = {
-    .pcName             = "0:",
-    .spi                = &sd_spi,
-    .ss_gpio            = 13,        // CS
-    .use_card_detect    = false,     // no CD switch on Maker Pi Pico
-    .card_detect_gpio   = 0,
-    .card_detected_true = 1,
-    .set_drive_strength = false,
-};
+#define TRACE_EVENTS  1024u          // power of two, 16 bytes each
+
+typedef struct {
+    uint32_t start_us;   // low 32 bits of hal_time_us()
+    uint32_t dur_us;
+    uint32_t arg;
+    uint32_t id;
+} trace_ev_t;
+
+static trace_ev_t trace_buf[TRACE_EVENTS];
+static uint32_t   trace_head = 0;    // spans recorded since the last dump
+
+static inline uint32_t trace_begin(void) {
+    return (uint32_t)hal_time_us();
+}
+
+// returns the span's duration in us
+static inline uint32_t trace_end(trace_id_t id, uint32_t t0, uint32_t arg) {
+    trace_ev_t *e = &trace_buf[trace_head++ & (TRACE_EVENTS - 1)];
+    e->start_us = t0;
+    e->dur_us   = (uint32_t)hal_time_us() - t0;
+    e->arg      = arg;
+    e->id       = id;
+    return e->dur_us;
+}
+
+// Print the ring oldest first, then clear it. Spans are stored when they end,
+// so an enclosing span follows the spans nested in it.
+static void trace_dump(void) {
+    uint32_t n     = trace_head < TRACE_EVENTS ? trace_head : TRACE_EVENTS;
+    uint32_t first = trace_head - n;
+    printf("[TRACE] begin events=%u dropped=%u now_us=%u\n",
+           n, trace_head - n, (uint32_t)hal_time_us());
+    for (uint32_t i = 0; i < n; i++) {
+        const trace_ev_t *e = &trace_buf[(first + i) & (TRACE_EVENTS - 1)];
+        printf("[TRACE] %u %u %s %u\n", e->start_us, e->dur_us, trace_names[e->id], e->arg);
+    }
+    printf("[TRACE] end\n");
+    trace_head = 0;
+}
+
+// =====================================================
+// ===============  PERF COUNTERS =======================
+// =====================================================
+// Always-on totals since boot, printed by menu 's'. The last line is
+// "[STATS] key=value ..." for the web server (GET /api/stats).
+
+static struct {
+    uint64_t spi_tx_bytes, spi_rx_bytes;   // DUT bus, command + data bytes
+    uint32_t spi_transactions;             // CS assertions
+    uint64_t wip_wait_us;                  // RDSR polling until WIP=0
+    uint32_t erase_timeouts;               // WIP timeouts in flash_dut_erase_4k
+    uint32_t erase_retries;                // erase re-issued after reset
+    uint32_t prog_timeouts;                // WIP timeouts after page program
+    uint64_t sd_rd_bytes, sd_wr_bytes;     // image data through sd_read / sd_write
+    uint64_t sd_rd_us, sd_wr_us;
+    uint64_t crc_bytes;
+} perf;
+
+// snapshot at the previous 's', for "since last" rates
+static struct {
+    uint64_t t_us, spi_rx_bytes, spi_tx_bytes, sd_rd_bytes, sd_wr_bytes;
+} perf_last;
+
+// bytes per microsecond → KiB/s
+static double perf_kib_s(uint64_t bytes, uint64_t us) {
+    return us ? (double)bytes * 1e6 / 1024.0 / (double)us : 0.0;
+}
+
+static void perf_print(void) {
+    uint64_t now = hal_time_us();
+    uint64_t dt  = now - perf_last.t_us;
+
+    printf("\n=== STATS (uptime %.3f s) ===\n", now / 1e6);
+    printf("DUT SPI : %llu B out, %llu B in, %u transactions\n",
+           (unsigned long long)perf.spi_tx_bytes, (unsigned long long)perf.spi_rx_bytes,
+           perf.spi_transactions);
+    printf("  WIP wait %.1f ms, erase timeouts %u, erase retries %u, program timeouts %u\n",
+           perf.wip_wait_us / 1e3, perf.erase_timeouts, perf.erase_retries,
+           perf.prog_timeouts);
+    printf("SD      : read %llu B in %.1f ms (%.1f KiB/s), "
+           "wrote %llu B in %.1f ms (%.1f KiB/s)\n",
+           (unsigned long long)perf.sd_rd_bytes, perf.sd_rd_us / 1e3,
+           perf_kib_s(perf.sd_rd_bytes, perf.sd_rd_us),
+           (unsigned long long)perf.sd_wr_bytes, perf.sd_wr_us / 1e3,
+           perf_kib_s(perf.sd_wr_bytes, perf.sd_wr_us));
+    printf("CRC     : %llu B\n", (unsigned long long)perf.crc_bytes);
+    printf("Since last stats (%.1f s): SPI in %.1f KiB/s, out %.1f KiB/s, "
+           "SD read %.1f KiB/s, write %.1f KiB/s\n", dt / 1e6,
+           perf_kib_s(perf.spi_rx_bytes - perf_last.spi_rx_bytes, dt),
+           perf_kib_s(perf.spi_tx_bytes - perf_last.spi_tx_bytes, dt),
+           perf_kib_s(perf.sd_rd_bytes  - perf_last.sd_rd_bytes,  dt),
+           perf_kib_s(perf.sd_wr_bytes  - perf_last.sd_wr_bytes,  dt));
+
+    printf("[STATS] uptime_ms=%llu spi_tx=%llu spi_rx=%llu spi_txn=%u wip_us=%llu "
+           "erase_timeouts=%u erase_retries=%u prog_timeouts=%u "
+           "sd_rd=%llu sd_rd_us=%llu sd_wr=%llu sd_wr_us=%llu crc=%llu\n",
+           (unsigned long long)(now / 1000),
+           (unsigned long long)perf.spi_tx_bytes, (unsigned long long)perf.spi_rx_bytes,
+           perf.spi_transactions, (unsigned long long)perf.wip_wait_us,
+           perf.erase_timeouts, perf.erase_retries, perf.prog_timeouts,
+           (unsigned long long)perf.sd_rd_bytes, (unsigned long long)perf.sd_rd_us,
+           (unsigned long long)perf.sd_wr_bytes, (unsigned long long)perf.sd_wr_us,
+           (unsigned long long)perf.crc_bytes);
+
+    perf_last.t_us         = now;
+    perf_last.spi_rx_bytes = perf.spi_rx_bytes;
+    perf_last.spi_tx_bytes = perf.spi_tx_bytes;
+    perf_last.sd_rd_bytes  = perf.sd_rd_bytes;
+    perf_last.sd_wr_bytes  = perf.sd_wr_bytes;
+}
+
+// =====================================================
+// ===============  SPI BUS RECORDER ====================
+// =====================================================
+// Menu 'b' starts / stops logging every DUT transaction (CS low → high) to
+// BUSLOG/<time>.fbl on SD: opcode, address, length, timing and an FNV-1a
+// hash of the data bytes. Identical back-to-back transactions (WIP polling)
+// are merged into one record. Records go through a RAM ring that a timer
+// flushes between job steps. host/replay_buslog.c replays a log against
+// the flash simulator.
+
+#define BUSLOG_FOLDER    "BUSLOG"
+#define BUSLOG_RING      256u        // records buffered in RAM, power of two
+#define BUSLOG_FLUSH_US  20000u
+
+typedef struct {
+    char     magic[8];     // "FBLv1\0"
+    uint32_t rec_size;     // sizeof(buslog_rec_t)
+    uint32_t records;      // filled in when the log is closed
+    uint32_t dropped;      // records lost to a full ring (SD too slow)
+    uint8_t  jedec[3];
+    uint8_t  reserved;
+    uint32_t t0_us;        // hal_time_us() at start, low 32 bits
+} __attribute__((packed)) buslog_hdr_t;
+
+typedef struct {
+    uint32_t t_us;         // CS low, low 32 bits of hal_time_us()
+    uint32_t dur_us;       // CS low → CS high of the last merged repeat
+    uint32_t hash;         // FNV-1a of the bytes after opcode + address
+    uint16_t len;          // bytes shifted incl. opcode and address
+    uint16_t repeat;       // identical transactions merged into this record
+    uint8_t  op;
+    uint8_t  addr[3];      // 24-bit address (big endian), 0 if the op has none
+} __attribute__((packed)) buslog_rec_t;
+
+static struct {
+    bool         on;
+    FIL          fp;
+    char         name[48];
+    buslog_hdr_t h;
+    buslog_rec_t ring[BUSLOG_RING];
+    uint32_t     head;     // next record to fill
+    uint32_t     tail;     // next record to write to SD
+    buslog_rec_t cur;      // transaction on the bus right now
+} buslog;
+
+static bool fs_mount_once(void);               // FIMG BACKUP / RESTORE section
+static void fmt_time(char *out, size_t n);     // FIMG BACKUP / RESTORE section
+
+static bool buslog_op_has_addr(uint8_t op) {
+    return op == 0x03 || op == 0x02 || op == 0x20 || op == 0xD8 || op == 0x5A;
+}
+
+static inline void buslog_cs_low(void) {
+    memset(&buslog.cur, 0, sizeof(buslog.cur));
+    buslog.cur.t_us   = (uint32_t)hal_time_us();
+    buslog.cur.hash   = 2166136261u;
+    buslog.cur.repeat = 1;
+}
+
+static inline void buslog_byte(uint8_t b) {
+    buslog_rec_t *c = &buslog.cur;
+    uint16_t i = c->len;
+    if (c->len < 0xFFFF) c->len++;
+    if (i == 0)                                     c->op = b;
+    else if (i <= 3 && buslog_op_has_addr(c->op))   c->addr[i - 1] = b;
+    else                                            c->hash = (c->hash ^ b) * 16777619u;
+}
+
+static void buslog_cs_high(void) {
+    buslog_rec_t *c = &buslog.cur;
+    c->dur_us = (uint32_t)hal_time_us() - c->t_us;
+
+    // same transaction as the last unflushed record → count it there
+    if (buslog.head != buslog.tail) {
+        buslog_rec_t *p = &buslog.ring[(buslog.head - 1) & (BUSLOG_RING - 1)];
+        if (p->op == c->op && p->len == c->len && p->hash == c->hash &&
+            memcmp(p->addr, c->addr, 3) == 0 && p->repeat < 0xFFFF) {
+            p->repeat++;
+            p->dur_us = (uint32_t)hal_time_us() - p->t_us;
+            return;
+        }
+    }
+    if (buslog.head - buslog.tail == BUSLOG_RING) {
+        buslog.h.dropped++;
+        return;
+    }
+    buslog.ring[buslog.head++ & (BUSLOG_RING - 1)] = *c;
+}
+
+// Timer: move buffered records to SD (between job steps, never mid-transaction)
+static void buslog_flush(void *arg) {
+    (void)arg;
+    if (!buslog.on) return;
+    while (buslog.tail != buslog.head) {
+        uint32_t idx = buslog.tail & (BUSLOG_RING - 1);
+        uint32_t n   = buslog.head - buslog.tail;
+        if (n > BUSLOG_RING - idx) n = BUSLOG_RING - idx;     // up to the ring's end
+        UINT bw = 0;
+        if (f_write(&buslog.fp, &buslog.ring[idx], n * sizeof(buslog_rec_t), &bw) != FR_OK ||
+            bw != n * sizeof(buslog_rec_t)) {
+            printf("\n[BUSLOG] SD write failed, recording stopped.\n");
+            buslog.on = false;
+            f_close(&buslog.fp);
+            return;
+        }
+        buslog.tail      += n;
+        buslog.h.records += n;
+    }
+}
+
+static int buslog_start(const uint8_t jedec[3]) {
+    if (!fs_mount_once()) {
+        printf("SD mount failed.\n");
+        return -1;
+    }
+    f_mkdir(BUSLOG_FOLDER);   // FR_EXIST is fine
+
+    char stamp[32]; fmt_time(stamp, sizeof(stamp));
+    snprintf(buslog.name, sizeof(buslog.name), "%s/%s.fbl", BUSLOG_FOLDER, stamp);
+    if (f_open(&buslog.fp, buslog.name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        printf("Open %s failed\n", buslog.name);
+        return -2;
+    }
+
+    memset(&buslog.h, 0, sizeof(buslog.h));
+    memcpy(buslog.h.magic, "FBLv1\0\0", 8);
+    buslog.h.rec_size = sizeof(buslog_rec_t);
+    memcpy(buslog.h.jedec, jedec, 3);
+    buslog.h.t0_us = (uint32_t)hal_time_us();
+
+    UINT bw = 0;
+    if (f_write(&buslog.fp, &buslog.h, sizeof(buslog.h), &bw) != FR_OK || bw != sizeof(buslog.h)) {
+        f_close(&buslog.fp);
+        printf("Header write failed.\n");
+        return -3;
+    }
+    buslog.head = buslog.tail = 0;
+    buslog.on = true;
+    printf("[BUSLOG] Recording DUT SPI transactions to %s ('b' again to stop)\n", buslog.name);
+    return 0;
+}
+
+static void buslog_stop(void) {
+    buslog_flush(NULL);
+    buslog.on = false;
 
-// Required by FatFs_SPI library
-size_t spi_get_num(void)            { return 1; }
-spi_t *spi_get_by_num(size_t n)     { return (n == 0) ? &sd_spi : NULL; }
-size_t sd_get_num(void)             { return 1; }
-sd_card_t *sd_get_by_num(size_t n)  { return (n == 0) ? &sd : NULL; }
+    UINT bw = 0;
+    f_lseek(&buslog.fp, 0);
+    f_write(&buslog.fp, &buslog.h, sizeof(buslog.h), &bw);   // final counts
+    f_close(&buslog.fp);
+    printf("[BUSLOG] %s: %u records, %u dropped\n",
+           buslog.name, buslog.h.records, buslog.h.dropped);
+}
 
 // =====================================================
 // ===============  FLASH DUT (JEDEC DRIVER) ============
@@ -98,20 +336,42 @@ typedef struct {
 #define FLASH_SECTOR_SIZE 4096
 
 static inline void flash_cs_low(void) {
-    asm volatile("nop; nop; nop;");
-    gpio_put(FLASH_PIN_CS, 0);
-    asm volatile("nop; nop; nop;");
+    perf.spi_transactions++;
+    if (buslog.on) buslog_cs_low();
+    hal_flash_select(true);
 }
 
 static inline void flash_cs_high(void) {
-    asm volatile("nop; nop; nop;");
-    gpio_put(FLASH_PIN_CS, 1);
-    asm volatile("nop; nop; nop;");
+    hal_flash_select(false);
+    if (buslog.on) buslog_cs_high();
+}
+
+// bus transfers, counted per direction (and logged while 'b' is on)
+static inline void flash_tx(const uint8_t *src, size_t len) {
+    perf.spi_tx_bytes += len;
+    hal_flash_write(src, len);
+    if (buslog.on)
+        for (size_t i = 0; i < len; i++) buslog_byte(src[i]);
+}
+
+static inline void flash_rx(uint8_t *dst, size_t len) {
+    perf.spi_rx_bytes += len;
+    hal_flash_read(dst, len);
+    if (buslog.on)
+        for (size_t i = 0; i < len; i++) buslog_byte(dst[i]);
+}
+
+static inline void flash_txrx(const uint8_t *tx, uint8_t *rx, size_t len) {
+    perf.spi_tx_bytes += len;
+    perf.spi_rx_bytes += len;
+    hal_flash_transfer(tx, rx, len);
+    if (buslog.on)   // opcode from MOSI, the rest (status) from MISO
+        for (size_t i = 0; i < len; i++) buslog_byte(buslog.cur.len ? rx[i] : tx[i]);
 }
 
 static inline void flash_cmd1(uint8_t cmd) {
     flash_cs_low();
-    spi_write_blocking(FLASH_SPI_PORT, &cmd, 1);
+    flash_tx(&cmd, 1);
     flash_cs_high();
 }
 
@@ -122,7 +382,7 @@ static inline void flash_wren(void) {
 static uint8_t flash_read_sr1(void) {
     uint8_t tx[2] = { CMD_RDSR1, 0x00 }, rx[2] = {0};
     flash_cs_low();
-    spi_write_read_blocking(FLASH_SPI_PORT, tx, rx, 2);
+    flash_txrx(tx, rx, 2);
     flash_cs_high();
     return rx[1];
 }
@@ -130,24 +390,36 @@ static uint8_t flash_read_sr1(void) {
 static uint8_t flash_read_sr2(void) {
     uint8_t tx[2] = { CMD_RDSR2, 0x00 }, rx[2] = {0};
     flash_cs_low();
-    spi_write_read_blocking(FLASH_SPI_PORT, tx, rx, 2);
+    flash_txrx(tx, rx, 2);
     flash_cs_high();
     return rx[1];
 }
 
 static bool flash_wait_busy_timeout(uint32_t timeout_ms) {
-    uint32_t t0 = to_ms_since_boot(get_absolute_time());
+    uint32_t tr = trace_begin(), polls = 0;
+    uint32_t t0 = hal_time_ms();
+    bool ok;
     while (true) {
-        if ((flash_read_sr1() & 0x01) == 0) return true; // WIP=0
-        if (to_ms_since_boot(get_absolute_time()) - t0 > timeout_ms) return false;
+        polls++;
+        if ((flash_read_sr1() & 0x01) == 0) { ok = true; break; } // WIP=0
+        if (hal_time_ms() - t0 > timeout_ms) { ok = false; break; }
     }
+    perf.wip_wait_us += trace_end(TR_WIP_WAIT, tr, polls);
+    return ok;
+}
+
+// fixed delay, traced so it shows up between bus transactions
+static void flash_delay_ms(uint32_t ms) {
+    uint32_t tr = trace_begin();
+    hal_sleep_ms(ms);
+    trace_end(TR_SLEEP, tr, ms);
 }
 
 static void flash_soft_reset(void) {
     flash_cmd1(CMD_RSTEN);
-    sleep_ms(1);
+    flash_delay_ms(1);
     flash_cmd1(CMD_RST);
-    sleep_ms(10);
+    flash_delay_ms(10);
 }
 
 static void flash_resume(void) {
@@ -157,13 +429,13 @@ static void flash_resume(void) {
 // Clear protection: try ULBPR then clear BP bits via WRSR
 static void flash_global_unprotect(void) {
     flash_cmd1(CMD_ULBPR);
-    sleep_ms(1);
+    flash_delay_ms(1);
 
     // Then explicitly clear SR1/SR2 BP bits
     flash_wren();
     uint8_t wr[3] = { CMD_WRSR, 0x00, 0x00 }; // SR1=0, SR2=0
     flash_cs_low();
-    spi_write_blocking(FLASH_SPI_PORT, wr, 3);
+    flash_tx(wr, 3);
     flash_cs_high();
     (void)flash_wait_busy_timeout(200);
 
@@ -173,13 +445,7 @@ static void flash_global_unprotect(void) {
 
 // Public DUT-style API
 static bool flash_dut_init(void) {
-    spi_init(FLASH_SPI_PORT, FLASH_SPI_HZ);
-    gpio_set_function(FLASH_PIN_MISO, GPIO_FUNC_SPI);
-    gpio_set_function(FLASH_PIN_MOSI, GPIO_FUNC_SPI);
-    gpio_set_function(FLASH_PIN_SCK,  GPIO_FUNC_SPI);
-    gpio_init(FLASH_PIN_CS);
-    gpio_set_dir(FLASH_PIN_CS, GPIO_OUT);
-    gpio_put(FLASH_PIN_CS, 1);
+    hal_flash_bus_init();
 
     flash_soft_reset();
     flash_global_unprotect();
@@ -193,8 +459,8 @@ static bool flash_dut_read_jedec(jedec_info_t *id) {
     uint8_t rx[3] = {0};
 
     flash_cs_low();
-    spi_write_blocking(FLASH_SPI_PORT, &cmd, 1);
-    spi_read_blocking(FLASH_SPI_PORT, 0, rx, 3);
+    flash_tx(&cmd, 1);
+    flash_rx(rx, 3);
     flash_cs_high();
 
     id->manuf_id    = rx[0];
@@ -214,10 +480,12 @@ static bool flash_dut_read(uint32_t addr, uint8_t *buf, size_t len) {
                        (uint8_t)(addr >> 16),
                        (uint8_t)(addr >> 8),
                        (uint8_t) addr };
+    uint32_t tr = trace_begin();
     flash_cs_low();
-    spi_write_blocking(FLASH_SPI_PORT, hdr, 4);
-    spi_read_blocking(FLASH_SPI_PORT, 0, buf, len);
+    flash_tx(hdr, 4);
+    flash_rx(buf, len);
     flash_cs_high();
+    trace_end(TR_SPI_READ, tr, (uint32_t)len);
     return true;
 }
 
@@ -225,16 +493,22 @@ static bool flash_dut_read(uint32_t addr, uint8_t *buf, size_t len) {
 static bool flash_dut_program_page(uint32_t addr, const uint8_t *data, size_t len) {
     if (!data || !len || len > FLASH_PAGE_SIZE) return false;
 
+    uint32_t tr = trace_begin();
     flash_wren();
     uint8_t hdr[4] = { CMD_PP,
                        (uint8_t)(addr >> 16),
                        (uint8_t)(addr >> 8),
                        (uint8_t) addr };
     flash_cs_low();
-    spi_write_blocking(FLASH_SPI_PORT, hdr, 4);
-    spi_write_blocking(FLASH_SPI_PORT, data, len);
+    flash_tx(hdr, 4);
+    flash_tx(data, len);
     flash_cs_high();
-    return flash_wait_busy_timeout(10 * 1000);    // 10s worst-case, usually <<1s
+    trace_end(TR_SPI_PROG, tr, (uint32_t)len);
+    if (!flash_wait_busy_timeout(10 * 1000)) {    // 10s worst-case, usually <<1s
+        perf.prog_timeouts++;
+        return false;
+    }
+    return true;
 }
 
 // Robust 4K erase with retry
@@ -243,17 +517,20 @@ static bool flash_dut_erase_4k(uint32_t addr) {
                        (uint8_t)(addr >> 16),
                        (uint8_t)(addr >> 8),
                        (uint8_t) addr };
+    uint32_t tr = trace_begin();
 
     flash_global_unprotect();
 
     flash_wren();
     flash_cs_low();
-    spi_write_blocking(FLASH_SPI_PORT, cmd, 4);
+    flash_tx(cmd, 4);
     flash_cs_high();
     if (!flash_wait_busy_timeout(2000)) {
         uint8_t sr1 = flash_read_sr1();
         uint8_t sr2 = flash_read_sr2();
         printf("Timeout erasing 0x%08x (SR1=0x%02x SR2=0x%02x)\n", addr, sr1, sr2);
+        perf.erase_timeouts++;
+        perf.erase_retries++;
 
         flash_resume();
         flash_soft_reset();
@@ -261,24 +538,225 @@ static bool flash_dut_erase_4k(uint32_t addr) {
 
         flash_wren();
         flash_cs_low();
-        spi_write_blocking(FLASH_SPI_PORT, cmd, 4);
+        flash_tx(cmd, 4);
         flash_cs_high();
         if (!flash_wait_busy_timeout(3000)) {
             sr1 = flash_read_sr1();
             sr2 = flash_read_sr2();
             printf("Timeout erasing 0x%08x (SR1=0x%02x SR2=0x%02x) after retry\n",
                    addr, sr1, sr2);
+            perf.erase_timeouts++;
+            trace_end(TR_ERASE, tr, addr);
             return false;
         }
     }
+    trace_end(TR_ERASE, tr, addr);
     return true;
 }
 
-// map JEDEC capacity code (0x10..0x20) → bytes
+// map JEDEC capacity code → bytes: 2^code bytes (EF4018 = 16 MiB), as the
+// simulator sizes itself; codes above 0x1F are clamped to fit 32 bits
 static uint32_t flash_calculate_capacity(uint8_t capacity_code) {
     if (capacity_code < 0x10 || capacity_code > 0x20) return 0;
-    uint32_t bits = 1u << capacity_code;
-    return bits / 8u;
+    if (capacity_code > 0x1F) capacity_code = 0x1F;
+    return 1u << capacity_code;
+}
+
+// =====================================================
+// ===============  COOPERATIVE SCHEDULER ===============
+// =====================================================
+//
+// main() never blocks inside an operation. One loop (sched_run_once)
+// services, in this order:
+//   1. console input   (menu keys, line prompts, abort key)
+//   2. timers          (progress reporting)
+//   3. one step of the active job, if any
+//   4. otherwise one slice of a background task
+//
+// Long operations (backup, restore, benchmark) are jobs: step() does a
+// small bounded piece of work (one page / one sector / one SD chunk) and
+// returns, so the abort key is seen within a few milliseconds.
+//
+// step() returns JOB_CONTINUE to be called again, 0 when finished OK,
+// or a negative error code (same codes the old blocking functions used).
+
+#define JOB_CONTINUE     1
+#define JOB_ABORTED      (-100)
+#define JOB_SLICE_BYTES  512u      // DUT bytes moved per step (~4 ms @ 1 MHz)
+#define PROGRESS_US      500000u   // progress line every 0.5 s
+
+#define MAX_TIMERS       4
+#define MAX_BG_TASKS     4
+
+typedef struct job job_t;
+typedef int  (*job_step_fn)(job_t *job);
+typedef void (*job_end_fn)(job_t *job);
+
+struct job {
+    const char  *name;        // "backup", "restore", "benchmark"
+    const char  *stage;       // progress label, NULL = no progress line
+    bool         stage_kib;   // done/total are bytes → print as KiB
+    uint32_t     done;
+    uint32_t     total;
+    job_step_fn  step;
+    job_end_fn   cleanup;     // called once when the job ends, rc already set
+    uint64_t     t_start_us;
+    int          rc;
+    bool         active;
+};
+
+typedef void (*timer_fn)(void *arg);
+
+typedef struct {
+    timer_fn  fn;
+    void     *arg;
+    uint32_t  period_us;
+    uint64_t  next_us;
+} sched_timer_t;
+
+// Background task: do at most one small slice of work.
+// Returns true if it did something, false if it has nothing to do.
+// yield (optional) is called when a foreground job starts, so the task
+// can release shared resources (open SD files) immediately.
+typedef bool (*bg_task_fn)(void *arg);
+typedef void (*bg_yield_fn)(void *arg);
+
+typedef struct {
+    const char  *name;
+    bg_task_fn   fn;
+    bg_yield_fn  yield;
+    void        *arg;
+} bg_task_t;
+
+static job_t         job_slot;             // only one foreground job at a time
+static volatile bool job_abort_req = false;
+static sched_timer_t timers[MAX_TIMERS];
+static int           timer_count = 0;
+static bg_task_t     bg_tasks[MAX_BG_TASKS];
+static int           bg_count = 0;
+static int           bg_next  = 0;         // round-robin position
+
+static void console_poll(void);            // CONSOLE + MENU section
+static void job_ended(job_t *job);         // CONSOLE + MENU section
+
+static inline bool job_busy(void) {
+    return job_slot.active;
+}
+
+static bool sched_add_timer(timer_fn fn, void *arg, uint32_t period_us) {
+    if (timer_count >= MAX_TIMERS) return false;
+    sched_timer_t *t = &timers[timer_count++];
+    t->fn        = fn;
+    t->arg       = arg;
+    t->period_us = period_us;
+    t->next_us   = hal_time_us() + period_us;
+    return true;
+}
+
+static bool sched_add_bg_task(const char *name, bg_task_fn fn,
+                              bg_yield_fn yield, void *arg) {
+    if (bg_count >= MAX_BG_TASKS) return false;
+    bg_tasks[bg_count].name  = name;
+    bg_tasks[bg_count].fn    = fn;
+    bg_tasks[bg_count].yield = yield;
+    bg_tasks[bg_count].arg   = arg;
+    bg_count++;
+    return true;
+}
+
+// Claim the job slot. Returns NULL if another job is still running.
+static job_t *job_start(const char *name, job_step_fn step, job_end_fn cleanup) {
+    if (job_slot.active) return NULL;
+    for (int i = 0; i < bg_count; i++) {
+        if (bg_tasks[i].yield) bg_tasks[i].yield(bg_tasks[i].arg);
+    }
+    memset(&job_slot, 0, sizeof(job_slot));
+    job_slot.name       = name;
+    job_slot.step       = step;
+    job_slot.cleanup    = cleanup;
+    job_slot.t_start_us = hal_time_us();
+    job_slot.active     = true;
+    job_abort_req       = false;
+    return &job_slot;
+}
+
+// Switch progress label; total == 0 hides the progress line
+static void job_set_stage(job_t *job, const char *stage, uint32_t total, bool kib) {
+    job->stage     = stage;
+    job->stage_kib = kib;
+    job->done      = 0;
+    job->total     = total;
+}
+
+static void job_abort(void) {
+    if (job_slot.active) job_abort_req = true;
+}
+
+static void job_finish(job_t *job, int rc) {
+    job->rc     = rc;
+    job->active = false;
+    if (job->cleanup) job->cleanup(job);
+    job_ended(job);
+}
+
+static void job_step_once(void) {
+    job_t *job = &job_slot;
+    if (!job->active) return;
+
+    if (job_abort_req) {
+        job_abort_req = false;
+        job_finish(job, JOB_ABORTED);     // job_ended() reports it
+        return;
+    }
+
+    uint32_t tr = trace_begin();
+    int rc = job->step(job);
+    trace_end(TR_JOB_STEP, tr, job->done);
+    if (rc != JOB_CONTINUE) job_finish(job, rc);
+}
+
+// Timer: one progress line for the active job (replaces the old
+// "every 64 KiB" printf inside each loop)
+static void progress_timer(void *arg) {
+    (void)arg;
+    const job_t *job = &job_slot;
+    if (!job->active || !job->stage || !job->total) return;
+
+    uint32_t tr = trace_begin();
+    int n;
+    if (job->stage_kib)
+        n = printf("%s %u / %u KiB\r", job->stage, job->done / 1024, job->total / 1024);
+    else
+        n = printf("%s %u / %u\r", job->stage, job->done, job->total);
+    trace_end(TR_PRINTF, tr, n > 0 ? (uint32_t)n : 0);
+}
+
+// One pass of the event loop
+static void sched_run_once(void) {
+    console_poll();
+
+    uint64_t now = hal_time_us();
+    for (int i = 0; i < timer_count; i++) {
+        if (now >= timers[i].next_us) {
+            timers[i].next_us = now + timers[i].period_us;
+            timers[i].fn(timers[i].arg);
+        }
+    }
+
+    if (job_busy()) {
+        job_step_once();
+        return;
+    }
+
+    // Idle: give one slice to the next background task that has work
+    for (int k = 0; k < bg_count; k++) {
+        int i = (bg_next + k) % bg_count;
+        if (bg_tasks[i].fn(bg_tasks[i].arg)) {
+            bg_next = (i + 1) % bg_count;
+            return;
+        }
+    }
+    hal_idle();
 }
 
 // =====================================================
@@ -288,33 +766,57 @@ static uint32_t flash_calculate_capacity(uint8_t capacity_code) {
 typedef struct {
     char     magic[8];      // "FIMGv1\0"
     uint8_t  jedec[3];      // manuf, type, capacity_id
-    uint8_t  reserved;
+    uint8_t  flags;         // FIMG_F_* (0 in older images)
     uint32_t flash_size;    // bytes
     uint32_t chunk_size;    // e.g., 4096
     uint32_t image_size;    // bytes of image (usually == flash_size)
     uint32_t crc32_all;     // CRC-32 of the image data (no header)
 } __attribute__((packed)) flashimg_hdr_t;
 
+#define FIMG_F_SECTOR_MAP  0x01u    // a sector map block follows the CRC trailer
+
+// Sector map block: one class (sector_class_t) per 4 KiB sector of the
+// image, two per byte, even sector in the low nibble
+typedef struct {
+    char     magic[4];      // "SMAP"
+    uint16_t sector_size;   // FLASH_SECTOR_SIZE
+    uint8_t  bits;          // 4 bits per sector
+    uint8_t  reserved;
+    uint32_t sectors;       // ceil(image_size / sector_size)
+    uint32_t crc;           // CRC-32 of the packed classes
+} __attribute__((packed)) fimg_smap_t;
+
 #define DUMP_FOLDER        "FLASHIMG"
 #define CHUNK_BYTES        4096u
 
-// mount SD (once) via FatFs_SPI + our hw_config
-static bool fs_mount_once(void) {
-    static bool mounted = false;
-    if (mounted) return true;
+// *.fimg only: not the <name>.fimg.part an interrupted upload leaves behind
+static bool is_fimg_name(const char *name) {
+    size_t n = strlen(name);
+    return n > 5 && !strcmp(name + n - 5, ".fimg");
+}
 
-    sd_card_t *pSD = sd_get_by_num(0);
-    if (!pSD) {
-        printf("sd_get_by_num(0) failed\n");
-        return false;
-    }
+static uint32_t smap_sectors(uint32_t image_size) {
+    return (image_size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+}
 
-    FRESULT fr = f_mount(&pSD->fatfs, pSD->pcName, 1);
-    if (fr != FR_OK) {
-        printf("f_mount failed: %d\n", fr);
-        return false;
-    }
-    mounted = true;
+static uint32_t smap_bytes(uint32_t image_size) {
+    return (smap_sectors(image_size) + 1) / 2;
+}
+
+// header + data + CRC trailer [+ sector map]
+static uint32_t fimg_file_size(const flashimg_hdr_t *h) {
+    uint32_t n = (uint32_t)sizeof(*h) + h->image_size + 4u;
+    if (h->flags & FIMG_F_SECTOR_MAP) n += (uint32_t)sizeof(fimg_smap_t) + smap_bytes(h->image_size);
+    return n;
+}
+
+static bool fs_mounted = false;
+
+// mount SD (once)
+static bool fs_mount_once(void) {
+    if (fs_mounted) return true;
+    if (!hal_sd_mount()) return false;
+    fs_mounted = true;
     return true;
 }
 
@@ -327,7 +829,7 @@ static bool fs_mount_once(void) {
 // 0xEDB88320u & -(int)(c & 1):
 // If LSB = 0 → AND with 0 → contributes 0
 // If LSB = 1 → AND with 0xFFFFFFFF → contributes 0xEDB88320
-static uint32_t crc32_update(uint32_t c, const uint8_t *b, size_t n) {
+static uint32_t crc32_calc(uint32_t c, const uint8_t *b, size_t n) {
     c = ~c;
     for (size_t i = 0; i < n; ++i) {
         c ^= b[i];
@@ -337,33 +839,51 @@ static uint32_t crc32_update(uint32_t c, const uint8_t *b, size_t n) {
     return ~c;
 }
 
-// CRC32 over live flash (streamed)
-static int crc32_over_flash(uint32_t total_bytes,
-                            uint32_t chunk_bytes,
-                            uint32_t *out_crc) {
-    if (!out_crc || chunk_bytes == 0) return -1;
+// image data CRC: traced and counted
+static uint32_t crc32_update(uint32_t c, const uint8_t *b, size_t n) {
+    uint32_t tr = trace_begin();
+    c = crc32_calc(c, b, n);
+    trace_end(TR_CRC, tr, (uint32_t)n);
+    perf.crc_bytes += n;
+    return c;
+}
+
+// ---- byte order helpers (frames, on-flash headers) ----
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
 
-    uint8_t *buf = (uint8_t*)malloc(chunk_bytes);
-    if (!buf) { printf("OOM.\n"); return -2; }
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
 
-    uint32_t crc = 0, addr = 0, remain = total_bytes;
-    while (remain) {
-        uint32_t n = (remain > chunk_bytes) ? chunk_bytes : remain;
-        if (!flash_dut_read(addr, buf, n)) {
-            free(buf);
-            printf("Flash read failed @0x%08x\n", addr);
-            return -3;
-        }
-        crc = crc32_update(crc, buf, n);
-        addr   += n;
-        remain -= n;
-        if ((addr & 0xFFFF) == 0)
-            printf("CRC %u / %u KiB\r", addr/1024, total_bytes/1024);
-    }
-    printf("\n");
-    free(buf);
-    *out_crc = crc;
-    return 0;
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static uint16_t get_be16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// f_read / f_write of image data, traced and counted
+static FRESULT sd_read(FIL *fp, void *buf, UINT n, UINT *br) {
+    uint32_t tr = trace_begin();
+    FRESULT fr = f_read(fp, buf, n, br);
+    perf.sd_rd_us    += trace_end(TR_SD_READ, tr, n);
+    perf.sd_rd_bytes += *br;
+    return fr;
+}
+
+static FRESULT sd_write(FIL *fp, const void *buf, UINT n, UINT *bw) {
+    uint32_t tr = trace_begin();
+    FRESULT fr = f_write(fp, buf, n, bw);
+    perf.sd_wr_us    += trace_end(TR_SD_WRITE, tr, n);
+    perf.sd_wr_bytes += *bw;
+    return fr;
 }
 
 // ensure /FLASHIMG exists
@@ -376,11 +896,139 @@ static void ensure_folder(void) {
 
 // timestamp label (simple: ms since boot)
 static void fmt_time(char *out, size_t n) {
-    uint32_t ms = to_ms_since_boot(get_absolute_time());
+    uint32_t ms = hal_time_ms();
     snprintf(out, n, "t%010u", ms);
 }
 
-// list .fimg files
+// ---- image catalog: last known verification state of every .fimg ----
+// Kept in RAM, persisted as FLASHIMG/CATALOG.csv. An entry is only trusted
+// while size and FAT date/time of the file still match what was checked.
+#define CATALOG_FILE   DUMP_FOLDER "/CATALOG.csv"
+#define MAX_CATALOG    64
+
+typedef enum { IMG_UNCHECKED = 0, IMG_OK, IMG_BAD } img_status_t;
+
+typedef struct {
+    char         fname[64];
+    uint32_t     fsize;
+    WORD         fdate, ftime;
+    uint32_t     crc;          // data CRC found by the last check
+    img_status_t status;
+    uint32_t     checked_ms;   // ms since boot of the last check
+    bool         seen;         // found during the current scrub pass (not saved)
+} catalog_entry_t;
+
+static catalog_entry_t catalog[MAX_CATALOG];
+static int  catalog_count  = 0;
+static bool catalog_loaded = false;
+
+static const char *img_status_name(img_status_t st) {
+    switch (st) {
+    case IMG_OK:  return "OK";
+    case IMG_BAD: return "BAD";
+    default:      return "UNCHECKED";
+    }
+}
+
+static const char *path_basename(const char *path) {
+    const char *s = strrchr(path, '/');
+    return s ? s + 1 : path;
+}
+
+static void catalog_load(void) {
+    if (catalog_loaded) return;
+    catalog_loaded = true;
+    catalog_count  = 0;
+
+    FIL f;
+    if (f_open(&f, CATALOG_FILE, FA_READ) != FR_OK) return;   // first run
+
+    char line[160], status[16];
+    f_gets(line, sizeof(line), &f);   // header
+    while (catalog_count < MAX_CATALOG && f_gets(line, sizeof(line), &f)) {
+        catalog_entry_t *e = &catalog[catalog_count];
+        memset(e, 0, sizeof(*e));
+        unsigned fsize, fdate, ftime, crc, checked;
+        if (sscanf(line, "%63[^,],%u,%u,%u,%x,%15[^,],%u",
+                   e->fname, &fsize, &fdate, &ftime, &crc, status, &checked) != 7)
+            continue;
+        e->fsize      = fsize;
+        e->fdate      = (WORD)fdate;
+        e->ftime      = (WORD)ftime;
+        e->crc        = crc;
+        e->checked_ms = checked;
+        e->status     = !strcmp(status, "OK")  ? IMG_OK
+                      : !strcmp(status, "BAD") ? IMG_BAD : IMG_UNCHECKED;
+        catalog_count++;
+    }
+    f_close(&f);
+}
+
+static void catalog_save(void) {
+    FIL f;
+    UINT bw = 0;
+    if (f_open(&f, CATALOG_FILE, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        printf("Could not write %s\n", CATALOG_FILE);
+        return;
+    }
+    char line[160];
+    int n = snprintf(line, sizeof(line), "name,size,fdate,ftime,crc,status,checked_ms\n");
+    f_write(&f, line, n, &bw);
+    for (int i = 0; i < catalog_count; i++) {
+        const catalog_entry_t *e = &catalog[i];
+        n = snprintf(line, sizeof(line), "%s,%u,%u,%u,%08x,%s,%u\n",
+                     e->fname, e->fsize, e->fdate, e->ftime, e->crc,
+                     img_status_name(e->status), e->checked_ms);
+        f_write(&f, line, n, &bw);
+    }
+    f_close(&f);
+}
+
+static catalog_entry_t *catalog_find(const char *fname) {
+    catalog_load();
+    for (int i = 0; i < catalog_count; i++)
+        if (!strcmp(catalog[i].fname, fname)) return &catalog[i];
+    return NULL;
+}
+
+// entry still describes the file on SD?
+static bool catalog_current(const catalog_entry_t *e, const FILINFO *fi) {
+    return e && e->fsize == (uint32_t)fi->fsize &&
+           e->fdate == fi->fdate && e->ftime == fi->ftime;
+}
+
+// Store the outcome of a full image check and persist the catalog
+static void catalog_record(const char *path, img_status_t st, uint32_t crc) {
+    FILINFO fi;
+    if (f_stat(path, &fi) != FR_OK) return;
+
+    const char *fname = path_basename(path);
+    catalog_entry_t *e = catalog_find(fname);
+    if (!e) {
+        if (catalog_count >= MAX_CATALOG) return;
+        e = &catalog[catalog_count++];
+        memset(e, 0, sizeof(*e));
+        snprintf(e->fname, sizeof(e->fname), "%s", fname);
+    }
+    e->fsize      = (uint32_t)fi.fsize;
+    e->fdate      = fi.fdate;
+    e->ftime      = fi.ftime;
+    e->crc        = crc;
+    e->status     = st;
+    e->checked_ms = hal_time_ms();
+    e->seen       = true;
+    catalog_save();
+}
+
+// Image verified OK, unchanged since, and header CRC agrees?
+static bool catalog_trusted(const char *path, uint32_t hdr_crc) {
+    FILINFO fi;
+    if (f_stat(path, &fi) != FR_OK) return false;
+    const catalog_entry_t *e = catalog_find(path_basename(path));
+    return catalog_current(e, &fi) && e->status == IMG_OK && e->crc == hdr_crc;
+}
+
+// list .fimg files (with scrub status from the catalog)
 static int list_flash_images(void) {
     if (!fs_mount_once()) {
         printf("SD not mounted.\n");
@@ -396,8 +1044,13 @@ static int list_flash_images(void) {
     }
 
     while (f_readdir(&d, &f) == FR_OK && f.fname[0]) {
-        if (strstr(f.fname, ".fimg")) {
-            printf("%s/%s\n", DUMP_FOLDER, f.fname);
+        if (is_fimg_name(f.fname)) {
+            const catalog_entry_t *e = catalog_find(f.fname);
+            if (catalog_current(e, &f) && e->status != IMG_UNCHECKED)
+                printf("%s/%s  [%s]\n", DUMP_FOLDER, f.fname,
+                       e->status == IMG_OK ? "verified" : "CORRUPT");
+            else
+                printf("%s/%s\n", DUMP_FOLDER, f.fname);
             count++;
         }
     }
@@ -406,119 +1059,740 @@ static int list_flash_images(void) {
     return count;
 }
 
-// backup entire flash into /FLASHIMG/<stamp>_<jedec>.fimg
-static int backup_flash_to_sd(void) {
-    if (!fs_mount_once()) {
-        printf("SD mount failed.\n");
-        return -1;
-    }
-    if (!flash_dut_init()) {
-        printf("Flash init failed.\n");
-        return -2;
-    }
+// ---- signature scan: structure map of the backup stream ----
+// backup_step() feeds every byte it reads through sig_feed(), an Aho-Corasick
+// automaton over the magics below. Bytes that occur in no magic share input
+// class 0, so the DFA is states x classes bytes (65 x 39), not states x 256.
+// A match opens a capture of the header behind the magic; once sig_need[]
+// bytes have streamed past, sig_check() accepts it (header CRCs where the
+// format has one) or drops it. Accepted hits are kept sorted by offset, runs
+// of JFFS2 nodes / UBI headers folded into one entry, and saved next to the
+// image as <stamp>_<jedec>.sig.csv. host/sigscan.cpp has the same table and
+// checks, so it produces the same map from a .fimg.
+
+typedef enum {
+    SIG_UIMAGE, SIG_SQUASHFS, SIG_JFFS2_LE, SIG_JFFS2_BE, SIG_UBI,
+    SIG_GZIP, SIG_LZMA, SIG_XZ, SIG_PEM, SIG_X509, SIG_ELF, SIG_TYPES
+} sig_type_t;
+
+static const char *const sig_type_names[SIG_TYPES] = {
+    "uimage", "squashfs", "jffs2-le", "jffs2-be", "ubi",
+    "gzip", "lzma", "xz", "pem", "x509", "elf",
+};
 
-    jedec_info_t id;
-    if (!flash_dut_read_jedec(&id)) {
-        printf("JEDEC read failed.\n");
-        return -3;
-    }
+// header bytes (magic included) sig_check() looks at
+static const uint8_t sig_need[SIG_TYPES] = { 64, 48, 12, 12, 64, 10, 13, 12, 64, 11, 20 };
 
-    uint32_t flash_sz = 16u * 1024u * 1024u;   // default 16MB
-    uint32_t sfdp = 0;
-    if (flash_dut_probe_capacity_sfdp(&sfdp) && sfdp) {
-        flash_sz = sfdp;
-    } else {
-        uint32_t by_jedec = flash_calculate_capacity(id.capacity_id);
-        if (by_jedec) flash_sz = by_jedec;
-    }
+typedef struct {
+    uint8_t     type;
+    uint8_t     len;
+    const char *magic;
+} sig_pattern_t;
+
+static const sig_pattern_t sig_patterns[] = {
+    { SIG_UIMAGE,   4, "\x27\x05\x19\x56" },
+    { SIG_SQUASHFS, 4, "hsqs" },                 // little-endian superblock
+    { SIG_SQUASHFS, 4, "sqsh" },                 // big-endian (v1 - v3)
+    { SIG_JFFS2_LE, 4, "\x85\x19\x01\xe0" },     // dirent
+    { SIG_JFFS2_LE, 4, "\x85\x19\x02\xe0" },     // inode
+    { SIG_JFFS2_LE, 4, "\x85\x19\x03\x20" },     // clean marker
+    { SIG_JFFS2_LE, 4, "\x85\x19\x04\x20" },     // padding
+    { SIG_JFFS2_BE, 4, "\x19\x85\xe0\x01" },
+    { SIG_JFFS2_BE, 4, "\x19\x85\xe0\x02" },
+    { SIG_JFFS2_BE, 4, "\x19\x85\x20\x03" },
+    { SIG_JFFS2_BE, 4, "\x19\x85\x20\x04" },
+    { SIG_UBI,      4, "UBI#" },                 // erase counter header
+    { SIG_UBI,      4, "UBI!" },                 // volume id header
+    { SIG_GZIP,     3, "\x1f\x8b\x08" },         // deflate
+    { SIG_LZMA,     3, "\x5d\x00\x00" },         // lc=3 lp=0 pb=2, dict >= 64 KiB
+    { SIG_XZ,       6, "\xfd" "7zXZ\x00" },
+    { SIG_PEM,     11, "-----BEGIN " },
+    { SIG_X509,     2, "\x30\x82" },             // SEQUENCE, 2-byte length
+    { SIG_ELF,      4, "\x7f" "ELF" },
+};
+#define SIG_PATTERNS  (sizeof(sig_patterns) / sizeof(sig_patterns[0]))
 
-    //makes sure sd card is there
-    ensure_folder();
-    char stamp[32]; fmt_time(stamp, sizeof(stamp));
+#define SIG_MAX_STATES   96         // trie nodes incl. root; the patterns above use 65
+#define SIG_MAX_PENDING  4          // headers being captured at once
+#define SIG_MAX_HITS     48         // map entries kept
+#define SIG_CAPTURE      64         // max of sig_need[]
+#define SIG_RUN_GAP      (1u << 20) // JFFS2 / UBI headers closer than this: one entry
 
-    char name[128];
-    snprintf(name, sizeof(name), "%s/%s_%02x%02x%02x.fimg",
-             DUMP_FOLDER, stamp, id.manuf_id, id.mem_type, id.capacity_id);
+typedef struct {
+    uint32_t offset;
+    uint32_t size;          // bytes the header declares, 0 = not known
+    uint32_t end;           // offset + max(size, header): merge bound (not saved)
+    uint32_t count;         // headers folded into the entry
+    uint8_t  type;
+    char     info[48];      // longest: "dict 262144 KiB, 4294967295 bytes unpacked"
+} sig_hit_t;
 
-    FIL fp; UINT bw = 0;
-    if (f_open(&fp, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
-        printf("Open %s failed\n", name);
-        return -4;
-    }
+typedef struct {
+    uint32_t offset;
+    uint8_t  type, n;
+    uint8_t  hdr[SIG_CAPTURE];
+} sig_capture_t;
 
-    flashimg_hdr_t h = {0};
-    memcpy(h.magic, "FIMGv1\0", 8);
-    h.jedec[0]    = id.manuf_id;
-    h.jedec[1]    = id.mem_type;
-    h.jedec[2]    = id.capacity_id;
-    h.flash_size  = flash_sz;
-    h.chunk_size  = CHUNK_BYTES;
-    h.image_size  = flash_sz;
-    h.crc32_all   = 0;
+typedef struct {
+    uint8_t       *delta;                   // [state * classes + class] -> state
+    uint8_t        cls[256];                // byte -> input class, 0 = in no magic
+    uint8_t        classes;
+    uint8_t        out[SIG_MAX_STATES];     // pattern + 1 ending in the state, 0 = none
+    uint8_t        link[SIG_MAX_STATES];    // nearest state on the fail chain with out
+    uint8_t        state;
+    sig_capture_t  cap[SIG_MAX_PENDING];
+    uint8_t        ncap;
+    sig_hit_t     *hits;
+    int            nhits;
+    uint32_t       dropped;                 // map full or too many open captures
+} sig_scan_t;
+
+static sig_scan_t sig;
+
+static void sig_free(void) {
+    free(sig.delta);
+    free(sig.hits);
+    sig.delta = NULL;
+    sig.hits  = NULL;
+}
 
-    if (f_write(&fp, &h, sizeof(h), &bw) != FR_OK || bw != sizeof(h)) {
-        f_close(&fp);
-        printf("Header write failed.\n");
-        return -5;
+// Build the DFA (trie, then BFS for fail links, missing edges filled in).
+// 0xFF marks "no edge yet" while building.
+static bool sig_begin(void) {
+    uint8_t fail[SIG_MAX_STATES], queue[SIG_MAX_STATES];
+
+    sig_free();
+    memset(&sig, 0, sizeof(sig));
+    int k = 1;
+    for (size_t p = 0; p < SIG_PATTERNS; p++)
+        for (int i = 0; i < sig_patterns[p].len; i++) {
+            uint8_t b = (uint8_t)sig_patterns[p].magic[i];
+            if (!sig.cls[b]) sig.cls[b] = (uint8_t)k++;
+        }
+    sig.classes = (uint8_t)k;
+    sig.delta   = malloc((size_t)SIG_MAX_STATES * k);
+    sig.hits    = malloc(SIG_MAX_HITS * sizeof(sig_hit_t));
+    if (!sig.delta || !sig.hits) {
+        sig_free();
+        return false;
     }
-
-    uint8_t *buf = (uint8_t*)malloc(CHUNK_BYTES);
-    if (!buf) {
-        f_close(&fp);
-        printf("OOM.\n");
-        return -6;
+    memset(sig.delta, 0xFF, (size_t)SIG_MAX_STATES * k);
+
+    int states = 1;
+    for (size_t p = 0; p < SIG_PATTERNS; p++) {
+        int s = 0;
+        for (int i = 0; i < sig_patterns[p].len; i++) {
+            uint8_t *t = &sig.delta[s * k + sig.cls[(uint8_t)sig_patterns[p].magic[i]]];
+            if (*t == 0xFF) {
+                if (states == SIG_MAX_STATES) {
+                    sig_free();
+                    return false;
+                }
+                *t = (uint8_t)states++;
+            }
+            s = *t;
+        }
+        sig.out[s] = (uint8_t)(p + 1);
     }
 
-    uint32_t crc = 0, addr = 0, total = flash_sz;
-    while (total) {
-        uint32_t n = (total > CHUNK_BYTES) ? CHUNK_BYTES : total;
-        if (!flash_dut_read(addr, buf, n)) {
-            free(buf); f_close(&fp);
-            printf("Flash read failed @0x%08x\n", addr);
-            return -7;
+    int head = 0, tail = 0;
+    for (int c = 0; c < k; c++) {
+        uint8_t *t = &sig.delta[c];
+        if (*t == 0xFF) {
+            *t = 0;
+        } else {
+            fail[*t] = 0;
+            queue[tail++] = *t;
         }
-        crc = crc32_update(crc, buf, n);
-        if (f_write(&fp, buf, n, &bw) != FR_OK || bw != n) {
-            free(buf); f_close(&fp);
-            printf("SD write failed.\n");
-            return -8;
+    }
+    while (head < tail) {
+        int s = queue[head++];
+        sig.link[s] = sig.out[fail[s]] ? fail[s] : sig.link[fail[s]];
+        for (int c = 0; c < k; c++) {
+            uint8_t *t = &sig.delta[s * k + c];
+            uint8_t  f = sig.delta[fail[s] * k + c];
+            if (*t == 0xFF) {
+                *t = f;
+            } else {
+                fail[*t] = f;
+                queue[tail++] = *t;
+            }
         }
-        addr  += n;
-        total -= n;
-
-        if ((addr & 0xFFFF) == 0)
-            printf("Backup %u / %u KiB\r", addr/1024, flash_sz/1024);
     }
-    printf("\n");
+    return true;
+}
 
-    // write CRC trailer
-    if (f_write(&fp, &crc, sizeof(crc), &bw) != FR_OK || bw != sizeof(crc)) {
-        free(buf); f_close(&fp);
-        printf("CRC write failed.\n");
-        return -9;
+// printable copy for the CSV (stops at NUL, no commas or quotes)
+static void sig_text(char *dst, size_t cap, const uint8_t *src, size_t n) {
+    size_t i = 0;
+    for (; i < n && i + 1 < cap && src[i]; i++) {
+        uint8_t c = src[i];
+        dst[i] = (c < 0x20 || c > 0x7E || c == ',' || c == '"') ? '.' : (char)c;
     }
-
-    // backfill header CRC at offset 0
-    h.crc32_all = crc;
-    f_lseek(&fp, 0);
-    f_write(&fp, &h, sizeof(h), &bw);
-
-    f_close(&fp);
-    free(buf);
-    printf("Backup OK: %s (size=%u, crc=0x%08x)\n", name, flash_sz, crc);
-    return 0;
+    dst[i] = 0;
 }
 
-// choose the newest .fimg from /FLASHIMG
-static int choose_latest_image(char *out, size_t n) {
-    DIR d; FILINFO f;
-    WORD best_date = 0, best_time = 0;
-    char best_path[128] = {0};
+static const char *elf_machine(uint16_t m) {
+    switch (m) {
+    case 3:   return "x86";
+    case 8:   return "MIPS";
+    case 20:  return "PowerPC";
+    case 40:  return "ARM";
+    case 62:  return "x86-64";
+    case 94:  return "Xtensa";
+    case 183: return "AArch64";
+    case 243: return "RISC-V";
+    default:  return "machine";
+    }
+}
 
-    if (f_opendir(&d, DUMP_FOLDER) != FR_OK) return -1;
+// Is the header at h (n bytes from the magic on) what the magic promises?
+// Fills hit->size and hit->info.
+static bool sig_check(uint8_t type, const uint8_t *h, uint32_t n, sig_hit_t *hit) {
+    static const char *const sqfs_comp[] = { "?", "gzip", "lzma", "lzo", "xz", "lz4", "zstd" };
+    static const char *const xz_check[16] = { [0] = "none", [1] = "crc32", [4] = "crc64", [10] = "sha256" };
+
+    if (n < sig_need[type]) return false;      // image ended inside the header
+    hit->size    = 0;
+    hit->info[0] = 0;
+
+    switch (type) {
+    case SIG_UIMAGE: {                          // big-endian, CRC over the header
+        uint8_t tmp[64];
+        memcpy(tmp, h, 64);
+        memset(tmp + 4, 0, 4);
+        if (crc32_calc(0, tmp, 64) != get_be32(h + 4)) return false;
+        hit->size = 64 + get_be32(h + 12);
+        sig_text(hit->info, sizeof(hit->info), h + 32, 32);
+        return true;
+    }
+    case SIG_SQUASHFS: {
+        bool le = h[0] == 'h';
+        uint16_t major = le ? get_le16(h + 28) : get_be16(h + 28);
+        if (major < 1 || major > 4) return false;
+        if (major < 4) {
+            snprintf(hit->info, sizeof(hit->info), "v%u %s", major, le ? "LE" : "BE");
+            return true;
+        }
+        uint32_t bs = get_le32(h + 12);
+        uint16_t comp = get_le16(h + 20);
+        if (!le || get_le16(h + 22) > 20 || bs != 1u << get_le16(h + 22) ||
+            bs < 4096 || get_le32(h + 44) != 0)
+            return false;
+        hit->size = get_le32(h + 40);            // bytes_used
+        snprintf(hit->info, sizeof(hit->info), "v4.%u %s block %u", get_le16(h + 30),
+                 comp < 7 ? sqfs_comp[comp] : "?", bs);
+        return true;
+    }
+    case SIG_JFFS2_LE:
+    case SIG_JFFS2_BE: {                        // hdr_crc = crc32_le(0, first 8 bytes)
+        bool le = type == SIG_JFFS2_LE;
+        uint32_t totlen = le ? get_le32(h + 4) : get_be32(h + 4);
+        uint32_t crc    = le ? get_le32(h + 8) : get_be32(h + 8);
+        if (totlen < 12 || ~crc32_calc(0xFFFFFFFFu, h, 8) != crc) return false;
+        hit->size = (totlen + 3) & ~3u;
+        return true;
+    }
+    case SIG_UBI:                               // hdr_crc = crc32_le(~0, first 60 bytes)
+        if (h[4] != 1 || ~crc32_calc(0, h, 60) != get_be32(h + 60)) return false;
+        return true;
+    case SIG_GZIP:
+        if ((h[3] & 0xE0) || (h[8] != 0 && h[8] != 2 && h[8] != 4) || (h[9] > 13 && h[9] != 255))
+            return false;
+        snprintf(hit->info, sizeof(hit->info), "%s", (h[3] & 0x08) ? "named" : "");
+        return true;
+    case SIG_LZMA: {                            // .lzma: props, dict size, unpacked size
+        uint32_t dict = get_le32(h + 1);
+        uint32_t lo = get_le32(h + 5), hi = get_le32(h + 9);
+        if (dict & (dict - 1) || dict > (1u << 28)) return false;
+        if (lo == 0xFFFFFFFFu && hi == 0xFFFFFFFFu)
+            snprintf(hit->info, sizeof(hit->info), "dict %u KiB", dict >> 10);
+        else if (hi == 0 && lo != 0)
+            snprintf(hit->info, sizeof(hit->info), "dict %u KiB, %u bytes unpacked", dict >> 10, lo);
+        else
+            return false;
+        return true;
+    }
+    case SIG_XZ:                                // stream flags + their CRC-32
+        if (h[6] != 0 || (h[7] & 0xF0) || crc32_calc(0, h + 6, 2) != get_le32(h + 8))
+            return false;
+        snprintf(hit->info, sizeof(hit->info), "check %s",
+                 xz_check[h[7]] ? xz_check[h[7]] : "?");
+        return true;
+    case SIG_PEM: {                             // -----BEGIN <LABEL>-----
+        uint32_t i = 11;
+        while (i < n && ((h[i] >= 'A' && h[i] <= 'Z') || h[i] == ' ')) i++;
+        if (i == 11 || i + 5 > n || memcmp(h + i, "-----", 5) != 0) return false;
+        sig_text(hit->info, sizeof(hit->info), h + 11, i - 11);
+        return true;
+    }
+    case SIG_X509: {                            // Certificate ::= SEQUENCE { tbs SEQUENCE { [0] version
+        uint16_t outer = get_be16(h + 2), inner = get_be16(h + 6);
+        if (outer < 256 || h[4] != 0x30 || h[5] != 0x82 || inner + 4u > outer ||
+            h[8] != 0xA0 || h[9] != 0x03 || h[10] != 0x02)
+            return false;
+        hit->size = 4u + outer;
+        return true;
+    }
+    case SIG_ELF: {
+        bool le = h[5] == 1;
+        uint16_t etype = le ? get_le16(h + 16) : get_be16(h + 16);
+        uint16_t mach  = le ? get_le16(h + 18) : get_be16(h + 18);
+        if ((h[4] != 1 && h[4] != 2) || (h[5] != 1 && h[5] != 2) || h[6] != 1 ||
+            etype < 1 || etype > 4)
+            return false;
+        static const char *const etypes[] = { "", "rel", "exec", "dyn", "core" };
+        snprintf(hit->info, sizeof(hit->info), "%u-bit %s %s %s %u", h[4] == 1 ? 32 : 64,
+                 le ? "LE" : "BE", etypes[etype], elf_machine(mach), mach);
+        return true;
+    }
+    }
+    return false;
+}
+
+static bool sig_run_type(uint8_t type) {
+    return type == SIG_JFFS2_LE || type == SIG_JFFS2_BE || type == SIG_UBI;
+}
+
+// Insert by offset; a JFFS2 / UBI header right after one of the same kind extends it
+static void sig_add(sig_hit_t *hit) {
+    int j = sig.nhits;
+    while (j > 0 && sig.hits[j - 1].offset > hit->offset) j--;
+
+    sig_hit_t *prev = j ? &sig.hits[j - 1] : NULL;
+    if (prev && prev->type == hit->type && sig_run_type(hit->type) &&
+        hit->offset <= prev->end + SIG_RUN_GAP) {
+        if (hit->end > prev->end) prev->end = hit->end;
+        prev->size = prev->end - prev->offset;
+        prev->count++;
+        return;
+    }
+    if (sig.nhits == SIG_MAX_HITS) {
+        sig.dropped++;
+        return;
+    }
+    memmove(&sig.hits[j + 1], &sig.hits[j], (size_t)(sig.nhits - j) * sizeof(sig_hit_t));
+    sig.hits[j] = *hit;
+    sig.nhits++;
+}
+
+static void sig_accept(const sig_capture_t *c) {
+    sig_hit_t hit;
+    if (!sig_check(c->type, c->hdr, c->n, &hit)) return;
+    uint32_t span = hit.size > sig_need[c->type] ? hit.size : sig_need[c->type];
+    hit.offset = c->offset;
+    hit.end    = c->offset + span;
+    hit.count  = 1;
+    hit.type   = c->type;
+    if (sig_run_type(hit.type)) hit.size = span;
+    sig_add(&hit);
+}
+
+// state s has output(s): open a capture per pattern ending at addr
+static void sig_match(uint32_t s, uint32_t addr) {
+    for (uint32_t t = sig.out[s] ? s : sig.link[s]; t; t = sig.link[t]) {
+        const sig_pattern_t *p = &sig_patterns[sig.out[t] - 1];
+        if (sig.ncap == SIG_MAX_PENDING) {
+            sig.dropped++;
+            continue;
+        }
+        sig_capture_t *c = &sig.cap[sig.ncap++];
+        c->offset = addr + 1 - p->len;
+        c->type   = p->type;
+        c->n      = p->len;
+        memcpy(c->hdr, p->magic, p->len);
+    }
+}
+
+static void sig_capture_byte(uint8_t b) {
+    for (int i = 0; i < sig.ncap;) {
+        sig_capture_t *c = &sig.cap[i];
+        c->hdr[c->n++] = b;
+        if (c->n == sig_need[c->type]) {
+            sig_accept(c);
+            sig.cap[i] = sig.cap[--sig.ncap];
+        } else {
+            i++;
+        }
+    }
+}
+
+// n bytes of the image at addr, in address order
+static void sig_feed(uint32_t addr, const uint8_t *p, uint32_t n) {
+    if (!sig.delta) return;
+    uint32_t tr = trace_begin();
+    const uint8_t *delta = sig.delta;
+    const uint32_t k = sig.classes;
+    uint32_t s = sig.state;
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t b = p[i];
+        if (sig.ncap) sig_capture_byte(b);
+        s = delta[s * k + sig.cls[b]];
+        if (sig.out[s] | sig.link[s]) sig_match(s, addr + i);
+    }
+    sig.state = (uint8_t)s;
+    trace_end(TR_SIGSCAN, tr, n);
+}
+
+// end of image: headers cut short are checked with what arrived (and fail)
+static void sig_finish(void) {
+    for (int i = 0; i < sig.ncap; i++) sig_accept(&sig.cap[i]);
+    sig.ncap = 0;
+}
+
+// FLASHIMG/<stamp>_<jedec>.fimg -> FLASHIMG/<stamp>_<jedec>.sig.csv
+static void sig_map_path(char *out, size_t n, const char *img) {
+    const char *dot = strrchr(img, '.');
+    int base = dot ? (int)(dot - img) : (int)strlen(img);
+    snprintf(out, n, "%.*s.sig.csv", base, img);
+}
+
+static bool sig_save(const char *path) {
+    FIL f;
+    UINT bw = 0;
+    if (f_open(&f, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return false;
+    char line[96];
+    int n = snprintf(line, sizeof(line), "offset,size,type,count,info\n");
+    f_write(&f, line, n, &bw);
+    for (int i = 0; i < sig.nhits; i++) {
+        const sig_hit_t *h = &sig.hits[i];
+        n = snprintf(line, sizeof(line), "0x%08x,%u,%s,%u,%s\n", h->offset, h->size,
+                     sig_type_names[h->type], h->count, h->info);
+        f_write(&f, line, n, &bw);
+    }
+    return f_close(&f) == FR_OK;
+}
+
+static void sig_print(int max) {
+    for (int i = 0; i < sig.nhits && i < max; i++) {
+        const sig_hit_t *h = &sig.hits[i];
+        printf("  0x%08x  %-9s", h->offset, sig_type_names[h->type]);
+        if (h->count > 1) printf(" x%u", h->count);
+        if (h->size)      printf(" %u bytes", h->size);
+        printf(" %s\n", h->info);
+    }
+    if (sig.nhits > max) printf("  ... %d more\n", sig.nhits - max);
+}
+
+// ---- sector map: class of every 4 KiB sector of the backup stream ----
+// One histogram per sector, integers only, filled by the same pass that
+// computes the CRC. The map is appended to the .fimg after the trailer
+// (FIMG_F_SECTOR_MAP); restore uses it to skip programming erased sectors.
+typedef enum {
+    SC_NONE = 0,    // not classified
+    SC_BLANK,       // all 0xFF: erased
+    SC_ZERO,        // all 0x00
+    SC_UNIFORM,     // one other byte value throughout
+    SC_LOW,         // code, text, tables, sparse data
+    SC_HIGH,        // compressed or encrypted
+    SC_COUNT
+} sector_class_t;
+
+static const char *const sector_class_names[SC_COUNT] = {
+    "none", "blank", "zero", "uniform", "low-entropy", "high-entropy"
+};
+
+#define SC_HIGH_Q8   1920u      // 7.5 bits/byte, in 1/256 bit
+
+typedef struct {
+    uint16_t *hist;             // 256 bins of the sector being filled
+    uint8_t  *map;              // two classes per byte, even sector in the low nibble
+    uint32_t  sectors;
+    uint32_t  sector;           // index of the sector being filled
+    uint32_t  fill;             // bytes of it seen so far
+    uint32_t  count[SC_COUNT];
+} sector_map_t;
+
+// log2(1 + i/32) in 1/256 bit
+static const uint8_t log2_frac_q8[32] = {
+      0,  11,  22,  33,  44,  54,  63,  73,  82,  92, 100, 109, 118, 126, 134, 142,
+    150, 157, 165, 172, 179, 186, 193, 200, 207, 213, 220, 226, 232, 238, 244, 250,
+};
+
+// log2(c) in 1/256 bit for c >= 1; exact to the table below 64, within 0.05 bit above
+static uint32_t log2_q8(uint32_t c) {
+    uint32_t e = 31u - (uint32_t)__builtin_clz(c);
+    uint32_t i = (e >= 5) ? (c >> (e - 5)) & 31u : (c << (5 - e)) & 31u;
+    return (e << 8) + log2_frac_q8[i];
+}
+
+static sector_class_t sector_classify(const uint16_t *hist, uint32_t n) {
+    if (hist[0xFF] == n) return SC_BLANK;
+    if (hist[0x00] == n) return SC_ZERO;
+
+    // Shannon entropy of the byte histogram: log2(n) - sum(c * log2(c)) / n
+    uint32_t sum = 0;
+    for (int v = 0; v < 256; v++) {
+        uint32_t c = hist[v];
+        if (c == n) return SC_UNIFORM;
+        if (c > 1) sum += c * log2_q8(c);
+    }
+    uint32_t total = n * log2_q8(n);
+    uint32_t h = (total > sum) ? (total - sum) / n : 0;
+    return (h >= SC_HIGH_Q8) ? SC_HIGH : SC_LOW;
+}
+
+static inline sector_class_t smap_get(const uint8_t *map, uint32_t s) {
+    return (sector_class_t)((map[s >> 1] >> ((s & 1u) * 4u)) & 0x0Fu);
+}
+
+static bool smap_begin(sector_map_t *sm, uint32_t image_size) {
+    memset(sm, 0, sizeof(*sm));
+    sm->sectors = smap_sectors(image_size);
+    sm->hist = (uint16_t*)calloc(256, sizeof(uint16_t));
+    sm->map  = (uint8_t*)calloc(smap_bytes(image_size), 1);
+    if (sm->hist && sm->map) return true;
+    free(sm->hist);
+    free(sm->map);
+    memset(sm, 0, sizeof(*sm));
+    return false;
+}
+
+static void smap_close_sector(sector_map_t *sm) {
+    if (!sm->fill || sm->sector >= sm->sectors) return;
+    sector_class_t c = sector_classify(sm->hist, sm->fill);
+    sm->map[sm->sector >> 1] |= (uint8_t)(c << ((sm->sector & 1u) * 4u));
+    sm->count[c]++;
+    sm->sector++;
+    sm->fill = 0;
+    memset(sm->hist, 0, 256 * sizeof(uint16_t));
+}
+
+// stream in order; a slice may end anywhere inside a sector
+static void smap_feed(sector_map_t *sm, const uint8_t *p, uint32_t n) {
+    if (!sm->hist) return;
+    while (n) {
+        uint32_t k = FLASH_SECTOR_SIZE - sm->fill;
+        if (k > n) k = n;
+        uint16_t *hist = sm->hist;
+        for (uint32_t i = 0; i < k; i++) hist[p[i]]++;
+        sm->fill += k;
+        p += k;
+        n -= k;
+        if (sm->fill == FLASH_SECTOR_SIZE) smap_close_sector(sm);
+    }
+}
+
+// end of image: classify a short last sector
+static void smap_finish(sector_map_t *sm) {
+    if (sm->hist) smap_close_sector(sm);
+}
+
+static void smap_free(sector_map_t *sm) {
+    free(sm->hist);
+    free(sm->map);
+    memset(sm, 0, sizeof(*sm));
+}
+
+// block header + packed classes, appended after the CRC trailer
+static bool smap_write(FIL *fp, const sector_map_t *sm, uint32_t image_size) {
+    fimg_smap_t b;
+    UINT bw = 0;
+    uint32_t len = smap_bytes(image_size);
+    memcpy(b.magic, "SMAP", 4);
+    b.sector_size = FLASH_SECTOR_SIZE;
+    b.bits        = 4;
+    b.reserved    = 0;
+    b.sectors     = sm->sectors;
+    b.crc         = crc32_calc(0, sm->map, len);
+    return f_write(fp, &b, sizeof(b), &bw) == FR_OK && bw == sizeof(b) &&
+           f_write(fp, sm->map, len, &bw) == FR_OK && bw == len;
+}
+
+static void smap_print(const sector_map_t *sm) {
+    printf("Sectors:");
+    for (int c = SC_BLANK; c < SC_COUNT; c++)
+        printf("%s %u %s", c == SC_BLANK ? "" : ",", sm->count[c], sector_class_names[c]);
+    printf("\n");
+}
+
+// ---- backup job: entire flash → /FLASHIMG/<stamp>_<jedec>.fimg ----
+typedef struct {
+    FIL            fp;
+    bool           fp_open;
+    flashimg_hdr_t h;
+    char           name[128];
+    uint8_t       *buf;
+    uint32_t       fill;      // bytes waiting in buf (flushed every CHUNK_BYTES)
+    uint32_t       addr;      // next DUT address to read
+    uint32_t       crc;
+    sector_map_t   smap;
+} backup_ctx_t;
+
+static backup_ctx_t bk;
+
+static void backup_cleanup(job_t *job) {
+    if (bk.fp_open) {
+        f_close(&bk.fp);
+        bk.fp_open = false;
+    }
+    free(bk.buf);
+    bk.buf = NULL;
+    sig_free();
+    smap_free(&bk.smap);
+
+    // never leave a truncated image behind, choose_latest_image() would pick it
+    if (job->rc != 0 && bk.name[0]) {
+        f_unlink(bk.name);
+        printf("Removed incomplete %s\n", bk.name);
+    }
+}
+
+static int backup_step(job_t *job) {
+    const uint32_t size = bk.h.image_size;
+    UINT bw = 0;
+
+    uint32_t n = size - bk.addr;
+    if (n > JOB_SLICE_BYTES)          n = JOB_SLICE_BYTES;
+    if (n > CHUNK_BYTES - bk.fill)    n = CHUNK_BYTES - bk.fill;
+
+    if (!flash_dut_read(bk.addr, bk.buf + bk.fill, n)) {
+        printf("Flash read failed @0x%08x\n", bk.addr);
+        return -7;
+    }
+    bk.crc   = crc32_update(bk.crc, bk.buf + bk.fill, n);
+    sig_feed(bk.addr, bk.buf + bk.fill, n);
+    smap_feed(&bk.smap, bk.buf + bk.fill, n);
+    bk.fill += n;
+    bk.addr += n;
+    job->done = bk.addr;
+
+    if (bk.fill == CHUNK_BYTES || bk.addr == size) {
+        if (sd_write(&bk.fp, bk.buf, bk.fill, &bw) != FR_OK || bw != bk.fill) {
+            printf("SD write failed.\n");
+            return -8;
+        }
+        bk.fill = 0;
+    }
+    if (bk.addr < size) return JOB_CONTINUE;
+    printf("\n");
+
+    // write CRC trailer
+    if (f_write(&bk.fp, &bk.crc, sizeof(bk.crc), &bw) != FR_OK || bw != sizeof(bk.crc)) {
+        printf("CRC write failed.\n");
+        return -9;
+    }
+
+    if (bk.smap.map) {
+        smap_finish(&bk.smap);
+        if (!smap_write(&bk.fp, &bk.smap, size)) {
+            printf("Sector map write failed.\n");
+            return -9;
+        }
+        bk.h.flags |= FIMG_F_SECTOR_MAP;
+    }
+
+    // backfill header CRC (and flags) at offset 0
+    bk.h.crc32_all = bk.crc;
+    f_lseek(&bk.fp, 0);
+    f_write(&bk.fp, &bk.h, sizeof(bk.h), &bw);
+
+    f_close(&bk.fp);
+    bk.fp_open = false;
+    printf("Backup OK: %s (size=%u, crc=0x%08x)\n", bk.name, size, bk.crc);
+    if (bk.smap.map) smap_print(&bk.smap);
+
+    if (sig.delta) {
+        char map[136];
+        sig_finish();
+        sig_map_path(map, sizeof(map), bk.name);
+        if (!sig_save(map)) {
+            printf("Could not write %s\n", map);
+        } else {
+            printf("Structures: %d in %s", sig.nhits, map);
+            if (sig.dropped) printf(" (%u more not recorded)", sig.dropped);
+            printf("\n");
+            sig_print(16);
+        }
+    }
+    return 0;
+}
+
+// Prepare and start the backup job. Returns 0 once the job is running.
+static int backup_flash_to_sd(void) {
+    if (job_busy()) {
+        printf("Busy: %s still running.\n", job_slot.name);
+        return -1;
+    }
+    if (!fs_mount_once()) {
+        printf("SD mount failed.\n");
+        return -1;
+    }
+    if (!flash_dut_init()) {
+        printf("Flash init failed.\n");
+        return -2;
+    }
+
+    jedec_info_t id;
+    if (!flash_dut_read_jedec(&id)) {
+        printf("JEDEC read failed.\n");
+        return -3;
+    }
+
+    uint32_t flash_sz = 16u * 1024u * 1024u;   // default 16MB
+    uint32_t sfdp = 0;
+    if (flash_dut_probe_capacity_sfdp(&sfdp) && sfdp) {
+        flash_sz = sfdp;
+    } else {
+        uint32_t by_jedec = flash_calculate_capacity(id.capacity_id);
+        if (by_jedec) flash_sz = by_jedec;
+    }
+
+    //makes sure sd card is there
+    ensure_folder();
+    char stamp[32]; fmt_time(stamp, sizeof(stamp));
+
+    memset(&bk, 0, sizeof(bk));
+    snprintf(bk.name, sizeof(bk.name), "%s/%s_%02x%02x%02x.fimg",
+             DUMP_FOLDER, stamp, id.manuf_id, id.mem_type, id.capacity_id);
+
+    UINT bw = 0;
+    if (f_open(&bk.fp, bk.name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        printf("Open %s failed\n", bk.name);
+        return -4;
+    }
+
+    memcpy(bk.h.magic, "FIMGv1\0", 8);
+    bk.h.jedec[0]    = id.manuf_id;
+    bk.h.jedec[1]    = id.mem_type;
+    bk.h.jedec[2]    = id.capacity_id;
+    bk.h.flash_size  = flash_sz;
+    bk.h.chunk_size  = CHUNK_BYTES;
+    bk.h.image_size  = flash_sz;
+    bk.h.crc32_all   = 0;
+
+    if (f_write(&bk.fp, &bk.h, sizeof(bk.h), &bw) != FR_OK || bw != sizeof(bk.h)) {
+        f_close(&bk.fp);
+        printf("Header write failed.\n");
+        return -5;
+    }
+
+    bk.buf = (uint8_t*)malloc(CHUNK_BYTES);
+    if (!bk.buf) {
+        f_close(&bk.fp);
+        printf("OOM.\n");
+        return -6;
+    }
+    bk.fp_open = true;
+    if (!sig_begin()) printf("No RAM for the signature scan, backing up without a structure map.\n");
+    if (!smap_begin(&bk.smap, flash_sz)) printf("No RAM for the sector map, backing up without one.\n");
+
+    job_t *job = job_start("backup", backup_step, backup_cleanup);
+    job_set_stage(job, "Backup", flash_sz, true);
+    printf("Backing up to %s (press x to abort)\n", bk.name);
+    return 0;
+}
+
+// choose the newest .fimg from /FLASHIMG
+static int choose_latest_image(char *out, size_t n) {
+    DIR d; FILINFO f;
+    WORD best_date = 0, best_time = 0;
+    char best_path[128] = {0};
+
+    if (f_opendir(&d, DUMP_FOLDER) != FR_OK) return -1;
 
     while (f_readdir(&d, &f) == FR_OK && f.fname[0]) {
-        if (!strstr(f.fname, ".fimg")) continue;
+        if (!is_fimg_name(f.fname)) continue;
 
         bool newer = false;
 
@@ -551,9 +1825,238 @@ static int choose_latest_image(char *out, size_t n) {
     return 0;
 }
 
-// restore from .fimg and print final CRC(file) vs CRC(flash)
-// name == NULL or "" → auto-pick latest
-static int restore_flash_from_sd(const char *name) {
+// bytes of `left` that can be programmed at addr without crossing a page
+static inline uint32_t page_span(uint32_t addr, uint32_t left) {
+    uint32_t room = FLASH_PAGE_SIZE - (addr & (FLASH_PAGE_SIZE - 1));
+    return (left > room) ? room : left;
+}
+
+// ---- restore job: .fimg → flash, then CRC(file) vs CRC(flash) ----
+enum {
+    RS_VERIFY,      // recompute image CRC from SD, compare header & trailer
+    RS_ERASE,       // one 4K sector per step
+    RS_PROGRAM,     // one page per step
+    RS_CHECK,       // CRC over live flash
+};
+
+typedef struct {
+    FIL            fp;
+    bool           fp_open;
+    flashimg_hdr_t h;
+    char           name[128];
+    uint8_t       *buf;       // h.chunk_size bytes
+    int            phase;
+    uint32_t       pos;       // progress inside the current phase (bytes / address)
+    uint32_t       buf_len;   // RS_PROGRAM: bytes valid in buf
+    uint32_t       buf_off;   // RS_PROGRAM: bytes of buf already programmed
+    uint32_t       crc;
+    bool           verify_only;   // skip erase/program, only compare flash vs image
+    uint8_t       *smap;      // packed sector classes, NULL = program everything
+    uint32_t       skipped;   // RS_PROGRAM: blank sectors left erased
+} restore_ctx_t;
+
+static restore_ctx_t rs;
+
+static void restore_cleanup(job_t *job) {
+    (void)job;
+    if (rs.fp_open) {
+        f_close(&rs.fp);
+        rs.fp_open = false;
+    }
+    free(rs.buf);
+    rs.buf = NULL;
+    free(rs.smap);
+    rs.smap = NULL;
+}
+
+static int restore_step_verify(job_t *job) {
+    UINT br = 0;
+    uint32_t n = rs.h.image_size - rs.pos;
+    if (n > rs.h.chunk_size) n = rs.h.chunk_size;
+
+    if (sd_read(&rs.fp, rs.buf, n, &br) != FR_OK || br != n) {
+        printf("Read fail while computing image CRC.\n");
+        return -8;
+    }
+    rs.crc  = crc32_update(rs.crc, rs.buf, n);
+    rs.pos += n;
+    job->done = rs.pos;
+    if (rs.pos < rs.h.image_size) return JOB_CONTINUE;
+
+    uint32_t crc_file_trailer = 0;
+    if (f_read(&rs.fp, &crc_file_trailer, sizeof(crc_file_trailer), &br) != FR_OK ||
+        br != sizeof(crc_file_trailer)) {
+        printf("CRC trailer read fail.\n");
+        return -9;
+    }
+
+    printf("\n");
+// Compare three CRCs:
+//  - h.crc32_all       : CRC stored in the header
+//  - crc_file_trailer  : CRC stored at the end of the file
+//  - crc_calc          : CRC recomputed from all image data we just read
+// If any mismatch, the .fimg image file is considered corrupted.
+    if (rs.crc != crc_file_trailer || rs.crc != rs.h.crc32_all) {
+        printf("CRC mismatch in image (header/trailer vs recompute)\n");
+        printf("  header   : 0x%08x\n", rs.h.crc32_all);
+        printf("  trailer  : 0x%08x\n", crc_file_trailer);
+        printf("  recompute: 0x%08x\n", rs.crc);
+        catalog_record(rs.name, IMG_BAD, rs.crc);
+        return -10;
+    }
+    printf("Image CRC OK: 0x%08x\n", rs.crc);
+    catalog_record(rs.name, IMG_OK, rs.crc);
+
+    printf("Erasing sectors...\n");
+    rs.phase = RS_ERASE;
+    rs.pos   = 0;
+    job_set_stage(job, "Erased", rs.h.flash_size, true);
+    return JOB_CONTINUE;
+}
+
+static int restore_step_erase(job_t *job) {
+    if (!flash_dut_erase_4k(rs.pos)) {
+        printf("Erase fail @0x%08x\n", rs.pos);
+        return -11;
+    }
+    rs.pos += FLASH_SECTOR_SIZE;
+    job->done = rs.pos;
+    if (rs.pos < rs.h.flash_size) return JOB_CONTINUE;
+
+    printf("\nProgramming...\n");
+    f_lseek(&rs.fp, sizeof(rs.h));   // go back to start of data
+    rs.phase   = RS_PROGRAM;
+    rs.pos     = 0;
+    rs.buf_len = 0;
+    rs.buf_off = 0;
+    job_set_stage(job, "Wrote", rs.h.image_size, true);
+    return JOB_CONTINUE;
+}
+
+static int restore_program_done(job_t *job) {
+    if (rs.skipped) printf("\nProgramming done, %u blank sectors skipped.\n", rs.skipped);
+    else            printf("\nProgramming done.\n");
+    rs.phase = RS_CHECK;
+    rs.pos   = 0;
+    rs.crc   = 0;
+    job_set_stage(job, "CRC", rs.h.image_size, true);
+    return JOB_CONTINUE;
+}
+
+static int restore_step_program(job_t *job) {
+    // refill one chunk from SD once the previous one is fully programmed
+    if (rs.buf_off == rs.buf_len) {
+        UINT br = 0;
+        uint32_t n = rs.h.image_size - rs.pos;
+        if (n > rs.h.chunk_size) n = rs.h.chunk_size;
+
+        // with a sector map, chunks stop at sector ends so blank ones can be
+        // skipped whole: RS_ERASE already left them at 0xFF
+        if (rs.smap) {
+            uint32_t room = FLASH_SECTOR_SIZE - (rs.pos & (FLASH_SECTOR_SIZE - 1));
+            if (n > room) n = room;
+            if (room == FLASH_SECTOR_SIZE && smap_get(rs.smap, rs.pos / FLASH_SECTOR_SIZE) == SC_BLANK) {
+                if (f_lseek(&rs.fp, f_tell(&rs.fp) + n) != FR_OK) {
+                    printf("Seek fail during programming.\n");
+                    return -12;
+                }
+                rs.pos   += n;
+                job->done = rs.pos;
+                rs.skipped++;
+                return (rs.pos < rs.h.image_size) ? JOB_CONTINUE : restore_program_done(job);
+            }
+        }
+        if (sd_read(&rs.fp, rs.buf, n, &br) != FR_OK || br != n) {
+            printf("Read fail during programming.\n");
+            return -12;
+        }
+        rs.buf_len = n;
+        rs.buf_off = 0;
+    }
+
+    // one page-sized write, never crossing a page boundary
+    uint32_t w = page_span(rs.pos, rs.buf_len - rs.buf_off);
+
+    if (!flash_dut_program_page(rs.pos, rs.buf + rs.buf_off, w)) {
+        printf("Prog fail @0x%08x\n", rs.pos);
+        return -13;
+    }
+    rs.buf_off += w;
+    rs.pos     += w;
+    job->done   = rs.pos;
+    if (rs.pos < rs.h.image_size) return JOB_CONTINUE;
+    return restore_program_done(job);
+}
+
+// compute CRC over live flash contents and compare with image CRC
+// stored in image header to confirm flash == image
+static int restore_step_check(job_t *job) {
+    uint32_t n = rs.h.image_size - rs.pos;
+    if (n > JOB_SLICE_BYTES)   n = JOB_SLICE_BYTES;
+    if (n > rs.h.chunk_size)   n = rs.h.chunk_size;
+
+    if (!flash_dut_read(rs.pos, rs.buf, n)) {
+        printf("Flash read failed @0x%08x\n", rs.pos);
+        printf("Final CRC over flash failed\n");
+        return -14;
+    }
+    rs.crc  = crc32_update(rs.crc, rs.buf, n);
+    rs.pos += n;
+    job->done = rs.pos;
+    if (rs.pos < rs.h.image_size) return JOB_CONTINUE;
+
+    printf("\n");
+    printf("CRC(file)=0x%08x  CRC(flash)=0x%08x\n", rs.h.crc32_all, rs.crc);
+    if (rs.crc != rs.h.crc32_all) {
+        printf("WARNING: CRC mismatch between file and flash.\n");
+        return -15;
+    }
+
+    if (rs.verify_only)
+        printf("Verify OK: flash matches image.\n");
+    else
+        printf("Restore OK: flash matches image.\n");
+    return 0;
+}
+
+static int restore_step(job_t *job) {
+    switch (rs.phase) {
+    case RS_VERIFY:  return restore_step_verify(job);
+    case RS_ERASE:   return restore_step_erase(job);
+    case RS_PROGRAM: return restore_step_program(job);
+    case RS_CHECK:   return restore_step_check(job);
+    }
+    return -1;
+}
+
+// Load and check the sector map that follows the CRC trailer, leave the
+// file at the start of the image data. false: no usable map.
+static bool restore_load_smap(void) {
+    fimg_smap_t b;
+    UINT br = 0;
+    uint32_t len = smap_bytes(rs.h.image_size);
+    bool ok = f_lseek(&rs.fp, sizeof(rs.h) + rs.h.image_size + 4u) == FR_OK &&
+              f_read(&rs.fp, &b, sizeof(b), &br) == FR_OK && br == sizeof(b) &&
+              memcmp(b.magic, "SMAP", 4) == 0 && b.sector_size == FLASH_SECTOR_SIZE &&
+              b.bits == 4 && b.sectors == smap_sectors(rs.h.image_size);
+    if (ok) ok = (rs.smap = (uint8_t*)malloc(len)) != NULL;
+    if (ok) ok = f_read(&rs.fp, rs.smap, len, &br) == FR_OK && br == len &&
+                 crc32_calc(0, rs.smap, len) == b.crc;
+    if (f_lseek(&rs.fp, sizeof(rs.h)) != FR_OK) ok = false;
+    if (!ok) {
+        free(rs.smap);
+        rs.smap = NULL;
+    }
+    return ok;
+}
+
+// Open and validate a .fimg for restore/verify, fill rs.
+// name == NULL or "" → auto-pick latest.
+static int restore_open(const char *name) {
+    if (job_busy()) {
+        printf("Busy: %s still running.\n", job_slot.name);
+        return -1;
+    }
     if (!fs_mount_once()) {
         printf("SD mount failed.\n");
         return -1;
@@ -563,170 +2066,619 @@ static int restore_flash_from_sd(const char *name) {
         return -2;
     }
 
-    char path[128];
+    memset(&rs, 0, sizeof(rs));
     if (!name || !*name) {
-        if (choose_latest_image(path, sizeof(path)) != 0) {
+        if (choose_latest_image(rs.name, sizeof(rs.name)) != 0) {
             printf("No .fimg found.\n");
             return -3;
         }
-        name = path;
+    } else {
+        snprintf(rs.name, sizeof(rs.name), "%s", name);
     }
-    printf("Restoring from %s\n", name);
 
-    FIL fp;
     UINT br = 0;
-    if (f_open(&fp, name, FA_READ) != FR_OK) {
-        printf("Open failed\n");
+    if (f_open(&rs.fp, rs.name, FA_READ) != FR_OK) {
+        printf("Open %s failed\n", rs.name);
         return -4;
     }
 
     // ----- Read and validate header -----
-    flashimg_hdr_t h = {0};
-    if (f_read(&fp, &h, sizeof(h), &br) != FR_OK || br != sizeof(h) ||
-        memcmp(h.magic, "FIMGv1\0", 8) != 0) {
-        f_close(&fp);
+    if (f_read(&rs.fp, &rs.h, sizeof(rs.h), &br) != FR_OK || br != sizeof(rs.h) ||
+        memcmp(rs.h.magic, "FIMGv1\0", 8) != 0) {
+        f_close(&rs.fp);
         printf("Bad header.\n");
         return -5;
     }
 
-    if (h.image_size == 0 || h.chunk_size == 0) {
-        f_close(&fp);
+    if (rs.h.image_size == 0 || rs.h.chunk_size == 0) {
+        f_close(&rs.fp);
         printf("Bad sizes in header: image_size=%u chunk_size=%u\n",
-               h.image_size, h.chunk_size);
+               rs.h.image_size, rs.h.chunk_size);
         return -6;
     }
 
-    // ----- Recompute CRC over image data and compare with header & trailer -----
-    uint32_t chunk_bytes = h.chunk_size;
-    uint8_t *buf = (uint8_t*)malloc(chunk_bytes);
-    if (!buf) {
-        f_close(&fp);
+    rs.buf = (uint8_t*)malloc(rs.h.chunk_size);
+    if (!rs.buf) {
+        f_close(&rs.fp);
         printf("OOM.\n");
         return -7;
     }
+    rs.fp_open = true;
+
+    if ((rs.h.flags & FIMG_F_SECTOR_MAP) && !restore_load_smap())
+        printf("Sector map unusable, programming every sector.\n");
+    return 0;
+}
 
-    uint32_t crc_calc   = 0;
-    uint32_t remain     = h.image_size;
-    uint32_t data_start = sizeof(h);
+// Prepare and start the restore job from a .fimg.
+// name == NULL or "" → auto-pick latest. Returns 0 once the job is running.
+static int restore_flash_from_sd(const char *name) {
+    int rc = restore_open(name);
+    if (rc != 0) return rc;
+    printf("Restoring from %s (press x to abort)\n", rs.name);
+
+    job_t *job = job_start("restore", restore_step, restore_cleanup);
+
+    // Already verified by the scrubber and unchanged since: skip re-reading it.
+    // The final CRC over flash still catches anything that went bad later.
+    if (catalog_trusted(rs.name, rs.h.crc32_all)) {
+        printf("Image pre-verified by scrubber, CRC 0x%08x\n", rs.h.crc32_all);
+        printf("Erasing sectors...\n");
+        rs.phase = RS_ERASE;
+        job_set_stage(job, "Erased", rs.h.flash_size, true);
+        return 0;
+    }
 
-    f_lseek(&fp, data_start);
+    rs.phase = RS_VERIFY;
+    job_set_stage(job, "Verify", rs.h.image_size, true);
+    return 0;
+}
 
-    while (remain) {
-        uint32_t n = (remain > chunk_bytes) ? chunk_bytes : remain;
-        if (f_read(&fp, buf, n, &br) != FR_OK || br != n) {
-            free(buf);
-            f_close(&fp);
-            printf("Read fail while computing image CRC.\n");
-            return -8;
+// Compare live flash against a .fimg without writing anything:
+// CRC over flash vs CRC in the image header.
+static int verify_flash_against_sd(const char *name) {
+    int rc = restore_open(name);
+    if (rc != 0) return rc;
+    printf("Verifying flash against %s (press x to abort)\n", rs.name);
+
+    rs.phase       = RS_CHECK;
+    rs.verify_only = true;
+    job_t *job = job_start("verify", restore_step, restore_cleanup);
+    job_set_stage(job, "CRC", rs.h.image_size, true);
+    return 0;
+}
+
+// =====================================================
+// ===============  BACKGROUND IMAGE SCRUBBER ===========
+// =====================================================
+//
+// Idle-time background task: walks /FLASHIMG, re-reads every .fimg that
+// has no current catalog entry, checks header CRC / trailer CRC against a
+// recomputed data CRC and records the result. One slice = one directory
+// entry or SCRUB_SLICE bytes of image data, so a key press is served
+// right after. When a foreground job starts the open file is closed and
+// the check resumes at the same offset afterwards.
+
+#define SCRUB_SLICE      1024u
+#define SCRUB_RESCAN_MS  60000u     // look for new / changed images every minute
+
+enum { SCRUB_SCAN, SCRUB_READ, SCRUB_WAIT };
+
+typedef struct {
+    int            state;
+    DIR            dir;
+    bool           dir_open;
+    FIL            fp;
+    bool           fp_open;
+    FILINFO        fi;           // image being checked
+    char           path[128];
+    flashimg_hdr_t h;
+    uint32_t       pos;          // data bytes checked so far
+    uint32_t       crc;
+    uint32_t       wait_until_ms;
+    uint8_t        buf[SCRUB_SLICE];
+} scrub_ctx_t;
+
+static scrub_ctx_t scrub;
+
+static void scrub_close(void) {
+    if (scrub.fp_open) {
+        f_close(&scrub.fp);
+        scrub.fp_open = false;
+    }
+    if (scrub.dir_open) {
+        f_closedir(&scrub.dir);
+        scrub.dir_open = false;
+    }
+}
+
+// Drop entries for images that disappeared during the last full pass
+static void scrub_prune(void) {
+    bool changed = false;
+    for (int i = 0; i < catalog_count; ) {
+        if (!catalog[i].seen) {
+            catalog[i] = catalog[--catalog_count];
+            changed = true;
+            continue;
         }
-        crc_calc = crc32_update(crc_calc, buf, n);
-        remain  -= n;
+        catalog[i].seen = false;
+        i++;
     }
+    if (changed) catalog_save();
+}
 
-    uint32_t crc_file_trailer = 0;
-    if (f_read(&fp, &crc_file_trailer, sizeof(crc_file_trailer), &br) != FR_OK ||
-        br != sizeof(crc_file_trailer)) {
-        free(buf);
-        f_close(&fp);
-        printf("CRC trailer read fail.\n");
-        return -9;
+static void scrub_result(img_status_t st, const char *why) {
+    scrub_close();
+    catalog_record(scrub.path, st, scrub.crc);
+    if (st == IMG_BAD)
+        printf("\n[SCRUB] %s is CORRUPT (%s)\n", scrub.path, why);
+    scrub.state = SCRUB_SCAN;
+}
+
+// (Re)open the current image at the data offset scrub.pos
+static bool scrub_open(void) {
+    FILINFO now;
+    UINT br = 0;
+    if (f_stat(scrub.path, &now) != FR_OK ||
+        now.fsize != scrub.fi.fsize || now.fdate != scrub.fi.fdate ||
+        now.ftime != scrub.fi.ftime) {
+        return false;   // gone or rewritten meanwhile
     }
+    if (f_open(&scrub.fp, scrub.path, FA_READ) != FR_OK) return false;
+    scrub.fp_open = true;
 
-    
-// Compare three CRCs:
-//  - h.crc32_all       : CRC stored in the header
-//  - crc_file_trailer  : CRC stored at the end of the file
-//  - crc_calc          : CRC recomputed from all image data we just read
-// If any mismatch, the .fimg image file is considered corrupted.
-    if (crc_calc != crc_file_trailer || crc_calc != h.crc32_all) {
-        printf("CRC mismatch in image (header/trailer vs recompute)\n");
-        printf("  header   : 0x%08x\n", h.crc32_all);
-        printf("  trailer  : 0x%08x\n", crc_file_trailer);
-        printf("  recompute: 0x%08x\n", crc_calc);
-        free(buf);
-        f_close(&fp);
-        return -10;
+    if (scrub.pos == 0) {
+        if (f_read(&scrub.fp, &scrub.h, sizeof(scrub.h), &br) != FR_OK || br != sizeof(scrub.h))
+            return false;
+    } else {
+        f_lseek(&scrub.fp, sizeof(scrub.h) + scrub.pos);
     }
-    printf("Image CRC OK: 0x%08x\n", crc_calc);
+    return true;
+}
 
-    // ----- Erase flash (up to flash_size from header) -----
-    printf("Erasing sectors...\n");
-    for (uint32_t a = 0; a < h.flash_size; a += FLASH_SECTOR_SIZE) {
-        if (!flash_dut_erase_4k(a)) {
-            free(buf);
-            f_close(&fp);
-            printf("Erase fail @0x%08x\n", a);
-            return -11;
+static bool scrub_step_scan(void) {
+    if (!scrub.dir_open) {
+        if (f_opendir(&scrub.dir, DUMP_FOLDER) != FR_OK) {
+            scrub.state         = SCRUB_WAIT;
+            scrub.wait_until_ms = hal_time_ms() + SCRUB_RESCAN_MS;
+            return false;
         }
-        if ((a & 0xFFFF) == 0) {
-            printf("Erased %u / %u KiB\r",
-                   (a + FLASH_SECTOR_SIZE) / 1024, h.flash_size / 1024);
+        scrub.dir_open = true;
+    }
+
+    if (f_readdir(&scrub.dir, &scrub.fi) != FR_OK || !scrub.fi.fname[0]) {
+        // full pass done
+        scrub_close();
+        scrub_prune();
+        scrub.state         = SCRUB_WAIT;
+        scrub.wait_until_ms = hal_time_ms() + SCRUB_RESCAN_MS;
+        return true;
+    }
+    if (!is_fimg_name(scrub.fi.fname)) return true;
+
+    catalog_entry_t *e = catalog_find(scrub.fi.fname);
+    if (e) e->seen = true;
+    if (catalog_current(e, &scrub.fi) && e->status != IMG_UNCHECKED) return true;
+
+    snprintf(scrub.path, sizeof(scrub.path), "%s/%s", DUMP_FOLDER, scrub.fi.fname);
+    scrub.pos = 0;
+    scrub.crc = 0;
+    scrub.state = SCRUB_READ;
+    return true;
+}
+
+static bool scrub_step_read(void) {
+    UINT br = 0;
+
+    if (!scrub.fp_open) {
+        bool first = (scrub.pos == 0);
+        if (!scrub_open()) {
+            scrub_close();
+            scrub.state = SCRUB_SCAN;    // picked up again next pass if still there
+            return true;
+        }
+        if (first && (memcmp(scrub.h.magic, "FIMGv1\0", 8) != 0 ||
+                      scrub.h.image_size == 0 ||
+                      scrub.fi.fsize != fimg_file_size(&scrub.h))) {
+            scrub_result(IMG_BAD, "bad header");
+            return true;
         }
     }
-    printf("\nProgramming...\n");
 
-    // ----- Program flash from image -----
-    uint32_t addr   = 0;
-    remain          = h.image_size;
-    f_lseek(&fp, data_start);   // go back to start of data
+    uint32_t n = scrub.h.image_size - scrub.pos;
+    if (n > SCRUB_SLICE) n = SCRUB_SLICE;
+    if (sd_read(&scrub.fp, scrub.buf, n, &br) != FR_OK || br != n) {
+        scrub_result(IMG_BAD, "read error");
+        return true;
+    }
+    scrub.crc  = crc32_update(scrub.crc, scrub.buf, n);
+    scrub.pos += n;
+    if (scrub.pos < scrub.h.image_size) return true;
+
+    uint32_t trailer = 0;
+    if (f_read(&scrub.fp, &trailer, sizeof(trailer), &br) != FR_OK || br != sizeof(trailer)) {
+        scrub_result(IMG_BAD, "no CRC trailer");
+        return true;
+    }
+    if (scrub.crc != trailer || scrub.crc != scrub.h.crc32_all)
+        scrub_result(IMG_BAD, "CRC mismatch");
+    else
+        scrub_result(IMG_OK, NULL);
+    return true;
+}
+
+static bool bg_scrub(void *arg) {
+    (void)arg;
+    if (!fs_mounted) return false;     // don't retry (and print) a failed mount here
+
+    switch (scrub.state) {
+    case SCRUB_SCAN:
+        return scrub_step_scan();
+    case SCRUB_READ:
+        return scrub_step_read();
+    case SCRUB_WAIT:
+        if ((int32_t)(hal_time_ms() - scrub.wait_until_ms) < 0)
+            return false;
+        scrub.state = SCRUB_SCAN;
+        return true;
+    }
+    return false;
+}
 
-    while (remain) {
-        uint32_t n = (remain > chunk_bytes) ? chunk_bytes : remain;
-        if (f_read(&fp, buf, n, &br) != FR_OK || br != n) {
-            free(buf);
-            f_close(&fp);
-            printf("Read fail during programming.\n");
-            return -12;
+// Foreground job starting: release SD handles right away, keep the offset
+static void scrub_yield(void *arg) {
+    (void)arg;
+    scrub_close();
+}
+
+// =====================================================
+// ===============  FILE TRANSFER (BINARY FRAMES) =======
+// =====================================================
+//
+// Menu 'f' moves a file between the SD card and the host in binary frames
+// on the console (same framing as web/serial_stream.py), for the web UI's
+// image download / upload:
+//
+//     00 A5 <len lo> <len hi> <type> <payload>        u32 fields little-endian
+//
+//   get <path> [offset]          SD → host, starting at offset (resume)
+//   put <path> <size> [resume]   host → <path>.part, renamed to <path> once
+//                                all bytes are in and the CRC matches;
+//                                "resume" continues an existing .part
+//
+//   'R' off size     device: ready, the transfer starts at off
+//   'D' off data     file data, either direction, in order
+//   'A' off          receiver has everything below off
+//   'E' size crc     sender: end; crc = CRC-32 of the bytes of this session
+//                    (put: the device answers with its own 'E' when done)
+//   'X' text         either side: abort, with a reason
+//
+// Backpressure: get keeps at most XFER_WINDOW bytes beyond the host's last
+// ack in flight. put stops reading the console while a received frame is
+// not yet on the SD card, so USB flow control holds the host back.
+//
+// The benchmark's host ranking (menu 1, "h") receives its answer through the
+// same parser, see BM_HOST below.
+
+#define XFER_DATA_MAX    1024u             // file bytes per 'D' frame
+#define XFER_WINDOW      (64u * 1024u)     // get: unacked bytes in flight
+#define XFER_ACK_BYTES   (16u * 1024u)     // put: ack (and f_sync) interval
+#define XFER_TIMEOUT_MS  15000u            // no frame from the host → fail
+#define XFER_RX_MAX      (1u + 4u + XFER_DATA_MAX)
+
+enum { XRX_SOF0, XRX_SOF1, XRX_LEN0, XRX_LEN1, XRX_BODY };
+
+typedef struct {
+    bool     on;            // transfer job running: console bytes are frames
+    bool     listen;        // benchmark waiting for the host's ranking frames
+    bool     put;           // host → device
+    FIL      fp;
+    bool     fp_open;
+    char     path[96];
+    char     part[104];     // put: <path>.part
+    uint32_t size;
+    uint32_t start;         // offset this session started at
+    uint32_t pos;           // get: next byte to send, put: next byte expected
+    uint32_t acked;         // get: host has all below, put: last ack sent
+    uint32_t crc;           // CRC-32 of [start, pos)
+    bool     end_sent;      // get: 'E' sent, waiting for the last ack
+    bool     host_abort;    // 'X' came from the host, don't echo one back
+    uint32_t last_rx_ms;
+    // frame parser (console_poll)
+    int      rx_state;
+    uint16_t rx_len;
+    uint16_t rx_fill;
+    bool     rx_ready;      // complete frame waiting for the job step
+    uint8_t  rx[XFER_RX_MAX];
+    uint8_t  tx[4 + 1 + 4 + XFER_DATA_MAX];
+} xfer_ctx_t;
+
+static xfer_ctx_t xf;
+
+// a job is taking frames: console bytes go to the parser, not the menu
+static inline bool xfer_rx_open(void) {
+    return xf.on || xf.listen;
+}
+
+// Send the frame whose payload (after the type byte) is already in xf.tx[5..]
+static void xfer_emit(uint8_t type, size_t n) {
+    size_t len = 1 + n;
+    xf.tx[0] = 0x00;
+    xf.tx[1] = 0xA5;
+    xf.tx[2] = (uint8_t)len;
+    xf.tx[3] = (uint8_t)(len >> 8);
+    xf.tx[4] = type;
+    hal_console_write(xf.tx, 4 + len);
+}
+
+static void xfer_send_words(uint8_t type, uint32_t a, uint32_t b, int words) {
+    put_le32(xf.tx + 5, a);
+    put_le32(xf.tx + 9, b);
+    xfer_emit(type, (size_t)words * 4);
+}
+
+static void xfer_send_error(const char *why) {
+    size_t n = strlen(why);
+    memcpy(xf.tx + 5, why, n);
+    xfer_emit('X', n);
+}
+
+// One console byte while a transfer runs, or inside a frame that arrives
+// after it ended (the host's window still in flight): those are dropped
+// here instead of reaching the menu as keys.
+static void xfer_rx_byte(int c) {
+    switch (xf.rx_state) {
+    case XRX_SOF0:
+        if (c == 0x00)
+            xf.rx_state = XRX_SOF1;
+        else if (xfer_rx_open() && (c == 'x' || c == 'X' || c == 0x03 || c == 0x1B))
+            job_abort();            // typed on a terminal between frames
+        break;
+    case XRX_SOF1:
+        xf.rx_state = (c == 0xA5) ? XRX_LEN0 : (c == 0x00) ? XRX_SOF1 : XRX_SOF0;
+        break;
+    case XRX_LEN0:
+        xf.rx_len   = (uint16_t)c;
+        xf.rx_state = XRX_LEN1;
+        break;
+    case XRX_LEN1:
+        xf.rx_len  |= (uint16_t)(c << 8);
+        xf.rx_fill  = 0;
+        xf.rx_state = (xf.rx_len && xf.rx_len <= XFER_RX_MAX) ? XRX_BODY : XRX_SOF0;
+        break;
+    case XRX_BODY:
+        xf.rx[xf.rx_fill++] = (uint8_t)c;
+        if (xf.rx_fill == xf.rx_len) {
+            xf.rx_ready   = xfer_rx_open();
+            xf.rx_state   = XRX_SOF0;
+            xf.last_rx_ms = hal_time_ms();
         }
+        break;
+    }
+}
 
-        // Split into page-sized writes
-        uint32_t off = 0;
-        while (off < n) {
-            uint32_t page_off = (addr + off) & (FLASH_PAGE_SIZE - 1);
-            uint32_t room     = FLASH_PAGE_SIZE - page_off;
-            uint32_t w        = (n - off > room) ? room : (n - off);
-
-            if (!flash_dut_program_page(addr + off, buf + off, w)) {
-                free(buf);
-                f_close(&fp);
-                printf("Prog fail @0x%08x\n", addr + off);
-                return -13;
-            }
-            off += w;
+// console_poll stops reading while this is true (backpressure)
+static inline bool xfer_rx_full(void) {
+    return xfer_rx_open() && xf.rx_ready;
+}
+
+// byte belongs to the frame parser rather than the menu / abort keys?
+static inline bool xfer_rx_wants(int c) {
+    return xfer_rx_open() || xf.rx_state != XRX_SOF0 || c == 0x00;
+}
+
+static void xfer_cleanup(job_t *job) {
+    if (xf.fp_open) {
+        f_close(&xf.fp);
+        xf.fp_open = false;
+    }
+    // tell the host, unless it was the host that gave up
+    if (job->rc != 0 && !xf.host_abort)
+        xfer_send_error(job->rc == JOB_ABORTED ? "aborted" : "failed");
+    if (job->rc != 0 && xf.put)
+        printf("\n[XFER] Kept %s (%u bytes), 'put ... resume' continues it\n", xf.part, xf.pos);
+    xf.on = false;
+}
+
+// Host sent 'X': stop without answering
+static int xfer_host_abort(void) {
+    xf.host_abort = true;
+    printf("\n[XFER] Host aborted: %.*s\n", (int)(xf.rx_len - 1), (const char *)xf.rx + 1);
+    return -3;
+}
+
+static bool xfer_timed_out(void) {
+    if (hal_time_ms() - xf.last_rx_ms < XFER_TIMEOUT_MS) return false;
+    printf("\n[XFER] No frame from the host for %u s.\n", XFER_TIMEOUT_MS / 1000);
+    return true;
+}
+
+// get: read the next piece from SD and send it, within the ack window
+static int xfer_step_get(job_t *job) {
+    if (xf.rx_ready) {
+        xf.rx_ready = false;
+        if (xf.rx[0] == 'X') return xfer_host_abort();
+        if (xf.rx[0] == 'A' && xf.rx_len >= 5) {
+            uint32_t off = get_le32(xf.rx + 1);
+            if (off > xf.acked && off <= xf.pos) xf.acked = off;
+        }
+    }
+
+    if (xf.end_sent) {
+        if (xf.acked == xf.size) return 0;
+    } else if (xf.pos == xf.size) {
+        xfer_send_words('E', xf.size, xf.crc, 2);
+        xf.end_sent = true;
+        return JOB_CONTINUE;
+    } else if (xf.pos - xf.acked < XFER_WINDOW) {
+        UINT n = xf.size - xf.pos, br = 0;
+        if (n > XFER_DATA_MAX) n = XFER_DATA_MAX;
+        uint8_t *data = xf.tx + 9;
+        if (sd_read(&xf.fp, data, n, &br) != FR_OK || br != n) {
+            printf("\n[XFER] SD read failed @%u\n", xf.pos);
+            return -4;
         }
+        xf.crc = crc32_update(xf.crc, data, n);
+        put_le32(xf.tx + 5, xf.pos);
+        xfer_emit('D', 4 + n);
+        xf.pos  += n;
+        job->done = xf.pos;
+        return JOB_CONTINUE;
+    }
+
+    if (xfer_timed_out()) return -2;
+    hal_idle();             // window full: wait for the host's ack
+    return JOB_CONTINUE;
+}
 
-        addr   += n;
-        remain -= n;
+// put: one received frame → SD, ack every XFER_ACK_BYTES
+static int xfer_step_put(job_t *job) {
+    if (!xf.rx_ready) {
+        if (xfer_timed_out()) return -2;
+        hal_idle();
+        return JOB_CONTINUE;
+    }
 
-        if ((addr & 0xFFFF) == 0) {
-            printf("Wrote %u / %u KiB\r", addr / 1024, h.flash_size / 1024);
+    const uint8_t *f = xf.rx;
+    uint16_t len = xf.rx_len;
+    xf.rx_ready = false;        // console_poll may read the next frame now
+
+    if (f[0] == 'X') return xfer_host_abort();
+
+    if (f[0] == 'D' && len > 5) {
+        uint32_t off = get_le32(f + 1);
+        UINT n = len - 5u, bw = 0;
+        if (off != xf.pos || n > xf.size - xf.pos) {
+            printf("\n[XFER] Data for @%u, expected @%u\n", off, xf.pos);
+            return -5;
+        }
+        if (sd_write(&xf.fp, f + 5, n, &bw) != FR_OK || bw != n) {
+            printf("\n[XFER] SD write failed @%u\n", xf.pos);
+            return -6;
         }
+        xf.crc = crc32_update(xf.crc, f + 5, n);
+        xf.pos += n;
+        job->done = xf.pos;
+        if (xf.pos - xf.acked >= XFER_ACK_BYTES || xf.pos == xf.size) {
+            f_sync(&xf.fp);     // resume restarts from what is really on the card
+            xf.acked = xf.pos;
+            xfer_send_words('A', xf.pos, 0, 1);
+        }
+        return JOB_CONTINUE;
     }
-    printf("\nProgramming done.\n");
-
-    // ----- Final CRC over live flash -----
-    // compute CRC over live flash contents and compare with image CRC
-    // store in image header to confirm flash == image 
-    uint32_t crc_flash = 0;
-    int crc_rc = crc32_over_flash(h.image_size, h.chunk_size, &crc_flash);
-    if (crc_rc != 0) {
-        free(buf);
-        f_close(&fp);
-        printf("Final CRC over flash failed (rc=%d)\n", crc_rc);
-        return -14;
+
+    if (f[0] == 'E' && len >= 9) {
+        uint32_t size = get_le32(f + 1), crc = get_le32(f + 5);
+        if (size != xf.size || xf.pos != xf.size) {
+            printf("\n[XFER] Host ended at %u of %u bytes, have %u\n", size, xf.size, xf.pos);
+            return -7;
+        }
+        if (crc != xf.crc) {
+            printf("\n[XFER] CRC mismatch: host 0x%08x, received 0x%08x\n", crc, xf.crc);
+            return -8;
+        }
+        f_close(&xf.fp);
+        xf.fp_open = false;
+
+        // f_rename does not replace: move an existing file aside, drop it
+        // only once the upload has its name
+        char old[sizeof(xf.part)];
+        FILINFO fi;
+        bool had_old = f_stat(xf.path, &fi) == FR_OK;
+        snprintf(old, sizeof(old), "%s.old", xf.path);
+        if (had_old) {
+            f_unlink(old);
+            if (f_rename(xf.path, old) != FR_OK) {
+                printf("\n[XFER] Cannot move %s aside, upload kept as %s\n", xf.path, xf.part);
+                return -9;
+            }
+        }
+        if (f_rename(xf.part, xf.path) != FR_OK) {
+            printf("\n[XFER] Rename %s -> %s failed\n", xf.part, xf.path);
+            if (had_old) f_rename(old, xf.path);
+            return -9;
+        }
+        if (had_old) f_unlink(old);
+        xfer_send_words('E', xf.size, xf.crc, 2);
+        printf("\n[XFER] Received %s (%u bytes, %u this session)\n",
+               xf.path, xf.size, xf.size - xf.start);
+        return 0;
     }
+    return JOB_CONTINUE;        // unknown frame type: ignore
+}
 
-    printf("CRC(file)=0x%08x  CRC(flash)=0x%08x\n", h.crc32_all, crc_flash);
+static int xfer_step(job_t *job) {
+    return xf.put ? xfer_step_put(job) : xfer_step_get(job);
+}
 
-    free(buf);
-    f_close(&fp);
+// "get <path> [offset]" / "put <path> <size> [resume]" → transfer job
+static int xfer_start(const char *line) {
+    char op[8] = "", name[96] = "", opt[16] = "";
+    unsigned long num = 0;
 
-    if (crc_flash != h.crc32_all) {
-        printf("WARNING: CRC mismatch between file and flash.\n");
-        return -15;
+    if (job_busy()) {
+        printf("Busy: %s still running.\n", job_slot.name);
+        return -1;
+    }
+    int nf = sscanf(line, "%7s %95s %lu %15s", op, name, &num, opt);
+    bool put = !strcmp(op, "put");
+    if (nf < 2 || (!put && strcmp(op, "get") != 0) || (put && nf < 3)) {
+        printf("[XFER] Usage: get <path> [offset]  |  put <path> <size> [resume]\n");
+        return -1;
+    }
+    if (!fs_mount_once()) {
+        printf("SD not mounted.\n");
+        return -1;
     }
 
-    printf("Restore OK: flash matches image.\n");
+    memset(&xf, 0, sizeof(xf));
+    xf.put = put;
+    // bare file name → inside DUMP_FOLDER, like menu 4
+    if (strchr(name, '/') == NULL)
+        snprintf(xf.path, sizeof(xf.path), "%s/%s", DUMP_FOLDER, name);
+    else
+        snprintf(xf.path, sizeof(xf.path), "%s", name);
+
+    if (put) {
+        xf.size = (uint32_t)num;
+        snprintf(xf.part, sizeof(xf.part), "%s.part", xf.path);
+        ensure_folder();
+
+        FILINFO fi;
+        BYTE mode = FA_CREATE_ALWAYS | FA_WRITE;
+        if (!strcmp(opt, "resume") && f_stat(xf.part, &fi) == FR_OK && fi.fsize <= xf.size) {
+            xf.start = (uint32_t)fi.fsize;
+            mode = FA_OPEN_ALWAYS | FA_WRITE;
+        }
+        if (f_open(&xf.fp, xf.part, mode) != FR_OK || f_lseek(&xf.fp, xf.start) != FR_OK) {
+            printf("[XFER] Open %s failed\n", xf.part);
+            return -4;
+        }
+    } else {
+        if (f_open(&xf.fp, xf.path, FA_READ) != FR_OK) {
+            printf("[XFER] Open %s failed\n", xf.path);
+            return -4;
+        }
+        xf.size = (uint32_t)f_size(&xf.fp);
+        xf.start = (num <= xf.size) ? (uint32_t)num : xf.size;
+        if (f_lseek(&xf.fp, xf.start) != FR_OK) {
+            f_close(&xf.fp);
+            printf("[XFER] Seek in %s failed\n", xf.path);
+            return -4;
+        }
+    }
+    xf.fp_open    = true;
+    xf.pos        = xf.start;
+    xf.acked      = xf.start;
+    xf.last_rx_ms = hal_time_ms();
+    xf.on         = true;
+
+    job_t *job = job_start("transfer", xfer_step, xfer_cleanup);
+    job_set_stage(job, put ? "Receive" : "Send", xf.size, true);
+    job->done = xf.start;
+    printf("[XFER] %s %s from %u of %u bytes (press x to abort)\n",
+           put ? "put" : "get", xf.path, xf.start, xf.size);
+    xfer_send_words('R', xf.start, xf.size, 2);
     return 0;
 }
 
@@ -831,6 +2783,22 @@ typedef struct {
     float score;
 } RankItem;
 
+// insert an entry into the sorted top-N list if its score is better (lower)
+// than one of the current best[k].score values
+static void rank_insert(RankItem *best, int topN, int index, float sc) {
+    for (int k = 0; k < topN; k++) {
+        if (sc < best[k].score) {       //compare scores to keep top N
+            //move worst score down the list
+            for (int m = topN - 1; m > k; m--) {
+                best[m] = best[m - 1];
+            }
+            best[k].index = index;
+            best[k].score = sc;
+            break;
+        }
+    }
+}
+
 static void print_match_summary(const ChipEntry* db,
                                 uint8_t manf, uint8_t dev0, uint8_t dev1,
                                 double read_us, double prog_ms, double erase_ms,
@@ -865,81 +2833,127 @@ static void print_match_summary(const ChipEntry* db,
 }
 
 // ====================== BENCHMARK + CSV WORKFLOW ======================
-// This function performs the main benchmarking
-// and then runs CSV matching for forensic identification of flash chips
-static void run_main_workflow(uint8_t manf_id,
-                              uint8_t mem_type,
-                              uint8_t capacity_code,
-                              int     topN)
-{
-    printf("\n--- Starting benchmark ---\n");
-    const uint32_t target_addr = 0x000000;
-    uint8_t page_buf[FLASH_PAGE_SIZE];
-    for (int i = 0; i < FLASH_PAGE_SIZE; i++) page_buf[i] = i;
+// This job performs the main benchmarking
+// and then runs CSV matching for forensic identification of flash chips.
+// Every trial, CSV batch and ranking slice is one scheduler step.
+//
+// With host ranking ("3h" at the prompt, "identify 3 host" in a script) the
+// job prints a [BENCH] fingerprint line and waits for the web server to rank
+// it against the full datasheet database (host/chip_ident.cpp via
+// web/ident.py). The answer comes back in binary frames (see FILE TRANSFER):
+//
+//   'M' rank(u8) row score(f32) manf dev0 dev1 read prog prog_max erase erase_max(f32) name
+//   'N' rows         end of the list, rows ranked
+//   'X' text         no ranking available
+//
+// An 'X', or no frame for HOST_RANK_TIMEOUT_MS, falls back to the on-device
+// CSV ranking below, so identification still works without a host.
+
+// 30 trials for erase and program
+#define ERASE_TRIALS 30
+#define PROG_TRIALS  30
+// 100 trials for read
+#define READ_TRIALS  100
+
+#define BATCH_SIZE   25      // CSV rows loaded per step
+#define RANK_SLICE   100     // DB rows scored per step
+#define HOST_RANK_TIMEOUT_MS 10000u
+
+enum { BM_ERASE, BM_PROG, BM_READ, BM_HOST, BM_DB_LOAD, BM_RANK };
 
-    // 30 trials for erase and program
-    #define ERASE_TRIALS 30 
-    #define PROG_TRIALS  30 
-    // 100 trials for read
-    #define READ_TRIALS  100
+// variables to check total, minimum, maximum timing value; the samples
+// themselves are kept for the percentiles in the [BENCH] report
+typedef struct {
+    double total_us, min_us, max_us;
+    float  samples_us[READ_TRIALS];
+    int    n;
+} op_stats_t;
 
-    // variables to check total, minimum, maximum timing value
-    uint64_t start, end;
-    double erase_total_us = 0, erase_min_us = 1e12, erase_max_us = 0;
-    double prog_total_us  = 0, prog_min_us  = 1e12, prog_max_us  = 0;
-    double read_total_us  = 0, read_min_us  = 1e12, read_max_us  = 0;
+typedef struct {
+    uint8_t    obs_manf, obs_dev0, obs_dev1;
+    int        topN;
+    int        phase;
+    int        trial;
+    uint8_t    page_buf[FLASH_PAGE_SIZE];
+    op_stats_t erase, prog, read;
+    double     obs_read_us, obs_prog_ms, obs_erase_ms;
+    FIL        file_sd;
+    bool       file_open;
+    int        rank_pos;
+    RankItem   best[MAX_MATCHES];
+    bool       reported;      // [BENCH] begin printed, end still owed
+    bool       host_rank;     // ask the host first (BM_HOST)
+    uint32_t   host_wait_ms;  // start of the wait, or the last frame
+    ChipEntry  host[MAX_MATCHES];       // host matches, best[k].index = k
+    int        host_row[MAX_MATCHES];   // their rows in the host's database
+} bench_ctx_t;
+
+static bench_ctx_t bm;
+
+static void stats_reset(op_stats_t *s) {
+    s->total_us = 0;
+    s->min_us   = 1e12;
+    s->max_us   = 0;
+    s->n        = 0;
+}
 
-    // ==================== ERASE BENCHMARK ====================
-    // Erase trials
-    // measure how long a sector erase tables, repeated 30x
-    for (int i = 0; i < ERASE_TRIALS; i++) {
-        start = time_us_64();
-        flash_dut_erase_4k(target_addr);
-        end   = time_us_64();
-        double elapsed = (double)(end - start);
-        erase_total_us += elapsed;
-        if (elapsed < erase_min_us) erase_min_us = elapsed;
-        if (elapsed > erase_max_us) erase_max_us = elapsed;
-    }
+static void stats_add(op_stats_t *s, double elapsed) {
+    s->total_us += elapsed;
+    if (elapsed < s->min_us) s->min_us = elapsed;
+    if (elapsed > s->max_us) s->max_us = elapsed;
+    if (s->n < READ_TRIALS) s->samples_us[s->n++] = (float)elapsed;
+}
 
-    // ==================== PROGRAM BENCHMARK ====================
-    // writes one page (256 bytes) at target_addr, repeated 30x to measure program time
-    // Program trials
-    for (int i = 0; i < PROG_TRIALS; i++) {
-        start = time_us_64();
-        flash_dut_program_page(target_addr, page_buf, FLASH_PAGE_SIZE);
-        end   = time_us_64();
-        double elapsed = (double)(end - start);
-        prog_total_us += elapsed;
-        if (elapsed < prog_min_us) prog_min_us = elapsed;
-        if (elapsed > prog_max_us) prog_max_us = elapsed;
+// Nearest-rank percentile; sorts the samples in place (insertion sort, n <= 100)
+static double stats_pct(op_stats_t *s, int pct) {
+    for (int i = 1; i < s->n; i++) {
+        float v = s->samples_us[i];
+        int   j = i;
+        for (; j > 0 && s->samples_us[j - 1] > v; j--) s->samples_us[j] = s->samples_us[j - 1];
+        s->samples_us[j] = v;
     }
+    if (s->n == 0) return 0.0;
+    int k = (pct * s->n + 99) / 100;
+    return s->samples_us[k > 0 ? k - 1 : 0];
+}
 
-    // ==================== READ BENCHMARK ====================
-    // reads one page (256 bytes) at target_addr, repeated 100x to measure read time
-    // Read trials
-    for (int i = 0; i < READ_TRIALS; i++) {
-        start = time_us_64();
-        flash_dut_read(target_addr, page_buf, FLASH_PAGE_SIZE);
-        end   = time_us_64();
-        double elapsed = (double)(end - start);
-        read_total_us += elapsed;
-        if (elapsed < read_min_us) read_min_us = elapsed;
-        if (elapsed > read_max_us) read_max_us = elapsed;
+// Machine-readable result line, picked up by the web server's run history
+static void bench_report_op(const char *op, op_stats_t *s) {
+    printf("[BENCH] op=%s n=%d min_us=%.2f avg_us=%.2f p50_us=%.2f p90_us=%.2f "
+           "p99_us=%.2f max_us=%.2f\n",
+           op, s->n, s->min_us, s->n ? s->total_us / s->n : 0.0,
+           stats_pct(s, 50), stats_pct(s, 90), stats_pct(s, 99), s->max_us);
+}
+
+static void bench_cleanup(job_t *job) {
+    xf.listen = false;
+    if (bm.reported) {
+        printf("[BENCH] end rc=%d\n", job->rc);
+        bm.reported = false;
+    }
+    if (bm.file_open) {
+        f_close(&bm.file_sd);
+        bm.file_open = false;
     }
+}
 
+static void bench_print_summary(void) {
     // Calculate average times for each operation
-    double erase_avg_us = erase_total_us / ERASE_TRIALS;
-    double prog_avg_us  = prog_total_us  / PROG_TRIALS;
-    double read_avg_us  = read_total_us  / READ_TRIALS;
+    double erase_avg_us = bm.erase.total_us / ERASE_TRIALS;
+    double prog_avg_us  = bm.prog.total_us  / PROG_TRIALS;
+    double read_avg_us  = bm.read.total_us  / READ_TRIALS;
 
     // Convert to milliseconds for easier comparison with datasheet specs
-    double erase_min_ms = erase_min_us / 1000.0;
-    double erase_max_ms = erase_max_us / 1000.0;
-    double erase_avg_ms = erase_avg_us / 1000.0;
-    double prog_min_ms  = prog_min_us  / 1000.0;
-    double prog_max_ms  = prog_max_us  / 1000.0;
-    double prog_avg_ms  = prog_avg_us  / 1000.0;
+    double erase_min_ms = bm.erase.min_us / 1000.0;
+    double erase_max_ms = bm.erase.max_us / 1000.0;
+    double erase_avg_ms = erase_avg_us    / 1000.0;
+    double prog_min_ms  = bm.prog.min_us  / 1000.0;
+    double prog_max_ms  = bm.prog.max_us  / 1000.0;
+    double prog_avg_ms  = prog_avg_us     / 1000.0;
+
+    bm.obs_read_us  = read_avg_us;
+    bm.obs_prog_ms  = prog_avg_ms;
+    bm.obs_erase_ms = erase_avg_ms;
 
     // Display the summary table for erase, program, and read operations
     printf("\n================ Benchmark Summary ================\n");
@@ -950,49 +2964,57 @@ static void run_main_workflow(uint8_t manf_id,
     printf("Program (ms) x%-3d |   %8.2f   |  %8.2f   |  %8.2f\n",
            PROG_TRIALS, prog_min_ms, prog_max_ms, prog_avg_ms);
     printf("Read (us) x%-3d  |   %8.2f   |  %8.2f   |  %8.2f\n",
-           READ_TRIALS, read_min_us, read_max_us, read_avg_us);
+           READ_TRIALS, bm.read.min_us, bm.read.max_us, read_avg_us);
     printf("========================================================\n");
 
-    // --- Load CSV database from SD ---
+    printf("[BENCH] begin jedec=%02X%02X%02X\n", bm.obs_manf, bm.obs_dev0, bm.obs_dev1);
+    bench_report_op("erase", &bm.erase);
+    bench_report_op("prog",  &bm.prog);
+    bench_report_op("read",  &bm.read);
+    bm.reported = true;
+}
+
+// --- Load CSV database from SD ---
+static int bench_open_db(void) {
     printf("\n--- Loading database from SD card ---\n");
     if (!fs_mount_once()) {
         printf("ERROR: SD card not mounted!\n");
-        return;
+        return -1;
     }
 
-    FIL file_sd;
-    FRESULT fr = f_open(&file_sd, "Embedded_datasheet.csv", FA_READ);
+    FRESULT fr = f_open(&bm.file_sd, "Embedded_datasheet.csv", FA_READ);
     if (fr != FR_OK) {
         printf("ERROR: Could not open Embedded_datasheet.csv (%d)\n", fr);
-        return;
+        return -2;
     }
-
-    char line[128];
-    #define BATCH_SIZE 25
+    bm.file_open = true;
     chip_count = 0;
 
     // Skip header
-    f_gets(line, sizeof(line), &file_sd);
+    char line[128];
+    f_gets(line, sizeof(line), &bm.file_sd);
+    return 0;
+}
 
-    while (true) {
-        int batch_count = 0;
+// One batch of CSV rows; returns number of rows kept
+static int bench_load_batch(void) {
+    char line[128];
+    int batch_count = 0;
 
-        while (f_gets(line, sizeof(line), &file_sd) &&
-               batch_count < BATCH_SIZE &&
-               chip_count + batch_count < MAX_CHIPS) {
+    while (batch_count < BATCH_SIZE &&
+           chip_count + batch_count < MAX_CHIPS &&
+           f_gets(line, sizeof(line), &bm.file_sd)) {
 
-            if (parse_chip_line(line, &chip_data[chip_count + batch_count])) {
-                batch_count++;
-            } else {
-                printf("Skipped bad CSV line: %s", line);
-            }
+        if (parse_chip_line(line, &chip_data[chip_count + batch_count])) {
+            batch_count++;
+        } else {
+            printf("Skipped bad CSV line: %s", line);
         }
-
-        if (batch_count == 0) break;
-        printf("\n%d entries loaded\n", batch_count); //Print every batch
-        chip_count += batch_count;
     }
+    return batch_count;
+}
 
+static void bench_print_loaded(void) {
     printf("\nTotal entries loaded into local memory: %d\n", chip_count); //Print total chips loaded
 
     printf("\n--- First 5 entries in local ---\n"); //Prints first 5 entries for user to check
@@ -1010,194 +3032,897 @@ static void run_main_workflow(uint8_t manf_id,
         printf("Erase(tSE): %.2f ms\n", c->erase_time_ms);
         printf("Erase(max): %.2f ms\n\n", c->erase_time_ms_max);
     }
+}
+
+// Compare this chip's data against a slice of known chips in the CSV
+// and keep the top N closest matches.
+static void bench_rank_slice(int from, int to) {
+    for (int i = from; i < to; i++) {
+        const ChipEntry *c = &chip_data[i];
+
+        // Skip entries with missing timing data
+        if (c->read_time_us <= 0.0f ||
+            c->write_time_ms <= 0.0f ||
+            c->erase_time_ms <= 0.0f) {
+            continue; //this row not compared
+        }
+
+        float sc = score_entry(c,
+                               bm.obs_manf, bm.obs_dev0, bm.obs_dev1,
+                               bm.obs_read_us, bm.obs_prog_ms, bm.obs_erase_ms);
+
+        rank_insert(bm.best, bm.topN, i, sc);
+    }
+}
+
+// db / rows: chip_data and its row numbers, or the host's matches
+static void bench_print_matches(const ChipEntry *db, const int *rows) {
+    const int     topN         = bm.topN;
+    const uint8_t obs_manf     = bm.obs_manf;
+    const uint8_t obs_dev0     = bm.obs_dev0;
+    const uint8_t obs_dev1     = bm.obs_dev1;
+    const double  obs_read_us  = bm.obs_read_us;
+    const double  obs_prog_ms  = bm.obs_prog_ms;
+    const double  obs_erase_ms = bm.obs_erase_ms;
+    const RankItem *best       = bm.best;
+
+    // Display matching results with performance comparison
+    printf("\n================= TOP %d MATCHES FROM CSV =================\n", topN);
+    printf("Observed JEDEC: 0x%02X 0x%02X 0x%02X\n",
+           obs_manf, obs_dev0, obs_dev1);
+    printf("Observed timings: READ=%.2f us, PROG=%.2f ms, ERASE=%.2f ms\n",
+           obs_read_us, obs_prog_ms, obs_erase_ms);
+    printf("==========================================================\n");
+
+    // Print top N matches
+    for (int k = 0; k < topN; k++) {
+        if (best[k].index < 0) continue;
+
+        const ChipEntry *c = &db[best[k].index];
+        int row = rows ? rows[best[k].index] : best[k].index + 1;
+
+        double db_read_us  = c->read_time_us;
+        double db_prog_ms  = c->write_time_ms;
+        double db_erase_ms = c->erase_time_ms;
+
+        // Compute percentage differences between observed timings and this DB row
+        // This shows how much faster/slower the observed chip is compared to DB
+        double rd_diff = (obs_read_us  - db_read_us)  /
+                         (db_read_us  == 0 ? 1 : db_read_us)  * 100.0;
+        double pr_diff = (obs_prog_ms  - db_prog_ms)  /
+                         (db_prog_ms  == 0 ? 1 : db_prog_ms)  * 100.0;
+        double er_diff = (obs_erase_ms - db_erase_ms) /
+                         (db_erase_ms == 0 ? 1 : db_erase_ms) * 100.0;
+
+        printf("\n[#%d] DB Row %d: %s\n",
+               k + 1, row, c->dev_name);
+        printf("[BENCH] match rank=%d row=%d score=%.4f name=%s\n",
+               k + 1, row, best[k].score, c->dev_name);
+        printf("  JEDEC (DB):   0x%02X 0x%02X 0x%02X\n",
+               c->manf_id, c->device_id[0], c->device_id[1]);
+        printf("  Score:        %.4f (lower is better)\n", best[k].score);
+
+        printf("  DB timings:\n");
+        printf("    READ_typ : %.2f us\n",  c->read_time_us);
+        printf("    PROG_typ : %.2f ms\n",  c->write_time_ms);
+        printf("    PROG_max : %.2f ms\n",  c->write_time_ms_max);
+        printf("    ERASE_typ: %.2f ms\n",  c->erase_time_ms);
+        printf("    ERASE_max: %.2f ms\n",  c->erase_time_ms_max);
+
+        printf("  Compare vs observed:\n");
+        printf("    READ  DB: %8.2f us | OBS: %8.2f us (%+6.1f%%)\n",
+               db_read_us,  obs_read_us,  rd_diff);
+        printf("    PROG  DB: %8.2f ms | OBS: %8.2f ms (%+6.1f%%)\n",
+               db_prog_ms,  obs_prog_ms,  pr_diff);
+        printf("    ERASE DB: %8.2f ms | OBS: %8.2f ms (%+6.1f%%)\n",
+               db_erase_ms, obs_erase_ms, er_diff);
+    }
 
-    f_close(&file_sd);
-    printf("\nIntegration complete.\n");
+    if (best[0].index >= 0) {
+        print_match_summary(db,
+                            obs_manf, obs_dev0, obs_dev1,
+                            obs_read_us, obs_prog_ms, obs_erase_ms,
+                            &best[0]);
+    }
+}
 
-    // --- Chip Identification: TOP N matches ---
-    if (chip_count > 0) {
-        if (topN < 1) topN = 1;
-        if (topN > MAX_MATCHES) topN = MAX_MATCHES;
+static void bench_reset_ranks(void) {
+    for (int i = 0; i < MAX_MATCHES; i++) {
+        bm.best[i].index = -1;
+        bm.best[i].score = INFINITY;
+    }
+}
 
-        const uint8_t obs_manf = manf_id;
-        const uint8_t obs_dev0 = mem_type;
-        const uint8_t obs_dev1 = capacity_code;
+static float get_lef32(const uint8_t *p) {
+    uint32_t v = get_le32(p);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
 
-        const double obs_read_us  = read_avg_us;
-        const double obs_prog_ms  = prog_avg_ms;
-        const double obs_erase_ms = erase_avg_ms;
+// Hand the fingerprint to the host; its frames then go to bench_host_step
+static void bench_host_request(void) {
+    printf("[BENCH] fingerprint jedec=%02X%02X%02X read_us=%.9g prog_ms=%.9g "
+           "erase_ms=%.9g top=%d\n", bm.obs_manf, bm.obs_dev0, bm.obs_dev1,
+           (double)(float)bm.obs_read_us, (double)(float)bm.obs_prog_ms,
+           (double)(float)bm.obs_erase_ms, bm.topN);
+    printf("\n--- Waiting for the host's ranking ---\n");
+    bench_reset_ranks();
+    xf.rx_ready     = false;
+    xf.listen       = true;
+    bm.host_wait_ms = hal_time_ms();
+}
 
-        RankItem best[MAX_MATCHES];
-        for (int i = 0; i < MAX_MATCHES; i++) {
-            best[i].index = -1;
-            best[i].score = INFINITY;
+// JOB_CONTINUE while waiting, 0 once the list is complete, -1: rank on the device
+static int bench_host_step(void) {
+    if (!xf.rx_ready) {
+        if (hal_time_ms() - bm.host_wait_ms < HOST_RANK_TIMEOUT_MS) {
+            hal_idle();
+            return JOB_CONTINUE;
         }
+        printf("\n[BENCH] No ranking from the host for %u s.\n", HOST_RANK_TIMEOUT_MS / 1000);
+        xf.listen = false;
+        return -1;
+    }
 
-        // Compare this chip's data against all known chips in the CSV
-        // and keep the top N closest matches.
-        for (int i = 0; i < chip_count; i++) {
-            const ChipEntry *c = &chip_data[i];
-            
-            // Skip entries with missing timing data
-            if (c->read_time_us <= 0.0f ||
-                c->write_time_ms <= 0.0f ||
-                c->erase_time_ms <= 0.0f) {
-                continue; //this row not compared
-            }
+    const uint8_t *f = xf.rx;
+    uint16_t len = xf.rx_len;
+    xf.rx_ready     = false;
+    bm.host_wait_ms = hal_time_ms();
+
+    if (f[0] == 'M' && len >= 33) {
+        int k = f[1] - 1;
+        if (k < 0 || k >= bm.topN) return JOB_CONTINUE;
+        ChipEntry *c = &bm.host[k];
+        memset(c, 0, sizeof(*c));
+        bm.host_row[k]       = (int)get_le32(f + 2);
+        bm.best[k].index     = k;
+        bm.best[k].score     = get_lef32(f + 6);
+        c->manf_id           = f[10];
+        c->device_id[0]      = f[11];
+        c->device_id[1]      = f[12];
+        c->read_time_us      = get_lef32(f + 13);
+        c->write_time_ms     = get_lef32(f + 17);
+        c->write_time_ms_max = get_lef32(f + 21);
+        c->erase_time_ms     = get_lef32(f + 25);
+        c->erase_time_ms_max = get_lef32(f + 29);
+        size_t n = len - 33u;
+        if (n > sizeof(c->dev_name) - 1) n = sizeof(c->dev_name) - 1;
+        memcpy(c->dev_name, f + 33, n);
+        return JOB_CONTINUE;
+    }
+    if (f[0] == 'N' && len >= 5) {
+        xf.listen = false;
+        printf("\nHost ranked %u rows.\n", get_le32(f + 1));
+        return 0;
+    }
+    if (f[0] == 'X') {
+        xf.listen = false;
+        printf("\n[BENCH] Host cannot rank: %.*s\n", (int)(len - 1), (const char *)f + 1);
+        return -1;
+    }
+    return JOB_CONTINUE;        // unknown frame type: ignore
+}
 
-            float sc = score_entry(c,
-                                   obs_manf, obs_dev0, obs_dev1,
-                                   obs_read_us, obs_prog_ms, obs_erase_ms);
-            
-            //insert this emtry into topN list if its score is better (lower) than on of the current best[k].score values
-            for (int k = 0; k < topN; k++) {
-                if (sc < best[k].score) {       //compare scores to keep top N
-                    //move wworst score down the list
-                    for (int m = topN - 1; m > k; m--) {
-                        best[m] = best[m - 1];
-                    }
-                    best[k].index = i;
-                    best[k].score = sc;
-                    break;
-                }
-            }
+static int bench_step(job_t *job) {
+    const uint32_t target_addr = 0x000000;
+    uint64_t start, end;
+
+    switch (bm.phase) {
+    // ==================== ERASE BENCHMARK ====================
+    // measure how long a sector erase takes, repeated 30x
+    case BM_ERASE:
+        start = hal_time_us();
+        flash_dut_erase_4k(target_addr);
+        end   = hal_time_us();
+        stats_add(&bm.erase, (double)(end - start));
+        job->done = ++bm.trial;
+        if (bm.trial == ERASE_TRIALS) {
+            bm.phase = BM_PROG;
+            bm.trial = 0;
+            job_set_stage(job, "Program trials", PROG_TRIALS, false);
+        }
+        return JOB_CONTINUE;
+
+    // ==================== PROGRAM BENCHMARK ====================
+    // writes one page (256 bytes) at target_addr, repeated 30x to measure program time
+    case BM_PROG:
+        start = hal_time_us();
+        flash_dut_program_page(target_addr, bm.page_buf, FLASH_PAGE_SIZE);
+        end   = hal_time_us();
+        stats_add(&bm.prog, (double)(end - start));
+        job->done = ++bm.trial;
+        if (bm.trial == PROG_TRIALS) {
+            bm.phase = BM_READ;
+            bm.trial = 0;
+            job_set_stage(job, "Read trials", READ_TRIALS, false);
+        }
+        return JOB_CONTINUE;
+
+    // ==================== READ BENCHMARK ====================
+    // reads one page (256 bytes) at target_addr, repeated 100x to measure read time
+    case BM_READ: {
+        start = hal_time_us();
+        flash_dut_read(target_addr, bm.page_buf, FLASH_PAGE_SIZE);
+        end   = hal_time_us();
+        stats_add(&bm.read, (double)(end - start));
+        job->done = ++bm.trial;
+        if (bm.trial < READ_TRIALS) return JOB_CONTINUE;
+
+        job_set_stage(job, NULL, 0, false);
+        bench_print_summary();
+        if (bm.host_rank) {
+            bench_host_request();
+            bm.phase = BM_HOST;
+            return JOB_CONTINUE;
         }
-        // Display matching results with performance comparison
-        printf("\n================= TOP %d MATCHES FROM CSV =================\n", topN);
-        printf("Observed JEDEC: 0x%02X 0x%02X 0x%02X\n",
-               obs_manf, obs_dev0, obs_dev1);
-        printf("Observed timings: READ=%.2f us, PROG=%.2f ms, ERASE=%.2f ms\n",
-               obs_read_us, obs_prog_ms, obs_erase_ms);
-        printf("==========================================================\n");
-
-        // Print top N matches
-        for (int k = 0; k < topN; k++) {
-            if (best[k].index < 0) continue;
-
-            ChipEntry *c = &chip_data[best[k].index];
-
-            double db_read_us  = c->read_time_us;
-            double db_prog_ms  = c->write_time_ms;
-            double db_erase_ms = c->erase_time_ms;
-            
-            // Compute percentage differences between observed timings and this DB row
-            // This shows how much faster/slower the observed chip is compared to DB
-            double rd_diff = (obs_read_us  - db_read_us)  /
-                             (db_read_us  == 0 ? 1 : db_read_us)  * 100.0;
-            double pr_diff = (obs_prog_ms  - db_prog_ms)  /
-                             (db_prog_ms  == 0 ? 1 : db_prog_ms)  * 100.0;
-            double er_diff = (obs_erase_ms - db_erase_ms) /
-                             (db_erase_ms == 0 ? 1 : db_erase_ms) * 100.0;
-
-            printf("\n[#%d] DB Row %d: %s\n",
-                   k + 1, best[k].index + 1, c->dev_name);
-            printf("  JEDEC (DB):   0x%02X 0x%02X 0x%02X\n",
-                   c->manf_id, c->device_id[0], c->device_id[1]);
-            printf("  Score:        %.4f (lower is better)\n", best[k].score);
-
-            printf("  DB timings:\n");
-            printf("    READ_typ : %.2f us\n",  c->read_time_us);
-            printf("    PROG_typ : %.2f ms\n",  c->write_time_ms);
-            printf("    PROG_max : %.2f ms\n",  c->write_time_ms_max);
-            printf("    ERASE_typ: %.2f ms\n",  c->erase_time_ms);
-            printf("    ERASE_max: %.2f ms\n",  c->erase_time_ms_max);
-
-            printf("  Compare vs observed:\n");
-            printf("    READ  DB: %8.2f us | OBS: %8.2f us (%+6.1f%%)\n",
-                   db_read_us,  obs_read_us,  rd_diff);
-            printf("    PROG  DB: %8.2f ms | OBS: %8.2f ms (%+6.1f%%)\n",
-                   db_prog_ms,  obs_prog_ms,  pr_diff);
-            printf("    ERASE DB: %8.2f ms | OBS: %8.2f ms (%+6.1f%%)\n",
-                   db_erase_ms, obs_erase_ms, er_diff);
+        int rc = bench_open_db();
+        if (rc != 0) return rc;
+        bm.phase = BM_DB_LOAD;
+        return JOB_CONTINUE;
+    }
+
+    case BM_HOST: {
+        int rc = bench_host_step();
+        if (rc == JOB_CONTINUE) return JOB_CONTINUE;
+        if (rc == 0) {
+            bench_print_matches(bm.host, bm.host_row);
+            break;
         }
+        // offline fallback: the on-device CSV ranking
+        printf("[BENCH] Ranking on the device instead.\n");
+        rc = bench_open_db();
+        if (rc != 0) return rc;
+        bm.phase = BM_DB_LOAD;
+        return JOB_CONTINUE;
+    }
 
-        if (best[0].index >= 0) {
-            print_match_summary(chip_data,
-                                obs_manf, obs_dev0, obs_dev1,
-                                obs_read_us, obs_prog_ms, obs_erase_ms,
-                                &best[0]);
+    case BM_DB_LOAD: {
+        int batch_count = bench_load_batch();
+        if (batch_count > 0) {
+            printf("\n%d entries loaded\n", batch_count); //Print every batch
+            chip_count += batch_count;
+            return JOB_CONTINUE;
         }
+
+        bench_print_loaded();
+        f_close(&bm.file_sd);
+        bm.file_open = false;
+        printf("\nIntegration complete.\n");
+
+        if (chip_count == 0) break;
+
+        // --- Chip Identification: TOP N matches ---
+        bench_reset_ranks();
+        bm.phase    = BM_RANK;
+        bm.rank_pos = 0;
+        return JOB_CONTINUE;
+    }
+
+    case BM_RANK: {
+        int to = bm.rank_pos + RANK_SLICE;
+        if (to > chip_count) to = chip_count;
+        bench_rank_slice(bm.rank_pos, to);
+        bm.rank_pos = to;
+        if (bm.rank_pos < chip_count) return JOB_CONTINUE;
+
+        bench_print_matches(chip_data, NULL);
+        break;
+    }
     }
 
     printf("\nProcess complete.\n");
+    return 0;
+}
+
+// "3", "3h", "3 host", "h": number of matches (default 3), true = rank on the host
+static bool parse_identify_arg(const char *arg, int *topN) {
+    *topN = (*arg >= '0' && *arg <= '9') ? atoi(arg) : 3;
+    return strchr(arg, 'h') != NULL || strchr(arg, 'H') != NULL;
+}
+
+// Start the benchmark + CSV identification job. Returns 0 once running.
+static int run_main_workflow(uint8_t manf_id,
+                             uint8_t mem_type,
+                             uint8_t capacity_code,
+                             int     topN,
+                             bool    host_rank)
+{
+    if (job_busy()) {
+        printf("Busy: %s still running.\n", job_slot.name);
+        return -1;
+    }
+    if (topN < 1) topN = 1;
+    if (topN > MAX_MATCHES) topN = MAX_MATCHES;
+
+    memset(&bm, 0, sizeof(bm));
+    bm.obs_manf = manf_id;
+    bm.obs_dev0 = mem_type;
+    bm.obs_dev1 = capacity_code;
+    bm.topN     = topN;
+    bm.host_rank = host_rank;
+    bm.phase    = BM_ERASE;
+    for (int i = 0; i < FLASH_PAGE_SIZE; i++) bm.page_buf[i] = i;
+    stats_reset(&bm.erase);
+    stats_reset(&bm.prog);
+    stats_reset(&bm.read);
+
+    printf("\n--- Starting benchmark --- (press x to abort)\n");
+    job_t *job = job_start("benchmark", bench_step, bench_cleanup);
+    job_set_stage(job, "Erase trials", ERASE_TRIALS, false);
+    return 0;
+}
+
+// =====================================================
+// ===============  JOB QUEUE (SCRIPTS) =================
+// =====================================================
+//
+// A script is a list of operations run back to back without going back
+// to the menu, e.g.   backup; restore; verify; identify 3
+//   - inline : menu 6, then the script on one line (';' separates ops)
+//   - from SD: menu 6, then @path  (one or more ops per line, '#' = comment)
+//
+// Ops: identify|bench [N] [host], backup, restore [file], verify [file], list
+// The queue stops at the first failed or aborted op. Every op (including
+// the skipped ones) gets one row in JOBS_RESULTS on the SD card.
+
+#define MAX_QUEUE      16
+#define JOBS_RESULTS   "JOBS_RESULTS.csv"
+
+typedef enum { OP_IDENTIFY, OP_BACKUP, OP_RESTORE, OP_VERIFY, OP_LIST, OP_STATS } op_kind_t;
+
+typedef struct {
+    op_kind_t kind;
+    char      arg[96];
+} queue_entry_t;
+
+static const struct {
+    const char *name;
+    op_kind_t   kind;
+} op_names[] = {
+    { "identify", OP_IDENTIFY },
+    { "bench",    OP_IDENTIFY },
+    { "backup",   OP_BACKUP   },
+    { "restore",  OP_RESTORE  },
+    { "verify",   OP_VERIFY   },
+    { "list",     OP_LIST     },
+    { "stats",    OP_STATS    },
+};
+
+static jedec_info_t  dut_id;            // read once at boot
+static queue_entry_t queue[MAX_QUEUE];
+static int      queue_len     = 0;
+static int      queue_pos     = 0;      // next entry to start
+static int      queue_failed  = 0;
+static bool     queue_running = false;
+static uint32_t queue_run_id  = 0;      // ms since boot when the script started
+
+static void print_menu(void);           // CONSOLE + MENU section
+
+static const char *op_name(op_kind_t kind) {
+    for (size_t i = 0; i < sizeof(op_names) / sizeof(op_names[0]); i++)
+        if (op_names[i].kind == kind) return op_names[i].name;
+    return "?";
+}
+
+// Parse one "op [arg]" item and append it to the queue
+static bool queue_add(const char *text) {
+    while (*text == ' ' || *text == '\t') text++;
+    if (!*text || *text == '#') return true;    // blank / comment
+
+    char word[16];
+    size_t w = 0;
+    while (*text && *text != ' ' && *text != '\t' && w < sizeof(word) - 1)
+        word[w++] = *text++;
+    word[w] = '\0';
+    while (*text == ' ' || *text == '\t') text++;
+
+    for (size_t i = 0; i < sizeof(op_names) / sizeof(op_names[0]); i++) {
+        if (strcmp(word, op_names[i].name) != 0) continue;
+        if (queue_len >= MAX_QUEUE) {
+            printf("[QUEUE] Too many ops (max %d).\n", MAX_QUEUE);
+            return false;
+        }
+        queue_entry_t *e = &queue[queue_len++];
+        e->kind = op_names[i].kind;
+        snprintf(e->arg, sizeof(e->arg), "%s", text);
+
+        // trim trailing blanks / line ending
+        size_t n = strlen(e->arg);
+        while (n && (e->arg[n - 1] == ' ' || e->arg[n - 1] == '\r' || e->arg[n - 1] == '\n'))
+            e->arg[--n] = '\0';
+        return true;
+    }
+    printf("[QUEUE] Unknown op '%s'\n", word);
+    return false;
+}
+
+// Split a script line on ';'
+static bool queue_add_line(char *line) {
+    char *save = NULL;
+    for (char *tok = strtok_r(line, ";", &save); tok; tok = strtok_r(NULL, ";", &save)) {
+        if (!queue_add(tok)) return false;
+    }
+    return true;
+}
+
+static bool queue_load_file(const char *path) {
+    if (!fs_mount_once()) {
+        printf("SD not mounted.\n");
+        return false;
+    }
+    FIL f;
+    if (f_open(&f, path, FA_READ) != FR_OK) {
+        printf("[QUEUE] Could not open %s\n", path);
+        return false;
+    }
+    char line[128];
+    bool ok = true;
+    while (ok && f_gets(line, sizeof(line), &f)) {
+        ok = queue_add_line(line);
+    }
+    f_close(&f);
+    return ok;
+}
+
+// Append one result row: run,index,op,arg,status,rc,start_ms,duration_ms
+static void queue_record(int idx, const char *status, int rc,
+                         uint64_t t_start_us, uint64_t t_end_us) {
+    if (!fs_mount_once()) return;
+
+    FIL f;
+    UINT bw = 0;
+    if (f_open(&f, JOBS_RESULTS, FA_OPEN_APPEND | FA_WRITE) != FR_OK) {
+        printf("[QUEUE] Could not open %s\n", JOBS_RESULTS);
+        return;
+    }
+
+    // the arg is free text from the script; a ',' in it would shift the columns
+    char arg[sizeof(queue[idx].arg)];
+    snprintf(arg, sizeof(arg), "%s", queue[idx].arg);
+    for (char *p = arg; *p; p++)
+        if (*p == ',') *p = ';';
+
+    char row[192];
+    int n = 0;
+    if (f_size(&f) == 0) {
+        n = snprintf(row, sizeof(row), "run,index,op,arg,status,rc,start_ms,duration_ms\n");
+        f_write(&f, row, n, &bw);
+    }
+    n = snprintf(row, sizeof(row), "t%010u,%d,%s,%s,%s,%d,%u,%u\n",
+                 queue_run_id, idx + 1, op_name(queue[idx].kind), arg,
+                 status, rc,
+                 (uint32_t)(t_start_us / 1000),
+                 (uint32_t)((t_end_us - t_start_us) / 1000));
+    f_write(&f, row, n, &bw);
+    f_close(&f);
+}
+
+static const char *queue_status(int rc) {
+    if (rc == 0)           return "OK";
+    if (rc == JOB_ABORTED) return "ABORTED";
+    return "FAIL";
+}
+
+// Start one entry. *sync is set when the op completed immediately.
+static int queue_start_entry(const queue_entry_t *e, bool *sync) {
+    *sync = false;
+    switch (e->kind) {
+    case OP_IDENTIFY: {
+        int  topN;
+        bool host = parse_identify_arg(e->arg, &topN);
+        return run_main_workflow(dut_id.manuf_id, dut_id.mem_type, dut_id.capacity_id,
+                                 topN, host);
+    }
+    case OP_BACKUP:
+        return backup_flash_to_sd();
+    case OP_RESTORE:
+        return restore_flash_from_sd(e->arg);
+    case OP_VERIFY:
+        return verify_flash_against_sd(e->arg);
+    case OP_LIST:
+        *sync = true;
+        return (list_flash_images() < 0) ? -1 : 0;
+    case OP_STATS:
+        *sync = true;
+        perf_print();
+        return 0;
+    }
+    return -1;
+}
+
+static void queue_finish(void) {
+    uint64_t now = hal_time_us();
+    for (; queue_pos < queue_len; queue_pos++)
+        queue_record(queue_pos, "SKIPPED", 0, now, now);
+
+    printf("\n[QUEUE] Finished: %d op(s), %d failed. Results in %s\n",
+           queue_len, queue_failed, JOBS_RESULTS);
+    queue_running = false;
+    print_menu();
+}
+
+// Start entries until one of them becomes a running job
+static void queue_advance(void) {
+    while (queue_pos < queue_len) {
+        if (queue_failed) {
+            queue_finish();
+            return;
+        }
+        const queue_entry_t *e = &queue[queue_pos];
+        printf("\n[QUEUE] %d/%d: %s %s\n", queue_pos + 1, queue_len, op_name(e->kind), e->arg);
+
+        bool sync = false;
+        uint64_t t0 = hal_time_us();
+        int rc = queue_start_entry(e, &sync);
+        if (rc == 0 && !sync) return;   // job running, queue_job_ended() resumes
+
+        queue_record(queue_pos, queue_status(rc), rc, t0, hal_time_us());
+        if (rc != 0) queue_failed++;
+        queue_pos++;
+    }
+    queue_finish();
+}
+
+// Called from job_ended() while a script runs
+static void queue_job_ended(const job_t *job) {
+    queue_record(queue_pos, queue_status(job->rc), job->rc, job->t_start_us, hal_time_us());
+    if (job->rc != 0) queue_failed++;
+    queue_pos++;
+    queue_advance();
+}
+
+// Load a script (inline or @file) and start running it
+static void queue_run_script(const char *script) {
+    char line[128];
+
+    queue_len    = 0;
+    queue_pos    = 0;
+    queue_failed = 0;
+
+    bool ok;
+    if (script[0] == '@') {
+        ok = queue_load_file(script + 1);
+    } else {
+        snprintf(line, sizeof(line), "%s", script);
+        ok = queue_add_line(line);
+    }
+    if (!ok || queue_len == 0) {
+        printf("[QUEUE] Nothing to run.\n");
+        print_menu();
+        return;
+    }
+
+    queue_run_id  = hal_time_ms();
+    queue_running = true;
+    printf("[QUEUE] %d op(s) queued (press x to abort)\n", queue_len);
+    queue_advance();
 }
 
 // =====================================================
-// ===============  INPUT HELPER ========================
+// ===============  CONSOLE + MENU ======================
 // =====================================================
 
-// Simple blocking line input from USB serial:
+#define KEY_CTRL_C 0x03
+#define KEY_ESC    0x1B
+
+typedef void (*line_fn)(const char *line);
+
+// Non-blocking line input from USB serial (replaces read_line_blocking):
 // - Stops on Enter (\r or \n)
 // - OR if there's been no new characters for ~500 ms after typing starts
 // - Handles backspace
-static void read_line_blocking(char *buf, size_t buf_len) {
-    size_t   pos     = 0;
-    bool     got_any = false;
-    uint64_t last_us = time_us_64();
-
-    while (1) {
-        int c = getchar_timeout_us(100000);   // wait up to 100 ms
-
-        if (c == PICO_ERROR_TIMEOUT) {
-            if (got_any && (time_us_64() - last_us) > 500000) { // 500 ms idle
-                putchar('\n');
-                break;
-            }
-            continue;
+static struct {
+    char     buf[128];
+    size_t   pos;
+    bool     got_any;
+    uint64_t last_us;
+    line_fn  on_line;      // non-NULL while a prompt is collecting a line
+} con;
+
+static bool         idle_mode  = false;  // 'q' pressed, waiting for 'm'
+static bool         con_closed = false;  // console input ended (host stdin EOF)
+
+static void print_menu(void) {
+    printf("\n=== MAIN MENU ===\n");
+    printf("  1 = Run benchmark + CSV + identification\n"); //comparision
+    printf("  2 = Backup SPI flash to SD  (/FLASHIMG/*.fimg)\n");
+    printf("  3 = Restore SPI flash from SD (latest .fimg)\n");
+    printf("  4 = Restore SPI flash from SD (choose specific file)\n");
+    printf("  5 = List available flash images (.fimg)\n");
+    printf("  6 = Run job script (inline or @file on SD)\n");
+    printf("  b = Start / stop SPI bus log (BUSLOG/*.fbl)\n");
+    printf("  f = File transfer with the web UI (binary frames)\n");
+    printf("  s = Show performance counters\n");
+    printf("  t = Dump trace buffer\n");
+    printf("  q = Quit (idle loop)\n");
+    printf("  x = Abort running operation\n");
+    printf("=================\n");
+    printf("Select option: ");
+}
+
+static void console_read_line(line_fn on_line) {
+    con.pos     = 0;
+    con.got_any = false;
+    con.last_us = hal_time_us();
+    con.on_line = on_line;
+}
+
+static void console_end_line(void) {
+    line_fn cb = con.on_line;
+    putchar('\n');
+    con.buf[con.pos] = '\0';
+    con.on_line = NULL;
+    cb(con.buf);
+}
+
+static void console_line_char(int c) {
+    con.last_us = hal_time_us();
+    con.got_any = true;
+
+    if (c == '\r' || c == '\n') {
+        console_end_line();
+        return;
+    }
+
+    // Backspace / delete
+    if (c == 8 || c == 127) {
+        if (con.pos > 0) {
+            con.pos--;
+            putchar('\b');
+            putchar(' ');
+            putchar('\b');
         }
+        return;
+    }
 
-        last_us = time_us_64();
-        got_any = true;
+    // Printable ASCII
+    if (c >= 32 && c < 127) {
+        if (con.pos < sizeof(con.buf) - 1) {
+            con.buf[con.pos++] = (char)c;
+            putchar(c);  // echo
+        }
+    }
+}
 
-        if (c == '\r' || c == '\n') {
-            putchar('\n');
-            break;
+// Called from job_finish() for every job, whatever the outcome
+static void job_ended(job_t *job) {
+    // one end line per job: the web UI's job tracker (JOB_RE) counts them
+    if (job->rc == JOB_ABORTED)
+        printf("\n[JOB] %s aborted by user.\n", job->name);
+
+    if (queue_running) {
+        queue_job_ended(job);
+        return;
+    }
+
+    uint32_t ms = (uint32_t)((hal_time_us() - job->t_start_us) / 1000);
+    if (job->rc == 0)
+        printf("[JOB] %s done in %u.%03u s\n", job->name, ms / 1000, ms % 1000);
+    else if (job->rc != JOB_ABORTED)
+        printf("[JOB] %s failed (rc=%d) after %u.%03u s\n",
+               job->name, job->rc, ms / 1000, ms % 1000);
+    print_menu();
+}
+
+// Synchronous failure to start a job → back to the menu
+static void menu_started(int rc) {
+    if (rc != 0) print_menu();
+}
+
+static void on_topn_line(const char *line) {
+    int  topN;
+    bool host = parse_identify_arg(line, &topN);
+    if (topN < 1)           topN = 1;
+    if (topN > MAX_MATCHES) topN = MAX_MATCHES;
+
+    menu_started(run_main_workflow(dut_id.manuf_id, dut_id.mem_type,
+                                   dut_id.capacity_id, topN, host));
+}
+
+static void on_restore_name_line(const char *input) {
+    char path[160];
+
+    if (input[0] == '\0') {
+        printf("[RESTORE] No filename entered, cancelled.\n");
+        print_menu();
+        return;
+    }
+
+    // If user only typed a bare filename, prepend DUMP_FOLDER/
+    if (strchr(input, '/') == NULL && strchr(input, '\\') == NULL) {
+        snprintf(path, sizeof(path), "%s/%s", DUMP_FOLDER, input);
+    } else {
+        snprintf(path, sizeof(path), "%s", input);
+    }
+
+    printf("[RESTORE] Using image: %s\n", path);
+    menu_started(restore_flash_from_sd(path));
+}
+
+static void on_script_line(const char *line) {
+    if (line[0] == '\0') {
+        printf("[QUEUE] No script entered, cancelled.\n");
+        print_menu();
+        return;
+    }
+    queue_run_script(line);
+}
+
+static void on_xfer_line(const char *line) {
+    if (line[0] == '\0') {
+        printf("[XFER] Nothing entered, cancelled.\n");
+        print_menu();
+        return;
+    }
+    menu_started(xfer_start(line));
+}
+
+static void menu_handle_key(int ch) {
+    if (idle_mode) {
+        if (ch == 'm' || ch == 'M') {
+            idle_mode = false;
+            printf("[MENU] Returning to main menu...\n");
+            print_menu();
         }
+        return;
+    }
 
-        // Backspace / delete
-        if (c == 8 || c == 127) {
-            if (pos > 0) {
-                pos--;
-                putchar('\b');
-                putchar(' ');
-                putchar('\b');
-            }
-            continue;
+    // stray line endings (e.g. "5\n" from the web UI) are not menu options
+    if (ch == '\r' || ch == '\n') return;
+
+    printf("%c\n", ch);   // echo
+
+    switch (ch) {
+    case '1':
+        printf("\n[CSV MATCH] How many top matches to display? (1-10, add h to rank on the host): "); // prompt user to input number of matches to show
+        console_read_line(on_topn_line);
+        break;
+
+    case '2':
+        //backup files
+        menu_started(backup_flash_to_sd());
+        break;
+
+    case '3':
+        // latest image
+        menu_started(restore_flash_from_sd(NULL));
+        break;
+
+    case '4':
+        // choose specific file
+        printf("\n[RESTORE] Existing images:\n");
+        list_flash_images();
+        printf("\n[RESTORE] Enter image path or name inside %s\n", DUMP_FOLDER);
+        printf("          e.g. FLASHIMG/xxx.fimg or just xxx.fimg\n");
+        printf("Filename: ");
+        console_read_line(on_restore_name_line);
+        break;
+
+    case '5':
+        //list all files
+        list_flash_images();
+        print_menu();
+        break;
+
+    case '6':
+        // batch of operations back to back
+        printf("\n[QUEUE] Ops: identify [N] [host], backup, restore [file], verify [file], list, stats\n");
+        printf("        e.g. backup; restore; verify; identify 3   or   @JOBS/run.txt\n");
+        printf("Script: ");
+        console_read_line(on_script_line);
+        break;
+
+    case 'b':
+    case 'B':
+        // record DUT transactions for offline replay (host/replay_buslog.c)
+        if (buslog.on) {
+            buslog_stop();
+        } else {
+            const uint8_t jedec[3] = { dut_id.manuf_id, dut_id.mem_type, dut_id.capacity_id };
+            buslog_start(jedec);
         }
+        print_menu();
+        break;
+
+    case 'f':
+    case 'F':
+        // .fimg download / upload for the web UI (web/transfer.py)
+        printf("\n[XFER] get <path> [offset]  |  put <path> <size> [resume]\n");
+        printf("Transfer: ");
+        console_read_line(on_xfer_line);
+        break;
+
+    case 's':
+    case 'S':
+        // throughput / error counters since boot
+        perf_print();
+        print_menu();
+        break;
+
+    case 't':
+    case 'T':
+        // timeline of the last driver / SD / CRC spans
+        trace_dump();
+        print_menu();
+        break;
+
+    case 'q':
+    case 'Q':
+        printf("[MENU] Entering idle mode. Press 'm' to return to main menu.\n");
+        idle_mode = true;
+        break;
+
+    default:
+        printf("[MENU] Unknown option '%c'. Please choose 1–6, b, f, s, t or q.\n", ch);
+        print_menu();
+        break;
+    }
+}
 
-        // Printable ASCII
-        if (c >= 32 && c < 127) {
-            if (pos < buf_len - 1) {
-                buf[pos++] = (char)c;
-                putchar(c);  // echo
-            }
+// Drain pending USB serial input without blocking
+static void console_poll(void) {
+    int c;
+    // a received transfer frame not yet on SD: leave the rest in the USB buffer
+    while (!con_closed && !xfer_rx_full() && (c = hal_getchar()) != HAL_NO_CHAR) {
+        if (c == HAL_CONSOLE_CLOSED) {
+            // host build fed from a pipe: finish a pending prompt, then
+            // main() exits once nothing is left running
+            con_closed = true;
+            if (con.on_line) console_end_line();
+            break;
+        }
+        if (con.on_line) {
+            console_line_char(c);
+        } else if (xfer_rx_wants(c)) {
+            xfer_rx_byte(c);
+        } else if (job_busy()) {
+            if (c == 'x' || c == 'X' || c == KEY_CTRL_C || c == KEY_ESC)
+                job_abort();
+            else if (c >= 32 && c < 127)
+                printf("\n[JOB] %s running, press x to abort.\n", job_slot.name);
+        } else {
+            menu_handle_key(c);
         }
     }
 
-    buf[pos] = '\0';
+    if (con.on_line && con.got_any &&
+        (hal_time_us() - con.last_us) > 500000) { // 500 ms idle
+        console_end_line();
+    }
+}
+
+// Background maintenance: mount the SD card and create /FLASHIMG while the
+// user is still reading the menu, so the first command doesn't pay for it.
+static bool bg_prepare_sd(void *arg) {
+    (void)arg;
+    static bool done = false;
+    if (done) return false;
+    done = true;
+    if (fs_mount_once()) ensure_folder();
+    return true;
 }
 
 // =====================================================
-// ===============  MAIN + MENU =========================
+// ===============  MAIN ================================
 // =====================================================
 
 int main(void) {
-    stdio_init_all();
-    sleep_ms(2000);
+    hal_init();
+    hal_sleep_ms(2000);
 
     printf("\n=== SPI Flash Forensic + FIMG Backup Tool ===\n");
 
     // Init flash & read JEDEC
     flash_dut_init();
 
-    jedec_info_t id;
-    if (!flash_dut_read_jedec(&id)) {
+    if (!flash_dut_read_jedec(&dut_id)) {
         printf("ERROR: flash_dut_read_jedec() failed\n");
     }
 
-    uint8_t manf_id       = id.manuf_id;
-    uint8_t mem_type      = id.mem_type;
-    uint8_t capacity_code = id.capacity_id;
+    uint8_t manf_id       = dut_id.manuf_id;
+    uint8_t mem_type      = dut_id.mem_type;
+    uint8_t capacity_code = dut_id.capacity_id;
 
     uint32_t capacity_bytes = 0;
     uint32_t sfdp_bytes     = 0;
@@ -1220,102 +3945,16 @@ int main(void) {
     printf("Approx Capacity: %.2f MB\n",
            capacity_bytes / (1024.0 * 1024.0));
 
-    while (true) {
-        printf("\n=== MAIN MENU ===\n");
-        printf("  1 = Run benchmark + CSV + identification\n"); //comparision
-        printf("  2 = Backup SPI flash to SD  (/FLASHIMG/*.fimg)\n");
-        printf("  3 = Restore SPI flash from SD (latest .fimg)\n");
-        printf("  4 = Restore SPI flash from SD (choose specific file)\n");
-        printf("  5 = List available flash images (.fimg)\n");
-        printf("  q = Quit (idle loop)\n");
-        printf("=================\n");
-        printf("Select option: ");
-
-        int ch = getchar_timeout_us(0);
-        while (ch == PICO_ERROR_TIMEOUT) {
-            tight_loop_contents();
-            ch = getchar_timeout_us(0);
-        }
-        printf("%c\n", ch);   // echo
-
-        switch (ch) {
-        case '1': {
-            int topN = 3;
-            printf("\n[CSV MATCH] How many top matches to display? (1-10): "); // prompt user to input number of matches to show
-            char line[8];
-            read_line_blocking(line, sizeof(line));
-            if (line[0] != '\0') {
-                topN = atoi(line);
-            }
-            if (topN < 1)           topN = 1;
-            if (topN > MAX_MATCHES) topN = MAX_MATCHES;
-
-            run_main_workflow(manf_id, mem_type, capacity_code, topN);
-            break;
-        }
-
-        case '2':
-            //backup files
-            backup_flash_to_sd();
-            break;
-
-        case '3':
-            // latest image
-            restore_flash_from_sd(NULL);
-            break;
-
-        case '4': {
-            // choose specific file
-            char input[128];
-            char path[160];
-
-            printf("\n[RESTORE] Existing images:\n");
-            list_flash_images();
-            printf("\n[RESTORE] Enter image path or name inside %s\n", DUMP_FOLDER);
-            printf("          e.g. FLASHIMG/xxx.fimg or just xxx.fimg\n");
-            printf("Filename: ");
-            read_line_blocking(input, sizeof(input));
-
-            if (input[0] == '\0') {
-                printf("[RESTORE] No filename entered, cancelled.\n");
-                break;
-            }
-
-            // If user only typed a bare filename, prepend DUMP_FOLDER/
-            if (strchr(input, '/') == NULL && strchr(input, '\\') == NULL) {
-                snprintf(path, sizeof(path), "%s/%s", DUMP_FOLDER, input);
-            } else {
-                snprintf(path, sizeof(path), "%s", input);
-            }
-
-            printf("[RESTORE] Using image: %s\n", path);
-            restore_flash_from_sd(path);
-            break;
-        }
-
-        case '5':
-            //list all files
-            list_flash_images();
-            break;
-
-        case 'q':
-        case 'Q':
-            printf("[MENU] Entering idle mode. Press 'm' to return to main menu.\n");
-            while (1) {
-                tight_loop_contents();
-                int ch2 = getchar_timeout_us(0);
-                if (ch2 == 'm' || ch2 == 'M') {
-                    printf("[MENU] Returning to main menu...\n");
-                    break;
-                }
-            }
-            break;
+    sched_add_timer(progress_timer, NULL, PROGRESS_US);
+    sched_add_timer(buslog_flush, NULL, BUSLOG_FLUSH_US);
+    sched_add_bg_task("sd-prepare", bg_prepare_sd, NULL, NULL);
+    sched_add_bg_task("scrub", bg_scrub, scrub_yield, NULL);
 
-        default:
-            printf("[MENU] Unknown option '%c'. Please choose 1–5 or q.\n", ch);
-            break;
-        }
+    print_menu();
+    while (!con_closed || job_busy() || queue_running) {
+        sched_run_once();
     }
 
-    return 0;   // never reached
+    printf("\n");
+    return 0;   // only when console input closes (host build)
 }
@@ -1,106 +1,270 @@
 # BridgeToPico.py / bridge_pico_mqtt.py
+#
+#   python BridgeToPico.py            one Pico on SERIAL_PORT, pico/log + pico/cmd
+#   python BridgeToPico.py --fleet    every Pico on this host (Linux), one set of
+#                                     topics per device: pico/<serial>/log ...
 
+import argparse
+import re
 import threading
 import time
 import serial
 from serial import SerialException
+from serial.tools import list_ports
 import paho.mqtt.client as mqtt
 
+from serial_stream import StreamSplitter
+
 # ==================== CONFIG ====================
 
 MQTT_HOST = "test.mosquitto.org"
 MQTT_PORT = 1883
 CMD_TOPIC = "pico/cmd"
 LOG_TOPIC = "pico/log"
+BIN_TOPIC = "pico/bin"          # framed binary from the Pico, payload only
+BIN_CMD_TOPIC = "pico/bin/cmd"  # raw bytes to the Pico, written unmodified
 
-SERIAL_PORT = "COM8"         
+SERIAL_PORT = "COM8"
 BAUDRATE = 115200
 
+# Output is published in batches: one message per BATCH_WINDOW seconds or
+# BATCH_BYTES of text, whichever comes first, and at once when the line is idle.
+BATCH_WINDOW = 0.02
+BATCH_BYTES = 8192
+READ_MAX = 16384
+
+# Fleet mode: Raspberry Pi USB vendor ID, and how often to look for new ports
+PICO_VID = 0x2E8A
+SCAN_INTERVAL = 2.0
+
+
+def dev_topic(dev_id, leaf):
+    """Per-device topic; dev_id "" is the single-device layout (pico/log)."""
+    return f"pico/{dev_id}/{leaf}" if dev_id else f"pico/{leaf}"
+
 
 # ================= SERIAL HANDLING =================
 
-def open_serial():
-    """Try to open the serial port in a loop until it succeeds."""
+def open_serial(port, retry=True):
+    """Try to open the serial port, in a loop until it succeeds if retry."""
     while True:
         try:
-            s = serial.Serial(SERIAL_PORT, BAUDRATE, timeout=0.1)
-            print(f"[Serial] Opened {SERIAL_PORT} @ {BAUDRATE}")
+            s = serial.Serial(port, BAUDRATE, timeout=BATCH_WINDOW)
+            print(f"[Serial] Opened {port} @ {BAUDRATE}")
             return s
         except SerialException as e:
+            if not retry:
+                print(f"[Serial open error] {e}")
+                return None
             print(f"[Serial open error] {e}. Retrying in 2s...")
             time.sleep(2)
 
 
-# global serial object (will be reopened if it breaks)
-ser = open_serial()
+class Batcher:
+    """Coalesce text pieces into one publish per time / size window."""
 
+    def __init__(self, client, topic, echo):
+        self.client = client
+        self.topic = topic
+        self.echo = echo
+        self.parts = []
+        self.size = 0
+        self.since = 0.0
 
-# ================= MQTT CALLBACKS =================
+    def add(self, piece):
+        if not self.parts:
+            self.since = time.monotonic()
+        self.parts.append(piece)
+        self.size += len(piece)
+        if self.size >= BATCH_BYTES:
+            self.publish()
 
-def on_connect(client, userdata, flags, reason_code, properties):
-    # Callback API version 2 signature
-    print(f"MQTT connected with result {reason_code}")
-    client.subscribe(CMD_TOPIC)
+    def due(self):
+        return self.parts and time.monotonic() - self.since >= BATCH_WINDOW
 
+    def publish(self):
+        if not self.parts:
+            return
+        text = b"".join(self.parts).decode("utf-8", errors="ignore")
+        self.parts, self.size = [], 0
+        if self.echo:
+            print(text, end="")
+        self.client.publish(self.topic, text)
 
-def on_message(client, userdata, msg):
-    global ser
-    cmd = msg.payload.decode("utf-8", errors="ignore")
-    print(f"[MQTT] CMD from topic {msg.topic}: {cmd!r}")
-    try:
-        ser.write(cmd.encode("utf-8"))
-        ser.flush()
-    except SerialException as e:
-        print(f"[Serial write error] {e}")
 
+class Link:
+    """One Pico: its serial port, reader thread and topics."""
 
-def serial_reader(client):
-    """Read Pico stdout and publish to MQTT."""
-    global ser
+    def __init__(self, client, port, dev_id, reopen):
+        self.client = client
+        self.port = port
+        self.dev_id = dev_id
+        self.reopen = reopen        # single mode: wait for the port to come back
+        self.ser = None
+        self.lock = threading.Lock()
+        self.thread = threading.Thread(target=self.reader, daemon=True)
 
-    while True:
-        try:
-            line = ser.readline()
-        except SerialException as e:
-            print(f"[Serial read error] {e}. Re-opening port...")
-            # try to close and reopen
+    def start(self):
+        self.thread.start()
+
+    def alive(self):
+        return self.thread.is_alive()
+
+    def write(self, data):
+        with self.lock:
+            if self.ser is None:
+                return
             try:
-                ser.close()
+                self.ser.write(data)
+                self.ser.flush()
+            except SerialException as e:
+                print(f"[Serial write error] {self.port}: {e}")
+
+    def status(self, online):
+        if self.dev_id:
+            self.client.publish(dev_topic(self.dev_id, "status"),
+                                "online" if online else "offline", retain=True)
+
+    def close(self):
+        with self.lock:
+            try:
+                self.ser.close()
             except Exception:
                 pass
+            self.ser = None
+
+    def reader(self):
+        """Read Pico stdout in chunks and publish it to MQTT in batches."""
+        batch = Batcher(self.client, dev_topic(self.dev_id, "log"), echo=not self.dev_id)
+        while True:
+            s = open_serial(self.port, retry=self.reopen)
+            if s is None:
+                return                  # fleet mode: the scanner tries again
+            with self.lock:
+                self.ser = s
+            self.status(True)
+            splitter = StreamSplitter()
+
+            while True:
+                try:
+                    # whatever the driver has buffered, or block up to one window for more
+                    chunk = s.read(min(max(s.in_waiting, 1), READ_MAX))
+                except (SerialException, OSError) as e:
+                    print(f"[Serial read error] {self.port}: {e}")
+                    break
+
+                items = splitter.feed(chunk) if chunk else splitter.flush()
+                for kind, data in items:
+                    if kind == "frame":
+                        batch.publish()         # keep text and frames in order
+                        self.client.publish(dev_topic(self.dev_id, "bin"), data)
+                    else:
+                        batch.add(data)
+
+                if not chunk or batch.due():
+                    batch.publish()
+
+            batch.publish()
+            self.close()
+            self.status(False)
+            if not self.reopen:
+                return                  # fleet mode: the scanner starts a new link
+            print("Re-opening port...")
             time.sleep(1)
-            ser = open_serial()
-            continue  # restart loop with new port
 
-        if not line:
-            time.sleep(0.01)
+
+# ================= DEVICE DISCOVERY =================
+
+def pico_ports():
+    """{device id: port} for every Pico CDC port. The id is the USB serial
+    number (from udev / sysfs), so it survives replugging into another port."""
+    found = {}
+    for p in list_ports.comports():
+        if p.vid != PICO_VID:
             continue
+        dev_id = re.sub(r"[^A-Za-z0-9_-]", "_", p.serial_number or p.name)
+        found[dev_id] = p.device
+    return found
 
-        try:
-            text = line.decode("utf-8", errors="ignore")
-        except Exception:
-            text = repr(line)
 
-        print(text, end="")
-        client.publish(LOG_TOPIC, text)
+links = {}          # device id -> Link
+links_lock = threading.Lock()
+
+
+def scan_forever(client):
+    while True:
+        for dev_id, port in pico_ports().items():
+            with links_lock:
+                link = links.get(dev_id)
+                if link is not None and link.alive():
+                    continue
+                print(f"[Fleet] {dev_id} on {port}")
+                link = links[dev_id] = Link(client, port, dev_id, reopen=False)
+            link.start()
+        time.sleep(SCAN_INTERVAL)
+
+
+# ================= MQTT CALLBACKS =================
+
+def on_connect(client, userdata, flags, reason_code, properties):
+    # Callback API version 2 signature
+    print(f"MQTT connected with result {reason_code}")
+    if userdata["fleet"]:
+        client.subscribe("pico/+/cmd")
+        client.subscribe("pico/+/bin/cmd")
+    else:
+        client.subscribe(CMD_TOPIC)
+        client.subscribe(BIN_CMD_TOPIC)
+
+
+def on_message(client, userdata, msg):
+    parts = msg.topic.split("/")
+    if userdata["fleet"]:
+        dev_id, leaf = parts[1], "/".join(parts[2:])
+    else:
+        dev_id, leaf = "", "/".join(parts[1:])
+
+    with links_lock:
+        link = links.get(dev_id)
+    if link is None:
+        return
+
+    if leaf == "bin/cmd":
+        data = msg.payload
+    else:
+        cmd = msg.payload.decode("utf-8", errors="ignore")
+        print(f"[MQTT] CMD from topic {msg.topic}: {cmd!r}")
+        data = cmd.encode("utf-8")
+    link.write(data)
 
 
 # ================= MAIN =================
+
+ap = argparse.ArgumentParser(description="Serial <-> MQTT bridge for the SPI flash Pico")
+ap.add_argument("--fleet", action="store_true",
+                help="bridge every connected Pico, topics pico/<serial>/...")
+ap.add_argument("--port", default=SERIAL_PORT, help="serial port in single mode")
+args = ap.parse_args()
+
 # Use Callback API version 2 to remove the deprecation warning
-client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, userdata={"fleet": args.fleet})
 client.on_connect = on_connect
 client.on_message = on_message
 
 client.connect(MQTT_HOST, MQTT_PORT, 60)
 
-t = threading.Thread(target=serial_reader, args=(client,), daemon=True)
-t.start()
+if args.fleet:
+    threading.Thread(target=scan_forever, args=(client,), daemon=True).start()
+else:
+    links[""] = Link(client, args.port, "", reopen=True)
+    links[""].start()
 
 try:
     client.loop_forever()
 except KeyboardInterrupt:
     print("\n[Main] KeyboardInterrupt – exiting...")
-    try:
-        ser.close()
-    except Exception:
-        pass
+    with links_lock:
+        for link in links.values():
+            link.status(False)
+            link.close()
+    client.loop(1.0)        # send the retained "offline" statuses
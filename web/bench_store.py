@@ -0,0 +1,168 @@
+# bench_store.py - history of benchmark runs (menu 1) in SQLite
+#
+# The firmware prints a machine-readable report next to its tables:
+#
+#     [BENCH] begin jedec=EF4015
+#     [BENCH] op=erase n=30 min_us=.. avg_us=.. p50_us=.. p90_us=.. p99_us=.. max_us=..
+#     [BENCH] op=prog ...   /   [BENCH] op=read ...
+#     [BENCH] match rank=1 row=3 score=2.0322 name=MX25L1606E
+#     [BENCH] end rc=0
+#
+# BenchParser turns one device's lines into a run, BenchStore keeps them.
+
+import re
+import sqlite3
+import threading
+import time
+
+BENCH_RE = re.compile(r"\[BENCH\] ((\w+).*)")
+KV_RE = re.compile(r"(\w+)=(\S+)")
+NAME_RE = re.compile(r" name=(.*)$")
+
+OP_FIELDS = ("n", "min_us", "avg_us", "p50_us", "p90_us", "p99_us", "max_us")
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS runs (
+    id       INTEGER PRIMARY KEY,
+    device   TEXT NOT NULL,
+    jedec    TEXT NOT NULL,
+    started  REAL NOT NULL,
+    finished REAL NOT NULL,
+    rc       INTEGER NOT NULL
+);
+CREATE INDEX IF NOT EXISTS runs_jedec ON runs (jedec, finished);
+CREATE TABLE IF NOT EXISTS ops (
+    run_id INTEGER NOT NULL REFERENCES runs (id),
+    op     TEXT NOT NULL,
+    n      INTEGER, min_us REAL, avg_us REAL, p50_us REAL, p90_us REAL,
+    p99_us REAL, max_us REAL,
+    PRIMARY KEY (run_id, op)
+);
+CREATE TABLE IF NOT EXISTS matches (
+    run_id INTEGER NOT NULL REFERENCES runs (id),
+    rank   INTEGER NOT NULL,
+    db_row INTEGER,
+    name   TEXT,
+    score  REAL,
+    PRIMARY KEY (run_id, rank)
+);
+"""
+
+
+class BenchParser:
+    """Collects one device's [BENCH] lines; feed() returns the run at 'end'."""
+
+    def __init__(self):
+        self.run = None
+
+    def feed(self, line):
+        m = BENCH_RE.search(line)
+        if not m:
+            return None
+        rest, kind = m.group(1).rstrip("\r\n"), m.group(2)
+        kv = dict(KV_RE.findall(rest))
+
+        if kind == "begin":
+            self.run = {"jedec": kv.get("jedec", "").upper(), "started": time.time(),
+                        "ops": {}, "matches": []}
+        elif self.run is None:
+            return None                 # joined in the middle of a report
+        elif kind == "op" and "op" in kv:
+            self.run["ops"][kv["op"]] = {f: (int if f == "n" else float)(kv[f])
+                                         for f in OP_FIELDS if f in kv}
+        elif kind == "match":
+            name = NAME_RE.search(rest)
+            self.run["matches"].append({
+                "rank": int(kv.get("rank", 0)), "db_row": int(kv.get("row", 0)),
+                "score": float(kv.get("score", "nan")),
+                "name": name.group(1).strip() if name else ""})
+        elif kind == "end":
+            run, self.run = self.run, None
+            run["finished"] = time.time()
+            run["rc"] = int(kv.get("rc", 0))
+            return run
+        return None
+
+
+class BenchStore:
+    def __init__(self, path):
+        self.lock = threading.Lock()
+        self.db = sqlite3.connect(path, check_same_thread=False)
+        self.db.row_factory = sqlite3.Row
+        self.db.executescript(SCHEMA)
+
+    def save(self, device, run):
+        with self.lock, self.db:
+            cur = self.db.execute(
+                "INSERT INTO runs (device, jedec, started, finished, rc) VALUES (?, ?, ?, ?, ?)",
+                (device, run["jedec"], run["started"], run["finished"], run["rc"]))
+            run_id = cur.lastrowid
+            for op, v in run["ops"].items():
+                self.db.execute(
+                    "INSERT INTO ops (run_id, op, n, min_us, avg_us, p50_us, p90_us, p99_us, max_us)"
+                    " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                    (run_id, op) + tuple(v.get(f) for f in OP_FIELDS))
+            for mt in run["matches"]:
+                self.db.execute(
+                    "INSERT INTO matches (run_id, rank, db_row, name, score) VALUES (?, ?, ?, ?, ?)",
+                    (run_id, mt["rank"], mt["db_row"], mt["name"], mt["score"]))
+        return run_id
+
+    def chips(self):
+        """JEDEC IDs seen, with run count and first / last run time."""
+        with self.lock:
+            rows = self.db.execute(
+                "SELECT jedec, COUNT(*) AS runs, MIN(finished) AS first, MAX(finished) AS last"
+                " FROM runs GROUP BY jedec ORDER BY last DESC").fetchall()
+        return [dict(r) for r in rows]
+
+    def runs(self, jedec=None, device=None, limit=50):
+        """Newest first, with the top match of each run."""
+        sql = ("SELECT r.*, m.name AS top_match, m.score AS top_score FROM runs r"
+               " LEFT JOIN matches m ON m.run_id = r.id AND m.rank = 1 WHERE 1")
+        args = []
+        if jedec:
+            sql += " AND r.jedec = ?"
+            args.append(jedec.upper())
+        if device is not None:
+            sql += " AND r.device = ?"
+            args.append(device)
+        sql += " ORDER BY r.finished DESC LIMIT ?"
+        args.append(limit)
+        with self.lock:
+            rows = self.db.execute(sql, args).fetchall()
+        return [dict(r) for r in rows]
+
+    def run(self, run_id):
+        with self.lock:
+            r = self.db.execute("SELECT * FROM runs WHERE id = ?", (run_id,)).fetchone()
+            if r is None:
+                return None
+            ops = self.db.execute("SELECT * FROM ops WHERE run_id = ?", (run_id,)).fetchall()
+            matches = self.db.execute(
+                "SELECT rank, db_row, name, score FROM matches WHERE run_id = ? ORDER BY rank",
+                (run_id,)).fetchall()
+        out = dict(r)
+        out["ops"] = {o["op"]: {f: o[f] for f in OP_FIELDS} for o in ops}
+        out["matches"] = [dict(m) for m in matches]
+        return out
+
+    def series(self, jedec, op, limit=500):
+        """Per-run statistics of one op for a chip, oldest first (drift charts)."""
+        with self.lock:
+            rows = self.db.execute(
+                "SELECT r.id AS run_id, r.device, r.finished, o.n, o.min_us, o.avg_us,"
+                " o.p50_us, o.p90_us, o.p99_us, o.max_us FROM runs r"
+                " JOIN ops o ON o.run_id = r.id"
+                " WHERE r.jedec = ? AND o.op = ? AND r.rc = 0"
+                " ORDER BY r.finished DESC LIMIT ?", (jedec.upper(), op, limit)).fetchall()
+        return [dict(r) for r in reversed(rows)]
+
+    def latest(self, jedec, max_age_s):
+        """Newest successful run of a chip not older than max_age_s, or None."""
+        with self.lock:
+            r = self.db.execute(
+                "SELECT id FROM runs WHERE jedec = ? AND rc = 0 AND finished >= ?"
+                " ORDER BY finished DESC LIMIT 1",
+                (jedec.upper(), time.time() - max_age_s)).fetchone()
+        return self.run(r["id"]) if r else None
@@ -0,0 +1,113 @@
+# ident.py - rank benchmark fingerprints on the host (menu 1 with "h")
+#
+# With host ranking the firmware prints, after its benchmark tables,
+#
+#     [BENCH] fingerprint jedec=EF4015 read_us=2201.5 prog_ms=0.41 erase_ms=44.9 top=3
+#
+# and waits for the answer in binary frames (serial_stream.py framing, see
+# "BENCHMARK + CSV WORKFLOW" in main.c):
+#
+#     'M' rank(u8) row score manf dev0 dev1 read prog prog_max erase erase_max name
+#     'N' rows       end of the list
+#     'X' text       no ranking, the device falls back to its own CSV
+#
+# IdentEngine keeps host/chip_ident.cpp (spi_flash_ident --serve) running
+# with the whole datasheet CSV loaded and asks it one query per fingerprint.
+
+import json
+import re
+import struct
+import subprocess
+import threading
+
+from serial_stream import make_frame
+
+FINGERPRINT_RE = re.compile(
+    r"\[BENCH\] fingerprint jedec=([0-9A-Fa-f]{6}) read_us=(\S+) prog_ms=(\S+) "
+    r"erase_ms=(\S+) top=(\d+)")
+
+MATCH = struct.Struct("<cBIf3B5f")      # 'M' frame without the name
+NAME_MAX = 31                           # ChipEntry.dev_name
+
+
+def parse_fingerprint(line):
+    """The query in a fingerprint line, or None."""
+    m = FINGERPRINT_RE.search(line)
+    if not m:
+        return None
+    try:
+        return {"jedec": m.group(1).upper(), "read_us": float(m.group(2)),
+                "prog_ms": float(m.group(3)), "erase_ms": float(m.group(4)),
+                "top": int(m.group(5))}
+    except ValueError:
+        return None
+
+
+def result_frames(result):
+    """Frames answering one query: an 'M' per match, then 'N'."""
+    frames = []
+    for mt in result["matches"]:
+        jedec = bytes.fromhex(mt["jedec"])
+        name = mt["name"].encode("utf-8", errors="ignore")[:NAME_MAX]
+        frames.append(make_frame(MATCH.pack(
+            b"M", mt["rank"], mt["row"], mt["score"], *jedec, mt["read_us"], mt["prog_ms"],
+            mt["prog_max_ms"], mt["erase_ms"], mt["erase_max_ms"]) + name))
+    frames.append(make_frame(b"N" + struct.pack("<I", result["rows"])))
+    return frames
+
+
+def error_frame(text):
+    return make_frame(b"X" + text.encode("utf-8", errors="ignore")[:200])
+
+
+class IdentEngine:
+    """One spi_flash_ident --serve process, started on first use and again
+    after it dies. Queries are answered one at a time."""
+
+    def __init__(self, binary, db_path):
+        self.binary = binary
+        self.db_path = db_path
+        self.lock = threading.Lock()
+        self.proc = None
+        self.info = None        # first line of the engine: rows, load time, threads
+
+    def _start(self):
+        self.proc = subprocess.Popen([self.binary, self.db_path, "--serve"],
+                                     stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                                     text=True, bufsize=1)
+        line = self.proc.stdout.readline()
+        if not line:
+            self.proc.wait()
+            self.proc = None
+            raise RuntimeError(f"{self.binary} exited while loading {self.db_path}")
+        self.info = json.loads(line)
+
+    def status(self):
+        with self.lock:
+            return {"binary": self.binary, "db": self.db_path,
+                    "running": self.proc is not None and self.proc.poll() is None,
+                    "info": self.info}
+
+    def rank(self, q):
+        """Top q["top"] rows for a fingerprint; raises RuntimeError."""
+        query = f'{q["jedec"]} {q["read_us"]!r} {q["prog_ms"]!r} {q["erase_ms"]!r} {q["top"]}\n'
+        with self.lock:
+            for attempt in (1, 2):
+                try:
+                    if self.proc is None or self.proc.poll() is not None:
+                        self._start()
+                    self.proc.stdin.write(query)
+                    self.proc.stdin.flush()
+                    line = self.proc.stdout.readline()
+                    if line:
+                        break
+                except (OSError, ValueError) as e:
+                    if attempt == 2:
+                        raise RuntimeError(f"identification engine: {e}")
+                self.proc = None
+            else:
+                raise RuntimeError("identification engine exited")
+        result = json.loads(line)
+        if "error" in result:
+            raise RuntimeError(result["error"])
+        return result
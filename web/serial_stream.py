@@ -0,0 +1,80 @@
+# serial_stream.py - split the Pico's USB serial byte stream into output pieces
+#
+# Shared by BridgeToPico.py and server.py (SPI_FLASH_TRANSPORT=serial).
+#
+# Text is cut after every \n *and* \r, so progress lines ("  42%\r") are
+# handed on as soon as they end instead of waiting for the next newline.
+#
+# Binary data travels in frames inside the same stream:
+#
+#     00 A5 <len lo> <len hi> <len bytes of payload>
+#
+# printf output never contains a NUL byte, so the marker cannot appear in
+# text. Frames are passed through untouched; what the payload means is up
+# to the sender.
+
+import re
+import struct
+
+FRAME_SOF = b"\x00\xa5"
+FRAME_HDR = struct.Struct("<2sH")
+
+_LINE_RE = re.compile(rb"[^\r\n]*[\r\n]")
+_TEXT_RE = re.compile(r"[^\r\n]*(?:[\r\n]|$)")
+
+
+def text_pieces(text):
+    """Split a (possibly batched) text payload back into \\r / \\n pieces."""
+    return [p for p in _TEXT_RE.findall(text) if p]
+
+
+def make_frame(payload):
+    return FRAME_HDR.pack(FRAME_SOF, len(payload)) + payload
+
+
+class StreamSplitter:
+    """Feed raw chunks in, get ("text", bytes) and ("frame", bytes) items out."""
+
+    def __init__(self):
+        self.buf = b""
+
+    def _lines(self, data, out):
+        end = 0
+        for m in _LINE_RE.finditer(data):
+            out.append(("text", m.group()))
+            end = m.end()
+        return data[end:]
+
+    def feed(self, chunk):
+        out = []
+        buf = self.buf + chunk
+        while buf:
+            sof = buf.find(FRAME_SOF)
+            if sof < 0:
+                # keep a trailing NUL: it may be the first half of a marker
+                keep = 1 if buf.endswith(b"\x00") else 0
+                rest = self._lines(buf[:len(buf) - keep], out)
+                buf = rest + buf[len(buf) - keep:]
+                break
+            if sof > 0:
+                rest = self._lines(buf[:sof], out)
+                if rest:                        # text cut short by a frame
+                    out.append(("text", rest))
+                buf = buf[sof:]
+            if len(buf) < FRAME_HDR.size:
+                break
+            _, length = FRAME_HDR.unpack_from(buf)
+            end = FRAME_HDR.size + length
+            if len(buf) < end:
+                break
+            out.append(("frame", buf[FRAME_HDR.size:end]))
+            buf = buf[end:]
+        self.buf = buf
+        return out
+
+    def flush(self):
+        """Line went quiet: hand on a prompt without a line ending."""
+        if not self.buf or self.buf.startswith(FRAME_SOF) or self.buf == b"\x00":
+            return []                           # partial frame, wait for the rest
+        out, self.buf = [("text", self.buf)], b""
+        return out
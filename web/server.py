@@ -1,14 +1,40 @@
+import itertools
+import json
 import os
+import re
+import shutil
+import tempfile
 import threading
+import time
+from collections import deque
 
-from flask import Flask, request, jsonify, render_template
+from flask import Flask, Response, request, jsonify, render_template, stream_with_context
 import paho.mqtt.client as mqtt
 
+from bench_store import BenchParser, BenchStore
+from ident import IdentEngine, error_frame, parse_fingerprint, result_frames
+from serial_stream import StreamSplitter, text_pieces
+from transfer import Transfer, fimg_check
+
 # ---------- MQTT config ----------
 MQTT_HOST = "test.mosquitto.org" 
 MQTT_PORT = 1883
 LOG_TOPIC = "pico/log" # Pico publishes stdout here
 CMD_TOPIC = "pico/cmd" # Web side publishes commands here
+BIN_TOPIC = "pico/bin" # framed binary from the Pico (see serial_stream.py)
+BIN_CMD_TOPIC = "pico/bin/cmd" # raw bytes to the Pico (image uploads, acks)
+# A fleet bridge (BridgeToPico.py --fleet) uses pico/<device>/log, .../cmd,
+# .../bin and a retained .../status ("online" / "offline") per device.
+
+# ---------- Device transport ----------
+# mqtt   : device reached through BridgeToPico.py and the broker (default)
+# serial : this process owns the Pico's USB serial port, no broker or bridge
+#          needed (works offline). SPI_FLASH_MQTT=1 still mirrors output to
+#          LOG_TOPIC and accepts commands from CMD_TOPIC.
+TRANSPORT = os.environ.get("SPI_FLASH_TRANSPORT", "mqtt")
+SERIAL_PORT = os.environ.get("SPI_FLASH_SERIAL", "COM8")
+BAUDRATE = 115200
+MQTT_FANOUT = TRANSPORT == "mqtt" or os.environ.get("SPI_FLASH_MQTT") == "1"
 
 # ---------- Flask app ----------
 BASE_DIR = os.path.dirname(os.path.abspath(__file__))
@@ -20,37 +46,539 @@ app = Flask(
     template_folder=BASE_DIR,
 )
 
-LOG_BUFFER = []
+# Benchmark run history (menu 1 / action identify), see bench_store.py
+BENCH_DB = os.environ.get("SPI_FLASH_BENCH_DB", os.path.join(BASE_DIR, "bench_history.sqlite3"))
+bench_store = BenchStore(BENCH_DB)
+# Images pulled from / pushed to the devices (menu 'f', see transfer.py):
+# <TRANSFER_DIR>/<device or "default">/<name>.fimg, uploads in .../upload/
+TRANSFER_DIR = os.environ.get("SPI_FLASH_TRANSFER_DIR", os.path.join(BASE_DIR, "transfers"))
+TRANSFERS_KEEP = 20     # finished transfers listed per device
+# Host ranking of benchmark fingerprints (menu 1 with "h", see ident.py):
+# SPI_FLASH_IDENT is host/chip_ident.cpp's spi_flash_ident, SPI_FLASH_IDENT_DB
+# the datasheet CSV it ranks against. Unset: the device ranks on its own.
+IDENT_BIN = os.environ.get("SPI_FLASH_IDENT")
+IDENT_DB = os.environ.get("SPI_FLASH_IDENT_DB",
+                          os.path.join(BASE_DIR, "..", "Embedded_datasheet.csv"))
+ident_engine = IdentEngine(IDENT_BIN, IDENT_DB) if IDENT_BIN else None
+
+# DUT identity from the boot banner ("Manufacturer ID: 0xEF" ...)
+CHIP_INFO_RE = re.compile(r"(Manufacturer ID|Memory Type|Capacity Code):\s+0x([0-9A-Fa-f]{2})")
+
+# Device output, one entry per output piece: (seq, text). seq counts up from 1
+# and never repeats, so a client can ask for everything after its last seq.
 LOG_MAX = 500
-db_loading = False
+log_lock = threading.Lock()
+log_cond = threading.Condition(log_lock)   # notified on every new line (SSE)
+
+
+class Device:
+    """Output buffer and parsed state of one Pico. "" is the single-device topics."""
+
+    def __init__(self, dev_id):
+        self.id = dev_id
+        self.log = deque(maxlen=LOG_MAX)
+        self.seq = 0
+        self.online = None          # unknown until a fleet bridge reports it
+        self.last_seen = None
+        self.db_loading = False
+        self.stats_last = None      # {"received": unix time, "counters": {...}}
+        self.stats_prev = None
+        self.jobs = deque()         # recent Job records, oldest first
+        self.pending = []           # unfinished jobs in send order
+        self.job_gen = 0            # version of the last job change
+        self.bench = BenchParser()
+        self.jedec = None           # DUT JEDEC ID as hex, once known
+        self.chip_info = {}
+        self.transfers = deque()    # Transfer records, newest last
+        self.transfer_gen = 0       # bumped on every transfer change
+
+    @property
+    def transfer(self):
+        """Latest transfer; only one runs at a time per device."""
+        return self.transfers[-1] if self.transfers else None
+
+    def info(self):
+        return {"id": self.id, "online": self.online, "last_seen": self.last_seen,
+                "lines": self.seq, "db_loading": self.db_loading, "jedec": self.jedec}
+
+
+devices = {"": Device("")}
+devices_gen = 0     # bumped when a device appears or goes on / offline
+
+# Job tracking: what the device prints while a command runs
+PROGRESS_RE = re.compile(r"([A-Za-z][A-Za-z ]*?) (\d+) / (\d+)( KiB)?\r")
+JOB_RE = re.compile(r"\[JOB\] (\S+) (done in|failed \(rc=(-?\d+)\) after|aborted)(?: ([\d.]+) s)?")
+BUSY_RE = re.compile(r"\[JOB\] (\S+) running, press x")
+QUEUE_STEP_RE = re.compile(r"\[QUEUE\] (\d+)/(\d+): (\S+)")
+BACKUP_OK_RE = re.compile(r"Backup OK: (\S+)")
+QUEUE_END_RE = re.compile(r"\[QUEUE\] (?:Finished: \d+ op\(s\), (\d+) failed|Nothing to run|No script)")
+MENU_HEADER = "=== MAIN MENU ==="
+MENU_PROMPT = "Select option:"
+# actions that start a device job; the others are done when the menu is back
+LONG_ACTIONS = {"identify", "backup", "restore", "restore_latest", "restore_choose", "script",
+                "download", "upload"}
+JOBS_KEEP = 50          # finished jobs kept per device
+RATE_SAMPLES = 8        # progress lines (0.5 s apart) used for bytes/s and ETA
+SSE_KEEPALIVE_S = 30
 
-mqtt_client = mqtt.Client()
+# Perf counters from the device's "[STATS] key=value ..." line (menu 's')
+STATS_RE = re.compile(r"\[STATS\] (.*)")
+
+mqtt_client = mqtt.Client() if MQTT_FANOUT else None
+ser = None
+ser_lock = threading.Lock()
 
 
 def on_connect(client, userdata, flags, rc):
     print("Web MQTT connected:", rc)
-    client.subscribe(LOG_TOPIC)
+    # serial mode: we are the bridge, so listen for commands instead of logs
+    if TRANSPORT == "serial":
+        client.subscribe(CMD_TOPIC)
+        client.subscribe(BIN_CMD_TOPIC)
+    else:
+        client.subscribe(LOG_TOPIC)
+        client.subscribe(BIN_TOPIC)
+        client.subscribe("pico/+/log")
+        client.subscribe("pico/+/bin")
+        client.subscribe("pico/+/status")
 
 
-def on_message(client, userdata, msg):
-    global db_loading
-    line = msg.payload.decode(errors="ignore")
+def dev_topic(dev_id, leaf):
+    return f"pico/{dev_id}/{leaf}" if dev_id else f"pico/{leaf}"
+
+
+def topic_device(topic):
+    """pico/log -> ("", "log"), pico/<id>/log -> ("<id>", "log")"""
+    parts = topic.split("/")
+    return ("", parts[1]) if len(parts) == 2 else (parts[1], parts[2])
+
+
+def parse_stats(line):
+    m = STATS_RE.search(line)
+    if not m:
+        return None
+    counters = {}
+    for item in m.group(1).split():
+        key, _, value = item.partition("=")
+        if value.isdigit():
+            counters[key] = int(value)
+    return counters or None
+
+
+def stats_rates(prev, last):
+    """Throughput between two snapshots, KiB/s of device uptime."""
+    if not prev or not last:
+        return None
+    dt_ms = last["uptime_ms"] - prev["uptime_ms"]
+    if dt_ms <= 0:
+        return None    # device rebooted in between
+    rates = {}
+    for key in ("spi_rx", "spi_tx", "sd_rd", "sd_wr", "crc"):
+        if key in last and key in prev:
+            rates[key + "_kib_s"] = round((last[key] - prev[key]) * 1000.0 / 1024.0 / dt_ms, 1)
+    return rates
+
+
+class Job:
+    """One command sent to a device and what came back for it."""
+
+    ids = itertools.count(1)
+    versions = itertools.count(1)
 
-    LOG_BUFFER.append(line)
-    if len(LOG_BUFFER) > LOG_MAX:
-        del LOG_BUFFER[0:len(LOG_BUFFER) - LOG_MAX]
+    def __init__(self, dev, action, payload):
+        self.id = next(Job.ids)
+        self.device = dev.id
+        self.action = action
+        self.payload = payload
+        self.state = "sent"         # sent -> running -> done / failed / aborted
+        self.created = time.time()
+        self.started = None
+        self.finished = None
+        self.step = None            # "2/4 backup" while a script runs
+        self.stage = None
+        self.done = 0
+        self.total = 0
+        self.unit = ""
+        self.samples = deque(maxlen=RATE_SAMPLES)  # (time, bytes or items)
+        self.result = None
+        self.file = None            # image written by a backup
+        self.last_line = ""
+        self.menu_seen = False      # menu printed after the command was sent
+        self.version = 0
+
+    def rate(self):
+        if len(self.samples) < 2:
+            return None
+        (t0, n0), (t1, n1) = self.samples[0], self.samples[-1]
+        return (n1 - n0) / (t1 - t0) if t1 > t0 else None
+
+    def info(self):
+        rate = self.rate()
+        percent = None
+        eta = None
+        if self.total:
+            percent = round(self.done * 100.0 / self.total, 1)
+            left = (self.total - self.done) * (1024 if self.unit else 1)
+            if rate:
+                eta = round(left / rate, 1)
+        if self.state == "done" and self.action in LONG_ACTIONS:
+            percent, eta = 100.0, 0
+        return {
+            "id": self.id, "device": self.device, "action": self.action,
+            "state": self.state, "created": self.created, "started": self.started,
+            "finished": self.finished, "step": self.step, "stage": self.stage,
+            "done": self.done, "total": self.total, "unit": self.unit,
+            "percent": percent,
+            "bytes_per_s": round(rate) if rate is not None and self.unit else None,
+            "eta_s": eta if self.state in ("sent", "running") else None,
+            "result": self.result, "file": self.file,
+        }
+
+
+jobs_by_id = {}
+
+
+def job_touch(dev, job):
+    job.version = next(Job.versions)
+    dev.job_gen = job.version
+    log_cond.notify_all()
+
+
+def job_new(dev, action, payload):
+    """Record a command; called with log_cond held."""
+    job = Job(dev, action, payload)
+    jobs_by_id[job.id] = job
+    dev.jobs.append(job)
+    dev.pending.append(job)
+    if len(dev.jobs) > JOBS_KEEP:
+        old = dev.jobs.popleft()
+        if old not in dev.pending:
+            jobs_by_id.pop(old.id, None)
+    job_touch(dev, job)
+    return job
+
+
+def job_end(dev, job, state, **result):
+    job.state = state
+    job.finished = time.time()
+    job.result = result
+    if job in dev.pending:
+        dev.pending.remove(job)
+    job_touch(dev, job)
+
+
+def job_running(job, now):
+    if job.state == "sent":
+        job.state = "running"
+        job.started = now
+
+
+def job_output(dev, line):
+    """Advance the device's oldest unfinished job from one output piece.
+    Output nobody asked for (keys typed on a terminal) gets a "console" job."""
+    now = time.time()
+    job = dev.pending[0] if dev.pending else None
+
+    m = BUSY_RE.search(line)
+    if m:
+        # the key we just sent was swallowed by a job that was already running
+        last = dev.pending[-1] if dev.pending else None
+        if last is not None and last.state == "sent":
+            job_end(dev, last, "failed", error=f"device busy ({m.group(1)} running)")
+        return
+
+    for m in PROGRESS_RE.finditer(line):
+        if job is None:
+            job = job_new(dev, "console", None)
+        job_running(job, now)
+        stage, done, total = m.group(1), int(m.group(2)), int(m.group(3))
+        if stage != job.stage or done < job.done:
+            job.samples.clear()
+        job.stage, job.done, job.total, job.unit = stage, done, total, "KiB" if m.group(4) else ""
+        job.samples.append((now, done * (1024 if job.unit else 1)))
+        job_touch(dev, job)
+    if job is None:
+        return
+
+    m = QUEUE_STEP_RE.search(line)
+    if m:
+        job_running(job, now)
+        job.step = f"{m.group(1)}/{m.group(2)} {m.group(3)}"
+        job.stage, job.done, job.total = None, 0, 0
+        job.samples.clear()
+        job_touch(dev, job)
+        return
+
+    m = QUEUE_END_RE.search(line)
+    if m and job.action == "script":
+        failed = int(m.group(1)) if m.group(1) else None
+        if failed == 0:
+            job_end(dev, job, "done", failed_ops=0)
+        else:
+            job_end(dev, job, "failed", failed_ops=failed, error=line.strip())
+        return
+
+    m = BACKUP_OK_RE.search(line)
+    if m:
+        job.file = m.group(1)
+
+    m = JOB_RE.search(line)
+    if m and (job.action != "script" or m.group(2) == "aborted"):
+        seconds = float(m.group(4)) if m.group(4) else None
+        if m.group(2) == "done in":
+            job_end(dev, job, "done", rc=0, seconds=seconds, name=m.group(1))
+        elif m.group(2) == "aborted":
+            job_end(dev, job, "aborted", name=m.group(1))
+        else:
+            job_end(dev, job, "failed", rc=int(m.group(3)), seconds=seconds, name=m.group(1))
+        return
+
+    if MENU_HEADER in line and job.state == "sent":
+        job.menu_seen = True
+        return
+    if line.rstrip().endswith(MENU_PROMPT) and job.menu_seen and job.state == "sent":
+        # menu is back without a job having run (a prompt still in flight
+        # when the command was sent has no header after it, so it is skipped;
+        # "Select option: f" is the menu taking our key, not giving up)
+        if job.action in LONG_ACTIONS:
+            job_end(dev, job, "failed", error=job.last_line or "did not start")
+        else:
+            job_end(dev, job, "done")
+        return
+
+    text = line.strip()
+    if text and not text.startswith("="):
+        job.last_line = text
+
+
+def get_device(dev_id):
+    global devices_gen
+    with log_cond:
+        dev = devices.get(dev_id)
+        if dev is None:
+            dev = devices[dev_id] = Device(dev_id)
+            devices_gen += 1
+            log_cond.notify_all()
+        return dev
+
+
+def set_online(dev_id, online):
+    global devices_gen
+    dev = get_device(dev_id)
+    with log_cond:
+        if dev.online != online:
+            dev.online = online
+            devices_gen += 1
+            log_cond.notify_all()
+
+
+def device_list():
+    with log_lock:
+        return [dev.info() for dev in devices.values()
+                if dev.id or dev.seq or len(devices) == 1]
+
+
+def log_append(dev, line):
+    with log_cond:
+        dev.seq += 1
+        dev.log.append((dev.seq, line))
+        dev.last_seen = time.time()
+        log_cond.notify_all()
+
+
+def log_after(dev, after):
+    """Lines with seq > after, newest last. Cost is O(new lines)."""
+    with log_lock:
+        last = dev.seq
+        first = dev.log[0][0] if dev.log else last + 1
+        # client is ahead of us (server restarted) or fell off the buffer
+        reset = after > last or after + 1 < first
+        if reset:
+            after = first - 1
+        n = last - after
+        lines = [line for _, line in itertools.islice(reversed(dev.log), n)]
+    lines.reverse()
+    return lines, last, reset
+
+
+def handle_output(line, dev_id=""):
+    """One piece of device output, whichever transport it came from."""
+    dev = get_device(dev_id)
+
+    counters = parse_stats(line)
+    if counters and "uptime_ms" in counters:
+        dev.stats_prev = dev.stats_last
+        dev.stats_last = {"received": time.time(), "counters": counters}
 
     if "--- Loading database from SD card ---" in line:
-        db_loading = True
+        dev.db_loading = True
     if "Total entries loaded into local memory" in line or "Integration complete." in line:
-        db_loading = False
+        dev.db_loading = False
+
+    m = CHIP_INFO_RE.search(line)
+    if m:
+        if m.group(1) == "Manufacturer ID":
+            dev.chip_info = {}
+        dev.chip_info[m.group(1)] = m.group(2).upper()
+        if len(dev.chip_info) == 3:
+            dev.jedec = "".join(dev.chip_info[k] for k in
+                                ("Manufacturer ID", "Memory Type", "Capacity Code"))
+    run = dev.bench.feed(line)
+    if run:
+        dev.jedec = run["jedec"] or dev.jedec
+        bench_store.save(dev.id, run)
+    query = parse_fingerprint(line)
+    if query:
+        threading.Thread(target=answer_fingerprint, args=(dev.id, query), daemon=True).start()
+
+    with log_cond:
+        job_output(dev, line)
+    log_append(dev, line)
+
+
+def answer_fingerprint(dev_id, query):
+    """Rank a device's benchmark fingerprint and send the matches back."""
+    if ident_engine is None:
+        frames = [error_frame("no ranking engine on the host (SPI_FLASH_IDENT)")]
+    else:
+        try:
+            frames = result_frames(ident_engine.rank(query))
+        except RuntimeError as e:
+            print(f"[Ident] {e}")
+            frames = [error_frame(str(e))]
+    send_bytes_to_device(b"".join(frames), dev_id)
+
+
+def handle_frame(payload, dev_id=""):
+    """One binary frame from a device: belongs to its running transfer."""
+    dev = devices.get(dev_id)
+    transfer = dev.transfer if dev else None
+    if transfer is not None and transfer.active():
+        transfer.frame(payload)
+
 
-# Register MQTT callbacks and start the loop in a background thread
-mqtt_client.on_connect = on_connect
-mqtt_client.on_message = on_message
-mqtt_client.connect(MQTT_HOST, MQTT_PORT, 60)
+def on_message(client, userdata, msg):
+    if TRANSPORT == "serial":
+        # command from another MQTT client
+        if msg.topic == BIN_CMD_TOPIC:
+            send_bytes_to_device(msg.payload)
+        else:
+            send_to_device(msg.payload.decode(errors="ignore"))
+        return
+    dev_id, leaf = topic_device(msg.topic)
+    if leaf == "bin":
+        handle_frame(msg.payload, dev_id)
+        return
+    text = msg.payload.decode(errors="ignore")
+    if leaf == "status":
+        set_online(dev_id, text == "online")
+    elif leaf == "log":
+        # the bridge batches output: one message may hold many lines
+        for piece in text_pieces(text):
+            handle_output(piece, dev_id)
+
+
+# ---------- direct serial transport ----------
+
+def serial_open():
+    import serial
+    while True:
+        try:
+            s = serial.Serial(SERIAL_PORT, BAUDRATE, timeout=0.05)
+            print(f"[Serial] Opened {SERIAL_PORT} @ {BAUDRATE}")
+            return s
+        except serial.SerialException as e:
+            print(f"[Serial open error] {e}. Retrying in 2s...")
+            time.sleep(2)
+
+
+def serial_reader():
+    """Read device output in chunks and hand it on as soon as a line ends."""
+    import serial
+    global ser
+    splitter = StreamSplitter()
+    while True:
+        if ser is None:
+            s = serial_open()
+            with ser_lock:
+                ser = s
+            splitter = StreamSplitter()
+        try:
+            chunk = ser.read(ser.in_waiting or 1)
+        except serial.SerialException as e:
+            print(f"[Serial read error] {e}. Re-opening port...")
+            with ser_lock:
+                try:
+                    ser.close()
+                except Exception:
+                    pass
+                ser = None
+            time.sleep(1)
+            continue
+
+        # quiet line: flush a prompt that has no line ending ("Select option: ")
+        items = splitter.feed(chunk) if chunk else splitter.flush()
+        for kind, data in items:
+            if kind == "frame":
+                handle_frame(data)
+                if mqtt_client is not None:
+                    mqtt_client.publish(BIN_TOPIC, data)
+                continue
+            text = data.decode("utf-8", errors="ignore")
+            handle_output(text)
+            if mqtt_client is not None:
+                mqtt_client.publish(LOG_TOPIC, text)
+
+
+def send_to_device(payload, dev_id=""):
+    """Send menu keys / text to the device over the configured transport."""
+    if TRANSPORT == "serial":
+        if dev_id:
+            return False            # serial mode drives exactly one Pico
+        with ser_lock:
+            if ser is None:
+                return False
+            ser.write(payload.encode("utf-8"))
+            ser.flush()
+        return True
+    mqtt_client.publish(dev_topic(dev_id, "cmd"), payload)
+    return True
+
+
+def send_bytes_to_device(data, dev_id=""):
+    """Raw bytes (transfer frames), unmodified on the way to the device."""
+    if TRANSPORT == "serial":
+        if dev_id:
+            return False
+        with ser_lock:
+            if ser is None:
+                return False
+            ser.write(data)
+            ser.flush()
+        return True
+    mqtt_client.publish(dev_topic(dev_id, "bin/cmd"), data)
+    return True
 
-threading.Thread(target=mqtt_client.loop_forever, daemon=True).start()
+
+def device_command(dev_id, action, payload):
+    """Send a menu command and record it as a Job (failed if it can't be sent)."""
+    dev = get_device(dev_id)
+    with log_cond:
+        job = job_new(dev, action, payload)
+    if not send_to_device(payload, dev_id):
+        with log_cond:
+            job_end(dev, job, "failed", error="device not connected")
+    return job
+
+
+# Start the transport(s) in background threads
+if TRANSPORT == "serial":
+    threading.Thread(target=serial_reader, daemon=True).start()
+if mqtt_client is not None:
+    mqtt_client.on_connect = on_connect
+    mqtt_client.on_message = on_message
+    mqtt_client.connect(MQTT_HOST, MQTT_PORT, 60)
+    threading.Thread(target=mqtt_client.loop_forever, daemon=True).start()
 
 
 # ---------- HTTP endpoints ----------
@@ -60,14 +588,133 @@ def index():
     return render_template("index.html")
 
 
+def arg_device():
+    """Device named by ?device=<id> (default: the single-device topics)."""
+    return devices.get(request.args.get("device", ""))
+
+
+def no_device():
+    return jsonify({"ok": False, "error": "unknown device"}), 404
+
+
+@app.get("/api/devices")
+def api_devices():
+    """Devices seen on the broker: id, online, last_seen, lines, db_loading."""
+    return jsonify({"devices": device_list()})
+
+
 @app.get("/api/logs")
 def api_logs():
+    """
+    Device output since a cursor: GET /api/logs?device=<id>&after=<seq>
+
+      lines   new lines, oldest first (after=0 → whole buffer)
+      next    cursor for the next call
+      reset   true if lines were missed (buffer wrapped, server restarted):
+              the client should clear its view before appending
+    """
+    dev = arg_device()
+    if dev is None:
+        return no_device()
+    after = request.args.get("after", default=0, type=int)
+    lines, last, reset = log_after(dev, max(after, 0))
+    return jsonify({
+        "lines": lines,
+        "next": last,
+        "reset": reset and after > 0,
+        "db_loading": dev.db_loading,
+    })
+
+
+@app.get("/api/stats")
+def api_stats():
+    """Last perf counters reported by the device (send action 'stats' to refresh)."""
+    dev = arg_device()
+    if dev is None:
+        return no_device()
+    if not dev.stats_last:
+        return jsonify({"ok": False, "error": "no stats received yet"}), 404
+    last = dev.stats_last["counters"]
+    # lifetime SD throughput from the device's own timing of f_read / f_write
+    sd = {}
+    if last.get("sd_rd_us"):
+        sd["sd_rd_kib_s"] = round(last["sd_rd"] * 1e6 / 1024.0 / last["sd_rd_us"], 1)
+    if last.get("sd_wr_us"):
+        sd["sd_wr_kib_s"] = round(last["sd_wr"] * 1e6 / 1024.0 / last["sd_wr_us"], 1)
     return jsonify({
-        "lines": LOG_BUFFER,
-        "db_loading": db_loading,
+        "ok": True,
+        "received": dev.stats_last["received"],
+        "counters": last,
+        "sd_throughput": sd,
+        "rates": stats_rates(dev.stats_prev and dev.stats_prev["counters"], last),
     })
 
 
+def sse(event, data, event_id=None):
+    msg = "event: %s\ndata: %s\n" % (event, json.dumps(data))
+    if event_id is not None:
+        msg += "id: %d\n" % event_id
+    return msg + "\n"
+
+
+def stream_events(dev, after):
+    """SSE generator: 'log' (id = seq), 'job' (record on every change),
+    'transfer', 'status' and 'devices' events."""
+    yield "retry: 2000\n\n"
+    sent_loading = None
+    sent_gen = None
+    sent_job = dev.job_gen      # only changes from now on
+    sent_transfer = dev.transfer_gen
+    while True:
+        if devices_gen != sent_gen:
+            sent_gen = devices_gen
+            yield sse("devices", {"devices": device_list()})
+        lines, last, reset = log_after(dev, after)
+        if lines or reset:
+            yield sse("log", {"lines": lines, "reset": reset and after > 0}, last)
+            after = last
+        if dev.job_gen != sent_job:
+            with log_lock:
+                changed = [job.info() for job in dev.jobs if job.version > sent_job]
+                sent_job = dev.job_gen
+            for info in changed:
+                yield sse("job", info)
+        if dev.transfer_gen != sent_transfer:
+            sent_transfer = dev.transfer_gen
+            yield sse("transfer", dev.transfer.info())
+        if dev.db_loading != sent_loading:
+            sent_loading = dev.db_loading
+            yield sse("status", {"db_loading": dev.db_loading})
+
+        with log_cond:
+            woke = log_cond.wait_for(lambda: dev.seq > after or devices_gen != sent_gen
+                                     or dev.job_gen != sent_job
+                                     or dev.transfer_gen != sent_transfer,
+                                     timeout=SSE_KEEPALIVE_S)
+        if not woke:
+            yield ": keepalive\n\n"     # keeps proxies from closing the stream
+
+
+@app.get("/api/stream")
+def api_stream():
+    """
+    Server-Sent Events push of device output. Resumes after the browser's
+    Last-Event-ID (or ?after=<seq>), so reconnects don't lose or repeat lines.
+    One stream per device: ?device=<id>.
+    """
+    dev = arg_device()
+    if dev is None:
+        return no_device()
+    after = request.headers.get("Last-Event-ID") or request.args.get("after") or 0
+    try:
+        after = max(int(after), 0)
+    except ValueError:
+        after = 0
+    return Response(stream_with_context(stream_events(dev, after)),
+                    mimetype="text/event-stream",
+                    headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"})
+
+
 @app.post("/api/command")
 def api_command():
     """
@@ -78,16 +725,39 @@ def api_command():
       3 = Restore SPI flash from SD (latest .fimg)
       4 = Restore SPI flash from SD (choose specific file)
       5 = List available flash images (.fimg)
+      6 = Run job script (ops separated by ';', or @file on SD)
+      b = Start / stop SPI bus log (BUSLOG/*.fbl on SD)
+      s = Show performance counters ([STATS] line, see GET /api/stats)
+      t = Dump trace buffer ([TRACE] lines, see host/trace2chrome.py)
       q = Quit (idle loop), m = return to menu in idle mode
       r = Resume from idle Loop to main menu
+
+    "device": "<id>" addresses one Pico of a fleet bridge.
+
+    identify: "topN" (1-10), "host": true ranks the benchmark result on the
+    host against the full datasheet CSV (see ident.py), falling back to the
+    device's own ranking when that is not available.
+
+    Returns {"ok": true, "job": <id>}: progress, throughput and the result
+    are then at GET /api/jobs/<id> (and pushed as 'job' events on /api/stream).
     """
     data = request.get_json(force=True)
+    dev_id = str(data.get("device") or "")
     action = data.get("action")
     topN = data.get("topN")
     filename = data.get("filename") 
+    script = data.get("script")
 
     if action == "identify":
-        # Option 1: Run benchmark + CSV + identification
+        # Option 1: Run benchmark + CSV + identification.
+        # "max_age_s": reuse a stored run of the same chip if it is recent enough
+        max_age = data.get("max_age_s")
+        dev = devices.get(dev_id)
+        if max_age and dev is not None and dev.jedec:
+            cached = bench_store.latest(dev.jedec, float(max_age))
+            if cached:
+                return jsonify({"ok": True, "cached": cached})
+        host = "h" if data.get("host") else ""
         if topN is not None:
             try:
                 topN = int(topN)
@@ -97,7 +767,9 @@ def api_command():
                 topN = 1
             if topN > 10:
                 topN = 10
-            payload = f"1{topN}\n"
+            payload = f"1{topN}{host}\n"
+        elif host:
+            payload = "1h\n"
         else:
             payload = "1"        
         
@@ -123,6 +795,26 @@ def api_command():
         # Menu option 5: list available .fimg images on SD
         payload = "5\n"
 
+    elif action == "script":
+        # Menu option 6: run a batch of ops back to back on the device,
+        # e.g. "backup; restore; verify; identify 3" or "@JOBS/run.txt"
+        safe = str(script or "").replace("\r", " ").replace("\n", ";").strip()
+        if not safe:
+            return jsonify({"ok": False, "error": "empty script"}), 400
+        payload = f"6{safe}\n"
+
+    elif action == "buslog":
+        # b: toggle recording of DUT SPI transactions to SD
+        payload = "b"
+
+    elif action == "stats":
+        # s: print perf counters; the [STATS] line is picked up by on_message
+        payload = "s"
+
+    elif action == "trace":
+        # t: dump the on-device trace ring buffer into the log
+        payload = "t"
+
     elif action == "quit":
         # q = Quit (idle loop)
         payload = "q"
@@ -135,20 +827,347 @@ def api_command():
         return jsonify({"ok": False, "error": "unknown action"}), 400
 
 
-    mqtt_client.publish(CMD_TOPIC, payload)
+    job = device_command(dev_id, action, payload)
+    if job.state == "failed":
+        return jsonify({"ok": False, "error": "device not connected", "job": job.id}), 503
+    return jsonify({"ok": True, "job": job.id})
+
+
+@app.get("/api/jobs")
+def api_jobs():
+    """Recent jobs of a device (?device=<id>), newest first."""
+    dev = arg_device()
+    if dev is None:
+        return no_device()
+    with log_lock:
+        jobs = [job.info() for job in reversed(dev.jobs)]
+    return jsonify({"jobs": jobs})
+
+
+@app.get("/api/jobs/<int:job_id>")
+def api_job(job_id):
+    """
+    One job: state (sent / running / done / failed / aborted), stage, done /
+    total, percent, bytes_per_s and eta_s from the progress lines, and the
+    result (rc, seconds or error) once it has finished.
+    """
+    with log_lock:
+        job = jobs_by_id.get(job_id)
+        info = job.info() if job else None
+    if info is None:
+        return jsonify({"ok": False, "error": "unknown job"}), 404
+    return jsonify({"ok": True, "job": info})
+
+
+# ---------- image transfer (menu 'f', see transfer.py) ----------
+
+transfers_by_id = {}
+
+
+def safe_name(name):
+    """Plain file name for the server and the device's FAT volume."""
+    name = os.path.basename(str(name or "").replace("\\", "/")).strip()
+    return re.sub(r"[^A-Za-z0-9._-]", "_", name)
+
+
+def transfer_dir(dev, *sub):
+    """Per-device directory under TRANSFER_DIR, never outside it."""
+    root = os.path.realpath(TRANSFER_DIR)
+    name = safe_name(dev.id).lstrip(".") or "default"
+    path = os.path.realpath(os.path.join(root, name, *sub))
+    if os.path.commonpath([root, path]) != root:
+        raise ValueError(f"transfer path outside {root}")
+    os.makedirs(path, exist_ok=True)
+    return path
+
+
+def transfer_active(dev):
+    with log_cond:
+        return dev.transfer is not None and dev.transfer.active()
+
+
+def transfer_begin(dev, direction, remote, local, staged=None, **kwargs):
+    """
+    Start a Transfer, or None while the device already has one running.
+    staged: file renamed to local once the transfer is accepted (upload).
+    """
+    dev_id = dev.id
+
+    def notify():
+        with log_cond:
+            dev.transfer_gen += 1
+            log_cond.notify_all()
+
+    with log_cond:
+        if dev.transfer is not None and dev.transfer.active():
+            return None
+        if staged:
+            os.replace(staged, local)
+        transfer = Transfer(dev_id, direction, remote, local,
+                            command=lambda action, payload: device_command(dev_id, action, payload),
+                            send=lambda data: send_bytes_to_device(data, dev_id),
+                            notify=notify, **kwargs)
+        dev.transfers.append(transfer)
+        transfers_by_id[transfer.id] = transfer
+        if len(dev.transfers) > TRANSFERS_KEEP:
+            transfers_by_id.pop(dev.transfers.popleft().id, None)
+    transfer.start()
+    return transfer
+
+
+def restore_after_upload(transfer):
+    """Upload finished: restore the DUT from it (menu 4)."""
+    return device_command(transfer.device, "restore_choose",
+                          f"4{os.path.basename(transfer.remote)}\n")
+
+
+def transfer_busy():
+    return jsonify({"ok": False, "error": "a transfer is already running on this device"}), 409
+
+
+@app.post("/api/images/download")
+def api_image_download():
+    """
+    Pull an image from the device's SD card to the server:
+      {"path": "FLASHIMG/x.fimg"}   (a bare name is looked up in FLASHIMG)
+      {"source": "dut"}             back up the flash first (menu 2), pull that
+
+    A partial earlier pull of the same file resumes where it stopped.
+    Returns {"ok": true, "transfer": {...}}; the bytes stream to the browser
+    from GET /api/transfers/<id>/file while they arrive.
+    """
+    data = request.get_json(force=True)
+    dev = devices.get(str(data.get("device") or ""))
+    if dev is None:
+        return no_device()
+    if data.get("source") == "dut":
+        remote, name, source = None, "dut.fimg", "dut"     # renamed after the backup
+    else:
+        remote = str(data.get("path") or "").strip()
+        if not remote or any(c.isspace() for c in remote):
+            return jsonify({"ok": False, "error": "path required, without spaces"}), 400
+        if "/" not in remote:
+            remote = f"FLASHIMG/{remote}"
+        name, source = safe_name(remote), None
+
+    transfer = transfer_begin(dev, "download", remote,
+                              os.path.join(transfer_dir(dev), name), source=source)
+    if transfer is None:
+        return transfer_busy()
+    return jsonify({"ok": True, "transfer": transfer.info()})
+
+
+@app.post("/api/images/upload")
+def api_image_upload():
+    """
+    Push a .fimg to FLASHIMG/ on the device's SD card:
+      POST /api/images/upload?device=<id>&name=x.fimg&restore=1
+    with the image as the body (raw, or multipart field "file").
+
+    The image is checked (header, trailer and data CRC) before it is sent.
+    With restore=1 the DUT is restored from it once it is on the card.
+
+    The body goes to a temporary file first; it replaces <name> (the local
+    copy a running or resumable transfer of that name uses) only once the
+    device has accepted the new transfer.
+    """
+    dev = arg_device()
+    if dev is None:
+        return no_device()
+    upload = request.files.get("file") if request.files else None
+    name = safe_name(request.args.get("name") or (upload.filename if upload else ""))
+    if not name.endswith(".fimg"):
+        return jsonify({"ok": False, "error": "name must end in .fimg"}), 400
+    if transfer_active(dev):
+        return transfer_busy()
+
+    updir = transfer_dir(dev, "upload")
+    fd, staged = tempfile.mkstemp(dir=updir, prefix=f".{name}.", suffix=".tmp")
+    try:
+        with os.fdopen(fd, "wb") as f:
+            shutil.copyfileobj(upload.stream if upload else request.stream, f, 1 << 20)
+        check = fimg_check(staged)
+        if not check["valid"]:
+            return jsonify({"ok": False, "error": check.get("error"), "check": check}), 400
+
+        after = restore_after_upload if request.args.get("restore") == "1" else None
+        transfer = transfer_begin(dev, "upload", f"FLASHIMG/{name}", os.path.join(updir, name),
+                                  staged=staged, after=after)
+        if transfer is None:
+            return transfer_busy()
+        return jsonify({"ok": True, "transfer": transfer.info(), "check": check})
+    finally:
+        if os.path.exists(staged):
+            os.remove(staged)
+
+
+@app.get("/api/transfers")
+def api_transfers():
+    """Recent transfers of a device (?device=<id>), newest first."""
+    dev = arg_device()
+    if dev is None:
+        return no_device()
+    with log_lock:
+        transfers = [t.info() for t in reversed(dev.transfers)]
+    return jsonify({"transfers": transfers})
+
+
+def get_transfer(transfer_id):
+    with log_lock:
+        return transfers_by_id.get(transfer_id)
+
+
+@app.get("/api/transfers/<int:transfer_id>")
+def api_transfer(transfer_id):
+    """
+    One transfer: state (queued / backup / running / done / failed /
+    cancelled), size, done, percent, bytes_per_s, eta_s, attempts, error and
+    for downloads the image check of the finished file.
+    """
+    transfer = get_transfer(transfer_id)
+    if transfer is None:
+        return jsonify({"ok": False, "error": "unknown transfer"}), 404
+    return jsonify({"ok": True, "transfer": transfer.info()})
+
+
+@app.post("/api/transfers/<int:transfer_id>/cancel")
+def api_transfer_cancel(transfer_id):
+    transfer = get_transfer(transfer_id)
+    if transfer is None:
+        return jsonify({"ok": False, "error": "unknown transfer"}), 404
+    transfer.cancel()
     return jsonify({"ok": True})
 
 
+@app.post("/api/transfers/<int:transfer_id>/resume")
+def api_transfer_resume(transfer_id):
+    """Start a failed / cancelled transfer again from where it stopped."""
+    old = get_transfer(transfer_id)
+    if old is None:
+        return jsonify({"ok": False, "error": "unknown transfer"}), 404
+    if old.active() or old.state == "done" or old.remote is None:
+        return jsonify({"ok": False, "error": f"transfer is {old.state}"}), 409
+    dev = devices.get(old.device)
+    if dev is None:
+        return no_device()
+    transfer = transfer_begin(dev, old.direction, old.remote, old.local,
+                              resume=True, after=old.after)
+    if transfer is None:
+        return transfer_busy()
+    return jsonify({"ok": True, "transfer": transfer.info()})
+
+
+def stream_transfer_file(transfer, pos):
+    """The downloaded file from pos, following it while it still grows."""
+    while True:
+        with transfer.file_lock:            # .part is renamed when complete
+            try:
+                with open(transfer.path(), "rb") as f:
+                    f.seek(pos)
+                    data = f.read(1 << 20)
+            except FileNotFoundError:
+                data = b""
+        if data:
+            pos += len(data)
+            yield data
+            continue
+        if not transfer.active():
+            return          # done, or failed: the short body makes the browser say so
+        with log_cond:
+            log_cond.wait(timeout=0.5)
+
+
+@app.get("/api/transfers/<int:transfer_id>/file")
+def api_transfer_file(transfer_id):
+    """
+    Download the image of a pull, streamed while it still arrives from the
+    device. Honours "Range: bytes=N-", so a browser can resume as well.
+    """
+    transfer = get_transfer(transfer_id)
+    if transfer is None or transfer.direction != "download":
+        return jsonify({"ok": False, "error": "unknown download"}), 404
+    # size is known once the device has answered (after the backup for source=dut)
+    with log_cond:
+        log_cond.wait_for(lambda: transfer.size is not None or not transfer.active(),
+                          timeout=SSE_KEEPALIVE_S)
+    if transfer.size is None:
+        return jsonify({"ok": False, "error": transfer.error or "not started yet"}), 409
+
+    size, start = transfer.size, 0
+    m = re.match(r"bytes=(\d+)-$", request.headers.get("Range", ""))
+    if m:
+        start = min(int(m.group(1)), size)
+    headers = {
+        "Content-Disposition": f'attachment; filename="{os.path.basename(transfer.local)}"',
+        "Content-Length": str(size - start),
+        "Accept-Ranges": "bytes",
+        "Cache-Control": "no-cache",
+    }
+    status = 200
+    if m:
+        status = 206
+        headers["Content-Range"] = f"bytes {start}-{size - 1}/{size}"
+    return Response(stream_with_context(stream_transfer_file(transfer, start)),
+                    status=status, mimetype="application/octet-stream", headers=headers)
+
+
+@app.get("/api/ident")
+def api_ident():
+    """Host ranking engine: configured, running, rows loaded."""
+    if ident_engine is None:
+        return jsonify({"enabled": False})
+    return jsonify({"enabled": True, **ident_engine.status()})
+
+
+@app.get("/api/bench/chips")
+def api_bench_chips():
+    """JEDEC IDs with stored benchmark runs: run count, first and last run."""
+    return jsonify({"chips": bench_store.chips()})
+
+
+@app.get("/api/bench/runs")
+def api_bench_runs():
+    """Stored runs, newest first: ?jedec=EF4015&device=<id>&limit=50"""
+    limit = min(max(request.args.get("limit", default=50, type=int), 1), 1000)
+    return jsonify({"runs": bench_store.runs(request.args.get("jedec"),
+                                             request.args.get("device"), limit)})
+
+
+@app.get("/api/bench/runs/<int:run_id>")
+def api_bench_run(run_id):
+    """One run: per-op n / min / avg / p50 / p90 / p99 / max (us) and the ranking."""
+    run = bench_store.run(run_id)
+    if run is None:
+        return jsonify({"ok": False, "error": "unknown run"}), 404
+    return jsonify({"ok": True, "run": run})
+
+
+@app.get("/api/bench/series")
+def api_bench_series():
+    """Drift of one chip over time: ?jedec=EF4015&op=erase|prog|read, oldest first."""
+    jedec = request.args.get("jedec")
+    if not jedec:
+        return jsonify({"ok": False, "error": "jedec required"}), 400
+    op = request.args.get("op", "erase")
+    return jsonify({"ok": True, "jedec": jedec.upper(), "op": op,
+                    "points": bench_store.series(jedec, op)})
+
+
 @app.post("/api/send")
 def api_send():
     data = request.get_json(force=True)
     payload = data.get("data", "")
+    dev_id = str(data.get("device") or "")
     if not isinstance(payload, str) or not payload:
         return jsonify({"ok": False, "error": "empty payload"}), 400
 
-    mqtt_client.publish(CMD_TOPIC, payload)
+    if not send_to_device(payload, dev_id):
+        return jsonify({"ok": False, "error": "device not connected"}), 503
     return jsonify({"ok": True})
 
 
 if __name__ == "__main__":
-    app.run(host="0.0.0.0", port=5000, debug=True)
+    # threaded: every open /api/stream holds a worker.
+    # No reloader in serial mode: its second process would fight over the port.
+    app.run(host="0.0.0.0", port=5000, debug=True, threaded=True,
+            use_reloader=TRANSPORT != "serial")
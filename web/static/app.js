@@ -20,13 +20,16 @@ function showBanner(type, message) {
 // Track whether we're waiting for a filename for menu option 4
 let restorePending = false;
 
+// Pico the terminal shows and commands go to ("" = single-device topics)
+let currentDevice = "";
+
 
 // High-level commands (mapped in server.py -> MQTT -> Pico menu)
 // identify, backup, restore (latest), quit, resume
 
-async function sendCommand(action, topN) {
+async function sendCommand(action, topN, extra) {
   try {
-    const body = { action };
+    const body = { action, device: currentDevice, ...extra };
     if (topN != null) {
       body.topN = topN;
     }
@@ -46,7 +49,8 @@ async function sendCommand(action, topN) {
     if (!data.ok) {
       showBanner("error", `Device rejected '${action}': ${data.error || "unknown error"}.`);
     } else {
-      showBanner("info", `Command '${action}' sent successfully.`);
+      activeJobId = data.job;
+      showBanner("info", `Command '${action}' sent (job ${data.job}).`);
     }
   } catch (err) {
     console.error(err);
@@ -60,7 +64,7 @@ async function sendRawToDevice(text) {
     const res = await fetch("/api/send", {
       method: "POST",
       headers: { "Content-Type": "application/json" },
-      body: JSON.stringify({ data: text }),
+      body: JSON.stringify({ data: text, device: currentDevice }),
     });
 
     if (!res.ok) {
@@ -83,7 +87,8 @@ async function sendRawToDevice(text) {
 // Menu option 1: Run benchmark + CSV + identification
 async function runBenchmarkWorkflow() {
   let topN = prompt(
-    "[CSV MATCH] How many top matches to display? (1-10, Enter for 3):",
+    "[CSV MATCH] How many top matches to display? (1-10, Enter for 3; " +
+      "add h to rank on the host, e.g. 3h):",
     "3"
   );
 
@@ -92,12 +97,14 @@ async function runBenchmarkWorkflow() {
     return;
   }
 
+  // "3h": rank against the host's full datasheet DB (server.py / ident.py)
+  const host = /h/i.test(topN);
   topN = parseInt(topN, 10);
   if (isNaN(topN)) topN = 3;
   if (topN < 1) topN = 1;
   if (topN > 10) topN = 10;
 
-  await sendCommand("identify", topN);
+  await sendCommand("identify", topN, host ? { host: true } : undefined);
 }
 
 
@@ -115,26 +122,536 @@ function restoreFromSpecificImage() {
 }
 
 
-// Poll logs from /api/logs and update the terminal + DB status pill
+// Menu option 6: run a job script (several ops back to back on the device)
+async function runJobScript() {
+  const script = prompt(
+    "[QUEUE] Ops separated by ';' (identify [N], backup, restore [file], verify [file], list, stats)\n" +
+      "or @path of a script file on SD:",
+    "backup; restore; verify; identify 3"
+  );
+
+  if (script === null || !script.trim()) {
+    return;
+  }
+
+  await sendCommand("script", null, { script: script.trim() });
+}
+
+
+// Menu option s: ask the device for its counters, then summarise /api/stats
+async function showStats() {
+  await sendCommand("stats");
+  setTimeout(async () => {
+    try {
+      const res = await fetch(`/api/stats?device=${encodeURIComponent(currentDevice)}`);
+      const data = await res.json();
+      if (!data.ok) return;
+      const c = data.counters;
+      const sd = data.sd_throughput || {};
+      let msg =
+        `SPI ${c.spi_rx} B in / ${c.spi_tx} B out, WIP wait ${(c.wip_us / 1000).toFixed(1)} ms, ` +
+        `erase timeouts ${c.erase_timeouts}, program timeouts ${c.prog_timeouts}; ` +
+        `SD read ${sd.sd_rd_kib_s ?? "-"} KiB/s, write ${sd.sd_wr_kib_s ?? "-"} KiB/s`;
+      if (data.rates) {
+        msg += ` (since previous: SPI in ${data.rates.spi_rx_kib_s} KiB/s)`;
+      }
+      showBanner("info", msg);
+    } catch (err) {
+      console.error(err);
+    }
+  }, 1500);
+}
+
+
+// Benchmark history: chips with stored runs, then one chart per operation
+async function loadBenchChips() {
+  const sel = document.getElementById("benchChip");
+  if (!sel) return;
+  try {
+    const res = await fetch("/api/bench/chips");
+    const data = await res.json();
+    const keep = sel.value;
+    sel.textContent = "";
+    for (const c of data.chips) {
+      const opt = document.createElement("option");
+      opt.value = c.jedec;
+      opt.textContent = `${c.jedec} (${c.runs} run${c.runs === 1 ? "" : "s"})`;
+      sel.appendChild(opt);
+    }
+    if (keep) sel.value = keep;
+  } catch (err) {
+    console.error(err);
+  }
+}
+
+// Median per run as a line, p90 dashed, min..max as a band
+function drawBenchChart(canvas, op, points) {
+  const ctx = canvas.getContext("2d");
+  const w = canvas.width;
+  const h = canvas.height;
+  const pad = { l: 48, r: 8, t: 14, b: 12 };
+  ctx.clearRect(0, 0, w, h);
+  ctx.font = "11px system-ui, sans-serif";
+  ctx.fillStyle = "#b0b0b0";
+  ctx.fillText(`${op} (us), ${points.length} run${points.length === 1 ? "" : "s"}`, pad.l, 11);
+  if (!points.length) return;
+
+  const lo = Math.min(...points.map((p) => p.min_us));
+  const hi = Math.max(...points.map((p) => p.max_us));
+  const span = hi - lo || Math.max(hi * 0.01, 1);
+  const x = (i) => pad.l + (points.length === 1 ? 0.5 : i / (points.length - 1)) * (w - pad.l - pad.r);
+  const y = (v) => h - pad.b - ((v - lo) / span) * (h - pad.t - pad.b);
+
+  ctx.fillText(hi.toFixed(1), 2, pad.t + 8);
+  ctx.fillText(lo.toFixed(1), 2, h - pad.b);
+
+  ctx.fillStyle = "rgba(33, 150, 243, 0.18)";
+  ctx.beginPath();
+  points.forEach((p, i) => (i ? ctx.lineTo(x(i), y(p.max_us)) : ctx.moveTo(x(i), y(p.max_us))));
+  for (let i = points.length - 1; i >= 0; i--) ctx.lineTo(x(i), y(points[i].min_us));
+  ctx.closePath();
+  ctx.fill();
+
+  const line = (key, color, dash) => {
+    ctx.strokeStyle = color;
+    ctx.setLineDash(dash);
+    ctx.beginPath();
+    points.forEach((p, i) => (i ? ctx.lineTo(x(i), y(p[key])) : ctx.moveTo(x(i), y(p[key]))));
+    ctx.stroke();
+    points.forEach((p, i) => ctx.fillRect(x(i) - 1.5, y(p[key]) - 1.5, 3, 3));
+  };
+  ctx.fillStyle = "#ffca28";
+  line("p90_us", "#ffca28", [4, 3]);
+  ctx.fillStyle = "#42a5f5";
+  line("p50_us", "#42a5f5", []);
+  ctx.setLineDash([]);
+}
+
+async function showBenchHistory() {
+  const sel = document.getElementById("benchChip");
+  const box = document.getElementById("benchCharts");
+  if (!sel || !box) return;
+  if (!sel.value) {
+    await loadBenchChips();
+    if (!sel.value) {
+      showBanner("info", "No benchmark runs stored yet. Run the benchmark workflow first.");
+      return;
+    }
+  }
+  const jedec = encodeURIComponent(sel.value);
+  try {
+    for (const canvas of box.querySelectorAll("canvas[data-op]")) {
+      const res = await fetch(`/api/bench/series?jedec=${jedec}&op=${canvas.dataset.op}`);
+      const data = await res.json();
+      drawBenchChart(canvas, canvas.dataset.op, data.points || []);
+    }
+    const res = await fetch(`/api/bench/runs?jedec=${jedec}&limit=1`);
+    const last = (await res.json()).runs[0];
+    const latest = document.getElementById("benchLatest");
+    if (latest && last) {
+      const when = new Date(last.finished * 1000).toLocaleString();
+      latest.textContent =
+        `Last run ${when} on ${last.device || "default"}: ` +
+        `best match ${last.top_match || "-"} (score ${last.top_score != null ? last.top_score.toFixed(4) : "-"})`;
+    }
+    box.hidden = false;
+  } catch (err) {
+    console.error(err);
+    showBanner("error", "Could not load benchmark history.");
+  }
+}
+
+
+// Image download / upload through the device (menu f, see web/transfer.py)
+let activeTransferId = null;
+let downloadTransferId = null;   // open its file in the browser once bytes flow
+
+function formatBytes(n) {
+  return n >= 1048576 ? `${(n / 1048576).toFixed(1)} MiB` : `${(n / 1024).toFixed(0)} KiB`;
+}
+
+// Transfer record from /api/transfers/<id> or a 'transfer' stream event
+function showTransfer(t) {
+  const el = document.getElementById("transferStatus");
+  const resume = document.getElementById("btnTransferResume");
+  const what = `${t.direction === "upload" ? "Upload" : "Download"} ${t.remote || t.name}`;
+  let text;
+  if (t.state === "backup") {
+    text = `${what}: backing up the flash first…`;
+  } else if (t.state === "running" || t.state === "queued") {
+    const parts = [what];
+    if (t.size != null) parts.push(`${formatBytes(t.done)} / ${formatBytes(t.size)} (${t.percent}%)`);
+    if (t.bytes_per_s != null) parts.push(formatRate(t.bytes_per_s));
+    if (t.eta_s != null) parts.push(`ETA ${Math.ceil(t.eta_s)} s`);
+    if (t.attempts > 1) parts.push(`attempt ${t.attempts}, resumed at ${formatBytes(t.offset)}`);
+    text = parts.join(" · ");
+  } else if (t.state === "done") {
+    text = `${what}: done, ${formatBytes(t.size)}`;
+    if (t.check) text += t.check.valid ? ", image CRC OK" : `, image check failed: ${t.check.error}`;
+    if (t.next_job != null) {
+      text += ", restoring…";
+      activeJobId = t.next_job;
+    }
+  } else {
+    text = `${what}: ${t.state}${t.error ? ` (${t.error})` : ""}`;
+  }
+  if (el) el.textContent = text;
+  if (resume) {
+    resume.hidden = !(t.state === "failed" || t.state === "cancelled");
+    resume.dataset.transfer = t.id;
+  }
+
+  // the browser download streams the file while it still arrives
+  if (t.id === downloadTransferId && (t.state === "running" || t.state === "done")) {
+    downloadTransferId = null;
+    window.location.href = `/api/transfers/${t.id}/file`;
+  }
+  if (t.id === activeTransferId && !["queued", "backup", "running"].includes(t.state)) {
+    activeTransferId = null;
+  }
+}
+
+async function transferRequest(url, options, label) {
+  try {
+    const res = await fetch(url, options);
+    const data = await res.json();
+    if (!data.ok) {
+      showBanner("error", `${label} failed: ${data.error || res.status}.`);
+      return null;
+    }
+    activeTransferId = data.transfer.id;
+    showTransfer(data.transfer);
+    return data.transfer;
+  } catch (err) {
+    console.error(err);
+    showBanner("error", "Could not reach server. Is server.py running?");
+    return null;
+  }
+}
+
+async function downloadImage(fromDut) {
+  const body = { device: currentDevice };
+  if (fromDut) {
+    if (!confirm("Back up the SPI flash to SD, then download the new image?")) return;
+    body.source = "dut";
+  } else {
+    const input = document.getElementById("imagePath");
+    body.path = input ? input.value.trim() : "";
+    if (!body.path) {
+      showBanner("error", "Enter the image path or name first (menu 5 lists them).");
+      return;
+    }
+  }
+  const t = await transferRequest("/api/images/download", {
+    method: "POST",
+    headers: { "Content-Type": "application/json" },
+    body: JSON.stringify(body),
+  }, "Download");
+  if (t) downloadTransferId = t.id;
+}
+
+async function uploadImage() {
+  const input = document.getElementById("imageFile");
+  const file = input && input.files[0];
+  if (!file) {
+    showBanner("error", "Choose a .fimg file first.");
+    return;
+  }
+  const restore = document.getElementById("imageRestore");
+  const doRestore = restore && restore.checked;
+  if (doRestore && !confirm(`Upload ${file.name} and restore the flash from it? This will overwrite the flash.`)) {
+    return;
+  }
+  const q = new URLSearchParams({ device: currentDevice, name: file.name, restore: doRestore ? "1" : "0" });
+  await transferRequest(`/api/images/upload?${q}`, { method: "POST", body: file }, "Upload");
+}
+
+async function resumeTransfer() {
+  const btn = document.getElementById("btnTransferResume");
+  if (!btn || !btn.dataset.transfer) return;
+  const t = await transferRequest(`/api/transfers/${btn.dataset.transfer}/resume`, { method: "POST" }, "Resume");
+  if (t && t.direction === "download") downloadTransferId = t.id;
+}
+
+
+// Cursor into the server's log: only lines after it are fetched
+let logCursor = 0;
+
+// Terminal: device output is kept here as lines in a ring buffer and drawn
+// virtually. Only the rows in view (plus a margin) are in the DOM, so a
+// backup session with 100k+ lines scrolls like an empty one.
+const TERM_MAX_LINES = 200000;
+const TERM_OVERSCAN = 30;
+
+const termBuf = {
+  lines: new Array(TERM_MAX_LINES),
+  start: 0,      // ring index of the oldest line
+  count: 0,      // complete lines in the ring
+  cur: "",       // line still being written (no '\n' yet)
+  cr: false,     // '\r' seen: the next text overwrites cur from column 0
+};
+let termEls = null;           // { term, spacer, view, rowH }
+let termPinned = true;        // follow new output unless the user scrolled up
+let termRenderQueued = false;
+
+function termClear() {
+  termBuf.start = 0;
+  termBuf.count = 0;
+  termBuf.cur = "";
+  termBuf.cr = false;
+  termBuf.lines.fill(undefined);
+  termPinned = true;
+}
+
+function termPush(line) {
+  const b = termBuf;
+  if (b.count < TERM_MAX_LINES) {
+    b.lines[(b.start + b.count) % TERM_MAX_LINES] = line;
+    b.count++;
+  } else {
+    b.lines[b.start] = line;                       // drop the oldest
+    b.start = (b.start + 1) % TERM_MAX_LINES;
+  }
+}
+
+// Terminal semantics for the characters that matter here: '\n' ends the
+// line, a lone '\r' returns to column 0 (progress lines redraw in place)
+function termWrite(text) {
+  const b = termBuf;
+  for (const tok of text.match(/[^\r\n]+|\r\n|\r|\n/g) || []) {
+    if (tok === "\n" || tok === "\r\n") {
+      termPush(b.cur);
+      b.cur = "";
+      b.cr = false;
+    } else if (tok === "\r") {
+      b.cr = true;
+    } else if (b.cr) {
+      b.cur = tok + b.cur.slice(tok.length);
+      b.cr = false;
+    } else {
+      b.cur += tok;
+    }
+  }
+}
+
+function termInit(term) {
+  if (termEls && termEls.term === term) return termEls;
+  term.textContent = "";
+  const spacer = document.createElement("div");
+  spacer.className = "terminal-spacer";
+  const view = document.createElement("pre");
+  view.className = "terminal-view";
+  spacer.appendChild(view);
+  term.appendChild(spacer);
+
+  const rowH = parseFloat(getComputedStyle(view).lineHeight) || 17;
+  termEls = { term, spacer, view, rowH };
+  term.addEventListener("scroll", () => {
+    termPinned = term.scrollHeight - term.scrollTop - term.clientHeight < rowH;
+    termScheduleRender();
+  });
+  window.addEventListener("resize", termScheduleRender);
+  return termEls;
+}
+
+function termScheduleRender() {
+  if (termRenderQueued) return;
+  termRenderQueued = true;
+  requestAnimationFrame(termRender);
+}
+
+function termRender() {
+  termRenderQueued = false;
+  if (!termEls) return;
+  const { term, spacer, view, rowH } = termEls;
+  const b = termBuf;
+  const total = b.count + (b.cur ? 1 : 0);
+
+  spacer.style.height = `${total * rowH}px`;
+  if (termPinned) term.scrollTop = term.scrollHeight;
+
+  const first = Math.max(0, Math.floor(term.scrollTop / rowH) - TERM_OVERSCAN);
+  const last = Math.min(total, first + Math.ceil(term.clientHeight / rowH) + 2 * TERM_OVERSCAN);
+  const rows = [];
+  for (let i = first; i < last; i++) {
+    rows.push(i < b.count ? b.lines[(b.start + i) % TERM_MAX_LINES] : b.cur);
+  }
+  view.style.top = `${first * rowH}px`;
+  view.textContent = rows.join("\n");
+}
+
+// Append device output to the terminal, keeping the view pinned to the
+// bottom unless the user scrolled up
+function appendTerminal(term, text, reset) {
+  termInit(term);
+  if (reset || logCursor === 0) {
+    termClear();
+  }
+  if (text) termWrite(text);
+  termScheduleRender();
+}
+
+function setDbStatus(loading) {
+  const db = document.getElementById("dbStatus");
+  if (!db) return;
+  if (loading) {
+    db.textContent = "Loading database from SD card…";
+    db.className = "status-pill status-on";
+  } else {
+    db.textContent = "Idle";
+    db.className = "status-pill status-off";
+  }
+}
+
+function setJobStatus(text, active) {
+  const el = document.getElementById("jobStatus");
+  if (!el) return;
+  el.textContent = text;
+  el.className = active ? "status-pill status-on" : "status-pill status-off";
+}
+
+// Last job started from this page; polled in fallback mode
+let activeJobId = null;
+
+function formatRate(bps) {
+  if (bps == null) return "";
+  return bps >= 1048576 ? `${(bps / 1048576).toFixed(2)} MiB/s` : `${(bps / 1024).toFixed(1)} KiB/s`;
+}
+
+// Job record from /api/jobs/<id> or a 'job' stream event
+function showJob(j) {
+  if (j.state === "sent" || j.state === "running") {
+    const parts = [j.step || j.action];
+    if (j.stage && j.total) parts.push(`${j.stage} ${j.percent}%`);
+    if (j.bytes_per_s != null) parts.push(formatRate(j.bytes_per_s));
+    if (j.eta_s != null) parts.push(`ETA ${Math.ceil(j.eta_s)} s`);
+    setJobStatus(parts.join(" · "), true);
+    return;
+  }
+  const r = j.result || {};
+  const secs = r.seconds != null ? ` in ${r.seconds} s` : "";
+  if (j.state === "done") {
+    setJobStatus(`${r.name || j.action} done${secs}`, false);
+  } else if (j.state === "aborted") {
+    setJobStatus(`${r.name || j.action} aborted`, false);
+  } else {
+    setJobStatus(`${r.name || j.action} failed: ${r.error || `rc=${r.rc}`}`, false);
+  }
+  if (j.id === activeJobId) activeJobId = null;
+}
+
+// Push channel: /api/stream sends log lines as they arrive plus parsed
+// progress / job events. Falls back to polling if EventSource is missing
+// or the server refuses the stream.
+let logPollTimer = null;
+let logStream = null;
+
+// Fill the device picker from the server's list (fleet bridge devices)
+function setDevices(list) {
+  const sel = document.getElementById("deviceSelect");
+  if (!sel) return;
+  const ids = list.map((d) => d.id);
+  if (!ids.includes(currentDevice)) ids.unshift(currentDevice);
+  sel.textContent = "";
+  for (const id of ids) {
+    const d = list.find((x) => x.id === id);
+    const opt = document.createElement("option");
+    opt.value = id;
+    opt.textContent = (id || "default") + (d && d.online === false ? " (offline)" : "");
+    sel.appendChild(opt);
+  }
+  sel.value = currentDevice;
+}
+
+function selectDevice(id) {
+  if (id === currentDevice) return;
+  currentDevice = id;
+  logCursor = 0;
+  const term = document.getElementById("terminal");
+  if (term) appendTerminal(term, "", true);
+  setJobStatus("Idle", false);
+  activeJobId = null;
+  activeTransferId = null;
+  if (logStream) {
+    logStream.close();
+    logStream = null;
+    startLogStream();
+  }
+}
+
+function startLogPolling() {
+  if (logPollTimer) return;
+  refreshLogs();
+  logPollTimer = setInterval(refreshLogs, 1000);
+}
+
+function startLogStream() {
+  if (!window.EventSource) {
+    startLogPolling();
+    return;
+  }
+  const term = document.getElementById("terminal");
+  const dev = encodeURIComponent(currentDevice);
+  const es = new EventSource(`/api/stream?device=${dev}&after=${logCursor}`);
+  logStream = es;
+
+  es.addEventListener("devices", (e) => {
+    setDevices(JSON.parse(e.data).devices);
+  });
+
+  es.addEventListener("log", (e) => {
+    const data = JSON.parse(e.data);
+    if (term) appendTerminal(term, data.lines.join(""), data.reset);
+    logCursor = Number(e.lastEventId) || logCursor;
+  });
+
+  es.addEventListener("status", (e) => {
+    setDbStatus(JSON.parse(e.data).db_loading);
+  });
+
+  es.addEventListener("job", (e) => {
+    const j = JSON.parse(e.data);
+    showJob(j);
+    // a finished benchmark adds a run to the history
+    if (j.action === "identify" && j.state === "done") loadBenchChips();
+  });
+
+  es.addEventListener("transfer", (e) => {
+    showTransfer(JSON.parse(e.data));
+  });
+
+  es.onerror = () => {
+    // CONNECTING: the browser retries by itself with Last-Event-ID
+    if (es.readyState === EventSource.CLOSED && es === logStream) {
+      logStream = null;
+      startLogPolling();
+    }
+  };
+}
+
+// Poll new log lines from /api/logs and update the terminal + DB status pill
 async function refreshLogs() {
   try {
-    const res = await fetch("/api/logs");
+    const dev = encodeURIComponent(currentDevice);
+    const res = await fetch(`/api/logs?device=${dev}&after=${logCursor}`);
     const data = await res.json();
 
     const term = document.getElementById("terminal");
     if (!term) return;
 
-    term.textContent = data.lines.join("");
+    if (data.lines.length || data.reset) {
+      appendTerminal(term, data.lines.join(""), data.reset);
+    }
+    logCursor = data.next;
+    setDbStatus(data.db_loading);
 
-    const db = document.getElementById("dbStatus");
-    if (db) {
-      if (data.db_loading) {
-        db.textContent = "Loading database from SD card…";
-        db.className = "status-pill status-on";
-      } else {
-        db.textContent = "Idle";
-        db.className = "status-pill status-off";
-      }
+    if (activeJobId != null) {
+      const jr = await fetch(`/api/jobs/${activeJobId}`);
+      if (jr.ok) showJob((await jr.json()).job);
+    }
+    if (activeTransferId != null) {
+      const tr = await fetch(`/api/transfers/${activeTransferId}`);
+      if (tr.ok) showTransfer((await tr.json()).transfer);
     }
   } catch (err) {
     console.error(err);
@@ -189,6 +706,43 @@ function setupHandlers() {
     });
   }
 
+  const btnScript = document.getElementById("btnScript");
+  if (btnScript) {
+    btnScript.addEventListener("click", runJobScript);
+  }
+
+  const btnImageDownload = document.getElementById("btnImageDownload");
+  if (btnImageDownload) {
+    btnImageDownload.addEventListener("click", () => downloadImage(false));
+  }
+  const btnImageDumpDut = document.getElementById("btnImageDumpDut");
+  if (btnImageDumpDut) {
+    btnImageDumpDut.addEventListener("click", () => downloadImage(true));
+  }
+  const btnImageUpload = document.getElementById("btnImageUpload");
+  if (btnImageUpload) {
+    btnImageUpload.addEventListener("click", uploadImage);
+  }
+  const btnTransferResume = document.getElementById("btnTransferResume");
+  if (btnTransferResume) {
+    btnTransferResume.addEventListener("click", resumeTransfer);
+  }
+
+  const btnBenchHistory = document.getElementById("btnBenchHistory");
+  if (btnBenchHistory) {
+    btnBenchHistory.addEventListener("click", showBenchHistory);
+  }
+  const benchChip = document.getElementById("benchChip");
+  if (benchChip) {
+    benchChip.addEventListener("change", showBenchHistory);
+    loadBenchChips();
+  }
+
+  const btnStats = document.getElementById("btnStats");
+  if (btnStats) {
+    btnStats.addEventListener("click", showStats);
+  }
+
   const btnQuit = document.getElementById("btnQuit");
   if (btnQuit) {
     btnQuit.addEventListener("click", () => {
@@ -238,9 +792,13 @@ function setupHandlers() {
     });
   }
 
-  // Start log polling
-  refreshLogs();
-  setInterval(refreshLogs, 1000);
+  const deviceSelect = document.getElementById("deviceSelect");
+  if (deviceSelect) {
+    deviceSelect.addEventListener("change", () => selectDevice(deviceSelect.value));
+  }
+
+  // Device output: pushed over SSE, polling only as a fallback
+  startLogStream();
 
   // On startup, ask Pico to show its main menu (like pressing "Return")
   setTimeout(() => {
@@ -0,0 +1,380 @@
+# transfer.py - .fimg download / upload through the device (menu 'f')
+#
+# The firmware moves a file between its SD card and the host in binary
+# frames (serial_stream.py framing, see "FILE TRANSFER" in main.c):
+#
+#     get <path> [offset]          SD -> host
+#     put <path> <size> [resume]   host -> <path>.part on SD, renamed when complete
+#
+#     'R' off size   device ready, transfer starts at off
+#     'D' off data   file data, in order
+#     'A' off        receiver has everything below off
+#     'E' size crc   end, CRC-32 of the bytes sent this session
+#     'X' text       abort
+#
+# A Transfer runs one of these in a thread. Downloads grow <name>.part in
+# TRANSFER_DIR and resume from its size; uploads resume from the .part the
+# device kept. An interrupted attempt is retried with resume RETRIES times.
+
+import itertools
+import os
+import queue
+import struct
+import threading
+import time
+import zlib
+
+from serial_stream import make_frame
+
+DATA_MAX = 1024             # file bytes per 'D' frame (XFER_DATA_MAX)
+WINDOW = 64 * 1024          # upload: unacked bytes in flight
+ACK_BYTES = 16 * 1024       # download: ack interval
+SEND_BATCH = 8 * 1024       # frames per send() (one MQTT publish)
+TIMEOUT_S = 15.0            # no frame from the device -> attempt failed
+END_GRACE_S = 2.0           # frames may trail the job's end on another MQTT topic
+RETRIES = 3
+NOTIFY_S = 0.25             # progress notifications at most this often
+
+U32 = struct.Struct("<I")
+U32x2 = struct.Struct("<II")
+
+# flashimg_hdr_t in main.c, then image data, then a CRC-32 trailer,
+# then (FIMG_F_SECTOR_MAP) fimg_smap_t and 4 bits of sector class per sector
+FIMG_HDR = struct.Struct("<8s3sBIIII")
+FIMG_SMAP = struct.Struct("<4sHBBII")
+FIMG_F_SECTOR_MAP = 0x01
+SECTOR_SIZE = 4096
+SECTOR_CLASSES = ("none", "blank", "zero", "uniform", "low-entropy", "high-entropy")
+
+
+def fimg_check(path):
+    """Header, trailer, recomputed data CRC and sector map of a .fimg file."""
+    info = {"valid": False}
+    try:
+        size = os.path.getsize(path)
+        with open(path, "rb") as f:
+            hdr = f.read(FIMG_HDR.size)
+            if len(hdr) < FIMG_HDR.size:
+                info["error"] = "shorter than the header"
+                return info
+            magic, jedec, flags, flash_size, chunk, image_size, hdr_crc = FIMG_HDR.unpack(hdr)
+            info.update(jedec=jedec.hex().upper(), flash_size=flash_size,
+                        image_size=image_size, crc=f"{hdr_crc:08x}")
+            if not magic.startswith(b"FIMGv1"):
+                info["error"] = "not a FIMGv1 image"
+                return info
+            sectors = (image_size + SECTOR_SIZE - 1) // SECTOR_SIZE
+            expect = FIMG_HDR.size + image_size + 4
+            if flags & FIMG_F_SECTOR_MAP:
+                expect += FIMG_SMAP.size + (sectors + 1) // 2
+            if size != expect:
+                info["error"] = f"size {size} != {expect} (header + {image_size} + trailer)"
+                return info
+            crc, left = 0, image_size
+            while left:
+                block = f.read(min(left, 1 << 20))
+                crc = zlib.crc32(block, crc)
+                left -= len(block)
+            trailer, = U32.unpack(f.read(4))
+            if flags & FIMG_F_SECTOR_MAP:
+                smagic, ssize, bits, _, count, map_crc = FIMG_SMAP.unpack(f.read(FIMG_SMAP.size))
+                packed = f.read((sectors + 1) // 2)
+                if (smagic != b"SMAP" or ssize != SECTOR_SIZE or bits != 4 or count != sectors
+                        or zlib.crc32(packed) != map_crc):
+                    info["error"] = "bad sector map"
+                    return info
+                classes = [0] * len(SECTOR_CLASSES)
+                for s in range(sectors):
+                    c = (packed[s >> 1] >> (4 * (s & 1))) & 0x0F
+                    classes[c if c < len(classes) else 0] += 1
+                info["sectors"] = {n: k for n, k in zip(SECTOR_CLASSES, classes) if k}
+    except OSError as e:
+        info["error"] = str(e)
+        return info
+    if crc != hdr_crc or crc != trailer:
+        info["error"] = f"CRC data {crc:08x}, header {hdr_crc:08x}, trailer {trailer:08x}"
+        return info
+    info["valid"] = True
+    return info
+
+
+class TransferError(Exception):
+    def __init__(self, msg, started=False):
+        super().__init__(msg)
+        self.started = started      # data moved: worth a resume
+
+
+class Transfer:
+    """
+    One download ("get") or upload ("put") on one device.
+
+    command(action, payload) sends a menu command and returns its server Job,
+    send(data) writes raw bytes to the device, notify() wakes SSE streams.
+    Frames for this device arrive through frame().
+    """
+
+    ids = itertools.count(1)
+
+    def __init__(self, dev_id, direction, remote, local, command, send, notify,
+                 source=None, resume=False, after=None):
+        self.id = next(Transfer.ids)
+        self.device = dev_id
+        self.direction = direction  # "download" / "upload"
+        self.remote = remote        # path on the SD card, None until a DUT backup names it
+        self.local = local          # finished file on the server
+        self.source = source        # "dut": back up the flash first
+        self.resume = resume        # upload: continue the .part the device kept
+        self.after = after          # called with the Transfer once it is done, may return a Job
+        self.next_job = None        # id of that Job (restore after an upload)
+        self.command = command
+        self.send = send
+        self.notify = notify
+        self.frames = queue.Queue()
+        self.file_lock = threading.Lock()   # /file readers vs. the final rename
+        self.state = "queued"       # queued -> backup -> running -> done / failed / cancelled
+        self.size = None
+        self.done = 0
+        self.offset = 0             # where the current attempt started
+        self.attempts = 0
+        self.job = None
+        self.error = None
+        self.check = None           # fimg_check() of the downloaded file
+        self.complete = False       # download renamed from .part to its name
+        self.created = time.time()
+        self.finished = None
+        self.samples = []           # (time, done) of the current attempt
+        self.version = 0
+        self.notified = 0.0
+        self.cancelled = False
+        self.thread = threading.Thread(target=self.run, daemon=True)
+
+    @property
+    def part(self):
+        return self.local + ".part"
+
+    def path(self):
+        """File a reader of the download should open right now."""
+        return self.local if self.complete else self.part
+
+    def active(self):
+        return self.state in ("queued", "backup", "running")
+
+    def info(self):
+        rate = None
+        if len(self.samples) >= 2:
+            (t0, n0), (t1, n1) = self.samples[0], self.samples[-1]
+            rate = (n1 - n0) / (t1 - t0) if t1 > t0 else None
+        eta = None
+        if rate and self.size is not None and self.state == "running":
+            eta = round((self.size - self.done) / rate, 1)
+        return {
+            "id": self.id, "device": self.device, "direction": self.direction,
+            "remote": self.remote, "name": os.path.basename(self.local),
+            "source": self.source, "state": self.state, "size": self.size,
+            "done": self.done, "offset": self.offset, "attempts": self.attempts,
+            "percent": round(self.done * 100.0 / self.size, 1) if self.size else None,
+            "bytes_per_s": round(rate) if rate else None, "eta_s": eta,
+            "job": self.job.id if self.job else None, "error": self.error,
+            "check": self.check, "next_job": self.next_job, "created": self.created, "finished": self.finished,
+        }
+
+    def changed(self, force=True):
+        now = time.monotonic()
+        if force or now - self.notified >= NOTIFY_S:
+            self.notified = now
+            self.version += 1
+            self.notify()
+
+    def progress(self, done):
+        self.done = done
+        now = time.time()
+        self.samples.append((now, done))
+        while len(self.samples) > 2 and now - self.samples[0][0] > 5.0:
+            self.samples.pop(0)
+        self.changed(force=False)
+
+    def start(self):
+        self.thread.start()
+
+    def cancel(self):
+        self.cancelled = True
+        self.frames.put(None)
+
+    def frame(self, payload):
+        if payload:
+            self.frames.put(payload)
+
+    # ---- device side ----
+
+    def wait_job(self, job, timeout):
+        """Until the device job has ended (menu back) or timeout."""
+        end = time.monotonic() + timeout
+        while job.state in ("sent", "running") and time.monotonic() < end:
+            time.sleep(0.1)
+
+    def next_frame(self, started):
+        """Next frame of this attempt; TransferError on timeout, abort or job end."""
+        last = time.monotonic()
+        ended = None
+        while True:
+            try:
+                payload = self.frames.get(timeout=0.5)
+            except queue.Empty:
+                payload = b""
+            if self.cancelled:
+                self.send(make_frame(b"Xcancelled"))
+                raise TransferError("cancelled")
+            if payload:
+                if payload[:1] == b"X":
+                    raise TransferError("device: " + payload[1:].decode(errors="replace"), started)
+                return payload
+            if self.job.state not in ("sent", "running"):
+                ended = ended or time.monotonic()
+                if time.monotonic() - ended < END_GRACE_S:
+                    continue
+                err = (self.job.result or {}).get("error") or f"device job {self.job.state}"
+                raise TransferError(err, started)
+            if time.monotonic() - last > TIMEOUT_S:
+                self.send(make_frame(b"Xtimeout"))
+                raise TransferError(f"no frame for {TIMEOUT_S:.0f} s", started)
+
+    def begin(self, action, payload):
+        """Send the menu command and wait for the 'R' frame: (offset, size)."""
+        while not self.frames.empty():      # leftovers of a failed attempt
+            self.frames.get_nowait()
+        self.job = self.command(action, payload)
+        while True:
+            f = self.next_frame(False)
+            if f[:1] == b"R" and len(f) >= 9:
+                return U32x2.unpack_from(f, 1)
+
+    def download_once(self):
+        have = os.path.getsize(self.part) if os.path.exists(self.part) else 0
+        offset, size = self.begin("download", f"fget {self.remote} {have}\n")
+        self.size, self.offset, self.samples = size, offset, []
+        self.state = "running"
+        self.progress(offset)
+
+        with open(self.part, "r+b" if os.path.exists(self.part) else "w+b") as f:
+            f.truncate(offset)
+            f.seek(offset)
+            pos = acked = offset
+            crc = 0
+            while True:
+                fr = self.next_frame(True)
+                kind = fr[:1]
+                if kind == b"D" and len(fr) > 5:
+                    off, = U32.unpack_from(fr, 1)
+                    if off != pos:
+                        raise TransferError(f"data for @{off}, expected @{pos}", True)
+                    data = fr[5:]
+                    f.write(data)
+                    crc = zlib.crc32(data, crc)
+                    pos += len(data)
+                    if pos - acked >= ACK_BYTES or pos == size:
+                        f.flush()
+                        self.send(make_frame(b"A" + U32.pack(pos)))
+                        acked = pos
+                    self.progress(pos)
+                elif kind == b"E" and len(fr) >= 9:
+                    end, dev_crc = U32x2.unpack_from(fr, 1)
+                    if end != size or pos != size:
+                        raise TransferError(f"device ended at {end}, have {pos} of {size}", True)
+                    if dev_crc != crc:
+                        raise TransferError(f"CRC {crc:08x} != device {dev_crc:08x}", True)
+                    if acked != pos:
+                        self.send(make_frame(b"A" + U32.pack(pos)))
+                    break
+
+        with self.file_lock:
+            os.replace(self.part, self.local)
+            self.complete = True
+        if self.local.endswith(".fimg"):
+            self.check = fimg_check(self.local)
+
+    def upload_once(self, resume):
+        size = os.path.getsize(self.local)
+        cmd = f"fput {self.remote} {size}{' resume' if resume else ''}\n"
+        offset, dev_size = self.begin("upload", cmd)
+        if dev_size != size:
+            raise TransferError(f"device expects {dev_size} bytes, file has {size}")
+        self.size, self.offset, self.samples = size, offset, []
+        self.state = "running"
+        self.progress(offset)
+
+        with open(self.local, "rb") as f:
+            f.seek(offset)
+            sent = acked = offset
+            crc = 0
+            end_sent = False
+            while True:
+                batch, n = [], 0
+                while sent < size and sent - acked < WINDOW and n < SEND_BATCH:
+                    data = f.read(min(DATA_MAX, size - sent))
+                    crc = zlib.crc32(data, crc)
+                    batch.append(make_frame(b"D" + U32.pack(sent) + data))
+                    sent += len(data)
+                    n += len(data)
+                if sent == size and not end_sent:
+                    batch.append(make_frame(b"E" + U32x2.pack(size, crc)))
+                    end_sent = True
+                if batch:
+                    if not self.send(b"".join(batch)):
+                        raise TransferError("device not connected", True)
+                    continue
+
+                fr = self.next_frame(True)      # window full: wait for an ack
+                kind = fr[:1]
+                if kind == b"A" and len(fr) >= 5:
+                    acked = max(acked, U32.unpack_from(fr, 1)[0])
+                    self.progress(acked)
+                elif kind == b"E" and len(fr) >= 9:
+                    end, dev_crc = U32x2.unpack_from(fr, 1)
+                    if end != size or dev_crc != crc:
+                        raise TransferError(f"device confirmed {end} bytes crc {dev_crc:08x}", True)
+                    self.progress(size)
+                    break
+
+    def backup_first(self):
+        """source "dut": menu 2, then download the image it wrote."""
+        self.state = "backup"
+        self.changed()
+        self.job = self.command("backup", "2")
+        self.wait_job(self.job, 24 * 3600)
+        if self.job.state != "done" or not self.job.file:
+            err = (self.job.result or {}).get("error") or f"backup {self.job.state}"
+            raise TransferError(err)
+        self.remote = self.job.file
+        self.local = os.path.join(os.path.dirname(self.local), os.path.basename(self.remote))
+
+    def run(self):
+        try:
+            if self.source == "dut":
+                self.backup_first()
+            for attempt in range(RETRIES):
+                self.attempts += 1
+                self.error = None
+                try:
+                    if self.direction == "download":
+                        self.download_once()
+                    else:
+                        self.upload_once(resume=self.resume or attempt > 0)
+                    # the device job ends (menu back) right after the last frame
+                    self.wait_job(self.job, TIMEOUT_S)
+                    self.state = "done"
+                    break
+                except TransferError as e:
+                    self.error = str(e)
+                    self.changed()
+                    if self.cancelled or not e.started or attempt + 1 == RETRIES:
+                        raise
+                    # the device prints its menu again before it takes a new command
+                    self.wait_job(self.job, TIMEOUT_S)
+        except (TransferError, OSError) as e:
+            self.error = str(e)
+            self.state = "cancelled" if self.cancelled else "failed"
+        self.finished = time.time()
+        if self.state == "done" and self.after:
+            job = self.after(self)
+            self.next_job = job.id if job else None
+        self.changed()